@@ -12,12 +12,24 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#define USE_SSE2
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_AVX2
+#endif
+#endif
 
 #include <eb32tree.h>
 #include <eb64tree.h>
@@ -38,15 +50,32 @@
 #define MAXLINE 16384
 #define QBITS 4
 
+/* lines longer than this are truncated when reading from a mapped file */
+#define MAPPED_LINE_SIZE (256*1024)
+
+/* number of fields indexed per line, further ones are looked up from the last
+ * indexed one. The field scanners may read up to 63 bytes past the end of a
+ * line, so line buffers must be padded accordingly.
+ */
+#define MAX_FIELDS 32
+#define LINE_PADDING 64
+
+/* files smaller than this are always processed by a single thread */
+#define MIN_CHUNK_SIZE (1024*1024)
+#define MAX_THREADS 256
+
 #define SEP(c) ((unsigned char)(c) <= ' ')
 #define SKIP_CHAR(p,c) do { while (1) { int __c = (unsigned char)*p++; if (__c == c) break; if (__c <= ' ') { p--; break; } } } while (0)
 
 /* [0] = err/date, [1] = req, [2] = conn, [3] = resp, [4] = data */
-static struct eb_root timers[5] = {
+static struct eb_root main_timers[5] = {
 	EB_ROOT_UNIQUE, EB_ROOT_UNIQUE, EB_ROOT_UNIQUE,
 	EB_ROOT_UNIQUE, EB_ROOT_UNIQUE,
 };
 
+/* each thread fills its own trees, which are merged once all are done */
+static __thread struct eb_root *timers = main_timers;
+
 struct timer {
 	struct eb32_node node;
 	unsigned int count;
@@ -70,6 +99,8 @@ struct url_stat {
 	unsigned long long total_time_ok; /* sum(all OK reqs' times) */
 	unsigned long long total_bytes_sent; /* sum(all bytes sent) */
 	unsigned int nb_err, nb_req;
+	unsigned int nb_over;             /* -approx: max overestimation of nb_req */
+	struct eb64_node cnt;             /* -approx: node in approx_counts */
 };
 
 #define FILT_COUNT_ONLY		0x01
@@ -118,12 +149,59 @@ struct url_stat {
 
 unsigned int filter = 0;
 unsigned int filter_invert = 0;
-const char *line;
-int linenum = 0;
-int parse_err = 0;
-int lines_out = 0;
+__thread const char *line;
+__thread int linenum = 0;
+__thread int parse_err = 0;
+__thread int lines_out = 0;
 int lines_max = -1;
 
+/* warnings go there, worker threads buffer them to report them in order */
+__thread FILE *warn_out;
+
+/* index of the fields of the current line, see index_fields() */
+static __thread const char *field_ptr[MAX_FIELDS];
+static __thread int nb_fields;
+static __thread const char *line_end;
+
+/* -bench : only index the fields if no action is set, and report the speed */
+int bench = 0;
+int index_only = 0;
+unsigned long long bench_bytes = 0;
+struct timeval bench_start;
+
+/* -approx <err> : percentiles are computed on timers rounded down to their
+ * <approx_bits> higher bits, and only <approx_slots> URLs or addresses are
+ * tracked, indexed by request count in <approx_counts>.
+ */
+double approx_err = 0;
+int approx_bits = 0;
+unsigned int approx_slots = 0;
+unsigned int approx_used = 0;
+struct eb_root approx_counts = EB_ROOT;
+
+const char *filter_term_code_name = NULL;
+int filter_time_resp = 0;
+int filt_http_status_low = 0, filt_http_status_high = 0;
+int skip_fields = 1;
+
+void (*line_filter)(const char *accept_field, const char *time_field, struct timer **tptr) = NULL;
+int fast_count = 0; /* only count lines, without parsing them */
+
+/* A worker thread processes the lines of one chunk of the mapped input */
+struct worker {
+	pthread_t thread;
+	const char *start, *end;       /* chunk of the input, on line boundaries */
+	struct eb_root timers[5];      /* same as main_timers */
+	int nblines;                   /* lines in the chunk, to number them */
+	int linenum, parse_err, lines_out;
+	char *warn_buf;                /* buffered warnings */
+	size_t warn_len;
+};
+
+static struct worker *workers;
+static int nb_workers;
+static pthread_barrier_t workers_counted;
+
 const char *fgets2(FILE *stream);
 
 void filter_count_url(const char *accept_field, const char *time_field, struct timer **tptr);
@@ -141,10 +219,11 @@ void usage(FILE *output, const char *msg)
 	fprintf(output,
 		"%s"
 		"Usage: halog [-h|--help] for long help\n"
-		"       halog [-q] [-c] [-m <lines>]\n"
+		"       halog [-q] [-c] [-m <lines>] [-j <threads>]\n"
 		"       {-cc|-gt|-pct|-st|-tc|-srv|-u|-uc|-ue|-ua|-ut|-uao|-uto|-uba|-ubt|-ic}\n"
 		"       [-s <skip>] [-e|-E] [-H] [-rt|-RT <time>] [-ad <delay>] [-ac <count>]\n"
-		"       [-v] [-Q|-QS] [-tcn|-TCN <termcode>] [ -hs|-HS [min][:[max]] ] < log\n"
+		"       [-v] [-Q|-QS] [-tcn|-TCN <termcode>] [ -hs|-HS [min][:[max]] ]\n"
+		"       [-approx <err>] [-bench] < log\n"
 		"\n",
 		msg ? msg : ""
 		);
@@ -174,6 +253,16 @@ void help()
 	       " -v                      invert the input filtering condition\n"
 	       " -q                      don't report errors/warnings\n"
 	       " -m <lines>              limit output to the first <lines> lines\n"
+	       " -j <threads>            parse the input using <threads> threads (0 = one per\n"
+	       "                         CPU) when it is a regular file. Output is the same.\n"
+	       " -approx <err>           bound memory usage with -pct, -u* and -ic : timers are\n"
+	       "                         rounded down by less than <err> (eg: 0.01 for 1%%),\n"
+	       "                         and only the 1/<err> most requested entries are kept,\n"
+	       "                         with counts overestimated by at most <err> * lines.\n"
+	       "                         The \"over\" column reports each entry's overestimate,\n"
+	       "                         averages only cover the requests really counted.\n"
+	       " -bench                  report the parsing speed on stderr. Without any output\n"
+	       "                         filter, only split the lines into fields.\n"
 	       "Output filters - only one may be used at a time\n"
 	       " -c    only report the number of lines that would have been printed\n"
 	       " -pct  output connect and response times percentiles\n"
@@ -317,6 +406,155 @@ const char *field_start(const char *p, int field)
 #endif
 }
 
+/* Field index. The fields of each line are located once, so that filters can
+ * directly access any of them instead of skipping the previous ones every
+ * time. A field starts at any character other than a space or a zero which
+ * follows a space or the beginning of the line, exactly like field_start()
+ * does. The vectorized scanners compute bit masks of the spaces and zeroes of
+ * 64-byte blocks, so that the field starts of a whole block are derived with a
+ * few logical operations.
+ */
+
+/* Indexes the fields of the current line from the masks of spaces and zeroes
+ * computed by <scan> for each 64-byte block. Up to MAX_FIELDS fields are
+ * stored in field_ptr[], and <line_end> is set to the trailing zero unless the
+ * index is full. Returns the number of indexed fields.
+ */
+static inline __attribute__((always_inline))
+int index_fields_blocks(const char *p, void (*scan)(const char *, unsigned long long *, unsigned long long *))
+{
+	unsigned long long spaces, zeroes, starts, prev = 1;
+	int nb = 0;
+
+	while (1) {
+		scan(p, &spaces, &zeroes);
+
+		/* a field starts on a non-space following a space */
+		starts = ~spaces & ((spaces << 1) | prev);
+		prev = spaces >> 63;
+
+		if (zeroes) {
+			zeroes &= -zeroes;      /* keep the first zero only */
+			starts &= zeroes - 1;   /* and what precedes it */
+		}
+
+		while (starts) {
+			if (nb == MAX_FIELDS)
+				return nb;
+			field_ptr[nb++] = p + __builtin_ctzll(starts);
+			starts &= starts - 1;
+		}
+
+		if (zeroes) {
+			line_end = p + __builtin_ctzll(zeroes);
+			return nb;
+		}
+		p += 64;
+	}
+}
+
+static int index_fields_scalar(const char *p)
+{
+	int nb = 0;
+
+	while (1) {
+		while (*p == ' ')
+			p++;
+		if (!*p)
+			break;
+		if (nb == MAX_FIELDS)
+			return nb;
+		field_ptr[nb++] = p;
+		while (*p != ' ' && *p)
+			p++;
+	}
+	line_end = p;
+	return nb;
+}
+
+#ifdef USE_SSE2
+static inline __attribute__((always_inline))
+void scan64_sse2(const char *p, unsigned long long *spaces, unsigned long long *zeroes)
+{
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i zero = _mm_setzero_si128();
+	unsigned long long s = 0, z = 0;
+	__m128i v;
+	int i;
+
+	for (i = 0; i < 64; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		s |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, sp)) << i;
+		z |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) << i;
+	}
+	*spaces = s;
+	*zeroes = z;
+}
+
+static int index_fields_sse2(const char *p)
+{
+	return index_fields_blocks(p, scan64_sse2);
+}
+#endif
+
+#ifdef USE_AVX2
+static inline __attribute__((always_inline, target("avx2")))
+void scan64_avx2(const char *p, unsigned long long *spaces, unsigned long long *zeroes)
+{
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_loadu_si256((const __m256i *)p);
+	__m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+
+	*spaces = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, sp)) |
+		((unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, sp)) << 32);
+	*zeroes = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero)) |
+		((unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero)) << 32);
+}
+
+static __attribute__((target("avx2"))) int index_fields_avx2(const char *p)
+{
+	return index_fields_blocks(p, scan64_avx2);
+}
+#endif
+
+/* the best scanner supported by the CPU, see select_field_scanner() */
+static int (*index_fields)(const char *p) = index_fields_scalar;
+static const char *field_scanner = "scalar";
+
+static void select_field_scanner()
+{
+#ifdef USE_SSE2
+	index_fields = index_fields_sse2;
+	field_scanner = "sse2";
+#endif
+#ifdef USE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		index_fields = index_fields_avx2;
+		field_scanner = "avx2";
+	}
+#endif
+}
+
+/* Returns field <field> (starting from 1) of the current line, which must have
+ * been indexed. Like field_start(), it returns the trailing zero if the line
+ * has less fields.
+ */
+static inline const char *line_field(int field)
+{
+	if (likely(field > 0 && field <= nb_fields))
+		return field_ptr[field - 1];
+	if (nb_fields < MAX_FIELDS && field > 0)
+		return line_end;
+	if (field <= 0)
+		return field_start(line, field);
+	return field_start(field_ptr[MAX_FIELDS - 1], field - MAX_FIELDS + 1);
+}
+
+/* returns field <field> of the log, after the fields skipped with "-s" */
+#define log_field(field) line_field((field) + skip_fields)
+
 /* keep only the <bits> higher bits of <i> */
 static inline unsigned int quantify_u32(unsigned int i, int bits)
 {
@@ -346,6 +584,20 @@ static inline int quantify(int i, int bits)
 		return -quantify_u32(-i, bits);
 }
 
+/* returns <v> rounded down to the precision requested with -approx */
+static inline int approx(int v)
+{
+	return approx_bits ? quantify(v, approx_bits) : v;
+}
+
+/* returns the number of requests whose times and bytes are summed in <ustat>,
+ * which excludes the count it inherited from an evicted entry with -approx.
+ */
+static inline unsigned int url_seen(const struct url_stat *ustat)
+{
+	return ustat->nb_req - ustat->nb_over;
+}
+
 /* Insert timer value <v> into tree <r>. A pre-allocated node must be passed
  * in <alloc>. It may be NULL, in which case the function will allocate it
  * itself. It will be reset to NULL once consumed. The caller is responsible
@@ -524,25 +776,473 @@ int convert_date(const char *field)
 void truncated_line(int linenum, const char *line)
 {
 	if (!(filter & FILT_QUIET))
-		fprintf(stderr, "Truncated line %d: %s\n", linenum, line);
+		fprintf(warn_out, "Truncated line %d: %s\n", linenum, line);
 }
 
-int main(int argc, char **argv)
+/* Applies the input filters to the current line, then passes it to the line
+ * filter. <tptr> is the timer node to be used by the line filter. Returns
+ * non-zero once no more lines are needed.
+ */
+static int process_line(struct timer **tptr)
 {
 	const char *b, *e, *p, *time_field, *accept_field, *source_field;
-	const char *filter_term_code_name = NULL;
+	int f, err, val, test;
+
+	linenum++;
+	time_field = NULL; accept_field = NULL;
+	source_field = NULL;
+
+	test = 1;
+
+	/* for any line we process, we first ensure that there is a field
+	 * looking like the accept date field (beginning with a '[').
+	 */
+	nb_fields = index_fields(line);
+	if (unlikely(index_only)) {
+		/* -bench without any action */
+		lines_out++;
+		return lines_max >= 0 && lines_out >= lines_max;
+	}
+
+	if (filter & FILT_COUNT_IP_COUNT)
+		source_field = log_field(SOURCE_FIELD);
+	accept_field = log_field(ACCEPT_FIELD);
+
+	if (unlikely(*accept_field != '[')) {
+		parse_err++;
+		return 0;
+	}
+
+	/* the day of month field is begin 01 and 31 */
+	if (accept_field[1] < '0' || accept_field[1] > '3') {
+		parse_err++;
+		return 0;
+	}
+
+	if (filter & FILT_HTTP_ONLY) {
+		/* only report lines with at least 4 timers */
+		if (!time_field) {
+			time_field = log_field(TIME_FIELD);
+			if (unlikely(!*time_field)) {
+				truncated_line(linenum, line);
+				return 0;
+			}
+		}
+
+		e = field_stop(time_field + 1);
+		/* we have field TIME_FIELD in [time_field]..[e-1] */
+		p = time_field;
+		f = 0;
+		while (!SEP(*p)) {
+			if (++f == 4)
+				break;
+			SKIP_CHAR(p, '/');
+		}
+		test &= (f >= 4);
+	}
+
+	if (filter & FILT_TIME_RESP) {
+		int tps;
+
+		/* only report lines with response times larger than filter_time_resp */
+		if (!time_field) {
+			time_field = log_field(TIME_FIELD);
+			if (unlikely(!*time_field)) {
+				truncated_line(linenum, line);
+				return 0;
+			}
+		}
+
+		e = field_stop(time_field + 1);
+		/* we have field TIME_FIELD in [time_field]..[e-1], let's check only the response time */
+
+		p = time_field;
+		err = 0;
+		f = 0;
+		while (!SEP(*p)) {
+			tps = str2ic(p);
+			if (tps < 0) {
+				tps = -1;
+				err = 1;
+			}
+			if (++f == 4)
+				break;
+			SKIP_CHAR(p, '/');
+		}
+
+		if (unlikely(f < 4)) {
+			parse_err++;
+			return 0;
+		}
+
+		test &= (tps >= filter_time_resp) ^ !!(filter & FILT_INVERT_TIME_RESP);
+	}
+
+	if (filter & (FILT_ERRORS_ONLY | FILT_HTTP_STATUS)) {
+		/* Check both error codes (-1, 5xx) and status code ranges */
+		b = log_field(STATUS_FIELD);
+
+		if (unlikely(!*b)) {
+			truncated_line(linenum, line);
+			return 0;
+		}
+
+		val = str2ic(b);
+		if (filter & FILT_ERRORS_ONLY)
+			test &= (val < 0 || (val >= 500 && val <= 599)) ^ !!(filter & FILT_INVERT_ERRORS);
+
+		if (filter & FILT_HTTP_STATUS)
+			test &= (val >= filt_http_status_low && val <= filt_http_status_high) ^ !!(filter & FILT_INVERT_HTTP_STATUS);
+	}
+
+	if (filter & (FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY)) {
+		/* Check if the server's queue is non-nul */
+		b = log_field(QUEUE_LEN_FIELD);
+
+		if (unlikely(!*b)) {
+			truncated_line(linenum, line);
+			return 0;
+		}
+
+		if (*b == '0') {
+			if (filter & FILT_QUEUE_SRV_ONLY) {
+				test = 0;
+			}
+			else {
+				do {
+					b++;
+					if (*b == '/') {
+						b++;
+						break;
+					}
+				} while (*b);
+				test &= ((unsigned char)(*b - '1') < 9);
+			}
+		}
+	}
+
+	if (filter & FILT_TERM_CODE_NAME) {
+		/* only report corresponding termination code name */
+		b = log_field(TERM_CODES_FIELD);
+
+		if (unlikely(!*b)) {
+			truncated_line(linenum, line);
+			return 0;
+		}
+
+		test &= (b[0] == filter_term_code_name[0] && b[1] == filter_term_code_name[1]) ^ !!(filter & FILT_INVERT_TERM_CODE_NAME);
+	}
+
+
+	test ^= filter_invert;
+	if (!test)
+		return 0;
+
+	/************** here we process inputs *******************/
+
+	if (line_filter) {
+		if (filter & FILT_COUNT_IP_COUNT)
+			filter_count_ip(source_field, accept_field, time_field, tptr);
+		else
+			line_filter(accept_field, time_field, tptr);
+	}
+	else
+		lines_out++; /* FILT_COUNT_ONLY was used, so we're just counting lines */
+	if (lines_max >= 0 && lines_out >= lines_max)
+		return 1;
+	return 0;
+}
+
+/* reports the parsing speed on stderr for -bench */
+static void bench_report()
+{
+	struct timeval now;
+	double secs;
+
+	gettimeofday(&now, NULL);
+	secs = (now.tv_sec - bench_start.tv_sec) + (now.tv_usec - bench_start.tv_usec) / 1000000.0;
+	if (secs <= 0)
+		secs = 0.000001;
+
+	fprintf(stderr, "bench: %d lines, %llu bytes in %.3f s : %.0f lines/s, %.3f GB/s (%s, %d threads)\n",
+		linenum, bench_bytes, secs, linenum / secs, bench_bytes / secs / 1e9,
+		field_scanner, nb_workers ? nb_workers : 1);
+}
+
+/* returns the number of lines between <p> and <end> */
+static int count_lines(const char *p, const char *end)
+{
+	int count = 0;
+
+	while (p < end) {
+		p = memchr(p, '\n', end - p);
+		count++;
+		if (!p)
+			break;
+		p++;
+	}
+	return count;
+}
+
+/* Processes the lines of the chunk of the worker passed in <arg>, filling the
+ * worker's own trees and counters.
+ */
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	struct timer *t = NULL;
+	const char *p, *e;
+	char *buf;
+	size_t len;
+	int base, i;
+
+	timers = w->timers;
+	warn_out = stderr;
+	if (!(filter & FILT_QUIET)) {
+		warn_out = open_memstream(&w->warn_buf, &w->warn_len);
+		if (!warn_out) {
+			fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+			exit(1);
+		}
+	}
+
+	if (fast_count) {
+		if (!filter_invert)
+			lines_out = count_lines(w->start, w->end);
+		goto done;
+	}
+
+	/* warnings report line numbers from the beginning of the input */
+	base = 0;
+	if (!(filter & FILT_QUIET)) {
+		w->nblines = count_lines(w->start, w->end);
+		pthread_barrier_wait(&workers_counted);
+		for (i = 0; &workers[i] != w; i++)
+			base += workers[i].nblines;
+	}
+	linenum = base;
+
+	buf = calloc(1, MAPPED_LINE_SIZE + LINE_PADDING);
+	if (!buf) {
+		fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+		exit(1);
+	}
+
+	for (p = w->start; p < w->end; p = e + 1) {
+		e = memchr(p, '\n', w->end - p);
+		if (!e)
+			e = w->end;
+		len = e - p;
+		if (len > MAPPED_LINE_SIZE)
+			len = MAPPED_LINE_SIZE;
+		memcpy(buf, p, len);
+		buf[len] = '\0';
+		line = buf;
+		if (process_line(&t))
+			break;
+	}
+	free(buf);
+	free(t);
+	linenum -= base;
+ done:
+	w->linenum = linenum;
+	w->parse_err = parse_err;
+	w->lines_out = lines_out;
+	if (warn_out != stderr)
+		fclose(warn_out);
+	return NULL;
+}
+
+/* moves the timers of tree <src> to tree <dst>, adding up their counts */
+static void merge_timers(struct eb_root *dst, struct eb_root *src)
+{
+	struct eb32_node *n, *next, *old;
+	struct timer *t;
+
+	for (n = eb32_first(src); n; n = next) {
+		next = eb32_next(n);
+		eb32_delete(n);
+		old = eb32i_insert(dst, n);
+		if (old != n) {
+			t = container_of(n, struct timer, node);
+			container_of(old, struct timer, node)->count += t->count;
+			free(t);
+		}
+	}
+}
+
+/* moves the servers of tree <src> to tree <dst>, adding up their stats */
+static void merge_servers(struct eb_root *dst, struct eb_root *src)
+{
+	struct ebmb_node *n, *next, *old;
+	struct srv_st *srv, *srv_old;
+	int f;
+
+	for (n = ebmb_first(src); n; n = next) {
+		next = ebmb_next(n);
+		ebmb_delete(n);
+		old = ebst_insert(dst, n);
+		if (old != n) {
+			srv = container_of(n, struct srv_st, node);
+			srv_old = container_of(old, struct srv_st, node);
+			for (f = 0; f <= 5; f++)
+				srv_old->st_cnt[f] += srv->st_cnt[f];
+			srv_old->nb_ct  += srv->nb_ct;
+			srv_old->nb_rt  += srv->nb_rt;
+			srv_old->nb_ok  += srv->nb_ok;
+			srv_old->cum_ct += srv->cum_ct;
+			srv_old->cum_rt += srv->cum_rt;
+			free(srv);
+		}
+	}
+}
+
+/* moves the URLs or addresses of tree <src> to tree <dst>, adding up their
+ * stats.
+ */
+static void merge_urls(struct eb_root *dst, struct eb_root *src)
+{
+	struct ebpt_node *n, *next, *old;
+	struct url_stat *ustat, *ustat_old;
+
+	for (n = ebpt_first(src); n; n = next) {
+		next = ebpt_next(n);
+		ebpt_delete(n);
+		old = ebis_insert(dst, n);
+		if (old != n) {
+			ustat = container_of(n, struct url_stat, node.url);
+			ustat_old = container_of(old, struct url_stat, node.url);
+			ustat_old->nb_req += ustat->nb_req;
+			ustat_old->nb_err += ustat->nb_err;
+			ustat_old->total_time += ustat->total_time;
+			ustat_old->total_time_ok += ustat->total_time_ok;
+			ustat_old->total_bytes_sent += ustat->total_bytes_sent;
+			free(ustat->url);
+			free(ustat);
+		}
+	}
+}
+
+/* Processes the input with <nbthr> threads (0 = one per CPU) when it is a
+ * regular file which can be mapped and the filters permit it, then merges the
+ * results of all threads in the main thread's trees and counters, in input
+ * order. Returns 0 if the input must be processed sequentially instead.
+ */
+static int run_workers(int nbthr)
+{
+	const char *map, *end, *p;
+	struct stat st;
+	off_t ofs, size;
+	int i, f;
+
+	/* printed lines must remain ordered, and some filters must stop
+	 * parsing the input as soon as enough lines were produced.
+	 */
+	if (line_filter == filter_output_line && !(filter & FILT_COUNT_IP_COUNT))
+		return 0;
+	if (lines_max >= 0 && (!line_filter || line_filter == filter_graphs))
+		return 0;
+	/* the tables of the most requested entries cannot be merged */
+	if (approx_slots && (filter & (FILT_COUNT_URL_ANY|FILT_COUNT_IP_COUNT)))
+		return 0;
+
+	if (fstat(0, &st) < 0 || !S_ISREG(st.st_mode))
+		return 0;
+
+	ofs = lseek(0, 0, SEEK_CUR);
+	if (ofs < 0 || ofs >= st.st_size)
+		return 0;
+	size = st.st_size - ofs;
+
+	if (nbthr <= 0)
+		nbthr = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbthr > MAX_THREADS)
+		nbthr = MAX_THREADS;
+	if (nbthr > size / MIN_CHUNK_SIZE)
+		nbthr = size / MIN_CHUNK_SIZE;
+	if (nbthr < 2)
+		return 0;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, 0, 0);
+	if (map == MAP_FAILED)
+		return 0;
+	madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+	workers = calloc(nbthr, sizeof(*workers));
+	if (!workers) {
+		fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+		exit(1);
+	}
+	nb_workers = nbthr;
+
+	/* cut the input into chunks of equal size, extended to the end of
+	 * their last line.
+	 */
+	p = map + ofs;
+	end = map + st.st_size;
+	for (i = 0; i < nb_workers; i++) {
+		workers[i].start = p;
+		if (i < nb_workers - 1) {
+			if (map + ofs + size / nb_workers * (i + 1) > p)
+				p = map + ofs + size / nb_workers * (i + 1);
+			p = memchr(p, '\n', end - p);
+			p = p ? p + 1 : end;
+		}
+		else
+			p = end;
+		workers[i].end = p;
+		for (f = 0; f < 5; f++)
+			workers[i].timers[f] = EB_ROOT_UNIQUE;
+	}
+
+	pthread_barrier_init(&workers_counted, NULL, nb_workers);
+	for (i = 0; i < nb_workers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0) {
+			fprintf(stderr, "Cannot create thread: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < nb_workers; i++) {
+		struct worker *w = &workers[i];
+
+		pthread_join(w->thread, NULL);
+
+		if (w->warn_len)
+			fwrite(w->warn_buf, 1, w->warn_len, stderr);
+		free(w->warn_buf);
+
+		linenum   += w->linenum;
+		bench_bytes += w->end - w->start;
+		parse_err += w->parse_err;
+		lines_out += w->lines_out;
+
+		if (filter & FILT_COUNT_IP_COUNT || line_filter == filter_count_url)
+			merge_urls(&timers[0], &w->timers[0]);
+		else if (line_filter == filter_count_srv_status)
+			merge_servers(&timers[0], &w->timers[0]);
+		else {
+			for (f = 0; f < 5; f++)
+				merge_timers(&timers[f], &w->timers[f]);
+		}
+	}
+
+	pthread_barrier_destroy(&workers_counted);
+	munmap((void *)map, st.st_size);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
 	const char *output_file = NULL;
-	int f, last, err;
+	int f, last;
 	struct timer *t = NULL;
 	struct eb32_node *n;
 	struct url_stat *ustat = NULL;
-	int val, test;
 	int filter_acc_delay = 0, filter_acc_count = 0;
-	int filter_time_resp = 0;
-	int filt_http_status_low = 0, filt_http_status_high = 0;
-	int skip_fields = 1;
+	int nb_threads = 1;
 
-	void (*line_filter)(const char *accept_field, const char *time_field, struct timer **tptr) = NULL;
+	warn_out = stderr;
 
 	argc--; argv++;
 	while (argc > 0) {
@@ -583,6 +1283,11 @@ int main(int argc, char **argv)
 			argc--; argv++;
 			lines_max = atol(*argv);
 		}
+		else if (strcmp(argv[0], "-j") == 0) {
+			if (argc < 2) die("missing option for -j");
+			argc--; argv++;
+			nb_threads = atol(*argv);
+		}
 		else if (strcmp(argv[0], "-e") == 0)
 			filter |= FILT_ERRORS_ONLY;
 		else if (strcmp(argv[0], "-E") == 0)
@@ -668,15 +1373,40 @@ int main(int argc, char **argv)
 				die("Fatal: missing output file name.\n");
 			output_file = argv[1];
 		}
+		else if (strcmp(argv[0], "-bench") == 0)
+			bench = 1;
+		else if (strcmp(argv[0], "-approx") == 0) {
+			if (argc < 2) die("missing option for -approx");
+			argc--; argv++;
+			approx_err = atof(*argv);
+			if (approx_err <= 0 || approx_err >= 1)
+				die("-approx expects an error bound between 0 and 1 (eg: 0.01)\n");
+		}
 		else if (strcmp(argv[0], "-h") == 0 || strcmp(argv[0], "--help") == 0)
 			help();
 		argc--;
 		argv++;
 	}
 
+	if (!filter && bench) {
+		/* only measure the line splitting and field indexing speed */
+		filter = FILT_COUNT_ONLY;
+		index_only = 1;
+	}
+
 	if (!filter)
 		die("No action specified.\n");
 
+	if (approx_err > 0) {
+		/* keeping b bits rounds values down by less than 2^(1-b) of
+		 * their value, and tracking N entries overestimates their
+		 * request count by at most 1/N of the total.
+		 */
+		for (approx_bits = 1; approx_bits < 31 && 2.0 / (1U << approx_bits) > approx_err; approx_bits++)
+			;
+		approx_slots = (1.0 / approx_err) + 0.999999;
+	}
+
 	if (filter & FILT_ACC_COUNT && !filter_acc_count)
 		filter_acc_count=1;
 
@@ -703,6 +1433,21 @@ int main(int argc, char **argv)
 	else if (filter & FILT_COUNT_ONLY)
 		line_filter = NULL;
 
+	/* FILT_COUNT_ONLY (see above), and no input filter (see below) */
+	fast_count = !line_filter &&
+		!(filter & (FILT_HTTP_ONLY|FILT_TIME_RESP|FILT_ERRORS_ONLY|FILT_HTTP_STATUS|FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY|FILT_TERM_CODE_NAME));
+
+	select_field_scanner();
+	if (bench) {
+		/* always parse the lines, even with -c */
+		fast_count = 0;
+		gettimeofday(&bench_start, NULL);
+		atexit(bench_report);
+	}
+
+	if (nb_threads != 1 && run_workers(nb_threads))
+		goto skip_filters;
+
 #if defined(POSIX_FADV_SEQUENTIAL)
 	/* around 20% performance improvement is observed on Linux with this
 	 * on cold-cache. Surprizingly, WILLNEED is less performant. Don't
@@ -712,8 +1457,7 @@ int main(int argc, char **argv)
 	posix_fadvise(0, 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
 
-	if (!line_filter && /* FILT_COUNT_ONLY ( see above), and no input filter (see below) */
-	    !(filter & (FILT_HTTP_ONLY|FILT_TIME_RESP|FILT_ERRORS_ONLY|FILT_HTTP_STATUS|FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY|FILT_TERM_CODE_NAME))) {
+	if (fast_count) {
 		/* read the whole file at once first, ignore it if inverted output */
 		if (!filter_invert)
 			while ((lines_max < 0 || lines_out < lines_max) && fgets2(stdin) != NULL)
@@ -723,173 +1467,9 @@ int main(int argc, char **argv)
 	}
 
 	while ((line = fgets2(stdin)) != NULL) {
-		linenum++;
-		time_field = NULL; accept_field = NULL;
-		source_field = NULL;
-
-		test = 1;
-
-		/* for any line we process, we first ensure that there is a field
-		 * looking like the accept date field (beginning with a '[').
-		 */
-		if (filter & FILT_COUNT_IP_COUNT) {
-			/* we need the IP first */
-			source_field = field_start(line, SOURCE_FIELD + skip_fields);
-			accept_field = field_start(source_field, ACCEPT_FIELD - SOURCE_FIELD + 1);
-		}
-		else
-			accept_field = field_start(line, ACCEPT_FIELD + skip_fields);
-
-		if (unlikely(*accept_field != '[')) {
-			parse_err++;
-			continue;
-		}
-
-		/* the day of month field is begin 01 and 31 */
-		if (accept_field[1] < '0' || accept_field[1] > '3') {
-			parse_err++;
-			continue;
-		}
-
-		if (filter & FILT_HTTP_ONLY) {
-			/* only report lines with at least 4 timers */
-			if (!time_field) {
-				time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);
-				if (unlikely(!*time_field)) {
-					truncated_line(linenum, line);
-					continue;
-				}
-			}
-
-			e = field_stop(time_field + 1);
-			/* we have field TIME_FIELD in [time_field]..[e-1] */
-			p = time_field;
-			f = 0;
-			while (!SEP(*p)) {
-				if (++f == 4)
-					break;
-				SKIP_CHAR(p, '/');
-			}
-			test &= (f >= 4);
-		}
-
-		if (filter & FILT_TIME_RESP) {
-			int tps;
-
-			/* only report lines with response times larger than filter_time_resp */
-			if (!time_field) {
-				time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);
-				if (unlikely(!*time_field)) {
-					truncated_line(linenum, line);
-					continue;
-				}
-			}
-
-			e = field_stop(time_field + 1);
-			/* we have field TIME_FIELD in [time_field]..[e-1], let's check only the response time */
-
-			p = time_field;
-			err = 0;
-			f = 0;
-			while (!SEP(*p)) {
-				tps = str2ic(p);
-				if (tps < 0) {
-					tps = -1;
-					err = 1;
-				}
-				if (++f == 4)
-					break;
-				SKIP_CHAR(p, '/');
-			}
-
-			if (unlikely(f < 4)) {
-				parse_err++;
-				continue;
-			}
-
-			test &= (tps >= filter_time_resp) ^ !!(filter & FILT_INVERT_TIME_RESP);
-		}
-
-		if (filter & (FILT_ERRORS_ONLY | FILT_HTTP_STATUS)) {
-			/* Check both error codes (-1, 5xx) and status code ranges */
-			if (time_field)
-				b = field_start(time_field, STATUS_FIELD - TIME_FIELD + 1);
-			else
-				b = field_start(accept_field, STATUS_FIELD - ACCEPT_FIELD + 1);
-
-			if (unlikely(!*b)) {
-				truncated_line(linenum, line);
-				continue;
-			}
-
-			val = str2ic(b);
-			if (filter & FILT_ERRORS_ONLY)
-				test &= (val < 0 || (val >= 500 && val <= 599)) ^ !!(filter & FILT_INVERT_ERRORS);
-
-			if (filter & FILT_HTTP_STATUS)
-				test &= (val >= filt_http_status_low && val <= filt_http_status_high) ^ !!(filter & FILT_INVERT_HTTP_STATUS);
-		}
-
-		if (filter & (FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY)) {
-			/* Check if the server's queue is non-nul */
-			if (time_field)
-				b = field_start(time_field, QUEUE_LEN_FIELD - TIME_FIELD + 1);
-			else
-				b = field_start(accept_field, QUEUE_LEN_FIELD - ACCEPT_FIELD + 1);
-
-			if (unlikely(!*b)) {
-				truncated_line(linenum, line);
-				continue;
-			}
-
-			if (*b == '0') {
-				if (filter & FILT_QUEUE_SRV_ONLY) {
-					test = 0;
-				}
-				else {
-					do {
-						b++;
-						if (*b == '/') {
-							b++;
-							break;
-						}
-					} while (*b);
-					test &= ((unsigned char)(*b - '1') < 9);
-				}
-			}
-		}
-
-		if (filter & FILT_TERM_CODE_NAME) {
-			/* only report corresponding termination code name */
-			if (time_field)
-				b = field_start(time_field, TERM_CODES_FIELD - TIME_FIELD + 1);
-			else
-				b = field_start(accept_field, TERM_CODES_FIELD - ACCEPT_FIELD + 1);
-
-			if (unlikely(!*b)) {
-				truncated_line(linenum, line);
-				continue;
-			}
-
-			test &= (b[0] == filter_term_code_name[0] && b[1] == filter_term_code_name[1]) ^ !!(filter & FILT_INVERT_TERM_CODE_NAME);
-		}
-
-
-		test ^= filter_invert;
-		if (!test)
-			continue;
-
-		/************** here we process inputs *******************/
-
-		if (line_filter) {
-			if (filter & FILT_COUNT_IP_COUNT)
-				filter_count_ip(source_field, accept_field, time_field, &t);
-			else
-				line_filter(accept_field, time_field, &t);
-		}
-		else
-			lines_out++; /* FILT_COUNT_ONLY was used, so we're just counting lines */
-		if (lines_max >= 0 && lines_out >= lines_max)
+		if (unlikely(bench))
+			bench_bytes += strlen(line) + 1;
+		if (process_line(&t))
 			break;
 	}
 
@@ -1085,13 +1665,13 @@ int main(int argc, char **argv)
 				else if (filter & FILT_COUNT_URL_TTOT)
 					ustat->node.val.key = ustat->total_time;
 				else if (filter & FILT_COUNT_URL_TAVG)
-					ustat->node.val.key = ustat->nb_req ? ustat->total_time / ustat->nb_req : 0;
+					ustat->node.val.key = url_seen(ustat) ? ustat->total_time / url_seen(ustat) : 0;
 				else if (filter & FILT_COUNT_URL_TTOTO)
 					ustat->node.val.key = ustat->total_time_ok;
 				else if (filter & FILT_COUNT_URL_TAVGO)
-					ustat->node.val.key = (ustat->nb_req - ustat->nb_err) ? ustat->total_time_ok / (ustat->nb_req - ustat->nb_err) : 0;
+					ustat->node.val.key = (url_seen(ustat) - ustat->nb_err) ? ustat->total_time_ok / (url_seen(ustat) - ustat->nb_err) : 0;
 				else if (filter & FILT_COUNT_URL_BAVG)
-					ustat->node.val.key = ustat->nb_req ? ustat->total_bytes_sent / ustat->nb_req : 0;
+					ustat->node.val.key = url_seen(ustat) ? ustat->total_bytes_sent / url_seen(ustat) : 0;
 				else if (filter & FILT_COUNT_URL_BTOT)
 					ustat->node.val.key = ustat->total_bytes_sent;
 				else
@@ -1103,25 +1683,28 @@ int main(int argc, char **argv)
 			timers[0] = timers[1];
 		}
 
+		/* with -approx, "over" reports how much "req" may be overestimated */
 		if (FILT_COUNT_IP_COUNT)
-			printf("#req err ttot tavg oktot okavg bavg btot src\n");
+			printf("#req err ttot tavg oktot okavg bavg btot%s src\n", approx_slots ? " over" : "");
 		else
-			printf("#req err ttot tavg oktot okavg bavg btot url\n");
+			printf("#req err ttot tavg oktot okavg bavg btot%s url\n", approx_slots ? " over" : "");
 
 		/* scan the tree in its reverse sorting order */
 		node = eb_last(&timers[0]);
 		while (node) {
 			ustat = container_of(node, struct url_stat, node.url.node);
-			printf("%d %d %Ld %Ld %Ld %Ld %Ld %Ld %s\n",
+			printf("%d %d %Ld %Ld %Ld %Ld %Ld %Ld",
 			       ustat->nb_req,
 			       ustat->nb_err,
 			       ustat->total_time,
-			       ustat->nb_req ? ustat->total_time / ustat->nb_req : 0,
+			       url_seen(ustat) ? ustat->total_time / url_seen(ustat) : 0,
 			       ustat->total_time_ok,
-			       (ustat->nb_req - ustat->nb_err) ? ustat->total_time_ok / (ustat->nb_req - ustat->nb_err) : 0,
-			       ustat->nb_req ? ustat->total_bytes_sent / ustat->nb_req : 0,
-			       ustat->total_bytes_sent,
-			       ustat->url);
+			       (url_seen(ustat) - ustat->nb_err) ? ustat->total_time_ok / (url_seen(ustat) - ustat->nb_err) : 0,
+			       url_seen(ustat) ? ustat->total_bytes_sent / url_seen(ustat) : 0,
+			       ustat->total_bytes_sent);
+			if (approx_slots)
+				printf(" %u", ustat->nb_over);
+			printf(" %s\n", ustat->url);
 
 			node = eb_prev(node);
 			lines_out++;
@@ -1134,6 +1717,22 @@ int main(int argc, char **argv)
 	if (!(filter & FILT_QUIET))
 		fprintf(stderr, "%d lines in, %d lines out, %d parsing errors\n",
 			linenum, lines_out, parse_err);
+	if (!(filter & FILT_QUIET) && approx_err > 0) {
+		unsigned long long approx_min = 0;
+
+		/* entries which are not tracked anymore were not requested more
+		 * than the least requested tracked one.
+		 */
+		if (approx_used == approx_slots && !eb_is_empty(&approx_counts))
+			approx_min = eb64_first(&approx_counts)->key;
+
+		if (filter & FILT_PERCENTILE)
+			fprintf(stderr, "approx: timers rounded down by less than %.3g%%\n",
+				100.0 * 2.0 / (1U << approx_bits));
+		else if (filter & (FILT_COUNT_URL_ANY|FILT_COUNT_IP_COUNT))
+			fprintf(stderr, "approx: %u entries tracked, req overestimated by at most %llu (%.3g%% of %d lines)\n",
+				approx_used, approx_min, 100.0 * approx_min / (linenum ? linenum : 1), linenum);
+	}
 	exit(0);
 }
 
@@ -1165,10 +1764,7 @@ void filter_count_status(const char *accept_field, const char *time_field, struc
 	const char *b;
 	int val;
 
-	if (time_field)
-		b = field_start(time_field, STATUS_FIELD - TIME_FIELD + 1);
-	else
-		b = field_start(accept_field, STATUS_FIELD - ACCEPT_FIELD + 1);
+	b = log_field(STATUS_FIELD);
 
 	if (unlikely(!*b)) {
 		truncated_line(linenum, line);
@@ -1187,10 +1783,7 @@ void filter_count_cook_codes(const char *accept_field, const char *time_field, s
 	const char *b;
 	int val;
 
-	if (time_field)
-		b = field_start(time_field, TERM_CODES_FIELD - TIME_FIELD + 1);
-	else
-		b = field_start(accept_field, TERM_CODES_FIELD - ACCEPT_FIELD + 1);
+	b = log_field(TERM_CODES_FIELD);
 
 	if (unlikely(!*b)) {
 		truncated_line(linenum, line);
@@ -1209,10 +1802,7 @@ void filter_count_term_codes(const char *accept_field, const char *time_field, s
 	const char *b;
 	int val;
 
-	if (time_field)
-		b = field_start(time_field, TERM_CODES_FIELD - TIME_FIELD + 1);
-	else
-		b = field_start(accept_field, TERM_CODES_FIELD - ACCEPT_FIELD + 1);
+	b = log_field(TERM_CODES_FIELD);
 
 	if (unlikely(!*b)) {
 		truncated_line(linenum, line);
@@ -1236,7 +1826,7 @@ void filter_count_srv_status(const char *accept_field, const char *time_field, s
 	/* the server field is before the status field, so let's
 	 * parse them in the proper order.
 	 */
-	b = field_start(accept_field, SERVER_FIELD - ACCEPT_FIELD + 1);
+	b = log_field(SERVER_FIELD);
 	if (unlikely(!*b)) {
 		truncated_line(linenum, line);
 		return;
@@ -1261,7 +1851,7 @@ void filter_count_srv_status(const char *accept_field, const char *time_field, s
 
 	/* let's collect the connect and response times */
 	if (!time_field) {
-		time_field = field_start(e, TIME_FIELD - SERVER_FIELD);
+		time_field = log_field(TIME_FIELD);
 		if (unlikely(!*time_field)) {
 			truncated_line(linenum, line);
 			return;
@@ -1307,7 +1897,7 @@ void filter_count_srv_status(const char *accept_field, const char *time_field, s
 	/* we're interested in the 5 HTTP status classes (1xx ... 5xx), and
 	 * the invalid ones which will be reported as 0.
 	 */
-	b = field_start(e, STATUS_FIELD - TIME_FIELD);
+	b = log_field(STATUS_FIELD);
 	if (unlikely(!*b)) {
 		truncated_line(linenum, line);
 		return;
@@ -1320,17 +1910,76 @@ void filter_count_srv_status(const char *accept_field, const char *time_field, s
 	srv->st_cnt[val]++;
 }
 
+/* Accounts the request described by <ustat> to the entry of URL <key>, which
+ * may be modified. <ustat> is either inserted or freed. With -approx, only the
+ * <approx_slots> most requested entries are kept using the Space-Saving
+ * algorithm : when the table is full, the least requested entry is replaced
+ * and its request count is inherited as a possible overestimation.
+ */
+static void insert_url_stat(struct url_stat *ustat, const char *key)
+{
+	struct ebpt_node *ebpt_old;
+	struct eb64_node *victim;
+	struct url_stat *ustat_old;
+
+	/* now instead of copying the URL for a simple lookup, we'll link
+	 * to it from the node we're trying to insert. If it returns a
+	 * different value, it was already there. Otherwise we just have
+	 * to dynamically realloc an entry using strdup().
+	 */
+	ustat->node.url.key = (char *)key;
+	ebpt_old = ebis_insert(&timers[0], &ustat->node.url);
+
+	if (ebpt_old != &ustat->node.url) {
+		/* node was already there, let's update previous one */
+		ustat_old = container_of(ebpt_old, struct url_stat, node.url);
+		ustat_old->nb_req ++;
+		ustat_old->nb_err += ustat->nb_err;
+		ustat_old->total_time += ustat->total_time;
+		ustat_old->total_time_ok += ustat->total_time_ok;
+		ustat_old->total_bytes_sent += ustat->total_bytes_sent;
+		free(ustat);
+
+		if (approx_slots) {
+			eb64_delete(&ustat_old->cnt);
+			ustat_old->cnt.key = ustat_old->nb_req;
+			eb64_insert(&approx_counts, &ustat_old->cnt);
+		}
+		return;
+	}
+
+	ustat->url = ustat->node.url.key = strdup(ustat->node.url.key);
+	if (!approx_slots)
+		return;
+
+	if (approx_used < approx_slots)
+		approx_used++;
+	else {
+		/* the table is full, evict the least requested entry */
+		victim = eb64_first(&approx_counts);
+		ustat_old = container_of(victim, struct url_stat, cnt);
+		eb64_delete(victim);
+		ebpt_delete(&ustat_old->node.url);
+
+		ustat->nb_req += ustat_old->nb_req;
+		ustat->nb_over = ustat_old->nb_req;
+		free(ustat_old->url);
+		free(ustat_old);
+	}
+	ustat->cnt.key = ustat->nb_req;
+	eb64_insert(&approx_counts, &ustat->cnt);
+}
+
 void filter_count_url(const char *accept_field, const char *time_field, struct timer **tptr)
 {
 	struct url_stat *ustat = NULL;
-	struct ebpt_node *ebpt_old;
 	const char *b, *e;
 	int f, err, array[5];
 	int val;
 
 	/* let's collect the response time */
 	if (!time_field) {
-		time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);  // avg 115 ns per line
+		time_field = log_field(TIME_FIELD);  // avg 115 ns per line
 		if (unlikely(!*time_field)) {
 			truncated_line(linenum, line);
 			return;
@@ -1370,7 +2019,7 @@ void filter_count_url(const char *accept_field, const char *time_field, struct t
 	ustat->total_time = (array[3] >= 0) ? array[3] : array[4];
 	ustat->total_time_ok = (array[3] >= 0) ? array[3] : 0;
 
-	e = field_start(e, BYTES_SENT_FIELD - TIME_FIELD + 1);
+	e = log_field(BYTES_SENT_FIELD);
 	val = str2ic(e);
 	ustat->total_bytes_sent = val;
 
@@ -1379,12 +2028,13 @@ void filter_count_url(const char *accept_field, const char *time_field, struct t
 	 * the next field because it's a capture. Let's fall back to the "method" itself
 	 * if there's nothing else.
 	 */
-	e = field_start(e, METH_FIELD - BYTES_SENT_FIELD + 1);
+	f = METH_FIELD;
+	e = log_field(f);
 	while (*e != '"' && *e) {
 		/* Note: some syslog servers escape quotes ! */
 		if (*e == '\\' && e[1] == '"')
 			break;
-		e = field_start(e, 2);
+		e = log_field(++f);
 	}
 
 	if (unlikely(!*e)) {
@@ -1392,7 +2042,7 @@ void filter_count_url(const char *accept_field, const char *time_field, struct t
 		return;
 	}
 
-	b = field_start(e, URL_FIELD - METH_FIELD + 1); // avg 40 ns per line
+	b = log_field(f + URL_FIELD - METH_FIELD);
 	if (!*b)
 		b = e;
 
@@ -1406,40 +2056,19 @@ void filter_count_url(const char *accept_field, const char *time_field, struct t
 		e++;
 	} while (*e);
 
-	/* now instead of copying the URL for a simple lookup, we'll link
-	 * to it from the node we're trying to insert. If it returns a
-	 * different value, it was already there. Otherwise we just have
-	 * to dynamically realloc an entry using strdup().
-	 */
-	ustat->node.url.key = (char *)b;
-	ebpt_old = ebis_insert(&timers[0], &ustat->node.url);
-
-	if (ebpt_old != &ustat->node.url) {
-		struct url_stat *ustat_old;
-		/* node was already there, let's update previous one */
-		ustat_old = container_of(ebpt_old, struct url_stat, node.url);
-		ustat_old->nb_req ++;
-		ustat_old->nb_err += ustat->nb_err;
-		ustat_old->total_time += ustat->total_time;
-		ustat_old->total_time_ok += ustat->total_time_ok;
-		ustat_old->total_bytes_sent += ustat->total_bytes_sent;
-	} else {
-		ustat->url = ustat->node.url.key = strdup(ustat->node.url.key);
-		ustat = NULL; /* node was used */
-	}
+	insert_url_stat(ustat, b);
 }
 
 void filter_count_ip(const char *source_field, const char *accept_field, const char *time_field, struct timer **tptr)
 {
 	struct url_stat *ustat = NULL;
-	struct ebpt_node *ebpt_old;
 	const char *b, *e;
 	int f, err, array[5];
 	int val;
 
 	/* let's collect the response time */
 	if (!time_field) {
-		time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);  // avg 115 ns per line
+		time_field = log_field(TIME_FIELD);  // avg 115 ns per line
 		if (unlikely(!*time_field)) {
 			truncated_line(linenum, line);
 			return;
@@ -1481,7 +2110,7 @@ void filter_count_ip(const char *source_field, const char *accept_field, const c
 	ustat->total_time = (array[0] >= 0) ? array[0] : array[4];
 	ustat->total_time_ok = (array[0] >= 0) ? array[0] : 0;
 
-	e = field_start(e, BYTES_SENT_FIELD - TIME_FIELD + 1);
+	e = log_field(BYTES_SENT_FIELD);
 	val = str2ic(e);
 	ustat->total_bytes_sent = val;
 
@@ -1494,28 +2123,8 @@ void filter_count_ip(const char *source_field, const char *accept_field, const c
 		e--;
 	*(char *)(e - 1) = '\0';
 
-	/* now instead of copying the src for a simple lookup, we'll link
-	 * to it from the node we're trying to insert. If it returns a
-	 * different value, it was already there. Otherwise we just have
-	 * to dynamically realloc an entry using strdup(). We're using the
-	 * <url> field of the node to store the source address.
-	 */
-	ustat->node.url.key = (char *)b;
-	ebpt_old = ebis_insert(&timers[0], &ustat->node.url);
-
-	if (ebpt_old != &ustat->node.url) {
-		struct url_stat *ustat_old;
-		/* node was already there, let's update previous one */
-		ustat_old = container_of(ebpt_old, struct url_stat, node.url);
-		ustat_old->nb_req ++;
-		ustat_old->nb_err += ustat->nb_err;
-		ustat_old->total_time += ustat->total_time;
-		ustat_old->total_time_ok += ustat->total_time_ok;
-		ustat_old->total_bytes_sent += ustat->total_bytes_sent;
-	} else {
-		ustat->url = ustat->node.url.key = strdup(ustat->node.url.key);
-		ustat = NULL; /* node was used */
-	}
+	/* we're using the <url> field of the node to store the source address */
+	insert_url_stat(ustat, b);
 }
 
 void filter_graphs(const char *accept_field, const char *time_field, struct timer **tptr)
@@ -1525,7 +2134,7 @@ void filter_graphs(const char *accept_field, const char *time_field, struct time
 	int f, err, array[5];
 
 	if (!time_field) {
-		time_field = field_start(accept_field, TIME_FIELD - ACCEPT_FIELD + 1);
+		time_field = log_field(TIME_FIELD);
 		if (unlikely(!*time_field)) {
 			truncated_line(linenum, line);
 			return;
@@ -1577,7 +2186,7 @@ void filter_graphs(const char *accept_field, const char *time_field, struct time
 
 			v = array[4] - array[0] - array[1] - array[2] - array[3]; // data time
 			if (v < 0 && !(filter & FILT_QUIET))
-				fprintf(stderr, "ERR: %s (%d %d %d %d %d => %d)\n",
+				fprintf(warn_out, "ERR: %s (%d %d %d %d %d => %d)\n",
 					line, array[0], array[1], array[2], array[3], array[4], v);
 			t2 = insert_timer(&timers[4], tptr, v); t2->count++;
 			lines_out++;
@@ -1586,20 +2195,20 @@ void filter_graphs(const char *accept_field, const char *time_field, struct time
 		if (err) {
 			if (array[4] < 0)
 				array[4] = -1;
-			t2 = insert_value(&timers[0], tptr, array[4]);  // total time
+			t2 = insert_value(&timers[0], tptr, approx(array[4]));  // total time
 			t2->count++;
 		} else {
 			int v;
 
-			t2 = insert_value(&timers[1], tptr, array[0]); t2->count++;  // req
-			t2 = insert_value(&timers[2], tptr, array[2]); t2->count++;  // conn
-			t2 = insert_value(&timers[3], tptr, array[3]); t2->count++;  // resp
+			t2 = insert_value(&timers[1], tptr, approx(array[0])); t2->count++;  // req
+			t2 = insert_value(&timers[2], tptr, approx(array[2])); t2->count++;  // conn
+			t2 = insert_value(&timers[3], tptr, approx(array[3])); t2->count++;  // resp
 
 			v = array[4] - array[0] - array[1] - array[2] - array[3]; // data time
 			if (v < 0 && !(filter & FILT_QUIET))
-				fprintf(stderr, "ERR: %s (%d %d %d %d %d => %d)\n",
+				fprintf(warn_out, "ERR: %s (%d %d %d %d %d => %d)\n",
 					line, array[0], array[1], array[2], array[3], array[4], v);
-			t2 = insert_value(&timers[4], tptr, v); t2->count++;
+			t2 = insert_value(&timers[4], tptr, approx(v)); t2->count++;
 			lines_out++;
 		}
 	}
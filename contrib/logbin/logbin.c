@@ -0,0 +1,443 @@
+/*
+ * Binary log records decoder
+ *
+ * This program decodes the binary log records produced by haproxy with
+ * "log-format-binary" and prints them as text, one line per record, made of
+ * the syslog header followed by "name=value" pairs. Records are read either
+ * from stdin (eg: the output of contrib/logring, or datagrams stored back to
+ * back by a collector), or directly from a UDP port with "-u". Lines which do
+ * not contain a binary record are printed unmodified.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <types/log.h>
+
+/* names of the fields, as used in log-format */
+static const char *field_names[] = {
+	[LOG_FMT_EXPR]           = "expr",
+	[LOG_FMT_CLIENTIP]       = "ci",
+	[LOG_FMT_CLIENTPORT]     = "cp",
+	[LOG_FMT_BACKENDIP]      = "bi",
+	[LOG_FMT_BACKENDPORT]    = "bp",
+	[LOG_FMT_FRONTENDIP]     = "fi",
+	[LOG_FMT_FRONTENDPORT]   = "fp",
+	[LOG_FMT_SERVERPORT]     = "sp",
+	[LOG_FMT_SERVERIP]       = "si",
+	[LOG_FMT_COUNTER]        = "rt",
+	[LOG_FMT_PID]            = "pid",
+	[LOG_FMT_DATE]           = "t",
+	[LOG_FMT_DATEGMT]        = "T",
+	[LOG_FMT_DATELOCAL]      = "Tl",
+	[LOG_FMT_TS]             = "Ts",
+	[LOG_FMT_MS]             = "ms",
+	[LOG_FMT_FRONTEND]       = "f",
+	[LOG_FMT_FRONTEND_XPRT]  = "ft",
+	[LOG_FMT_BACKEND]        = "b",
+	[LOG_FMT_SERVER]         = "s",
+	[LOG_FMT_BYTES]          = "B",
+	[LOG_FMT_BYTES_UP]       = "U",
+	[LOG_FMT_TQ]             = "Tq",
+	[LOG_FMT_TW]             = "Tw",
+	[LOG_FMT_TC]             = "Tc",
+	[LOG_FMT_TR]             = "Tr",
+	[LOG_FMT_TT]             = "Tt",
+	[LOG_FMT_STATUS]         = "ST",
+	[LOG_FMT_CCLIENT]        = "CC",
+	[LOG_FMT_CSERVER]        = "CS",
+	[LOG_FMT_TERMSTATE]      = "ts",
+	[LOG_FMT_TERMSTATE_CK]   = "tsc",
+	[LOG_FMT_ACTCONN]        = "ac",
+	[LOG_FMT_FECONN]         = "fc",
+	[LOG_FMT_BECONN]         = "bc",
+	[LOG_FMT_SRVCONN]        = "sc",
+	[LOG_FMT_RETRIES]        = "rc",
+	[LOG_FMT_SRVQUEUE]       = "sq",
+	[LOG_FMT_BCKQUEUE]       = "bq",
+	[LOG_FMT_HDRREQUEST]     = "hr",
+	[LOG_FMT_HDRRESPONS]     = "hs",
+	[LOG_FMT_HDRREQUESTLIST] = "hrl",
+	[LOG_FMT_HDRRESPONSLIST] = "hsl",
+	[LOG_FMT_REQ]            = "r",
+	[LOG_FMT_HOSTNAME]       = "H",
+	[LOG_FMT_UNIQUEID]       = "ID",
+	[LOG_FMT_SSL_CIPHER]     = "sslc",
+	[LOG_FMT_SSL_VERSION]    = "sslv",
+};
+
+static const char *monthname[12] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static unsigned int get16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static unsigned int get32(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* prints string <p> of <len> bytes between quotes, with quotes, backslashes
+ * and non-printable characters escaped.
+ */
+static void print_str(const unsigned char *p, int len)
+{
+	putchar('"');
+	while (len-- > 0) {
+		if (*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if (*p < 0x20 || *p >= 0x7f)
+			printf("\\x%02x", *p);
+		else
+			putchar(*p);
+		p++;
+	}
+	putchar('"');
+}
+
+/* Decodes one string at <p>, prints it and returns the number of bytes read,
+ * or -1 if it does not fit in <left> bytes.
+ */
+static int decode_str(const unsigned char *p, int left)
+{
+	unsigned int len;
+
+	if (left < 2)
+		return -1;
+	len = get16(p);
+	if (len == LOG_BIN_NOSTR) {
+		putchar('-');
+		return 2;
+	}
+	if (len > left - 2)
+		return -1;
+	print_str(p + 2, len);
+	return len + 2;
+}
+
+static void print_date(int type, time_t sec, unsigned int ms)
+{
+	struct tm tm;
+	char zone[8];
+
+	switch (type) {
+	case LOG_FMT_TS:
+		printf("%u", (unsigned int)sec);
+		break;
+	case LOG_FMT_MS:
+		printf("%03u", ms);
+		break;
+	case LOG_FMT_DATEGMT:
+		gmtime_r(&sec, &tm);
+		printf("%02d/%s/%04d:%02d:%02d:%02d +0000",
+		       tm.tm_mday, monthname[tm.tm_mon], tm.tm_year + 1900,
+		       tm.tm_hour, tm.tm_min, tm.tm_sec);
+		break;
+	case LOG_FMT_DATELOCAL:
+		localtime_r(&sec, &tm);
+		strftime(zone, sizeof(zone), "%z", &tm);
+		printf("%02d/%s/%04d:%02d:%02d:%02d %s",
+		       tm.tm_mday, monthname[tm.tm_mon], tm.tm_year + 1900,
+		       tm.tm_hour, tm.tm_min, tm.tm_sec, zone);
+		break;
+	default:
+		localtime_r(&sec, &tm);
+		printf("%02d/%s/%04d:%02d:%02d:%02d.%03u",
+		       tm.tm_mday, monthname[tm.tm_mon], tm.tm_year + 1900,
+		       tm.tm_hour, tm.tm_min, tm.tm_sec, ms);
+		break;
+	}
+}
+
+/* Decodes the <len> bytes of fields at <p> and prints them. Returns 0 on
+ * success or -1 if the record is malformed.
+ */
+static int decode_fields(const unsigned char *p, int len)
+{
+	const unsigned char *end = p + len;
+	char addr[INET6_ADDRSTRLEN];
+	int tag, type, ret, nb;
+	const char *name;
+
+	while (p < end) {
+		tag = *p++;
+		type = tag & ~LOG_BIN_PLUS;
+		name = NULL;
+		if (type < sizeof(field_names) / sizeof(field_names[0]))
+			name = field_names[type];
+		if (!name)
+			return -1;
+
+		printf(" %s=", name);
+		if ((tag & LOG_BIN_PLUS) && type != LOG_FMT_FRONTEND_XPRT)
+			putchar('+');
+
+		switch (type) {
+		case LOG_FMT_CLIENTIP:
+		case LOG_FMT_BACKENDIP:
+		case LOG_FMT_FRONTENDIP:
+		case LOG_FMT_SERVERIP:
+			if (end - p < 1)
+				return -1;
+			if (*p == 4 && end - p >= 5) {
+				printf("%s", inet_ntop(AF_INET, p + 1, addr, sizeof(addr)));
+				p += 5;
+			}
+			else if (*p == 6 && end - p >= 17) {
+				printf("%s", inet_ntop(AF_INET6, p + 1, addr, sizeof(addr)));
+				p += 17;
+			}
+			else if (*p == 0) {
+				putchar('-');
+				p++;
+			}
+			else
+				return -1;
+			break;
+
+		case LOG_FMT_CLIENTPORT:
+		case LOG_FMT_BACKENDPORT:
+		case LOG_FMT_FRONTENDPORT:
+		case LOG_FMT_SERVERPORT:
+			if (end - p < 2)
+				return -1;
+			printf("%u", get16(p));
+			p += 2;
+			break;
+
+		case LOG_FMT_DATE:
+		case LOG_FMT_DATEGMT:
+		case LOG_FMT_DATELOCAL:
+		case LOG_FMT_TS:
+		case LOG_FMT_MS:
+			if (end - p < 6)
+				return -1;
+			print_date(type, (time_t)get32(p), get16(p + 4));
+			p += 6;
+			break;
+
+		case LOG_FMT_BYTES:
+		case LOG_FMT_BYTES_UP:
+			if (end - p < 8)
+				return -1;
+			printf("%lld", (long long)(((unsigned long long)get32(p) << 32) | get32(p + 4)));
+			p += 8;
+			break;
+
+		case LOG_FMT_COUNTER:
+		case LOG_FMT_PID:
+		case LOG_FMT_TQ:
+		case LOG_FMT_TW:
+		case LOG_FMT_TC:
+		case LOG_FMT_TR:
+		case LOG_FMT_TT:
+		case LOG_FMT_STATUS:
+		case LOG_FMT_ACTCONN:
+		case LOG_FMT_FECONN:
+		case LOG_FMT_BECONN:
+		case LOG_FMT_SRVCONN:
+		case LOG_FMT_RETRIES:
+		case LOG_FMT_SRVQUEUE:
+		case LOG_FMT_BCKQUEUE:
+			if (end - p < 4)
+				return -1;
+			printf("%d", (int)get32(p));
+			p += 4;
+			break;
+
+		case LOG_FMT_TERMSTATE:
+		case LOG_FMT_TERMSTATE_CK:
+			nb = (type == LOG_FMT_TERMSTATE) ? 2 : 4;
+			if (end - p < nb)
+				return -1;
+			fwrite(p, 1, nb, stdout);
+			p += nb;
+			break;
+
+		case LOG_FMT_HDRREQUEST:
+		case LOG_FMT_HDRRESPONS:
+		case LOG_FMT_HDRREQUESTLIST:
+		case LOG_FMT_HDRRESPONSLIST:
+			if (end - p < 1)
+				return -1;
+			nb = *p++;
+			putchar('{');
+			while (nb--) {
+				ret = decode_str(p, end - p);
+				if (ret < 0)
+					return -1;
+				p += ret;
+				if (nb)
+					putchar('|');
+			}
+			putchar('}');
+			break;
+
+		default: /* strings */
+			ret = decode_str(p, end - p);
+			if (ret < 0)
+				return -1;
+			p += ret;
+			if (type == LOG_FMT_FRONTEND_XPRT && (tag & LOG_BIN_PLUS))
+				putchar('~');
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Decodes the messages found in the <len> bytes at <buf>. Each message starts
+ * with a syslog header ending with ": ", followed by either a binary record
+ * and a line feed, or a text line. Returns the number of bytes consumed, which
+ * may be less than <len> if the last message is incomplete.
+ */
+static int decode_buffer(const unsigned char *buf, int len)
+{
+	const unsigned char *p = buf, *end = buf + len;
+	const unsigned char *hdr, *lf;
+	unsigned int rlen;
+
+	while (p < end) {
+		/* find the end of the header, which must be on the current line */
+		lf = memchr(p, '\n', end - p);
+		for (hdr = p; hdr + 3 < end; hdr++) {
+			if (lf && hdr >= lf)
+				break;
+			if (hdr[0] == ':' && hdr[1] == ' ' &&
+			    hdr[2] == LOG_BIN_MAGIC && hdr[3] == LOG_BIN_VERSION)
+				break;
+		}
+
+		if (hdr + 3 >= end || (lf && hdr >= lf) ||
+		    hdr[0] != ':' || hdr[2] != LOG_BIN_MAGIC) {
+			/* text line */
+			if (!lf)
+				break;
+			fwrite(p, 1, lf + 1 - p, stdout);
+			p = lf + 1;
+			continue;
+		}
+
+		/* binary record : ": " magic version len16 fields '\n' */
+		if (end - (hdr + 2) < LOG_BIN_HDR_LEN)
+			break;
+		rlen = get16(hdr + 4);
+		if (end - (hdr + 2 + LOG_BIN_HDR_LEN) < rlen + 1)
+			break;
+
+		fwrite(p, 1, hdr + 1 - p, stdout);
+		if (decode_fields(hdr + 2 + LOG_BIN_HDR_LEN, rlen) < 0)
+			printf(" <malformed record>");
+		putchar('\n');
+
+		p = hdr + 2 + LOG_BIN_HDR_LEN + rlen;
+		if (*p == '\n')
+			p++;
+	}
+	return p - buf;
+}
+
+static void usage(const char *name, int code)
+{
+	fprintf(stderr,
+		"Usage: %s [-u [<addr>:]<port>] [-h]\n"
+		"  Decodes haproxy's binary log records read from stdin, or received\n"
+		"  on UDP port <port> when -u is set, and prints them as text.\n",
+		name);
+	exit(code);
+}
+
+static int read_udp(const char *arg)
+{
+	static unsigned char buf[65536];
+	struct sockaddr_in sin;
+	const char *colon;
+	int fd, ret;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	colon = strrchr(arg, ':');
+	if (colon) {
+		char host[64];
+
+		snprintf(host, sizeof(host), "%.*s", (int)(colon - arg), arg);
+		if (!inet_pton(AF_INET, host, &sin.sin_addr)) {
+			fprintf(stderr, "Invalid address '%s'\n", host);
+			return 1;
+		}
+		arg = colon + 1;
+	}
+	sin.sin_port = htons(atoi(arg));
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		fprintf(stderr, "Cannot bind UDP socket : %s\n", strerror(errno));
+		return 1;
+	}
+
+	while (1) {
+		ret = recv(fd, buf, sizeof(buf) - 1, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		/* datagrams are complete messages, make sure they're terminated */
+		if (!ret || buf[ret - 1] != '\n')
+			buf[ret++] = '\n';
+		decode_buffer(buf, ret);
+		fflush(stdout);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[65536];
+	int len = 0, ret, done;
+
+	if (argc > 1 && strcmp(argv[1], "-h") == 0)
+		usage(argv[0], 0);
+	if (argc > 2 && strcmp(argv[1], "-u") == 0)
+		return read_udp(argv[2]);
+	if (argc > 1)
+		usage(argv[0], 1);
+
+	while (1) {
+		ret = read(0, buf + len, sizeof(buf) - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+		done = decode_buffer(buf, len);
+		if (!done && len == sizeof(buf)) {
+			/* garbage which cannot be a valid message */
+			done = len;
+		}
+		memmove(buf, buf + done, len - done);
+		len -= done;
+	}
+
+	if (len)
+		decode_buffer(buf, len);
+	return 0;
+}
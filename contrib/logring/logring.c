@@ -0,0 +1,282 @@
+/*
+ * Shared memory log ring reader
+ *
+ * This program streams to stdout the log lines that haproxy writes into a
+ * shared memory ring declared with "log ring@<file>". It follows the ring
+ * until interrupted, and reports the consumed position back into the ring so
+ * that haproxy can apply the "drop-new" overflow policy. When the file is
+ * replaced (eg: after a reload), the old ring is drained first, then the new
+ * one is opened.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <types/log.h>
+
+/* time to wait for a reserved record to be completed before skipping it */
+#define STUCK_DELAY_MS  1000
+/* polling interval when the ring is empty */
+#define IDLE_DELAY_MS   10
+
+struct ring {
+	const char *name;
+	struct log_shm_hdr *hdr;
+	char *data;
+	unsigned int mask;
+	unsigned int shift;
+	size_t map_len;
+	ino_t ino;
+	dev_t dev;
+};
+
+static int opt_peek;        /* -n : do not report the consumed position */
+static int opt_end;         /* -e : start at the end of the ring */
+static int opt_exit;        /* -x : exit once the ring is empty */
+static unsigned long long lines, losses;
+
+static void usage(const char *name, int code)
+{
+	fprintf(stderr,
+		"Usage: %s [-nexh] <ring_file>\n"
+		"  -n : peek only, do not report the consumed position to haproxy\n"
+		"  -e : start at the end of the ring instead of the first unread line\n"
+		"  -x : exit once the ring is empty instead of following it\n"
+		"  -h : show this help\n",
+		name);
+	exit(code);
+}
+
+static void msleep(int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+/* maps ring file <name> into <r>. Returns 0 on success or -1 on failure after
+ * having reported the error.
+ */
+static int ring_open(struct ring *r, const char *name)
+{
+	struct stat st;
+	struct log_shm_hdr hdr;
+	void *area;
+	int fd;
+
+	fd = open(name, O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open '%s' : %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(hdr) ||
+	    read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    memcmp(hdr.magic, LOG_SHM_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != LOG_SHM_VERSION ||
+	    !hdr.size || (hdr.size & (hdr.size - 1)) ||
+	    st.st_size < (off_t)(sizeof(hdr) + hdr.size)) {
+		fprintf(stderr, "'%s' is not a valid log ring.\n", name);
+		close(fd);
+		return -1;
+	}
+
+	area = mmap(NULL, sizeof(hdr) + hdr.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (area == MAP_FAILED) {
+		fprintf(stderr, "Cannot map '%s' : %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	r->name    = name;
+	r->hdr     = area;
+	r->data    = (char *)(r->hdr + 1);
+	r->mask    = hdr.size - 1;
+	r->map_len = sizeof(hdr) + hdr.size;
+	r->ino     = st.st_ino;
+	r->dev     = st.st_dev;
+	for (r->shift = 0; (1U << r->shift) < hdr.size; r->shift++)
+		;
+	return 0;
+}
+
+/* returns non-zero if the ring's file was replaced by another one */
+static int ring_replaced(const struct ring *r)
+{
+	struct stat st;
+
+	if (stat(r->name, &st) < 0)
+		return 0;
+	return st.st_ino != r->ino || st.st_dev != r->dev;
+}
+
+/* returns the position to start reading from */
+static unsigned long long ring_start(const struct ring *r)
+{
+	unsigned long long head = r->hdr->head;
+	unsigned long long tail = r->hdr->tail;
+
+	if (opt_end || tail > head || head - tail > r->mask + 1ULL)
+		return head;
+	return tail;
+}
+
+/* Reads ring <r> from position <*pos> and writes the lines to stdout until it
+ * is empty. Returns the number of lines read. Positions which were overwritten
+ * before being read are skipped and accounted as losses.
+ */
+static int ring_read(struct ring *r, unsigned long long *pos)
+{
+	static char line[MAX_SYSLOG_LEN];
+	struct log_shm_hdr *hdr = r->hdr;
+	struct log_shm_rec *rec;
+	unsigned long long p, head;
+	unsigned int ofs, len, room, lap;
+	int stuck = 0, done = 0;
+
+	while (1) {
+		p = *pos;
+		ofs = p & r->mask;
+		rec = (struct log_shm_rec *)(r->data + ofs);
+		lap = rec->lap;
+		head = hdr->head;
+
+		if (lap != (unsigned int)(p >> r->shift) + 1) {
+			if (p == head)
+				break; /* empty */
+
+			if ((int)(lap - ((unsigned int)(p >> r->shift) + 1)) > 0 ||
+			    head - p > r->mask + 1ULL) {
+				/* we were overtaken by the producers */
+				losses++;
+				*pos = head;
+				continue;
+			}
+
+			/* the record is reserved but not complete yet */
+			if (stuck >= STUCK_DELAY_MS) {
+				/* the producer probably died, skip */
+				losses++;
+				*pos = head;
+				stuck = 0;
+				continue;
+			}
+			fflush(stdout);
+			msleep(1);
+			stuck++;
+			continue;
+		}
+		stuck = 0;
+
+		__sync_synchronize();
+		len = rec->len;
+		if (len > sizeof(line)) {
+			losses++;
+			*pos = hdr->head;
+			continue;
+		}
+
+		ofs += sizeof(*rec);
+		room = r->mask + 1 - ofs;
+		if (len <= room)
+			memcpy(line, r->data + ofs, len);
+		else {
+			memcpy(line, r->data + ofs, room);
+			memcpy(line + room, r->data, len - room);
+		}
+
+		/* make sure nobody wrote over the record while we were copying it */
+		__sync_synchronize();
+		head = hdr->head;
+		if (head - p > r->mask + 1ULL) {
+			losses++;
+			*pos = head;
+			continue;
+		}
+
+		fwrite(line, 1, len, stdout);
+		lines++;
+		done++;
+		*pos = p + ((sizeof(*rec) + len + 7) & ~7U);
+		if (!opt_peek)
+			hdr->tail = *pos;
+	}
+	return done;
+}
+
+int main(int argc, char **argv)
+{
+	struct ring ring, next;
+	unsigned long long pos;
+	const char *name = NULL;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-' || !argv[i][1]) {
+			if (name)
+				usage(argv[0], 1);
+			name = argv[i];
+		}
+		else {
+			const char *o;
+
+			for (o = argv[i] + 1; *o; o++) {
+				if (*o == 'n')
+					opt_peek = 1;
+				else if (*o == 'e')
+					opt_end = 1;
+				else if (*o == 'x')
+					opt_exit = 1;
+				else if (*o == 'h')
+					usage(argv[0], 0);
+				else
+					usage(argv[0], 1);
+			}
+		}
+	}
+
+	if (!name)
+		usage(argv[0], 1);
+
+	if (ring_open(&ring, name) < 0)
+		exit(1);
+	pos = ring_start(&ring);
+
+	while (1) {
+		if (ring_read(&ring, &pos))
+			continue;
+
+		fflush(stdout);
+		if (opt_exit)
+			break;
+
+		if (ring_replaced(&ring) && ring_open(&next, name) == 0) {
+			/* drain what the old processes may still have written */
+			ring_read(&ring, &pos);
+			munmap(ring.hdr, ring.map_len);
+			ring = next;
+			pos = ring_start(&ring);
+			continue;
+		}
+		msleep(IDLE_DELAY_MS);
+	}
+
+	if (losses)
+		fprintf(stderr, "%llu lines read, %llu losses detected.\n", lines, losses);
+	return 0;
+}
@@ -156,6 +156,69 @@
 #define SRV_CHK_INTER_THRES 1000
 #endif
 
+/* Interval in milliseconds at which the processes which do not run the checks
+ * when "shared-checks" is set pick up the server states published by the
+ * checking process.
+ */
+#ifndef SHARED_CHECK_SYNC_INTER
+#define SHARED_CHECK_SYNC_INTER 100
+#endif
+
+/* Interval in milliseconds at which each process publishes its counters into
+ * the shared area when "stats aggregate" is set.
+ */
+#ifndef STATS_SHARED_SYNC_INTER
+#define STATS_SHARED_SYNC_INTER 1000
+#endif
+
+/* Maximum number of frontends, backends and servers whose counters a process
+ * publishes at once in the shared area, the next ones being published during
+ * the following polling loops.
+ */
+#ifndef STATS_SHARED_SYNC_BATCH
+#define STATS_SHARED_SYNC_BATCH 64
+#endif
+
+/* Maximum time in microseconds the stats dump functions may spend in a single
+ * call before yielding to other tasks, so that dumping large configurations
+ * does not delay the traffic.
+ */
+#ifndef STATS_DUMP_BUDGET
+#define STATS_DUMP_BUDGET 500
+#endif
+
+/* Default number of log lines which may be queued during a polling loop
+ * before being sent at once, see "tune.log.ring".
+ */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 64
+#endif
+
+/* Default size of the data area of the shared memory log rings, see
+ * "log-ring-size". It must be a power of two.
+ */
+#ifndef LOG_SHM_SIZE
+#define LOG_SHM_SIZE 1048576
+#endif
+
+/* Passive latency observation ("observe-latency"). Response times are stored
+ * in SRV_LAT_BUCKETS power-of-two buckets (the last one covers everything
+ * above 2^(SRV_LAT_BUCKETS-2) ms). Servers of a backend are compared every
+ * SRV_LAT_EVAL_INTER milliseconds, after which their histograms are halved.
+ * A server needs at least SRV_LAT_MIN_SAMPLES samples to be compared.
+ */
+#ifndef SRV_LAT_BUCKETS
+#define SRV_LAT_BUCKETS 18
+#endif
+
+#ifndef SRV_LAT_EVAL_INTER
+#define SRV_LAT_EVAL_INTER 5000
+#endif
+
+#ifndef SRV_LAT_MIN_SAMPLES
+#define SRV_LAT_MIN_SAMPLES 20
+#endif
+
 /* Specifies the string used to report the version and release date on the
  * statistics page. May be defined to the empty string ("") to permanently
  * disable the feature.
@@ -201,4 +264,14 @@
 #define SSLCACHESIZE 20000
 #endif
 
+/* bytes sent with small SSL records before they grow, in dynamic record mode */
+#ifndef SSL_RECORD_GROW
+#define SSL_RECORD_GROW 1048576
+#endif
+
+/* idle time (ms) after which SSL records shrink again, in dynamic record mode */
+#ifndef SSL_RECORD_IDLE
+#define SSL_RECORD_IDLE 1000
+#endif
+
 #endif /* _COMMON_DEFAULTS_H */
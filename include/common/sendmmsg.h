@@ -0,0 +1,71 @@
+/*
+ * include/common/sendmmsg.h
+ * Definition of the sendmmsg system call for older Linux libc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef _COMMON_SENDMMSG_H
+#define _COMMON_SENDMMSG_H
+
+#if defined (__linux__) && defined(USE_SENDMMSG)
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <common/syscall.h>
+
+/* On Linux >= 3.0, the sendmmsg() syscall sends several datagrams at once.
+ * It is only exposed by glibc >= 2.14 and with _GNU_SOURCE, so we use our
+ * own definitions. The syscall number is only known on a few architectures,
+ * it is disabled on other ones.
+ */
+#ifndef __NR_sendmmsg
+#if defined(__x86_64__)
+#define __NR_sendmmsg 307
+#elif defined(__i386__)
+#define __NR_sendmmsg 345
+#elif defined(__ARM_EABI__)
+#define __NR_sendmmsg 374
+#endif
+#endif
+
+#ifdef __NR_sendmmsg
+struct my_mmsghdr {
+	struct msghdr msg_hdr;	/* message header */
+	unsigned int msg_len;	/* number of bytes sent, set by the kernel */
+};
+
+static inline int my_sendmmsg(int fd, struct my_mmsghdr *vec, unsigned int vlen, unsigned int flags)
+{
+	return syscall(__NR_sendmmsg, fd, vec, vlen, flags);
+}
+#else
+#undef USE_SENDMMSG
+#endif /* __NR_sendmmsg */
+
+#else
+#undef USE_SENDMMSG
+#endif /* __linux__ && USE_SENDMMSG */
+#endif /* _COMMON_SENDMMSG_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
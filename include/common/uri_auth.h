@@ -13,6 +13,7 @@
 #ifndef _COMMON_URI_AUTH_H
 #define _COMMON_URI_AUTH_H
 
+#include <common/chunk.h>
 #include <common/config.h>
 
 #include <types/auth.h>
@@ -45,6 +46,7 @@ struct uri_auth {
 	struct list http_req_rules;	/* stats http-request rules : allow/deny/auth */
 	struct list admin_rules;	/* 'stats admin' rules (chained) */
 	struct uri_auth *next;		/* Used at deinit() to build a list of unique elements */
+	struct chunk html_head;		/* HTML page header, built on first use */
 };
 
 /* This is the default statistics URI */
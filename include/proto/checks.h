@@ -22,8 +22,11 @@
 #ifndef _PROTO_CHECKS_H
 #define _PROTO_CHECKS_H
 
+#include <types/checks.h>
+#include <types/session.h>
 #include <types/task.h>
 #include <common/config.h>
+#include <common/memory.h>
 
 const char *get_check_status_description(short check_status);
 const char *get_check_status_info(short check_status);
@@ -31,8 +34,11 @@ void set_server_down(struct server *s);
 void set_server_up(struct server *s);
 int start_checks();
 void health_adjust(struct server *s, short status);
+void health_observe_latency(struct session *s);
 
 extern struct data_cb check_conn_cb;
+extern struct check_sched check_sched;
+extern struct pool_head *pool2_check_buf;
 
 #endif /* _PROTO_CHECKS_H */
 
@@ -0,0 +1,101 @@
+/*
+ * include/proto/counters.h
+ * This file contains inline functions for the latency histograms.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _PROTO_COUNTERS_H
+#define _PROTO_COUNTERS_H
+
+#include <common/config.h>
+#include <types/counters.h>
+
+/* Returns the index of the bucket covering <ms> milliseconds. Values below
+ * 4 ms have their own bucket. Above, the two bits following the highest one
+ * select one of the 4 buckets of its power of two.
+ */
+static inline unsigned int lat_histo_bucket(unsigned int ms)
+{
+	unsigned int high, b;
+
+	if (ms < (1U << LAT_HISTO_SUB_BITS))
+		return ms;
+
+	high = 31 - __builtin_clz(ms);  /* >= LAT_HISTO_SUB_BITS */
+	b = ((high - LAT_HISTO_SUB_BITS + 1) << LAT_HISTO_SUB_BITS) +
+	    ((ms >> (high - LAT_HISTO_SUB_BITS)) & ((1U << LAT_HISTO_SUB_BITS) - 1));
+	return b < LAT_HISTO_BUCKETS ? b : LAT_HISTO_BUCKETS - 1;
+}
+
+/* Returns the lowest value in milliseconds covered by bucket <b>. Bucket
+ * LAT_HISTO_BUCKETS may be passed to get the upper bound of the last one.
+ */
+static inline unsigned int lat_histo_low(unsigned int b)
+{
+	unsigned int sub = (1U << LAT_HISTO_SUB_BITS);
+
+	if (b < sub)
+		return b;
+	return (sub + (b & (sub - 1))) << ((b >> LAT_HISTO_SUB_BITS) - 1);
+}
+
+/* Accounts for a sample of <ms> milliseconds in histogram <h>. Negative values
+ * mean that the timer was not reached and are ignored.
+ */
+static inline void lat_histo_add(struct lat_histo *h, int ms)
+{
+	if (ms < 0)
+		return;
+	h->bucket[lat_histo_bucket(ms)]++;
+	h->count++;
+	if ((unsigned int)ms > h->max)
+		h->max = ms;
+}
+
+/* Returns the estimated <pct> percentile of histogram <h> in milliseconds,
+ * linearly interpolated within its bucket. The histogram must not be empty.
+ */
+static inline unsigned int lat_histo_percentile(const struct lat_histo *h, int pct)
+{
+	unsigned long long rank, cum;
+	unsigned int low, high, b;
+
+	rank = (h->count * pct + 99) / 100;
+	if (!rank)
+		rank = 1;
+
+	for (b = 0, cum = 0; b < LAT_HISTO_BUCKETS; cum += h->bucket[b], b++) {
+		if (cum + h->bucket[b] < rank)
+			continue;
+		low = lat_histo_low(b);
+		high = lat_histo_low(b + 1);
+		if (high > h->max + 1)
+			high = h->max + 1;
+		if (high <= low + 1)
+			return low;
+		return low + (unsigned long long)(high - low) * (rank - cum - 1) / h->bucket[b];
+	}
+	return h->max;
+}
+
+#endif /* _PROTO_COUNTERS_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -31,6 +31,10 @@
 #define STAT_HIDE_DOWN  0x00000008	/* hide 'down' servers in the stats page */
 #define STAT_NO_REFRESH 0x00000010	/* do not automatically refresh the stats page */
 #define STAT_ADMIN      0x00000020	/* indicate a stats admin level */
+#define STAT_SHOW_PROC  0x00000040	/* also dump the shared counters of each process */
+#define STAT_FMT_METRICS 0x00000080	/* dump the metrics in Prometheus format */
+#define STAT_FIELDS     0x00000100	/* only dump the CSV fields set in ctx.stats.fields */
+#define STAT_NO_LAT     0x00000200	/* no latency field requested, skip the percentiles */
 #define STAT_BOUND      0x00800000	/* bound statistics to selected proxies/types/services */
 
 #define STATS_TYPE_FE  0
@@ -53,6 +57,9 @@
 #define STAT_CLI_O_CLR  9   /* clear tables */
 #define STAT_CLI_O_SET  10  /* set entries in tables */
 #define STAT_CLI_O_STAT 11  /* dump stats */
+#define STAT_CLI_O_SSL  12  /* dump SSL handshake stats */
+#define STAT_CLI_O_HISTO 13 /* dump latency histograms */
+#define STAT_CLI_O_METRICS 14 /* dump metrics in Prometheus format */
 
 /* HTML form to limit output scope */
 #define STAT_SCOPE_TXT_MAXLEN 20      /* max len for scope substring */
@@ -62,6 +69,8 @@
 extern struct si_applet http_stats_applet;
 
 void stats_io_handler(struct stream_interface *si);
+int stats_shared_init(char **err);
+int stats_parse_fields(struct stream_interface *si, const char *list, int len);
 
 
 #endif /* _PROTO_DUMPSTATS_H */
@@ -39,9 +39,19 @@ extern char *log_format;
 extern char default_tcp_log_format[];
 extern char default_http_log_format[];
 extern char clf_http_log_format[];
+extern struct log_counters log_counters;
 
 
+/* returns the shared memory log ring called <name>, which is created if it
+ * does not exist yet. Returns NULL on memory allocation failure.
+ */
+struct log_shm_ring *log_shm_ring_get(const char *name);
+
+/* creates and maps the files of all the shared memory log rings */
+int log_shm_rings_init(char **err);
+
 int build_logline(struct session *s, char *dst, size_t maxsize, struct list *list_format);
+int build_logbin(struct session *s, char *dst, size_t maxsize, struct list *list_format);
 
 /*
  * send a log for the session when we have enough info about it.
@@ -106,6 +116,11 @@ void send_log(struct proxy *p, int level, const char *format, ...)
 
 void __send_log(struct proxy *p, int level, char *message, size_t size);
 
+/*
+ * Sends the log lines queued since the last call, see "tune.log.ring".
+ */
+void log_flush();
+
 /*
  * returns log level for <lev> or -1 if not found.
  */
@@ -116,6 +131,12 @@ int get_log_level(const char *lev);
  */
 int get_log_facility(const char *fac);
 
+/*
+ * Parses the optional "sample" and "rate-limit" settings of a "log" line.
+ * Returns the number of words before them, or -1 on error.
+ */
+int parse_logsrv_limits(char **args, struct logsrv *logsrv, char **err);
+
 /*
  * Write a string in the log string
  * Take cares of quote options
@@ -42,6 +42,7 @@ int init_session();
 void session_shutdown(struct session *session, int why);
 
 void session_process_counters(struct session *s);
+void session_account_timers(struct session *s);
 void sess_change_server(struct session *sess, struct server *newsrv);
 struct task *process_session(struct task *t);
 void default_srv_error(struct session *s, struct stream_interface *si);
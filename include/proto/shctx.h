@@ -44,5 +44,8 @@ int shared_context_init(int size, int use_shared_memory);
  * Shared context MUST be firstly initialized */
 void shared_context_set_cache(SSL_CTX *ctx);
 
+/* Session lookup callback set by shared_context_set_cache() */
+SSL_SESSION *shctx_get_cb(SSL *ssl, unsigned char *key, int key_len, int *do_copy);
+
 #endif /* SHCTX_H */
 
@@ -26,12 +26,22 @@
 #include <types/connection.h>
 #include <types/listener.h>
 #include <types/proxy.h>
+#include <types/ssl_sock.h>
 #include <types/stream_interface.h>
 
 extern struct xprt_ops ssl_sock;
+extern unsigned int ssl_hs_budget;
+extern unsigned long long ssl_records[SSL_REC_CLASSES];
+extern unsigned int ssl_lazy_ctx_cur;
+extern unsigned long long ssl_lazy_ctx_loads;
+extern unsigned long long ssl_bio_reads;
+extern unsigned long long ssl_bio_recv;
 int ssl_sock_handshake(struct connection *conn, unsigned int flag);
 int ssl_sock_prepare_ctx(struct bind_conf *bind_conf, SSL_CTX *ctx, struct proxy *proxy);
 void ssl_sock_free_certs(struct bind_conf *bind_conf);
+#if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+int ssl_sock_update_ocsp_response(struct chunk *der, char **err);
+#endif
 int ssl_sock_prepare_all_ctx(struct bind_conf *bind_conf, struct proxy *px);
 int ssl_sock_prepare_srv_ctx(struct server *srv, struct proxy *px);
 void ssl_sock_free_all_ctx(struct bind_conf *bind_conf);
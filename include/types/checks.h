@@ -10,6 +10,13 @@
  *
  */
 
+#ifndef _TYPES_CHECKS_H
+#define _TYPES_CHECKS_H
+
+#include <common/mini-clist.h>
+#include <common/regex.h>
+#include <ebtree.h>
+
 /* check status */
 enum {
 	HCHK_STATUS_UNKNOWN	 = 0,	/* Unknown */
@@ -102,3 +109,71 @@ struct analyze_status {
 	char *desc;				/* description */
 	unsigned char lr[HANA_OBS_SIZE];	/* result for l4/l7: 0 = ignore, 1 - error, 2 - OK */
 };
+
+/* tcp-check rule actions */
+enum {
+	TCPCHK_ACT_SEND = 0,		/* send a string or binary data */
+	TCPCHK_ACT_EXPECT,		/* wait for a string, binary data or a regex */
+	TCPCHK_ACT_CONNECT,		/* (re)connect to the server */
+};
+
+/* tcp-check expect methods */
+enum {
+	TCPCHK_EXP_STRING = 0,		/* the response must contain a string */
+	TCPCHK_EXP_BINARY,		/* the response must contain binary data */
+	TCPCHK_EXP_REGEX,		/* the response must match a regex */
+};
+
+/* One step of a "tcp-check" sequence. Rules are compiled at configuration
+ * time : binary data are already decoded and regex already compiled, so that
+ * running a check only involves the check's own buffers.
+ */
+struct tcpcheck_rule {
+	struct list list;		/* list linked to from the proxy */
+	int action;			/* TCPCHK_ACT_* */
+	int index;			/* step number, starting at 1 */
+	int expect;			/* TCPCHK_EXP_* for expect rules */
+	int inverse;			/* non-zero if the expect rule is negated */
+	int port;			/* port for connect rules, 0 = check port */
+	char *string;			/* data to send or expect, or the regex's text */
+	int string_len;			/* length of <string> */
+	regex_t *expect_regex;		/* compiled regex for TCPCHK_EXP_REGEX */
+};
+
+/* Central health check scheduler. Idle servers are queued in <queue> by the
+ * date of their next check, and a single dispatcher task starts the due ones,
+ * possibly limited by "maxchkrate". Check connections and buffers are only
+ * allocated while a check runs.
+ */
+struct check_sched {
+	struct eb_root queue;		/* idle servers sorted by next check date */
+	struct task *task;		/* the dispatcher task */
+	unsigned int running;		/* number of checks currently running */
+	unsigned long long started;	/* number of checks started */
+	unsigned long long reused;	/* number of checks which reused a kept-alive connection */
+	unsigned long long delayed;	/* number of times "maxchkrate" delayed checks */
+	unsigned long long lag_total;	/* cumulated delay between scheduled and actual start (ms) */
+	unsigned int lag_max;		/* highest delay between scheduled and actual start (ms) */
+};
+
+/* An entry of the check scheduler's queue */
+struct check_sched_entry {
+	struct eb32_node node;		/* position in the queue, key=next check date */
+	struct task *task;		/* task to wake up once the date is reached */
+};
+
+/* Server state published by the checking process to the other ones when
+ * "shared-checks" is set. The array of these entries lives in a shared
+ * memory area mapped before the processes are forked. <seq> is odd while
+ * the writer updates the entry, so readers retry or skip until it is even.
+ */
+struct shared_check_state {
+	volatile unsigned int seq;	/* sequence number, odd during updates */
+	unsigned int state;		/* SRV_RUNNING | SRV_GOINGDOWN */
+	unsigned int uweight;		/* user weight set on the checking process */
+	int health;			/* health counter */
+	short status, code;		/* last check result and code */
+	long duration;			/* last check duration in ms */
+};
+
+#endif /* _TYPES_CHECKS_H */
@@ -23,6 +23,32 @@
 #ifndef _TYPES_COUNTERS_H
 #define _TYPES_COUNTERS_H
 
+#include <types/freq_ctr.h>
+
+/* Latency histograms. Times in milliseconds are stored into log-linear buckets,
+ * with 1 << LAT_HISTO_SUB_BITS buckets per power of two, so that a value is at
+ * most 25% above its bucket's lower bound. Values below 4 ms have their own
+ * bucket, and the last bucket collects everything above about 30 minutes. See
+ * proto/counters.h for the functions manipulating them.
+ */
+#define LAT_HISTO_SUB_BITS      2
+#define LAT_HISTO_BUCKETS      80
+
+/* the timers observed at the end of each session, as reported in the logs */
+enum {
+	LAT_TW = 0,                             /* time spent in queues (Tw) */
+	LAT_TC,                                 /* time to connect to the server (Tc) */
+	LAT_TR,                                 /* server response time (Tr) */
+	LAT_TT,                                 /* total session time (Tt) */
+	LAT_TIMERS                              /* number of timers */
+};
+
+struct lat_histo {
+	unsigned long long count;               /* number of samples */
+	unsigned int max;                       /* highest sample, in ms */
+	unsigned long long bucket[LAT_HISTO_BUCKETS];
+};
+
 /* maybe later we might thing about having a different struct for FE and BE */
 struct pxcounters {
 	unsigned int conn_max;                  /* max # of active sessions */
@@ -53,6 +79,8 @@ struct pxcounters {
 	long long retries;                      /* retried and redispatched connections (BE only) */
 	long long redispatches;                 /* retried and redispatched connections (BE only) */
 	long long intercepted_req;              /* number of monitoring or stats requests intercepted by the frontend */
+	long long log_suppressed;               /* session logs not sent due to sampling or rate limits (FE only) */
+	struct lat_histo lat[LAT_TIMERS];       /* latency histograms (LAT_*) */
 
 	union {
 		struct {
@@ -102,6 +130,36 @@ struct srvcounters {
 
 	long long failed_checks, failed_hana;	/* failed health checks and health analyses */
 	long long down_trans;			/* up->down transitions */
+
+	long long ssl_reuse, ssl_full;		/* resumed and full SSL handshakes with the server */
+	struct lat_histo lat[LAT_TIMERS];	/* latency histograms (LAT_*) */
+};
+
+/* Counters of one frontend, backend or server published by each process when
+ * "stats aggregate" is set, so that any process can report the totals. The
+ * records live in a shared memory area mapped before the processes are forked,
+ * one array per process. <seq> is odd while the owner updates the record, so
+ * readers retry until it is even.
+ */
+struct shared_counters {
+	volatile unsigned int seq;		/* sequence number, odd during updates */
+	unsigned int cur;			/* feconn, beconn or cur_sess */
+	unsigned int pend;			/* nbpend (BE and servers only) */
+	struct freq_ctr sess_per_sec;		/* sessions per second */
+	struct freq_ctr conn_per_sec;		/* connections per second (FE only) */
+	struct freq_ctr req_per_sec;		/* HTTP requests per second (FE only) */
+	union {
+		struct pxcounters px;		/* fe_counters or be_counters */
+		struct srvcounters sv;		/* server counters */
+	} c;
+};
+
+/* Header of the shared area above. The clear epochs are incremented by the
+ * process executing "clear counters" so that the other ones do the same.
+ */
+struct shared_counters_hdr {
+	volatile unsigned int clear_epoch;	/* "clear counters" */
+	volatile unsigned int clear_all_epoch;	/* "clear counters all" */
 };
 
 #endif /* _TYPES_COUNTERS_H */
@@ -83,6 +83,8 @@ struct global {
 	struct freq_ctr comp_bps_in;	/* bytes per second, before http compression */
 	struct freq_ctr comp_bps_out;	/* bytes per second, after http compression */
 	int cps_lim, cps_max;
+	struct freq_ctr chk_per_sec;    /* health checks started per second */
+	int chks_lim;                   /* max health checks started per second, 0=unlimited */
 	int comp_rate_lim;           /* HTTP compression rate limit */
 	int maxpipes;		/* max # of pipes */
 	int maxsock;		/* max # of sockets */
@@ -93,12 +95,15 @@ struct global {
 	unsigned int req_count; /* HTTP request counter */
 	int last_checks;
 	int spread_checks;
+	int shared_checks;      /* process running checks for all others, 0=disabled */
 	char *chroot;
 	char *pidfile;
 	char *node, *desc;		/* node name & description */
 	char *log_tag;                  /* name for syslog */
 	struct list logsrvs;
 	char *log_send_hostname;   /* set hostname in syslog header */
+	unsigned int log_shm_size; /* size of the shared memory log rings */
+	int log_shm_flags;         /* LOG_SHM_F_* flags for the shared memory log rings */
 	struct {
 		int maxpollevents; /* max number of poll events at once */
 		int maxaccept;     /* max number of consecutive accept() */
@@ -111,6 +116,7 @@ struct global {
 		int server_sndbuf; /* set server sndbuf to this value if not null */
 		int server_rcvbuf; /* set server rcvbuf to this value if not null */
 		int chksize;       /* check buffer size in bytes, defaults to BUFSIZE */
+		int log_ring;      /* max number of log lines queued per polling loop, <= 1 = disabled */
 		int pipesize;      /* pipe size in bytes, system defaults if zero */
 		int max_http_hdr;  /* max number of HTTP headers, use MAX_HTTP_HDR if zero */
 		int cookie_len;    /* max length of cookie captures */
@@ -118,6 +124,12 @@ struct global {
 		int sslcachesize;  /* SSL cache size in session, defaults to 20000 */
 		unsigned int ssllifetime;   /* SSL session lifetime in seconds */
 		unsigned int ssl_max_record; /* SSL max record size */
+		unsigned int ssl_min_record; /* SSL initial record size in dynamic mode, 0=disabled */
+		unsigned int ssl_rec_grow;   /* bytes sent with small records before growing them */
+		unsigned int ssl_rec_idle;   /* idle time (ms) after which records shrink again */
+		unsigned int ssl_ctx_cache;  /* max number of lazily loaded SSL contexts, 0=load all at boot */
+		unsigned int ssl_readahead;  /* size of the SSL read-ahead buffer, 0=disabled */
+		unsigned int ssl_max_hs;     /* max frontend SSL handshake steps per polling loop, 0=unlimited */
 #endif
 #ifdef USE_ZLIB
 		int zlibmemlevel;    /* zlib memlevel */
@@ -137,6 +149,7 @@ struct global {
 	unsigned long cpu_map[32];  /* list of CPU masks for the 32 first processes */
 #endif
 	struct proxy *stats_fe;     /* the frontend holding the stats settings */
+	int stats_aggregate;        /* "stats aggregate" : report the counters of all processes */
 };
 
 extern struct global global;
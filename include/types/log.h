@@ -27,6 +27,7 @@
 #include <netinet/in.h>
 #include <common/config.h>
 #include <common/mini-clist.h>
+#include <types/freq_ctr.h>
 
 #define MAX_SYSLOG_LEN          1024
 #define NB_LOG_FACILITIES       24
@@ -34,6 +35,61 @@
 #define SYSLOG_PORT             514
 #define UNIQUEID_LEN            128
 
+/* Shared memory log rings ("log ring@<file>"). The file starts with a header
+ * followed by a data area whose size is a power of two. Producers reserve
+ * space by advancing <head>, which counts bytes since the creation of the
+ * ring, so that the offset of a position is (pos & (size - 1)). Each record
+ * starts on an 8-byte boundary with a struct log_shm_rec, followed by the
+ * line itself padded to 8 bytes. The <lap> field is written last, and equals
+ * (pos / size) + 1 for a complete record. The reader reports the position it
+ * has consumed in <tail>. This layout is shared with contrib/logring.
+ */
+#define LOG_SHM_MAGIC           "HALOGRNG"
+#define LOG_SHM_VERSION         1
+#define LOG_SHM_MIN_SIZE        131072
+#define LOG_SHM_MAX_SIZE        (1U << 30)
+
+/* overflow policies for the shared memory rings, stored in <flags> */
+#define LOG_SHM_F_DROP_NEW      0x00000001	/* drop new lines when the ring is full */
+
+struct log_shm_hdr {
+	char magic[8];                  /* LOG_SHM_MAGIC, no trailing zero */
+	unsigned int version;           /* LOG_SHM_VERSION */
+	unsigned int size;              /* size of the data area, power of two */
+	unsigned int flags;             /* LOG_SHM_F_* */
+	unsigned int pid;               /* pid of the process which created the ring */
+	char pad0[40];
+	volatile unsigned long long head; /* next position to be reserved by producers */
+	char pad1[56];
+	volatile unsigned long long tail; /* first position not consumed by the reader */
+	char pad2[56];
+	volatile unsigned long long drops; /* number of lines dropped by producers */
+	char pad3[56];
+};
+
+struct log_shm_rec {
+	unsigned int len;               /* length of the line which follows */
+	volatile unsigned int lap;      /* (pos / size) + 1 once the record is complete */
+};
+
+/* A shared memory log ring as seen by the process */
+struct log_shm_ring {
+	struct list list;               /* chaining of all rings */
+	char *name;                     /* file name */
+	struct log_shm_hdr *hdr;        /* mapped area, NULL until log_shm_rings_init() */
+	char *data;                     /* data area right after the header */
+	unsigned int mask;              /* size of the data area - 1 */
+	unsigned int shift;             /* log2(size) */
+};
+
+/* Counters of the log lines sent to the syslog servers */
+struct log_counters {
+	unsigned long long sent;	/* lines successfully sent */
+	unsigned long long dropped;	/* lines which could not be sent */
+	unsigned long long batches;	/* number of batched send calls */
+	unsigned long long suppressed;	/* session logs not sent due to sampling or rate limits */
+};
+
 
 /* lists of fields that can be logged */
 enum {
@@ -112,12 +168,21 @@ enum {
 };
 
 
+struct session;
+struct lf_state;
+
 struct logformat_node {
 	struct list list;
 	int type;      // LOG_FMT_*
 	int options;   // LOG_OPT_*
 	char *arg;     // text for LOG_FMT_TEXT, arg for others
 	void *expr;    // for use with LOG_FMT_EXPR
+	int len;       // length of <arg> for LOG_FMT_TEXT
+	/* emits the field into <dst> which has <size> bytes left, and returns
+	 * the pointer to the trailing zero, or NULL if there is not enough room.
+	 */
+	char *(*emit)(char *dst, size_t size, struct session *s,
+	              const struct logformat_node *node, struct lf_state *st);
 };
 
 #define LOG_OPT_HEXA		0x00000001
@@ -125,6 +190,31 @@ struct logformat_node {
 #define LOG_OPT_QUOTE		0x00000004
 #define LOG_OPT_REQ_CAP         0x00000008
 #define LOG_OPT_RES_CAP         0x00000010
+#define LOG_OPT_OWN_SPACE       0x00000020	/* emitter manages the separator state itself */
+#define LOG_OPT_END_SPACE       0x00000040	/* text ends with a merged separator */
+#define LOG_OPT_BINARY          0x00000080	/* emit a binary record ("log-format-binary") */
+
+/* Binary log records ("log-format-binary") replace the text after the syslog
+ * header. A record starts with LOG_BIN_MAGIC, LOG_BIN_VERSION and the length
+ * of the fields which follow on 16 bits. Each field starts with its LOG_FMT_*
+ * type on one byte, with LOG_BIN_PLUS set when the text format would prefix
+ * the value with a '+' ('~' after the frontend name for SSL with %ft). Then
+ * depending on the type :
+ *   - integers : 4 bytes (8 for %B and %U), signed ;
+ *   - dates (%t, %T, %Tl, %Ts, %ms) : 4 bytes of seconds and 2 of milliseconds ;
+ *   - addresses : one byte for the family (4, 6, or 0 with no address) then
+ *     4 or 16 bytes ;
+ *   - ports : 2 bytes ;
+ *   - strings : length on 2 bytes (LOG_BIN_NOSTR for none), then the bytes ;
+ *   - header captures : count on 1 byte, followed by as many strings ;
+ *   - termination states : 2 characters for %ts, 4 for %tsc.
+ * Integers are in network byte order. Constant texts are not emitted.
+ */
+#define LOG_BIN_MAGIC           0xB1
+#define LOG_BIN_VERSION         1
+#define LOG_BIN_HDR_LEN         4
+#define LOG_BIN_PLUS            0x80
+#define LOG_BIN_NOSTR           0xFFFF
 
 
 /* Fields that need to be extracted from the incoming connection or request for
@@ -152,6 +242,13 @@ struct logsrv {
 	int facility;
 	int level;
 	int minlvl;
+	struct log_shm_ring *ring;      /* shared memory ring, or NULL for a socket */
+	unsigned int sample_num;        /* send <sample_num> session logs out of <sample_den> */
+	unsigned int sample_den;        /* 0 = no sampling */
+	unsigned int sample_cnt;        /* position in the current sampling period */
+	unsigned int rate_limit;        /* max session logs per second, 0 = unlimited */
+	struct freq_ctr rate;           /* session logs sent per second */
+	int skip;                       /* the current session log must not be sent */
 };
 
 #endif /* _TYPES_LOG_H */
@@ -47,12 +47,14 @@
 #define SRV_RUNNING	0x0001	/* the server is UP */
 #define SRV_BACKUP	0x0002	/* this server is a backup server */
 #define SRV_MAPPORTS	0x0004	/* this server uses mapped ports */
-/* unused: 0x0008 */
+#define SRV_AGENT_CHECKED 0x0008	/* this server runs an agent check */
 #define SRV_CHECKED	0x0010	/* this server needs to be checked */
 #define SRV_GOINGDOWN	0x0020	/* this server says that it's going down (404) */
 #define SRV_WARMINGUP	0x0040	/* this server is warming up after a failure */
 #define SRV_MAINTAIN	0x0080	/* this server is in maintenance mode */
-/* unused: 0x0100, 0x0200, 0x0400 */
+#define SRV_AGENT_DOWN	0x0100	/* the server's agent reported it down */
+#define SRV_AGENT_RUNNING 0x0200	/* an agent check is currently running on this server */
+#define SRV_LAT_SLOW	0x0400	/* the server's latency is far above the backend's median */
 #define SRV_SEND_PROXY	0x0800	/* this server talks the PROXY protocol */
 #define SRV_NON_STICK	0x1000	/* never add connections allocated to this server to a stick table */
 #define SRV_CHK_RUNNING 0x2000  /* a check is currently running on this server */
@@ -121,6 +123,7 @@ struct server {
 	int maxqueue;				/* maximum number of pending connections allowed */
 	struct freq_ctr sess_per_sec;		/* sessions per second on this server */
 	struct srvcounters counters;		/* statistics counters */
+	unsigned int stats_slot;		/* position in the shared counters */
 
 	struct list pendconns;			/* pending connections */
 	struct list actconns;			/* active connections */
@@ -171,13 +174,35 @@ struct server {
 		short port;                     /* the port to use for the health checks */
 		struct buffer *bi, *bo;         /* input and output buffers to send/recv check */
 		struct task *task;              /* the task associated to the health check processing, NULL if disabled */
+		struct check_sched_entry sched; /* position in the check scheduler's queue */
 		struct timeval start;           /* last health check start time */
 		long duration;                  /* time in ms took to finish last health check */
 		short status, code;             /* check result, check code */
 		char desc[HCHK_DESC_LEN];       /* health check descritpion */
 		int use_ssl;                    /* use SSL for health checks */
 		int send_proxy;                 /* send a PROXY protocol header with checks */
+		int keepalive;                  /* the check connection is kept open for next check */
+		struct tcpcheck_rule *current_step; /* tcp-check rule to run, NULL if not started */
+		struct shared_check_state *shared; /* state shared between processes, or NULL */
+		unsigned int shared_seq;        /* last <shared->seq> applied by this process */
 	} check;
+	struct {                                /* agent check specific configuration */
+		struct connection *conn;        /* connection to the agent, only while it runs */
+		struct buffer *bi;              /* agent reply, only while it runs */
+		struct task *task;              /* the task running the agent check, NULL if disabled */
+		struct check_sched_entry sched; /* position in the check scheduler's queue */
+		short port;                     /* the port the agent listens on */
+		short status;                   /* last agent check result (HCHK_STATUS_*) */
+		int inter;                      /* interval between agent checks in ms */
+		char desc[HCHK_DESC_LEN];       /* last agent reply or error */
+	} agent;
+
+	struct {                                /* passive latency observation ("observe-latency") */
+		unsigned int hist[SRV_LAT_BUCKETS]; /* decaying log2 histogram of response times in ms */
+		unsigned int samples;           /* sum of all buckets above */
+		unsigned int p50, p90;          /* percentiles from the last evaluation, in ms */
+		int factor;                     /* slow above <factor> x backend median, 0 = disabled */
+	} lat;
 
 #ifdef USE_OPENSSL
 	int use_ssl;				/* ssl enabled */
@@ -25,11 +25,89 @@
 #include <openssl/ssl.h>
 #include <ebmbtree.h>
 
+#include <common/chunk.h>
+#include <common/mini-clist.h>
+
+struct bind_conf;
+struct proxy;
+
+/* A certificate which is only indexed by its names at startup. Its SSL
+ * context is built upon first use and may be released when too many such
+ * contexts are instantiated (see "tune.ssl.ctxcache"). The files are read at
+ * startup since they may not be reachable anymore once chrooted.
+ */
+struct ssl_lazy_crt {
+	char *path;                  /* PEM file the certificate was read from */
+	struct chunk pem;            /* contents of the PEM file */
+	struct chunk ocsp;           /* contents of "<path>.ocsp", if any */
+	SSL_CTX *ctx;                /* instantiated context, or NULL */
+	struct bind_conf *bind_conf; /* bind line the certificate belongs to */
+	struct proxy *px;            /* proxy the bind line belongs to */
+	struct list lru;             /* position in the LRU list of instantiated contexts */
+};
+
+/* Data read in advance from the socket by the read-ahead BIO, waiting for
+ * OpenSSL to parse it. It is only allocated while it holds some data.
+ */
+struct ssl_sock_rabuf {
+	int len;                  /* number of bytes read from the socket */
+	int ofs;                  /* number of bytes already passed to OpenSSL */
+	char data[0];             /* tune.ssl.readahead bytes */
+};
+
+#define SSL_READAHEAD_MIN  1024  /* min size of the read-ahead buffer */
+
+/* reasons for which incoming SSL handshakes may fail */
+enum {
+	SSL_HS_FAIL_EMPTY = 0,  /* client closed before sending anything */
+	SSL_HS_FAIL_ABORT,      /* client aborted during the handshake */
+	SSL_HS_FAIL_VERIFY,     /* client certificate verification failed */
+	SSL_HS_FAIL_PROTO,      /* SSL protocol error */
+	SSL_HS_FAIL_OTHER,      /* any other error */
+	SSL_HS_FAIL_REASONS     /* number of failure reasons */
+};
+
+/* handshake CPU time is reported in buckets of doubling sizes, the first one
+ * being below SSL_HS_CPU_MIN_US microseconds and the last one unbounded.
+ */
+#define SSL_HS_CPU_MIN_US   250
+#define SSL_HS_CPU_BUCKETS  8
+
+/* incoming SSL handshake statistics of a bind line */
+struct ssl_hs_counters {
+	unsigned long long full;                      /* full handshakes */
+	unsigned long long reuse_cache;               /* handshakes resumed from the session cache */
+	unsigned long long reuse_ticket;              /* handshakes resumed from a TLS ticket */
+	unsigned long long fail[SSL_HS_FAIL_REASONS]; /* failed handshakes per reason */
+	unsigned long long cpu[SSL_HS_CPU_BUCKETS];   /* handshakes per CPU time bucket */
+	unsigned long long cpu_us;                    /* total CPU time spent in handshakes (us) */
+};
+
 struct sni_ctx {
 	SSL_CTX *ctx;             /* context associated to the certificate */
+	struct ssl_lazy_crt *lazy; /* certificate to load upon first use, or NULL */
 	int order;                /* load order for the certificate */
 	int neg;                  /* reject if match */
 	struct ebmb_node name;    /* node holding the servername value */
 };
 
+/* size classes of the records sent over SSL connections */
+enum {
+	SSL_REC_SMALL = 0,        /* records of less than SSL_REC_SMALL_MAX bytes */
+	SSL_REC_MEDIUM,           /* records smaller than a full TLS record */
+	SSL_REC_LARGE,            /* full-sized TLS records */
+	SSL_REC_CLASSES           /* number of size classes */
+};
+
+#define SSL_REC_SMALL_MAX  2048   /* upper limit of the "small" records class */
+#define SSL_REC_FULL       16384  /* payload size of a full-sized TLS record */
+
+/* dynamic record sizing state, attached to SSL connections when
+ * "tune.ssl.minrecord" is set.
+ */
+struct ssl_sock_recsz {
+	unsigned int sent;        /* bytes sent since the last idle period */
+	unsigned int last;        /* date of the last successful write, in ticks */
+};
+
 #endif /* _TYPES_SSL_SOCK_H */
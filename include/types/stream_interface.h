@@ -130,6 +130,9 @@ struct stream_interface {
 				unsigned int flags;	/* STAT_* */
 				int iid, type, sid;	/* proxy id, type and service id if bounding of stats is enabled */
 				int st_code;		/* the status code returned by an action */
+				int proc;		/* process being broken down (STAT_SHOW_PROC), 0=all */
+				unsigned int metric;	/* metric being dumped (show metrics) */
+				unsigned long long fields[2]; /* CSV fields to dump (STAT_FIELDS) */
 			} stats;
 			struct {
 				struct bref bref;	/* back-reference from the session being dumped */
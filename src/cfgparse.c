@@ -325,6 +325,32 @@ int warnifnotcap(struct proxy *proxy, int cap, const char *file, int line, const
 	return 0;
 }
 
+/*
+ * Decodes the hexadecimal string <in> into a newly allocated block of binary
+ * data returned in <out> with its length in <len>. Returns 1 on success, or
+ * 0 if the string is not made of an even number of hex digits or if memory
+ * is lacking.
+ */
+static int cfg_parse_hex(const char *in, char **out, int *len)
+{
+	int i, l = strlen(in);
+
+	if (!l || (l & 1))
+		return 0;
+
+	for (i = 0; i < l; i++)
+		if (!ishex(in[i]))
+			return 0;
+
+	*len = l / 2;
+	if ((*out = malloc(*len)) == NULL)
+		return 0;
+
+	for (i = 0; i < *len; i++)
+		(*out)[i] = (hex2i(in[2 * i]) << 4) + hex2i(in[2 * i + 1]);
+	return 1;
+}
+
 /* Report a warning if a rule is placed after a 'block' rule.
  * Return 1 if the warning has been emitted, otherwise 0.
  */
@@ -561,6 +587,19 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 		}
 		global.tune.chksize = atol(args[1]);
 	}
+	else if (!strcmp(args[0], "tune.log.ring")) {
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.tune.log_ring = atol(args[1]);
+		if (global.tune.log_ring < 0 || global.tune.log_ring > 1024) {
+			Alert("parsing [%s:%d] : '%s' expects a number of lines between 0 and 1024.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	}
 #ifdef USE_OPENSSL
 	else if (!strcmp(args[0], "tune.ssl.cachesize")) {
 		if (*(args[1]) == 0) {
@@ -598,6 +637,76 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 		}
 		global.tune.ssl_max_record = atol(args[1]);
 	}
+	else if (!strcmp(args[0], "tune.ssl.maxhandshakes")) {
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.tune.ssl_max_hs = atol(args[1]);
+	}
+	else if (!strcmp(args[0], "tune.ssl.ctxcache")) {
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.tune.ssl_ctx_cache = atol(args[1]);
+	}
+	else if (!strcmp(args[0], "tune.ssl.readahead")) {
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.tune.ssl_readahead = atol(args[1]);
+		if (global.tune.ssl_readahead && global.tune.ssl_readahead < SSL_READAHEAD_MIN) {
+			Alert("parsing [%s:%d] : '%s' must be 0 or at least %d.\n",
+			      file, linenum, args[0], SSL_READAHEAD_MIN);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	}
+	else if (!strcmp(args[0], "tune.ssl.minrecord")) {
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.tune.ssl_min_record = atol(args[1]);
+	}
+	else if (!strcmp(args[0], "tune.ssl.recordgrow")) {
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.tune.ssl_rec_grow = atol(args[1]);
+	}
+	else if (!strcmp(args[0], "tune.ssl.recordidle")) {
+		unsigned int idle;
+		const char *res;
+
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects a <time> argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+
+		res = parse_time_err(args[1], &idle, TIME_UNIT_MS);
+		if (res) {
+			Alert("parsing [%s:%d]: unexpected character '%c' in argument to <%s>.\n",
+			      file, linenum, *res, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		if (!idle) {
+			Alert("parsing [%s:%d] : '%s' expects a strictly positive time.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.tune.ssl_rec_idle = idle;
+	}
 #endif
 	else if (!strcmp(args[0], "tune.bufsize")) {
 		if (*(args[1]) == 0) {
@@ -873,6 +982,19 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 		}
 		global.cps_lim = atol(args[1]);
 	}
+	else if (!strcmp(args[0], "maxchkrate")) {
+		if (global.chks_lim != 0) {
+			Alert("parsing [%s:%d] : '%s' already specified. Continuing.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT;
+			goto out;
+		}
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		global.chks_lim = atol(args[1]);
+	}
 	else if (!strcmp(args[0], "maxcomprate")) {
 		if (*(args[1]) == 0) {
 			Alert("parsing [%s:%d] : '%s' expects an integer argument in kb/s.\n", file, linenum, args[0]);
@@ -1100,7 +1222,7 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 	}
 	else if (!strcmp(args[0], "log")) {  /* syslog server address */
 		struct sockaddr_storage *sk;
-		int port1, port2;
+		int port1, port2, nbarg;
 		struct logsrv *logsrv;
 
 		if (*(args[1]) == 0 || *(args[2]) == 0) {
@@ -1118,8 +1240,16 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			logsrv->facility = 0;
 		}
 
+		nbarg = parse_logsrv_limits(args + 3, logsrv, &errmsg);
+		if (nbarg < 0) {
+			Alert("parsing [%s:%d] : '%s' : %s.\n", file, linenum, args[0], errmsg);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			free(logsrv);
+			goto out;
+		}
+
 		logsrv->level = 7; /* max syslog level = debug */
-		if (*(args[3])) {
+		if (nbarg > 0) {
 			logsrv->level = get_log_level(args[3]);
 			if (logsrv->level < 0) {
 				Alert("parsing [%s:%d] : unknown optional log level '%s'\n", file, linenum, args[3]);
@@ -1129,7 +1259,7 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 		}
 
 		logsrv->minlvl = 0; /* limit syslog level to this level (emerg) */
-		if (*(args[4])) {
+		if (nbarg > 1) {
 			logsrv->minlvl = get_log_level(args[4]);
 			if (logsrv->minlvl < 0) {
 				Alert("parsing [%s:%d] : unknown optional minimum log level '%s'\n", file, linenum, args[4]);
@@ -1138,6 +1268,24 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			}
 		}
 
+		if (strncmp(args[1], "ring@", 5) == 0) {
+			if (!*(args[1] + 5)) {
+				Alert("parsing [%s:%d] : '%s' : missing file name after 'ring@'.\n", file, linenum, args[0]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				free(logsrv);
+				goto out;
+			}
+			logsrv->ring = log_shm_ring_get(args[1] + 5);
+			if (!logsrv->ring) {
+				Alert("parsing [%s:%d] : out of memory.\n", file, linenum);
+				err_code |= ERR_ALERT | ERR_ABORT;
+				free(logsrv);
+				goto out;
+			}
+			LIST_ADDQ(&global.logsrvs, &logsrv->list);
+			goto out;
+		}
+
 		sk = str2sa_range(args[1], &port1, &port2, &errmsg, NULL);
 		if (!sk) {
 			Alert("parsing [%s:%d] : '%s': %s\n", file, linenum, args[0], errmsg);
@@ -1185,6 +1333,45 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 		global.log_send_hostname = malloc(len + 2);
 		snprintf(global.log_send_hostname, len + 2, "%s ", name);
 	}
+	else if (!strcmp(args[0], "log-ring-size")) { /* size of the shared memory log rings */
+		const char *res;
+		unsigned int size;
+
+		if (*(args[1]) == 0) {
+			Alert("parsing [%s:%d] : '%s' expects a size as argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		res = parse_size_err(args[1], &size);
+		if (res) {
+			Alert("parsing [%s:%d] : unexpected character '%c' in argument of '%s'.\n",
+			      file, linenum, *res, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		if (size < LOG_SHM_MIN_SIZE || size > LOG_SHM_MAX_SIZE) {
+			Alert("parsing [%s:%d] : '%s' expects a size between %u and %u bytes.\n",
+			      file, linenum, args[0], LOG_SHM_MIN_SIZE, LOG_SHM_MAX_SIZE);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		/* round up to the next power of two */
+		global.log_shm_size = LOG_SHM_MIN_SIZE;
+		while (global.log_shm_size < size)
+			global.log_shm_size <<= 1;
+	}
+	else if (!strcmp(args[0], "log-ring-overflow")) { /* what to do when a log ring is full */
+		if (strcmp(args[1], "drop-oldest") == 0)
+			global.log_shm_flags &= ~LOG_SHM_F_DROP_NEW;
+		else if (strcmp(args[1], "drop-new") == 0)
+			global.log_shm_flags |= LOG_SHM_F_DROP_NEW;
+		else {
+			Alert("parsing [%s:%d] : '%s' expects either 'drop-oldest' or 'drop-new' as argument.\n",
+			      file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	}
 	else if (!strcmp(args[0], "log-tag")) {  /* tag to report to syslog */
 		if (*(args[1]) == 0) {
 			Alert("parsing [%s:%d] : '%s' expects a tag for use in syslog.\n", file, linenum, args[0]);
@@ -1211,6 +1398,23 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			err_code |= ERR_ALERT | ERR_FATAL;
 		}
 	}
+	else if (!strcmp(args[0], "shared-checks")) {  /* only one process runs the checks */
+		if (global.shared_checks != 0) {
+			Alert("parsing [%s:%d]: shared-checks already specified. Continuing.\n", file, linenum);
+			err_code |= ERR_ALERT;
+			goto out;
+		}
+		global.shared_checks = 1;
+		if (*(args[1]) != 0) {
+			global.shared_checks = atol(args[1]);
+			if (global.shared_checks < 1 || global.shared_checks > 32) {
+				Alert("parsing [%s:%d]: '%s' expects a process number in range 1..32.\n",
+				      file, linenum, args[0]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+		}
+	}
 	else if (strcmp(args[0], "cpu-map") == 0) {  /* map a process list to a CPU set */
 #ifdef USE_CPU_AFFINITY
 		int cur_arg, i;
@@ -3421,6 +3625,7 @@ stats_error_parsing:
 			    curproxy->conf.logformat_string != clf_http_log_format)
 				free(curproxy->conf.logformat_string);
 			curproxy->conf.logformat_string = logformat;
+			curproxy->options2 &= ~PR_O2_LOGBIN;
 
 			free(curproxy->conf.lfs_file);
 			curproxy->conf.lfs_file = strdup(curproxy->conf.args.file);
@@ -3433,6 +3638,7 @@ stats_error_parsing:
 			    curproxy->conf.logformat_string != clf_http_log_format)
 				free(curproxy->conf.logformat_string);
 			curproxy->conf.logformat_string = default_tcp_log_format;
+			curproxy->options2 &= ~PR_O2_LOGBIN;
 
 			free(curproxy->conf.lfs_file);
 			curproxy->conf.lfs_file = strdup(curproxy->conf.args.file);
@@ -3673,6 +3879,16 @@ stats_error_parsing:
 			memcpy(curproxy->check_req, DEF_LDAP_CHECK_REQ, sizeof(DEF_LDAP_CHECK_REQ) - 1);
 			curproxy->check_len = sizeof(DEF_LDAP_CHECK_REQ) - 1;
 		}
+		else if (!strcmp(args[1], "tcp-check")) {
+			/* use the "tcp-check" rules to check servers' health */
+			if (warnifnotcap(curproxy, PR_CAP_BE, file, linenum, args[1], NULL))
+				err_code |= ERR_WARN;
+
+			free(curproxy->check_req);
+			curproxy->check_req = NULL;
+			curproxy->options2 &= ~PR_O2_CHK_ANY;
+			curproxy->options2 |= PR_O2_TCPCHK_CHK;
+		}
 		else if (!strcmp(args[1], "forwardfor")) {
 			int cur_arg;
 
@@ -3813,6 +4029,10 @@ stats_error_parsing:
 			/* enable emission of the apparent state of a server in HTTP checks */
 			curproxy->options2 |= PR_O2_CHK_SNDST;
 		}
+		else if (strcmp(args[1], "keep-alive") == 0) {
+			/* reuse the same connection for consecutive HTTP checks */
+			curproxy->options2 |= PR_O2_CHK_KA;
+		}
 		else if (strcmp(args[1], "expect") == 0) {
 			const char *ptr_arg;
 			int cur_arg;
@@ -3905,10 +4125,143 @@ stats_error_parsing:
 			}
 		}
 		else {
-			Alert("parsing [%s:%d] : '%s' only supports 'disable-on-404', 'send-state', 'expect'.\n", file, linenum, args[0]);
+			Alert("parsing [%s:%d] : '%s' only supports 'disable-on-404', 'send-state', 'keep-alive', 'expect'.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	}
+	else if (!strcmp(args[0], "tcp-check")) {
+		struct tcpcheck_rule *tcpcheck;
+		const char *ptr_arg;
+		int cur_arg;
+
+		if (curproxy == &defproxy) {
+			Alert("parsing [%s:%d] : '%s' not allowed in 'defaults' section.\n", file, linenum, args[0]);
 			err_code |= ERR_ALERT | ERR_FATAL;
 			goto out;
 		}
+
+		if (warnifnotcap(curproxy, PR_CAP_BE, file, linenum, args[0], NULL))
+			err_code |= ERR_WARN;
+
+		tcpcheck = calloc(1, sizeof(*tcpcheck));
+		if (!tcpcheck) {
+			Alert("parsing [%s:%d] : out of memory.\n", file, linenum);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		if (strcmp(args[1], "connect") == 0) {
+			tcpcheck->action = TCPCHK_ACT_CONNECT;
+
+			cur_arg = 2;
+			while (*args[cur_arg]) {
+				if (strcmp(args[cur_arg], "port") == 0) {
+					tcpcheck->port = atol(args[cur_arg + 1]);
+					if (tcpcheck->port < 1 || tcpcheck->port > 65535) {
+						Alert("parsing [%s:%d] : '%s %s %s' expects a valid port number as an argument.\n",
+						      file, linenum, args[0], args[1], args[cur_arg]);
+						goto tcpcheck_fail;
+					}
+					cur_arg += 2;
+				}
+				else {
+					Alert("parsing [%s:%d] : '%s %s' only supports 'port', found '%s'.\n",
+					      file, linenum, args[0], args[1], args[cur_arg]);
+					goto tcpcheck_fail;
+				}
+			}
+		}
+		else if (strcmp(args[1], "send") == 0) {
+			if (!*(args[2])) {
+				Alert("parsing [%s:%d] : '%s %s' expects <data> as an argument.\n",
+				      file, linenum, args[0], args[1]);
+				goto tcpcheck_fail;
+			}
+			tcpcheck->action = TCPCHK_ACT_SEND;
+			tcpcheck->string_len = strlen(args[2]);
+			tcpcheck->string = strdup(args[2]);
+		}
+		else if (strcmp(args[1], "send-binary") == 0) {
+			tcpcheck->action = TCPCHK_ACT_SEND;
+			if (!cfg_parse_hex(args[2], &tcpcheck->string, &tcpcheck->string_len)) {
+				Alert("parsing [%s:%d] : '%s %s' expects <hexstring> as an argument.\n",
+				      file, linenum, args[0], args[1]);
+				goto tcpcheck_fail;
+			}
+		}
+		else if (strcmp(args[1], "expect") == 0) {
+			tcpcheck->action = TCPCHK_ACT_EXPECT;
+
+			cur_arg = 2;
+			/* consider exclamation marks, sole or at the beginning of a word */
+			while (*(ptr_arg = args[cur_arg])) {
+				while (*ptr_arg == '!') {
+					tcpcheck->inverse = !tcpcheck->inverse;
+					ptr_arg++;
+				}
+				if (*ptr_arg)
+					break;
+				cur_arg++;
+			}
+
+			if (!*(args[cur_arg + 1])) {
+				Alert("parsing [%s:%d] : '%s %s %s' expects <pattern> as an argument.\n",
+				      file, linenum, args[0], args[1], ptr_arg);
+				goto tcpcheck_fail;
+			}
+
+			if (strcmp(ptr_arg, "string") == 0) {
+				tcpcheck->expect = TCPCHK_EXP_STRING;
+				tcpcheck->string_len = strlen(args[cur_arg + 1]);
+				tcpcheck->string = strdup(args[cur_arg + 1]);
+			}
+			else if (strcmp(ptr_arg, "binary") == 0) {
+				tcpcheck->expect = TCPCHK_EXP_BINARY;
+				if (!cfg_parse_hex(args[cur_arg + 1], &tcpcheck->string, &tcpcheck->string_len)) {
+					Alert("parsing [%s:%d] : '%s %s %s' expects <hexstring> as an argument.\n",
+					      file, linenum, args[0], args[1], ptr_arg);
+					goto tcpcheck_fail;
+				}
+			}
+			else if (strcmp(ptr_arg, "rstring") == 0) {
+				tcpcheck->expect = TCPCHK_EXP_REGEX;
+				tcpcheck->string_len = strlen(args[cur_arg + 1]);
+				tcpcheck->string = strdup(args[cur_arg + 1]);
+				tcpcheck->expect_regex = calloc(1, sizeof(regex_t));
+				if (!tcpcheck->expect_regex ||
+				    regcomp(tcpcheck->expect_regex, args[cur_arg + 1], REG_EXTENDED) != 0) {
+					Alert("parsing [%s:%d] : '%s %s %s' : bad regular expression '%s'.\n",
+					      file, linenum, args[0], args[1], ptr_arg, args[cur_arg + 1]);
+					free(tcpcheck->expect_regex);
+					tcpcheck->expect_regex = NULL;
+					goto tcpcheck_fail;
+				}
+			}
+			else {
+				Alert("parsing [%s:%d] : '%s %s' only supports [!] 'string', 'binary', 'rstring', found '%s'.\n",
+				      file, linenum, args[0], args[1], ptr_arg);
+				goto tcpcheck_fail;
+			}
+		}
+		else {
+			Alert("parsing [%s:%d] : '%s' only supports 'connect', 'send', 'send-binary' and 'expect'.\n",
+			      file, linenum, args[0]);
+			goto tcpcheck_fail;
+		}
+
+		if (LIST_ISEMPTY(&curproxy->tcpcheck_rules))
+			tcpcheck->index = 1;
+		else
+			tcpcheck->index = LIST_PREV(&curproxy->tcpcheck_rules, struct tcpcheck_rule *, list)->index + 1;
+		LIST_ADDQ(&curproxy->tcpcheck_rules, &tcpcheck->list);
+		goto out;
+
+	tcpcheck_fail:
+		free(tcpcheck->string);
+		free(tcpcheck);
+		err_code |= ERR_ALERT | ERR_FATAL;
+		goto out;
 	}
 	else if (!strcmp(args[0], "monitor")) {
 		if (curproxy == &defproxy) {
@@ -4077,7 +4430,7 @@ stats_error_parsing:
 	else if (!strcmp(args[0], "server") || !strcmp(args[0], "default-server")) {  /* server address */
 		int cur_arg;
 		short realport = 0;
-		int do_check = 0, defsrv = (*args[0] == 'd');
+		int do_check = 0, do_agent = 0, defsrv = (*args[0] == 'd');
 
 		if (!defsrv && curproxy == &defproxy) {
 			Alert("parsing [%s:%d] : '%s' not allowed in 'defaults' section.\n", file, linenum, args[0]);
@@ -4179,6 +4532,8 @@ stats_error_parsing:
 
 			newsrv->check.use_ssl	= curproxy->defsrv.check.use_ssl;
 			newsrv->check.port	= curproxy->defsrv.check.port;
+			newsrv->agent.port	= curproxy->defsrv.agent.port;
+			newsrv->agent.inter	= curproxy->defsrv.agent.inter;
 			newsrv->inter		= curproxy->defsrv.inter;
 			newsrv->fastinter	= curproxy->defsrv.fastinter;
 			newsrv->downinter	= curproxy->defsrv.downinter;
@@ -4188,6 +4543,7 @@ stats_error_parsing:
 			newsrv->minconn		= curproxy->defsrv.minconn;
 			newsrv->maxconn		= curproxy->defsrv.maxconn;
 			newsrv->slowstart	= curproxy->defsrv.slowstart;
+			newsrv->lat.factor	= curproxy->defsrv.lat.factor;
 			newsrv->onerror		= curproxy->defsrv.onerror;
 			newsrv->consecutive_errors_limit
 						= curproxy->defsrv.consecutive_errors_limit;
@@ -4341,6 +4697,27 @@ stats_error_parsing:
 				newsrv->check.port = atol(args[cur_arg + 1]);
 				cur_arg += 2;
 			}
+			else if (!strcmp(args[cur_arg], "agent-port")) {
+				newsrv->agent.port = atol(args[cur_arg + 1]);
+				cur_arg += 2;
+			}
+			else if (!strcmp(args[cur_arg], "agent-inter")) {
+				const char *err = parse_time_err(args[cur_arg + 1], &val, TIME_UNIT_MS);
+				if (err) {
+					Alert("parsing [%s:%d] : unexpected character '%c' in 'agent-inter' argument of server %s.\n",
+					      file, linenum, *err, newsrv->id);
+					err_code |= ERR_ALERT | ERR_FATAL;
+					goto out;
+				}
+				if (val <= 0) {
+					Alert("parsing [%s:%d]: invalid value %d for argument '%s' of server %s.\n",
+					      file, linenum, val, args[cur_arg], newsrv->id);
+					err_code |= ERR_ALERT | ERR_FATAL;
+					goto out;
+				}
+				newsrv->agent.inter = val;
+				cur_arg += 2;
+			}
 			else if (!defsrv && !strcmp(args[cur_arg], "backup")) {
 				newsrv->state |= SRV_BACKUP;
 				cur_arg ++;
@@ -4411,6 +4788,11 @@ stats_error_parsing:
 				do_check = 1;
 				cur_arg += 1;
 			}
+			else if (!defsrv && !strcmp(args[cur_arg], "agent-check")) {
+				global.maxsock++;
+				do_agent = 1;
+				cur_arg += 1;
+			}
 			else if (!defsrv && !strcmp(args[cur_arg], "disabled")) {
 				newsrv->state |= SRV_MAINTAIN;
 				newsrv->state &= ~SRV_RUNNING;
@@ -4440,6 +4822,22 @@ stats_error_parsing:
 
 				cur_arg += 2;
 			}
+			else if (!strcmp(args[cur_arg], "observe-latency")) {
+				val = atol(args[cur_arg + 1]);
+				if (val < 2 || val > 100) {
+					Alert("parsing [%s:%d]: '%s' expects an integer factor between 2 and 100 (got '%s').\n",
+						file, linenum, args[cur_arg], args[cur_arg + 1]);
+					err_code |= ERR_ALERT | ERR_FATAL;
+					goto out;
+				}
+				if (curproxy->mode != PR_MODE_HTTP) {
+					Alert("parsing [%s:%d]: '%s' can only be used in http proxies.\n",
+						file, linenum, args[cur_arg]);
+					err_code |= ERR_ALERT;
+				}
+				newsrv->lat.factor = val;
+				cur_arg += 2;
+			}
 			else if (!strcmp(args[cur_arg], "on-error")) {
 				if (!strcmp(args[cur_arg + 1], "fastinter"))
 					newsrv->onerror = HANA_ONERR_FASTINTER;
@@ -4803,32 +5201,26 @@ stats_error_parsing:
 				goto out;
 			}
 
-			/* Allocate buffer for check requests... */
-			if ((newsrv->check.bi = calloc(sizeof(struct buffer) + global.tune.chksize, sizeof(char))) == NULL) {
-				Alert("parsing [%s:%d] : out of memory while allocating check buffer.\n", file, linenum);
-				err_code |= ERR_ALERT | ERR_ABORT;
-				goto out;
-			}
-			newsrv->check.bi->size = global.tune.chksize;
+			/* the check connection and buffers are only allocated
+			 * while a check is running.
+			 */
+			newsrv->check.status = HCHK_STATUS_INI;
+			newsrv->state |= SRV_CHECKED;
+		}
 
-			/* Allocate buffer for check responses... */
-			if ((newsrv->check.bo = calloc(sizeof(struct buffer) + global.tune.chksize, sizeof(char))) == NULL) {
-				Alert("parsing [%s:%d] : out of memory while allocating check buffer.\n", file, linenum);
-				err_code |= ERR_ALERT | ERR_ABORT;
+		if (do_agent) {
+			if (!newsrv->agent.port) {
+				Alert("parsing [%s:%d] : server %s has 'agent-check' but no 'agent-port'.\n",
+				      file, linenum, newsrv->id);
+				err_code |= ERR_ALERT | ERR_FATAL;
 				goto out;
 			}
-			newsrv->check.bo->size = global.tune.chksize;
 
-			/* Allocate buffer for partial check results... */
-			if ((newsrv->check.conn = calloc(1, sizeof(struct connection))) == NULL) {
-				Alert("parsing [%s:%d] : out of memory while allocating check connection.\n", file, linenum);
-				err_code |= ERR_ALERT | ERR_ABORT;
-				goto out;
-			}
+			if (!newsrv->agent.inter)
+				newsrv->agent.inter = newsrv->inter;
 
-			newsrv->check.conn->t.sock.fd = -1; /* no check in progress yet */
-			newsrv->check.status = HCHK_STATUS_INI;
-			newsrv->state |= SRV_CHECKED;
+			newsrv->agent.status = HCHK_STATUS_INI;
+			newsrv->state |= SRV_AGENT_CHECKED;
 		}
 
 		if (!defsrv) {
@@ -4870,7 +5262,7 @@ stats_error_parsing:
 		curproxy->header_unique_id = strdup(args[1]);
 	}
 
-	else if (strcmp(args[0], "log-format") == 0) {
+	else if (strcmp(args[0], "log-format") == 0 || strcmp(args[0], "log-format-binary") == 0) {
 		if (!*(args[1])) {
 			Alert("parsing [%s:%d] : %s expects an argument.\n", file, linenum, args[0]);
 			err_code |= ERR_ALERT | ERR_FATAL;
@@ -4887,6 +5279,10 @@ stats_error_parsing:
 		    curproxy->conf.logformat_string != clf_http_log_format)
 			free(curproxy->conf.logformat_string);
 		curproxy->conf.logformat_string = strdup(args[1]);
+		if (strcmp(args[0], "log-format-binary") == 0)
+			curproxy->options2 |= PR_O2_LOGBIN;
+		else
+			curproxy->options2 &= ~PR_O2_LOGBIN;
 
 		free(curproxy->conf.lfs_file);
 		curproxy->conf.lfs_file = strdup(curproxy->conf.args.file);
@@ -4896,8 +5292,8 @@ stats_error_parsing:
 		 * reporting the correct line-number when possible.
 		 */
 		if (curproxy != &defproxy && !(curproxy->cap & PR_CAP_FE)) {
-			Warning("parsing [%s:%d] : backend '%s' : 'log-format' directive is ignored in backends.\n",
-				file, linenum, curproxy->id);
+			Warning("parsing [%s:%d] : backend '%s' : '%s' directive is ignored in backends.\n",
+				file, linenum, curproxy->id, args[0]);
 			err_code |= ERR_WARN;
 		}
 	}
@@ -4919,12 +5315,33 @@ stats_error_parsing:
 	}
 	else if (!strcmp(args[0], "log")) {  /* syslog server address */
 		struct logsrv *logsrv;
+		int nbarg;
+
+		if (*(args[1]) && !strcmp(args[1], "global")) {
+			struct logsrv limits;
+
+			/* "log global" may only be followed by sampling settings
+			 * which then apply to all the copied servers.
+			 */
+			memset(&limits, 0, sizeof(limits));
+			nbarg = parse_logsrv_limits(args + 2, &limits, &errmsg);
+			if (nbarg != 0) {
+				if (nbarg > 0)
+					memprintf(&errmsg, "unexpected '%s' after 'global'", args[2]);
+				Alert("parsing [%s:%d] : '%s' : %s.\n", file, linenum, args[0], errmsg);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
 
-		if (*(args[1]) && *(args[2]) == 0 && !strcmp(args[1], "global")) {
 			/* copy global.logrsvs linked list to the end of curproxy->logsrvs */
 			list_for_each_entry(tmplogsrv, &global.logsrvs, list) {
 				struct logsrv *node = malloc(sizeof(struct logsrv));
 				memcpy(node, tmplogsrv, sizeof(struct logsrv));
+				if (*args[2]) {
+					node->sample_num = limits.sample_num;
+					node->sample_den = limits.sample_den;
+					node->rate_limit = limits.rate_limit;
+				}
 				LIST_INIT(&node->list);
 				LIST_ADDQ(&curproxy->logsrvs, &node->list);
 			}
@@ -4942,9 +5359,16 @@ stats_error_parsing:
 				goto out;
 
 			}
+
+			nbarg = parse_logsrv_limits(args + 3, logsrv, &errmsg);
+			if (nbarg < 0) {
+				Alert("parsing [%s:%d] : '%s' : %s.\n", file, linenum, args[0], errmsg);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
 	    
 			logsrv->level = 7; /* max syslog level = debug */
-			if (*(args[3])) {
+			if (nbarg > 0) {
 				logsrv->level = get_log_level(args[3]);
 				if (logsrv->level < 0) {
 					Alert("parsing [%s:%d] : unknown optional log level '%s'\n", file, linenum, args[3]);
@@ -4955,7 +5379,7 @@ stats_error_parsing:
 			}
 
 			logsrv->minlvl = 0; /* limit syslog level to this level (emerg) */
-			if (*(args[4])) {
+			if (nbarg > 1) {
 				logsrv->minlvl = get_log_level(args[4]);
 				if (logsrv->minlvl < 0) {
 					Alert("parsing [%s:%d] : unknown optional minimum log level '%s'\n", file, linenum, args[4]);
@@ -4965,6 +5389,22 @@ stats_error_parsing:
 				}
 			}
 
+			if (strncmp(args[1], "ring@", 5) == 0) {
+				if (!*(args[1] + 5)) {
+					Alert("parsing [%s:%d] : '%s' : missing file name after 'ring@'.\n", file, linenum, args[0]);
+					err_code |= ERR_ALERT | ERR_FATAL;
+					goto out;
+				}
+				logsrv->ring = log_shm_ring_get(args[1] + 5);
+				if (!logsrv->ring) {
+					Alert("parsing [%s:%d] : out of memory.\n", file, linenum);
+					err_code |= ERR_ALERT | ERR_ABORT;
+					goto out;
+				}
+				LIST_ADDQ(&curproxy->logsrvs, &logsrv->list);
+				goto out;
+			}
+
 			sk = str2sa_range(args[1], &port1, &port2, &errmsg, NULL);
 			if (!sk) {
 				Alert("parsing [%s:%d] : '%s': %s\n", file, linenum, args[0], errmsg);
@@ -6147,6 +6587,26 @@ int check_config_validity()
 		else if (curproxy->options & PR_O_TRANSP)
 			curproxy->options &= ~(PR_O_DISPATCH | PR_O_HTTP_PROXY);
 
+		if ((curproxy->options2 & PR_O2_CHK_ANY) != PR_O2_TCPCHK_CHK) {
+			if (!LIST_ISEMPTY(&curproxy->tcpcheck_rules)) {
+				Warning("config : '%s' rules will be ignored for %s '%s' (requires 'option tcp-check').\n",
+					"tcp-check", proxy_type_str(curproxy), curproxy->id);
+				err_code |= ERR_WARN;
+			}
+		}
+		else {
+			struct tcpcheck_rule *tcpcheck;
+
+			/* every step must fit in the check buffers */
+			list_for_each_entry(tcpcheck, &curproxy->tcpcheck_rules, list) {
+				if (tcpcheck->string_len >= global.tune.chksize) {
+					Alert("config : %s '%s' : 'tcp-check' rule at step %d is larger than 'tune.chksize' (%d bytes).\n",
+					      proxy_type_str(curproxy), curproxy->id, tcpcheck->index, global.tune.chksize);
+					cfgerr++;
+				}
+			}
+		}
+
 		if ((curproxy->options2 & PR_O2_CHK_ANY) != PR_O2_HTTP_CHK) {
 			if (curproxy->options & PR_O_DISABLE404) {
 				Warning("config : '%s' will be ignored for %s '%s' (requires 'option httpchk').\n",
@@ -6160,6 +6620,12 @@ int check_config_validity()
 				err_code |= ERR_WARN;
 				curproxy->options &= ~PR_O2_CHK_SNDST;
 			}
+			if (curproxy->options2 & PR_O2_CHK_KA) {
+				Warning("config : '%s' will be ignored for %s '%s' (requires 'option httpchk').\n",
+					"keep-alive", proxy_type_str(curproxy), curproxy->id);
+				err_code |= ERR_WARN;
+				curproxy->options2 &= ~PR_O2_CHK_KA;
+			}
 		}
 
 		/* if a default backend was specified, let's find it */
@@ -6496,7 +6962,8 @@ out_uri_auth_compat:
 			curproxy->conf.args.ctx = ARGC_LOG;
 			curproxy->conf.args.file = curproxy->conf.lfs_file;
 			curproxy->conf.args.line = curproxy->conf.lfs_line;
-			parse_logformat_string(curproxy->conf.logformat_string, curproxy, &curproxy->logformat, LOG_OPT_MANDATORY,
+			parse_logformat_string(curproxy->conf.logformat_string, curproxy, &curproxy->logformat,
+					       LOG_OPT_MANDATORY | ((curproxy->options2 & PR_O2_LOGBIN) ? LOG_OPT_BINARY : 0),
 					       SMP_VAL_FE_LOG_END);
 			curproxy->conf.args.file = NULL;
 			curproxy->conf.args.line = 0;
@@ -7025,8 +7492,9 @@ out_uri_auth_compat:
 			}
 			if (nbproc > 1) {
 				if (curproxy->uri_auth) {
-					Warning("Proxy '%s': in multi-process mode, stats will be limited to process assigned to the current request.\n",
-						curproxy->id);
+					if (!global.stats_aggregate)
+						Warning("Proxy '%s': in multi-process mode, stats will be limited to process assigned to the current request.\n",
+							curproxy->id);
 					if (!LIST_ISEMPTY(&curproxy->uri_auth->admin_rules)) {
 						Warning("Proxy '%s': stats admin will not work correctly in multi-process mode.\n",
 							curproxy->id);
@@ -20,6 +20,7 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -37,8 +38,10 @@
 
 #include <proto/backend.h>
 #include <proto/checks.h>
+#include <proto/connection.h>
 #include <proto/dumpstats.h>
 #include <proto/fd.h>
+#include <proto/freq_ctr.h>
 #include <proto/log.h>
 #include <proto/queue.h>
 #include <proto/port_range.h>
@@ -52,6 +55,19 @@
 #include <proto/task.h>
 
 static int httpchk_expect(struct server *s, int done);
+static int httpchk_ka_parse(struct server *s);
+static void check_sched_queue(struct check_sched_entry *e, int expire);
+static void check_close_conn(struct connection *conn);
+static void check_drop_conn(struct server *s);
+static int check_conn_alive(struct connection *conn);
+static int check_connect(struct server *s, struct connection *conn, const struct data_cb *cb, int port);
+static struct data_cb tcpcheck_conn_cb;
+
+struct check_sched check_sched = {
+	.queue = EB_ROOT,
+};
+
+struct pool_head *pool2_check_buf = NULL;
 
 static const struct check_status check_statuses[HCHK_STATUS_SIZE] = {
 	[HCHK_STATUS_UNKNOWN]	= { SRV_CHK_UNKNOWN,                   "UNK",     "Unknown" },
@@ -384,6 +400,14 @@ static void shutdown_backup_sessions(struct proxy *px, int why)
 			shutdown_sessions(srv, why);
 }
 
+/* Forgets everything learned about server <s>'s response times. */
+static void srv_lat_reset(struct server *s)
+{
+	memset(s->lat.hist, 0, sizeof(s->lat.hist));
+	s->lat.samples = 0;
+	s->lat.p50 = s->lat.p90 = 0;
+}
+
 /* Sets server <s> down, notifies by all available means, recounts the
  * remaining servers on the proxy and transfers queued sessions whenever
  * possible to other servers. It automatically recomputes the number of
@@ -407,6 +431,15 @@ void set_server_down(struct server *s)
 		if (s->proxy->lbprm.set_server_status_down)
 			s->proxy->lbprm.set_server_status_down(s);
 
+		/* the server will come back with fresh latency statistics */
+		if (s->state & SRV_LAT_SLOW) {
+			s->state &= ~SRV_LAT_SLOW;
+			s->eweight = s->uweight;
+			if (s->proxy->lbprm.algo & BE_LB_PROP_DYN)
+				s->eweight *= BE_WEIGHT_SCALE;
+		}
+		srv_lat_reset(s);
+
 		if (s->onmarkeddown & HANA_ONMARKEDDOWN_SHUTDOWNSESSIONS)
 			shutdown_sessions(s, SN_ERR_DOWN);
 
@@ -462,6 +495,8 @@ void set_server_up(struct server *s) {
 
 	if (s->state & SRV_MAINTAIN) {
 		s->health = s->rise;
+		/* leaving maintenance forgets what the agent reported */
+		s->state &= ~SRV_AGENT_DOWN;
 	}
 
 	if (s->health == s->rise || s->track) {
@@ -693,9 +728,150 @@ void health_adjust(struct server *s, short status)
 
 	if (s->fastinter) {
 		expire = tick_add(now_ms, MS_TO_TICKS(s->fastinter));
-		if (s->check.task->expire > expire)
-			s->check.task->expire = expire;
+		if (s->check.sched.node.node.leaf_p && tick_is_lt(expire, s->check.sched.node.key))
+			check_sched_queue(&s->check.sched, expire);
+	}
+}
+
+/* Returns an estimate of the <pct> percentile of server <s>'s response times
+ * in milliseconds. Values are linearly interpolated within a bucket. The
+ * server must have at least one sample.
+ */
+static unsigned int srv_lat_percentile(const struct server *s, int pct)
+{
+	unsigned int rank, cum, low;
+	int b;
+
+	rank = ((unsigned long long)s->lat.samples * pct + 99) / 100;
+	if (!rank)
+		rank = 1;
+
+	for (b = cum = 0; b < SRV_LAT_BUCKETS; cum += s->lat.hist[b], b++) {
+		if (cum + s->lat.hist[b] < rank)
+			continue;
+		if (!b)
+			return 0;
+		/* bucket <b> covers [2^(b-1) .. 2^b - 1] */
+		low = 1U << (b - 1);
+		return low + (unsigned long long)low * (rank - cum - 1) / s->lat.hist[b];
 	}
+	return 1U << (SRV_LAT_BUCKETS - 2);
+}
+
+/* Compares the median response times of backend <px>'s observed servers. The
+ * servers whose median exceeds their "observe-latency" factor times the median
+ * of all of them get their effective weight divided by this factor. They get
+ * their full weight back (using the slowstart ramp if any) once their median
+ * falls below 3/4 of this limit. The histograms are halved afterwards so that
+ * older samples progressively fade away.
+ */
+static void srv_lat_evaluate(struct proxy *px)
+{
+	struct server *s, *o;
+	unsigned int median = 0, limit;
+	int nbsrv = 0, below, b;
+
+	/* compute the percentiles of all eligible servers and count them */
+	for (s = px->srv; s; s = s->next) {
+		if (!s->lat.factor || s->lat.samples < SRV_LAT_MIN_SAMPLES ||
+		    (s->state & (SRV_RUNNING|SRV_MAINTAIN)) != SRV_RUNNING)
+			continue;
+		s->lat.p50 = srv_lat_percentile(s, 50);
+		s->lat.p90 = srv_lat_percentile(s, 90);
+		nbsrv++;
+	}
+
+	/* the backend's median is the lowest server median which is greater
+	 * than or equal to at least half of the eligible servers' medians.
+	 */
+	for (s = px->srv; nbsrv >= 2 && s; s = s->next) {
+		if (!s->lat.factor || s->lat.samples < SRV_LAT_MIN_SAMPLES ||
+		    (s->state & (SRV_RUNNING|SRV_MAINTAIN)) != SRV_RUNNING)
+			continue;
+		below = 0;
+		for (o = px->srv; o; o = o->next) {
+			if (!o->lat.factor || o->lat.samples < SRV_LAT_MIN_SAMPLES ||
+			    (o->state & (SRV_RUNNING|SRV_MAINTAIN)) != SRV_RUNNING)
+				continue;
+			if (o->lat.p50 <= s->lat.p50)
+				below++;
+		}
+		if (below >= (nbsrv + 1) / 2 && (!median || s->lat.p50 < median))
+			median = s->lat.p50;
+	}
+
+	for (s = px->srv; s; s = s->next) {
+		if (!s->lat.factor)
+			continue;
+
+		if (nbsrv >= 2 && s->lat.samples >= SRV_LAT_MIN_SAMPLES &&
+		    (s->state & (SRV_RUNNING|SRV_MAINTAIN)) == SRV_RUNNING) {
+			limit = s->lat.factor * MAX(median, 1);
+
+			if (!(s->state & SRV_LAT_SLOW) && s->lat.p50 > limit) {
+				/* the warmup must not override the penalty */
+				s->state |= SRV_LAT_SLOW;
+				s->state &= ~SRV_WARMINGUP;
+				server_recalc_eweight(s);
+
+				chunk_printf(&trash,
+				             "Server %s/%s is slow (median %ums, p90 %ums, backend median %ums), weight reduced",
+				             px->id, s->id, s->lat.p50, s->lat.p90, median);
+				Warning("%s.\n", trash.str);
+				send_log(px, LOG_NOTICE, "%s.\n", trash.str);
+			}
+			else if ((s->state & SRV_LAT_SLOW) && s->lat.p50 <= limit * 3 / 4) {
+				s->state &= ~SRV_LAT_SLOW;
+				if (s->slowstart > 0 && s->warmup) {
+					s->state |= SRV_WARMINGUP;
+					s->last_change = now.tv_sec;
+					task_schedule(s->warmup, tick_add(now_ms, MS_TO_TICKS(MAX(1000, s->slowstart / 20))));
+				}
+				server_recalc_eweight(s);
+
+				chunk_printf(&trash,
+				             "Server %s/%s is no longer slow (median %ums, p90 %ums, backend median %ums), weight restored",
+				             px->id, s->id, s->lat.p50, s->lat.p90, median);
+				Warning("%s.\n", trash.str);
+				send_log(px, LOG_NOTICE, "%s.\n", trash.str);
+			}
+		}
+
+		/* age the samples */
+		s->lat.samples = 0;
+		for (b = 0; b < SRV_LAT_BUCKETS; b++) {
+			s->lat.hist[b] /= 2;
+			s->lat.samples += s->lat.hist[b];
+		}
+	}
+
+	px->lat_next = tick_add(now_ms, MS_TO_TICKS(SRV_LAT_EVAL_INTER));
+}
+
+/* Accounts for the response time of session <s>'s server at the end of a
+ * transaction if this server observes latencies. The response time is the
+ * time between the connection establishment and the beginning of the
+ * response, as reported by "Tr" in the logs. The backend's servers are
+ * compared once in a while from there.
+ */
+void health_observe_latency(struct session *s)
+{
+	struct server *srv = objt_server(s->target);
+	unsigned int ms;
+	int b;
+
+	if (!srv || !srv->lat.factor || s->logs.t_data < 0 || s->logs.t_connect < 0)
+		return;
+
+	ms = s->logs.t_data - s->logs.t_connect;
+	for (b = 0; ms && b < SRV_LAT_BUCKETS - 1; b++)
+		ms >>= 1;
+
+	srv->lat.hist[b]++;
+	srv->lat.samples++;
+
+	if (!tick_isset(s->be->lat_next) || tick_is_expired(s->be->lat_next, now_ms))
+		srv_lat_evaluate(s->be);
 }
 
 static int httpchk_build_status_header(struct server *s, char *buffer)
@@ -836,6 +1012,7 @@ static void event_srv_chk_r(struct connection *conn)
 	struct task *t = s->check.task;
 	char *desc;
 	int done;
+	int ka = 0;
 	unsigned short msglen;
 
 	if (unlikely((s->result & SRV_CHK_FAILED) || (conn->flags & CO_FL_ERROR))) {
@@ -904,9 +1081,18 @@ static void event_srv_chk_r(struct connection *conn)
 			goto out_wakeup;
 		}
 
+		/* with keep-alive, we need the whole response before deciding */
+		if (s->proxy->options2 & PR_O2_CHK_KA) {
+			ka = httpchk_ka_parse(s);
+			if (!ka && !done)
+				goto wait_more_data;
+			if (ka > 0)
+				done = 1;
+		}
+
 		s->check.code = str2uic(s->check.bi->data + 9);
 		desc = ltrim(s->check.bi->data + 12, ' ');
-		
+
 		if ((s->proxy->options & PR_O_DISABLE404) &&
 			 (s->state & SRV_RUNNING) && (s->check.code == 404)) {
 			/* 404 may be accepted as "stopping" only if the server was up */
@@ -927,6 +1113,10 @@ static void event_srv_chk_r(struct connection *conn)
 			cut_crlf(desc);
 			set_server_check_status(s, HCHK_STATUS_L7STS, desc);
 		}
+
+		/* the response was complete, the connection may be reused */
+		if (ka > 0)
+			s->check.keepalive = 1;
 		break;
 
 	case PR_O2_SSL3_CHK:
@@ -1195,13 +1385,20 @@ static void event_srv_chk_r(struct connection *conn)
 	} /* switch */
 
  out_wakeup:
-	if (s->result & SRV_CHK_FAILED)
-		conn->flags |= CO_FL_ERROR;
-
 	/* Reset the check buffer... */
 	*s->check.bi->data = '\0';
 	s->check.bi->i = 0;
 
+	if (s->check.keepalive) {
+		/* leave the connection open for the next check */
+		__conn_data_stop_both(conn);
+		task_wakeup(t, TASK_WOKEN_IO);
+		return;
+	}
+
+	if (s->result & SRV_CHK_FAILED)
+		conn->flags |= CO_FL_ERROR;
+
 	/* Close the connection... We absolutely want to perform a hard close
 	 * and reset the connection if some data are pending, otherwise we end
 	 * up with many TIME_WAITs and eat all the source port range quickly.
@@ -1237,11 +1434,12 @@ static int wake_srv_chk(struct connection *conn)
 		/* Note that we might as well have been woken up by a handshake handler */
 		if (s->result == SRV_CHK_UNKNOWN)
 			s->result |= SRV_CHK_FAILED;
+		s->check.keepalive = 0;
 		__conn_data_stop_both(conn);
 		task_wakeup(s->check.task, TASK_WOKEN_IO);
 	}
 
-	if (s->result & (SRV_CHK_FAILED|SRV_CHK_PASSED))
+	if ((s->result & (SRV_CHK_FAILED|SRV_CHK_PASSED)) && !s->check.keepalive)
 		conn_full_close(conn);
 	return 0;
 }
@@ -1252,6 +1450,231 @@ struct data_cb check_conn_cb = {
 	.wake = wake_srv_chk,
 };
 
+/* Looks for the <len> bytes at <pattern> in the <size> bytes starting at
+ * <data>. Returns the number of bytes up to the end of the first occurrence,
+ * or zero if it is not found.
+ */
+static int tcpcheck_find(const char *data, int size, const char *pattern, int len)
+{
+	const char *end = data + size - len;
+	const char *p;
+
+	for (p = data; p <= end; p++) {
+		p = memchr(p, *pattern, end - p + 1);
+		if (!p)
+			break;
+		if (memcmp(p, pattern, len) == 0)
+			return p - data + len;
+	}
+	return 0;
+}
+
+/*
+ * I/O callback for "tcp-check" connections. It runs the server's proxy rules
+ * from the current step until one of them needs to wait for I/O, in which
+ * case the step is recorded, or until the sequence fails or completes, in
+ * which case the check status is set and the check task woken up. Data to
+ * send are merged in the check's output buffer and flushed before each expect
+ * or connect rule. Expect rules consume the data up to the end of what they
+ * matched, the remaining data are left to the next ones. No memory is
+ * allocated here, the rules were compiled at configuration time.
+ */
+static void tcpcheck_main(struct connection *conn)
+{
+	struct server *s = conn->owner;
+	struct task *t = s->check.task;
+	struct list *head = &s->proxy->tcpcheck_rules;
+	struct tcpcheck_rule *rule;
+	regmatch_t pmatch;
+	int done, match, used, port, ret;
+
+	if (unlikely((s->result & SRV_CHK_FAILED) || (conn->flags & CO_FL_ERROR))) {
+		if (!(s->result & SRV_CHK_FAILED)) {
+			int skerr, err = errno;
+			socklen_t lskerr = sizeof(skerr);
+
+			if (!(conn->flags & CO_FL_WAIT_L4_CONN))
+				set_server_check_status(s, HCHK_STATUS_SOCKERR, NULL);
+			else {
+				if (!getsockopt(conn->t.sock.fd, SOL_SOCKET, SO_ERROR, &skerr, &lskerr) && skerr)
+					err = skerr;
+				set_server_check_status(s, HCHK_STATUS_L4CON, strerror(err));
+			}
+		}
+		goto out_end_tcpcheck;
+	}
+
+	if (conn->flags & CO_FL_HANDSHAKE)
+		return;
+
+	rule = s->check.current_step;
+	if (!rule) {
+		/* first call : the connection was initiated by process_chk(),
+		 * which already handled an initial "connect" rule.
+		 */
+		rule = LIST_NEXT(head, struct tcpcheck_rule *, list);
+		if (&rule->list != head && rule->action == TCPCHK_ACT_CONNECT)
+			rule = LIST_NEXT(&rule->list, struct tcpcheck_rule *, list);
+
+		/* we allow up to <timeout.check> if nonzero for the whole sequence */
+		if (s->proxy->timeout.check) {
+			t->expire = tick_add_ifset(now_ms, s->proxy->timeout.check);
+			task_queue(t);
+		}
+	}
+
+	while (1) {
+		/* flush pending data before waiting for anything or reaching
+		 * the end, and when the next data do not fit anymore.
+		 */
+		if (s->check.bo->o &&
+		    (&rule->list == head || rule->action != TCPCHK_ACT_SEND ||
+		     rule->string_len > buffer_total_space(s->check.bo))) {
+			conn->xprt->snd_buf(conn, s->check.bo, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (conn->flags & CO_FL_ERROR) {
+				set_server_check_status(s, HCHK_STATUS_L4CON, strerror(errno));
+				goto out_end_tcpcheck;
+			}
+			if (s->check.bo->o) {
+				__conn_data_want_send(conn);
+				goto out_wait;
+			}
+		}
+
+		if (&rule->list == head)
+			break;
+
+		if (rule->action == TCPCHK_ACT_SEND) {
+			bo_putblk(s->check.bo, rule->string, rule->string_len);
+		}
+		else if (rule->action == TCPCHK_ACT_CONNECT) {
+			/* close the current connection and open a new one */
+			check_close_conn(conn);
+			s->check.bi->i = 0;
+			port = rule->port ? rule->port : s->check.port;
+			rule = LIST_NEXT(&rule->list, struct tcpcheck_rule *, list);
+			s->check.current_step = rule;
+
+			ret = check_connect(s, conn, &tcpcheck_conn_cb, port);
+			if (ret == SN_ERR_NONE) {
+				conn_data_poll_recv(conn);
+				return;
+			}
+
+			/* no fd was allocated, nothing to close */
+			conn->xprt = NULL;
+			if (ret == SN_ERR_SRVTO || ret == SN_ERR_SRVCL)
+				set_server_check_status(s, HCHK_STATUS_L4CON, strerror(errno));
+			else
+				set_server_check_status(s, HCHK_STATUS_SOCKERR, NULL);
+			task_wakeup(t, TASK_WOKEN_IO);
+			return;
+		}
+		else { /* TCPCHK_ACT_EXPECT */
+			done = 0;
+			if (!(conn->flags & (CO_FL_SOCK_RD_SH | CO_FL_DATA_RD_SH)) &&
+			    s->check.bi->i < s->check.bi->size)
+				conn->xprt->rcv_buf(conn, s->check.bi, s->check.bi->size);
+
+			if (conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_DATA_RD_SH)) {
+				done = 1;
+				if ((conn->flags & CO_FL_ERROR) && !s->check.bi->i) {
+					/* only report network errors if we got nothing */
+					if (conn->flags & CO_FL_WAIT_L4_CONN)
+						set_server_check_status(s, HCHK_STATUS_L4CON, strerror(errno));
+					else
+						set_server_check_status(s, HCHK_STATUS_SOCKERR, NULL);
+					goto out_end_tcpcheck;
+				}
+			}
+
+			if (s->check.bi->i < s->check.bi->size)
+				s->check.bi->data[s->check.bi->i] = '\0';
+			else {
+				s->check.bi->data[s->check.bi->i - 1] = '\0';
+				done = 1; /* buffer full, don't wait for more data */
+			}
+
+			if (!s->check.bi->i && !done) {
+				__conn_data_stop_send(conn);
+				__conn_data_poll_recv(conn);
+				goto out_wait;
+			}
+
+			if (rule->expect == TCPCHK_EXP_REGEX) {
+				match = regexec(rule->expect_regex, s->check.bi->data, 1, &pmatch, 0) == 0;
+				used = match ? pmatch.rm_eo : 0;
+			}
+			else {
+				used = tcpcheck_find(s->check.bi->data, s->check.bi->i,
+				                     rule->string, rule->string_len);
+				match = used > 0;
+			}
+
+			if (!match && !done && !rule->inverse) {
+				/* the pattern may still come */
+				__conn_data_stop_send(conn);
+				__conn_data_poll_recv(conn);
+				goto out_wait;
+			}
+
+			if (match == rule->inverse) {
+				if (match)
+					chunk_printf(&trash, "TCPCHK matched unwanted content at step %d", rule->index);
+				else if (rule->expect == TCPCHK_EXP_BINARY)
+					chunk_printf(&trash, "TCPCHK did not match binary content at step %d", rule->index);
+				else
+					chunk_printf(&trash, "TCPCHK did not match content '%s' at step %d",
+					             rule->string, rule->index);
+				set_server_check_status(s, HCHK_STATUS_L7RSP, trash.str);
+				goto out_end_tcpcheck;
+			}
+
+			/* the next expect rule will only look at what follows the
+			 * match, which may already have been received.
+			 */
+			if (used) {
+				s->check.bi->i -= used;
+				memmove(s->check.bi->data, s->check.bi->data + used, s->check.bi->i);
+			}
+		}
+
+		rule = LIST_NEXT(&rule->list, struct tcpcheck_rule *, list);
+	}
+
+	/* all rules passed */
+	set_server_check_status(s, HCHK_STATUS_L7OKD, "(tcp-check)");
+
+ out_end_tcpcheck:
+	*s->check.bi->data = '\0';
+	s->check.bi->i = 0;
+
+	if (s->result & SRV_CHK_FAILED)
+		conn->flags |= CO_FL_ERROR;
+
+	/* hard close as in event_srv_chk_r() */
+	if (conn->xprt && conn->xprt->shutw)
+		conn->xprt->shutw(conn, 0);
+	if (conn->ctrl) {
+		if (!(conn->flags & CO_FL_WAIT_RD))
+			recv(conn->t.sock.fd, trash.str, trash.size, MSG_NOSIGNAL|MSG_DONTWAIT);
+		setsockopt(conn->t.sock.fd, SOL_SOCKET, SO_LINGER,
+			   (struct linger *) &nolinger, sizeof(struct linger));
+	}
+	__conn_data_stop_both(conn);
+	task_wakeup(t, TASK_WOKEN_IO);
+	return;
+
+ out_wait:
+	s->check.current_step = rule;
+}
+
+static struct data_cb tcpcheck_conn_cb = {
+	.recv = tcpcheck_main,
+	.send = tcpcheck_main,
+	.wake = wake_srv_chk,
+};
+
 /*
  * updates the server's weight during a warmup stage. Once the final weight is
  * reached, the task automatically stops. Note that any server status change
@@ -1295,6 +1718,331 @@ static struct task *server_warmup(struct task *t)
 	return t;
 }
 
+/* Array of shared server states when "shared-checks" is enabled */
+static struct shared_check_state *shared_checks_area = NULL;
+
+/* Returns non-zero if checks are run by another process which publishes the
+ * server states, in which case the current process must not run them.
+ */
+static inline int check_is_follower(struct server *s)
+{
+	return s->check.shared && global.nbproc > 1 && relative_pid != global.shared_checks;
+}
+
+/* Publishes the state of server <s> to the other processes. Only the checking
+ * process calls this. Nothing is written if nothing relevant changed, so that
+ * other processes do not needlessly reapply the same state. A server in
+ * maintenance is not published since maintenance is local to each process.
+ */
+static void check_publish_state(struct server *s)
+{
+	struct shared_check_state *sh = s->check.shared;
+	unsigned int state = s->state & (SRV_RUNNING | SRV_GOINGDOWN);
+
+	if (s->state & SRV_MAINTAIN)
+		return;
+
+	if (sh->state == state && sh->uweight == s->uweight && sh->health == s->health &&
+	    sh->status == s->check.status && sh->code == s->check.code)
+		return;
+
+	sh->seq++;
+	__sync_synchronize();
+	sh->state    = state;
+	sh->uweight  = s->uweight;
+	sh->health   = s->health;
+	sh->status   = s->check.status;
+	sh->code     = s->check.code;
+	sh->duration = s->check.duration;
+	__sync_synchronize();
+	sh->seq++;
+}
+
+/* Applies to server <s> the state published by the checking process. The
+ * up/down and enabled/disabled states are enforced on each call so that a
+ * local transition (eg: "observe layer7") cannot diverge forever, while the
+ * weight is only applied when a new state was published, so that a weight
+ * changed locally on the CLI remains until the next published change.
+ */
+static void check_apply_shared_state(struct server *s)
+{
+	struct shared_check_state *sh = s->check.shared;
+	struct shared_check_state copy;
+	unsigned int seq;
+
+	seq = sh->seq;
+	if (seq & 1)
+		return; /* being written, try again next time */
+	__sync_synchronize();
+	copy = *sh;
+	__sync_synchronize();
+	if (sh->seq != seq)
+		return;
+
+	if (!seq || (s->state & SRV_MAINTAIN))
+		return; /* nothing published yet or local maintenance */
+
+	if ((copy.state & SRV_RUNNING) && !(s->state & SRV_RUNNING)) {
+		s->health = s->rise;
+		set_server_up(s);
+	}
+	else if (!(copy.state & SRV_RUNNING) && (s->state & SRV_RUNNING)) {
+		s->health = s->rise;
+		set_server_down(s);
+	}
+
+	if (s->state & SRV_RUNNING) {
+		if ((copy.state & SRV_GOINGDOWN) && !(s->state & SRV_GOINGDOWN))
+			set_server_disabled(s);
+		else if (!(copy.state & SRV_GOINGDOWN) && (s->state & SRV_GOINGDOWN))
+			set_server_enabled(s);
+	}
+
+	if (seq == s->check.shared_seq)
+		return;
+
+	s->check.shared_seq = seq;
+	s->health = copy.health;
+	s->check.status = copy.status;
+	s->check.code = copy.code;
+	s->check.duration = copy.duration;
+	if (copy.uweight != s->uweight) {
+		s->uweight = copy.uweight;
+		server_recalc_eweight(s);
+	}
+}
+
+/*
+ * Periodically applies the server states published by the checking process
+ * when "shared-checks" is enabled. It stops itself in the checking process.
+ */
+static struct task *process_shared_checks(struct task *t)
+{
+	struct proxy *px;
+	struct server *s;
+
+	if (global.nbproc <= 1 || relative_pid == global.shared_checks) {
+		t->expire = TICK_ETERNITY;
+		return t;
+	}
+
+	for (px = proxy; px; px = px->next)
+		for (s = px->srv; s; s = s->next)
+			if (s->check.shared)
+				check_apply_shared_state(s);
+
+	t->expire = tick_add(now_ms, MS_TO_TICKS(SHARED_CHECK_SYNC_INTER));
+	return t;
+}
+
+/* Queues scheduler entry <e> into the check scheduler so that its task is
+ * woken up at date <expire>, and makes sure the dispatcher wakes up in time.
+ */
+static void check_sched_queue(struct check_sched_entry *e, int expire)
+{
+	eb32_delete(&e->node);
+	e->node.key = expire;
+	eb32_insert(&check_sched.queue, &e->node);
+	if (check_sched.task)
+		task_schedule(check_sched.task, expire);
+}
+
+/* Computes the date of the next check for server <s> which just finished
+ * its check or skipped it, and queues it into the scheduler. The date is
+ * derived from the previously scheduled one and not from the current date,
+ * so that checks do not drift by their duration and remain evenly spaced.
+ */
+static void check_sched_next(struct server *s)
+{
+	int inter = srv_getinter(s);
+	int rv = 0;
+	int expire;
+
+	if (global.spread_checks > 0) {
+		rv = inter * global.spread_checks / 100;
+		rv -= (int) (2 * rv * (rand() / (RAND_MAX + 1.0)));
+	}
+
+	expire = tick_add(s->check.sched.node.key, MS_TO_TICKS(inter + rv));
+	while (tick_is_expired(expire, now_ms))
+		expire = tick_add(expire, MS_TO_TICKS(inter));
+	check_sched_queue(&s->check.sched, expire);
+}
+
+/* Allocates the connection and buffers needed by server <s> to run a check.
+ * Returns non-zero on success, or zero if memory is lacking.
+ */
+static int check_alloc(struct server *s)
+{
+	if (!s->check.conn && (s->check.conn = pool_alloc2(pool2_connection)) == NULL)
+		return 0;
+
+	if (!s->check.bi && (s->check.bi = pool_alloc2(pool2_check_buf)) == NULL)
+		return 0;
+	s->check.bi->size = global.tune.chksize;
+
+	if (!s->check.bo && (s->check.bo = pool_alloc2(pool2_check_buf)) == NULL)
+		return 0;
+	s->check.bo->size = global.tune.chksize;
+
+	check_sched.running++;
+	return 1;
+}
+
+/* Releases the connection and buffers of server <s> once its check is over.
+ * The connection must already be closed.
+ */
+static void check_release(struct server *s)
+{
+	struct connection *conn = s->check.conn;
+	struct buffer *bi = s->check.bi;
+	struct buffer *bo = s->check.bo;
+
+	if (!s->check.keepalive) {
+		pool_free2(pool2_connection, conn);
+		s->check.conn = NULL;
+	}
+	pool_free2(pool2_check_buf, bi);
+	pool_free2(pool2_check_buf, bo);
+	s->check.bi = s->check.bo = NULL;
+	check_sched.running--;
+}
+
+/* Prepares check connection <conn> of server <s> with data callbacks <cb>
+ * and connects it to the server's check address on port <port>. It returns
+ * one of :
+ *  - SN_ERR_NONE if everything's OK
+ *  - SN_ERR_SRVTO if there are no more servers
+ *  - SN_ERR_SRVCL if the connection was refused by the server
+ *  - SN_ERR_PRXCOND if the connection has been limited by the proxy (maxconn)
+ *  - SN_ERR_RESOURCE if a system resource is lacking (eg: fd limits, ports, ...)
+ *  - SN_ERR_INTERNAL for any other purely internal errors
+ * Additionnally, in the case of SN_ERR_RESOURCE, an emergency log will be emitted.
+ * Note that we try to prevent the network stack from sending the ACK during the
+ * connect() when a pure TCP check is used (without PROXY protocol).
+ */
+static int check_connect(struct server *s, struct connection *conn, const struct data_cb *cb, int port)
+{
+	int ret;
+
+	conn->flags = CO_FL_NONE;
+	conn->err_code = CO_ER_NONE;
+	conn->target = &s->obj_type;
+	conn_prepare(conn, cb, s->check.proto, s->check.xprt, s);
+
+	/* no client address */
+	clear_addr(&conn->addr.from);
+
+	if (is_addr(&s->check.addr))
+		/* we'll connect to the check addr specified on the server */
+		conn->addr.to = s->check.addr;
+	else
+		/* we'll connect to the addr on the server */
+		conn->addr.to = s->addr;
+
+	set_host_port(&conn->addr.to, port);
+
+	ret = SN_ERR_INTERNAL;
+	if (s->check.proto->connect)
+		ret = s->check.proto->connect(conn, s->proxy->options2 & PR_O2_CHK_ANY,
+		                              s->check.send_proxy ? 1 : (s->proxy->options2 & PR_O2_CHK_ANY) ? 0 : 2);
+	conn->flags |= CO_FL_WAKE_DATA;
+	if (s->check.send_proxy)
+		conn->flags |= CO_FL_LOCAL_SPROXY;
+	return ret;
+}
+
+/* Performs a hard close of check connection <conn>, resetting it so that no
+ * TIME_WAIT is left on our side.
+ */
+static void check_close_conn(struct connection *conn)
+{
+	if (!conn->xprt)
+		return;
+	if (conn->ctrl)
+		setsockopt(conn->t.sock.fd, SOL_SOCKET, SO_LINGER,
+			   (struct linger *) &nolinger, sizeof(struct linger));
+	conn_full_close(conn);
+}
+
+/* Closes and releases the idle connection that server <s> may have kept alive
+ * from its last check.
+ */
+static void check_drop_conn(struct server *s)
+{
+	struct connection *conn = s->check.conn;
+
+	if (!s->check.keepalive)
+		return;
+	s->check.keepalive = 0;
+	check_close_conn(conn);
+	pool_free2(pool2_connection, conn);
+	s->check.conn = NULL;
+}
+
+/* Returns non-zero if the idle check connection <conn> kept alive from a
+ * previous check may be reused, which is not the case if the server closed
+ * it or unexpectedly sent something in the mean time.
+ */
+static int check_conn_alive(struct connection *conn)
+{
+	char c;
+
+	if (!conn->xprt || !conn->ctrl ||
+	    (conn->flags & (CO_FL_CONN_STATE | CO_FL_HANDSHAKE)) != CO_FL_CONNECTED)
+		return 0;
+
+	if (recv(conn->t.sock.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 || errno != EAGAIN)
+		return 0;
+	return 1;
+}
+
+/*
+ * The check dispatcher. It starts the checks of all servers whose date was
+ * reached, by waking their check task up, unless "maxchkrate" is reached in
+ * which case it comes back as soon as a new check may be started.
+ */
+static struct task *process_check_sched(struct task *t)
+{
+	struct eb32_node *eb;
+	struct check_sched_entry *e;
+
+	t->expire = TICK_ETERNITY;
+	eb = eb32_lookup_ge(&check_sched.queue, now_ms - TIMER_LOOK_BACK);
+	while (1) {
+		if (unlikely(!eb)) {
+			/* we might have reached the end of the tree, typically because
+			 * <now_ms> is in the first half and we're first scanning the last
+			 * half. Let's loop back to the beginning of the tree now.
+			 */
+			eb = eb32_first(&check_sched.queue);
+			if (likely(!eb))
+				break;
+		}
+
+		if (tick_is_lt(now_ms, eb->key)) {
+			/* next check not due yet */
+			t->expire = eb->key;
+			break;
+		}
+
+		if (global.chks_lim && !freq_ctr_remain(&global.chk_per_sec, global.chks_lim, 0)) {
+			/* too many checks started during the last second */
+			check_sched.delayed++;
+			t->expire = tick_add(now_ms, next_event_delay(&global.chk_per_sec, global.chks_lim, 0));
+			break;
+		}
+
+		/* the node keeps its key, which the check uses to measure its lag */
+		e = eb32_entry(eb, struct check_sched_entry, node);
+		eb = eb32_next(eb);
+		eb32_delete(&e->node);
+		update_freq_ctr(&global.chk_per_sec, 1);
+		task_wakeup(e->task, TASK_WOKEN_TIMER);
+	}
+	return t;
+}
+
 /*
  * manages a server health-check. Returns
  * the time the task accepts to wait, or TIME_ETERNITY for infinity.
@@ -1303,20 +2051,42 @@ static struct task *process_chk(struct task *t)
 {
 	struct server *s = t->context;
 	struct connection *conn = s->check.conn;
-	int rv;
-	int ret;
+	unsigned int lag;
+	int ret, port;
 	int expired = tick_is_expired(t->expire, now_ms);
 
+	if (check_is_follower(s)) {
+		/* another process runs the check for us */
+		t->expire = TICK_ETERNITY;
+		return t;
+	}
+
 	if (!(s->state & SRV_CHK_RUNNING)) {
-		/* no check currently running */
-		if (!expired) /* woke up too early */
-			return t;
+		/* no check currently running, we were woken up by the scheduler */
 
 		/* we don't send any health-checks when the proxy is stopped or when
 		 * the server should not be checked.
 		 */
-		if (!(s->state & SRV_CHECKED) || s->proxy->state == PR_STSTOPPED || (s->state & SRV_MAINTAIN))
+		if (!(s->state & SRV_CHECKED) || s->proxy->state == PR_STSTOPPED || (s->state & SRV_MAINTAIN)) {
+			check_drop_conn(s);
+			goto reschedule;
+		}
+
+		if (!check_alloc(s)) {
+			set_server_check_status(s, HCHK_STATUS_SOCKERR, "out of memory");
 			goto reschedule;
+		}
+
+		conn = s->check.conn;
+		check_sched.started++;
+
+		/* measure how late we start compared to the scheduled date */
+		lag = now_ms - s->check.sched.node.key;
+		if ((int)lag > 0) {
+			check_sched.lag_total += lag;
+			if (lag > check_sched.lag_max)
+				check_sched.lag_max = lag;
+		}
 
 		/* we'll initiate a new check */
 		set_server_check_status(s, HCHK_STATUS_START, NULL);
@@ -1327,8 +2097,9 @@ static struct task *process_chk(struct task *t)
 		s->check.bo->p = s->check.bo->data;
 		s->check.bo->o = 0;
 
-		/* prepare the check buffer */
-		if (s->proxy->options2 & PR_O2_CHK_ANY) {
+		/* prepare the check buffer, tcp-check fills it by itself */
+		if ((s->proxy->options2 & PR_O2_CHK_ANY) &&
+		    (s->proxy->options2 & PR_O2_CHK_ANY) != PR_O2_TCPCHK_CHK) {
 			bo_putblk(s->check.bo, s->proxy->check_req, s->proxy->check_len);
 
 			/* we want to check if this host replies to HTTP or SSLv3 requests
@@ -1342,47 +2113,46 @@ static struct task *process_chk(struct task *t)
 			else if ((s->proxy->options2 & PR_O2_CHK_ANY) == PR_O2_HTTP_CHK) {
 				if (s->proxy->options2 & PR_O2_CHK_SNDST)
 					bo_putblk(s->check.bo, trash.str, httpchk_build_status_header(s, trash.str));
+				if (s->proxy->options2 & PR_O2_CHK_KA)
+					bo_putstr(s->check.bo, "Connection: keep-alive\r\n");
 				bo_putstr(s->check.bo, "\r\n");
 				*s->check.bo->p = '\0'; /* to make gdb output easier to read */
 			}
 		}
 
-		/* prepare a new connection */
-		conn->flags = CO_FL_NONE;
-		conn->err_code = CO_ER_NONE;
-		conn->target = &s->obj_type;
-		conn_prepare(conn, &check_conn_cb, s->check.proto, s->check.xprt, s);
-
-		/* no client address */
-		clear_addr(&conn->addr.from);
+		/* reuse the connection kept alive by the previous check if the
+		 * server did not close it in the mean time.
+		 */
+		if (s->check.keepalive) {
+			s->check.keepalive = 0;
+			if (check_conn_alive(conn)) {
+				check_sched.reused++;
+				conn->flags &= ~(CO_FL_WAIT_RD | CO_FL_WAIT_WR);
+				t->expire = tick_add(now_ms, MS_TO_TICKS(s->inter));
+				if (s->proxy->timeout.check)
+					t->expire = tick_first(t->expire, tick_add(now_ms, s->proxy->timeout.check));
+				conn_data_want_send(conn);
+				conn_data_poll_recv(conn);
+				goto out_wait;
+			}
+			check_close_conn(conn);
+		}
 
-		if (is_addr(&s->check.addr))
-			/* we'll connect to the check addr specified on the server */
-			conn->addr.to = s->check.addr;
+		/* prepare a new connection */
+		if ((s->proxy->options2 & PR_O2_CHK_ANY) == PR_O2_TCPCHK_CHK) {
+			struct tcpcheck_rule *first;
+
+			/* an initial "connect" rule may specify the port */
+			port = s->check.port;
+			first = LIST_NEXT(&s->proxy->tcpcheck_rules, struct tcpcheck_rule *, list);
+			if (&first->list != &s->proxy->tcpcheck_rules &&
+			    first->action == TCPCHK_ACT_CONNECT && first->port)
+				port = first->port;
+			s->check.current_step = NULL;
+			ret = check_connect(s, conn, &tcpcheck_conn_cb, port);
+		}
 		else
-			/* we'll connect to the addr on the server */
-			conn->addr.to = s->addr;
-
-		set_host_port(&conn->addr.to, s->check.port);
-
-		/* It can return one of :
-		 *  - SN_ERR_NONE if everything's OK
-		 *  - SN_ERR_SRVTO if there are no more servers
-		 *  - SN_ERR_SRVCL if the connection was refused by the server
-		 *  - SN_ERR_PRXCOND if the connection has been limited by the proxy (maxconn)
-		 *  - SN_ERR_RESOURCE if a system resource is lacking (eg: fd limits, ports, ...)
-		 *  - SN_ERR_INTERNAL for any other purely internal errors
-		 * Additionnally, in the case of SN_ERR_RESOURCE, an emergency log will be emitted.
-		 * Note that we try to prevent the network stack from sending the ACK during the
-		 * connect() when a pure TCP check is used (without PROXY protocol).
-		 */
-		ret = SN_ERR_INTERNAL;
-		if (s->check.proto->connect)
-			ret = s->check.proto->connect(conn, s->proxy->options2 & PR_O2_CHK_ANY,
-		                                      s->check.send_proxy ? 1 : (s->proxy->options2 & PR_O2_CHK_ANY) ? 0 : 2);
-		conn->flags |= CO_FL_WAKE_DATA;
-		if (s->check.send_proxy)
-			conn->flags |= CO_FL_LOCAL_SPROXY;
+			ret = check_connect(s, conn, &check_conn_cb, s->check.port);
 
 		switch (ret) {
 		case SN_ERR_NONE:
@@ -1397,7 +2167,7 @@ static struct task *process_chk(struct task *t)
 				t->expire = tick_first(t->expire, t_con);
 			}
 			conn_data_poll_recv(conn);   /* prepare for reading a possible reply */
-			goto reschedule;
+			goto out_wait;
 
 		case SN_ERR_SRVTO: /* ETIMEDOUT */
 		case SN_ERR_SRVCL: /* ECONNREFUSED, ENETUNREACH, ... */
@@ -1419,20 +2189,7 @@ static struct task *process_chk(struct task *t)
 		}
 		else
 			set_server_down(s);
-
-		/* we allow up to min(inter, timeout.connect) for a connection
-		 * to establish but only when timeout.check is set
-		 * as it may be to short for a full check otherwise
-		 */
-		while (tick_is_expired(t->expire, now_ms)) {
-			int t_con;
-
-			t_con = tick_add(t->expire, s->proxy->timeout.connect);
-			t->expire = tick_add(t->expire, MS_TO_TICKS(s->inter));
-
-			if (s->proxy->timeout.check)
-				t->expire = tick_first(t->expire, t_con);
-		}
+		check_release(s);
 	}
 	else {
 		/* there was a test running.
@@ -1465,6 +2222,12 @@ static struct task *process_chk(struct task *t)
 				/* connection established but expired check */
 				if ((s->proxy->options2 & PR_O2_CHK_ANY) == PR_O2_SSL3_CHK)
 					set_server_check_status(s, HCHK_STATUS_L6TOUT, NULL);
+				else if ((s->proxy->options2 & PR_O2_CHK_ANY) == PR_O2_TCPCHK_CHK &&
+					 s->check.current_step &&
+					 &s->check.current_step->list != &s->proxy->tcpcheck_rules) {
+					chunk_printf(&trash, "TCPCHK timeout at step %d", s->check.current_step->index);
+					set_server_check_status(s, HCHK_STATUS_L7TOUT, trash.str);
+				}
 				else	/* HTTP, SMTP, ... */
 					set_server_check_status(s, HCHK_STATUS_L7TOUT, NULL);
 
@@ -1475,7 +2238,7 @@ static struct task *process_chk(struct task *t)
 
 		/* check complete or aborted */
 
-		if (conn->xprt) {
+		if (conn->xprt && !s->check.keepalive) {
 			/* The check was aborted and the connection was not yet closed.
 			 * This can happen upon timeout, or when an external event such
 			 * as a failed response coupled with "observe layer7" caused the
@@ -1504,25 +2267,297 @@ static struct task *process_chk(struct task *t)
 					set_server_disabled(s);
 			}
 
-			if (s->health < s->rise + s->fall - 1) {
+			/* a server reported down by its agent stays down */
+			if (s->health < s->rise + s->fall - 1 && !(s->state & SRV_AGENT_DOWN)) {
 				s->health++; /* was bad, stays for a while */
 				set_server_up(s);
 			}
 		}
 		s->state &= ~SRV_CHK_RUNNING;
+		check_release(s);
+	}
+
+ reschedule:
+	if (s->check.shared)
+		check_publish_state(s);
+
+	/* the task sleeps until the scheduler wakes it up for the next check */
+	t->expire = TICK_ETERNITY;
+	check_sched_next(s);
+ out_wait:
+	return t;
+}
+
+/* Sets the status of the agent check of server <s> to <status> with optional
+ * description <desc>.
+ */
+static void agent_set_status(struct server *s, short status, const char *desc)
+{
+	s->agent.status = status;
+	if (desc && *desc) {
+		strncpy(s->agent.desc, desc, HCHK_DESC_LEN-1);
+		s->agent.desc[HCHK_DESC_LEN-1] = '\0';
+		cut_crlf(s->agent.desc);
+	} else
+		s->agent.desc[0] = '\0';
+}
+
+/* Marks server <s> down if <down> is non-zero and it is still running, or
+ * brings it back up if its agent previously reported it down and <down> is
+ * zero. In the latter case the server is only brought up if its health
+ * checks, if any, did not fail meanwhile.
+ */
+static void agent_set_down(struct server *s, int down)
+{
+	if (down) {
+		s->state |= SRV_AGENT_DOWN;
+		if ((s->state & (SRV_RUNNING | SRV_MAINTAIN)) == SRV_RUNNING) {
+			s->health = s->rise;
+			set_server_down(s);
+		}
+	}
+	else {
+		if (!(s->state & SRV_AGENT_DOWN))
+			return;
+		s->state &= ~SRV_AGENT_DOWN;
+		if (!(s->state & (SRV_RUNNING | SRV_MAINTAIN)) && !(s->result & SRV_CHK_FAILED)) {
+			s->health = s->rise;
+			set_server_up(s);
+		}
+	}
+}
+
+/* Applies the one-line reply <msg> of the agent of server <s>. A percentage
+ * sets the weight relative to the configured one, "drain" sets it to zero
+ * and "ready" restores it. "down", "stopped" and "fail", optionally followed
+ * by a reason, mark the server down until another valid reply is received.
+ * "up" only brings the server back.
+ */
+static void agent_apply_reply(struct server *s, char *msg)
+{
+	const char *err = NULL;
+	const char *down_cmd = NULL;
+	short status = HCHK_STATUS_L7OKD;
+
+	cut_crlf(msg);
+	msg = ltrim(msg, ' ');
+
+	if (!strncasecmp(msg, "down", 4))
+		down_cmd = "down";
+	else if (!strncasecmp(msg, "stopped", 7))
+		down_cmd = "stopped";
+	else if (!strncasecmp(msg, "fail", 4))
+		down_cmd = "fail";
+
+	if (down_cmd) {
+		const char *end = msg + strlen(down_cmd);
+
+		/* the command must terminate the string or be followed by a blank */
+		if (*end == '\0' || *end == ' ' || *end == '\t') {
+			agent_set_down(s, 1);
+			agent_set_status(s, HCHK_STATUS_L7STS, msg);
+			return;
+		}
+	}
+
+	if (strchr(msg, '%'))
+		err = server_parse_weight_change_request(s, msg);
+	else if (!strcasecmp(msg, "drain"))
+		err = server_parse_weight_change_request(s, "0%");
+	else if (!strcasecmp(msg, "ready"))
+		err = server_parse_weight_change_request(s, "100%");
+	else if (strcasecmp(msg, "up") != 0)
+		err = "Unknown feedback string";
+
+	if (err)
+		status = HCHK_STATUS_L7RSP;
+	else
+		agent_set_down(s, 0);
+	agent_set_status(s, status, err ? err : msg);
+}
+
+/* Allocates the connection and buffer needed by the agent check of server
+ * <s>. Returns non-zero on success, or zero if memory is lacking.
+ */
+static int agent_alloc(struct server *s)
+{
+	if (!s->agent.conn && (s->agent.conn = pool_alloc2(pool2_connection)) == NULL)
+		return 0;
+
+	if (!s->agent.bi && (s->agent.bi = pool_alloc2(pool2_check_buf)) == NULL)
+		return 0;
+	s->agent.bi->size = global.tune.chksize;
 
-		rv = 0;
-		if (global.spread_checks > 0) {
-			rv = srv_getinter(s) * global.spread_checks / 100;
-			rv -= (int) (2 * rv * (rand() / (RAND_MAX + 1.0)));
+	check_sched.running++;
+	return 1;
+}
+
+/* Releases the connection and buffer of the agent check of server <s> once it
+ * is over. The connection must already be closed.
+ */
+static void agent_release(struct server *s)
+{
+	struct connection *conn = s->agent.conn;
+	struct buffer *bi = s->agent.bi;
+
+	pool_free2(pool2_connection, conn);
+	pool_free2(pool2_check_buf, bi);
+	s->agent.conn = NULL;
+	s->agent.bi = NULL;
+	check_sched.running--;
+}
+
+/* Reads the agent's reply, which ends with a line feed or the connection's
+ * closure, and applies it.
+ */
+static void agent_chk_r(struct connection *conn)
+{
+	struct server *s = conn->owner;
+	struct buffer *bi = s->agent.bi;
+	char *eol;
+	int done;
+
+	if (s->agent.status != HCHK_STATUS_START)
+		goto out_wakeup;
+
+	if (conn->flags & (CO_FL_HANDSHAKE | CO_FL_WAIT_RD))
+		return;
+
+	conn->xprt->rcv_buf(conn, bi, bi->size - 1);
+	done = (conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_DATA_RD_SH)) || bi->i >= bi->size - 1;
+	bi->data[bi->i] = '\0';
+
+	eol = strchr(bi->data, '\n');
+	if (!eol && !done) {
+		__conn_data_poll_recv(conn);
+		return;
+	}
+
+	if (eol)
+		*eol = '\0';
+
+	if (*bi->data)
+		agent_apply_reply(s, bi->data);
+	else if (conn->flags & CO_FL_ERROR)
+		agent_set_status(s, HCHK_STATUS_SOCKERR, NULL);
+	else
+		agent_set_status(s, HCHK_STATUS_L7RSP, "Empty reply");
+
+ out_wakeup:
+	__conn_data_stop_both(conn);
+	task_wakeup(s->agent.task, TASK_WOKEN_IO);
+}
+
+/* Nothing is ever sent to the agent */
+static void agent_chk_w(struct connection *conn)
+{
+	__conn_data_stop_send(conn);
+}
+
+/* Handles connection status updates of agent checks, and reports errors */
+static int agent_wake(struct connection *conn)
+{
+	struct server *s = conn->owner;
+
+	if (unlikely(conn->flags & CO_FL_ERROR) && s->agent.status == HCHK_STATUS_START) {
+		agent_set_status(s, (conn->flags & CO_FL_CONNECTED) ? HCHK_STATUS_SOCKERR : HCHK_STATUS_L4CON, NULL);
+		__conn_data_stop_both(conn);
+		task_wakeup(s->agent.task, TASK_WOKEN_IO);
+	}
+	return 0;
+}
+
+static struct data_cb agent_conn_cb = {
+	.recv = agent_chk_r,
+	.send = agent_chk_w,
+	.wake = agent_wake,
+};
+
+/*
+ * Manages a server's agent check. The agent is expected to send a short line
+ * as soon as the connection is established, then to close it.
+ */
+static struct task *process_agent(struct task *t)
+{
+	struct server *s = t->context;
+	struct connection *conn = s->agent.conn;
+	int expire;
+	int ret;
+
+	if (check_is_follower(s)) {
+		/* another process runs the agent check for us */
+		t->expire = TICK_ETERNITY;
+		return t;
+	}
+
+	if (!(s->state & SRV_AGENT_RUNNING)) {
+		/* woken up by the scheduler */
+		if (s->proxy->state == PR_STSTOPPED || (s->state & SRV_MAINTAIN))
+			goto reschedule;
+
+		if (!agent_alloc(s)) {
+			agent_set_status(s, HCHK_STATUS_SOCKERR, "out of memory");
+			goto reschedule;
+		}
+
+		conn = s->agent.conn;
+		s->state |= SRV_AGENT_RUNNING;
+		s->agent.status = HCHK_STATUS_START;
+		s->agent.bi->p = s->agent.bi->data;
+		s->agent.bi->i = 0;
+		check_sched.started++;
+
+		conn->flags = CO_FL_NONE;
+		conn->err_code = CO_ER_NONE;
+		conn->target = &s->obj_type;
+		conn_prepare(conn, &agent_conn_cb, s->proto, &raw_sock, s);
+		clear_addr(&conn->addr.from);
+		conn->addr.to = is_addr(&s->check.addr) ? s->check.addr : s->addr;
+		set_host_port(&conn->addr.to, s->agent.port);
+
+		ret = SN_ERR_INTERNAL;
+		if (s->proto->connect)
+			ret = s->proto->connect(conn, 0, 0);
+		conn->flags |= CO_FL_WAKE_DATA;
+
+		if (ret == SN_ERR_NONE) {
+			t->expire = tick_add(now_ms, MS_TO_TICKS(s->agent.inter));
+			if (s->proxy->timeout.check)
+				t->expire = tick_first(t->expire, tick_add(now_ms, s->proxy->timeout.check));
+			conn_data_want_recv(conn);
+			return t;
 		}
-		t->expire = tick_add(now_ms, MS_TO_TICKS(srv_getinter(s) + rv));
+
+		/* synchronous error, no fd was allocated */
+		if (ret == SN_ERR_SRVTO || ret == SN_ERR_SRVCL)
+			agent_set_status(s, HCHK_STATUS_L4CON, strerror(errno));
+		else
+			agent_set_status(s, HCHK_STATUS_SOCKERR, NULL);
 	}
+	else {
+		if (s->agent.status == HCHK_STATUS_START) {
+			if (!tick_is_expired(t->expire, now_ms))
+				return t; /* woke up too early */
+			if (conn->flags & CO_FL_CONNECTED)
+				agent_set_status(s, HCHK_STATUS_L7TOUT, NULL);
+			else
+				agent_set_status(s, HCHK_STATUS_L4TOUT, NULL);
+		}
+		check_close_conn(conn);
+	}
+
+	s->state &= ~SRV_AGENT_RUNNING;
+	agent_release(s);
 
  reschedule:
-	while (tick_is_expired(t->expire, now_ms))
-		t->expire = tick_add(t->expire, MS_TO_TICKS(s->inter));
- out_wait:
+	if (s->check.shared)
+		check_publish_state(s);
+
+	t->expire = TICK_ETERNITY;
+	expire = tick_add(s->agent.sched.node.key, MS_TO_TICKS(s->agent.inter));
+	while (tick_is_expired(expire, now_ms))
+		expire = tick_add(expire, MS_TO_TICKS(s->agent.inter));
+	check_sched_queue(&s->agent.sched, expire);
 	return t;
 }
 
@@ -1536,6 +2571,8 @@ int start_checks() {
 	struct server *s;
 	struct task *t;
 	int nbchk=0, mininter=0, srvpos=0;
+	int nbagent=0, agentpos=0;
+	int nbshared=0, sharedpos=0;
 
 	/* 1- count the checkers to run simultaneously.
 	 * We also determine the minimum interval among all of those which
@@ -1546,6 +2583,12 @@ int start_checks() {
 	 */
 	for (px = proxy; px; px = px->next) {
 		for (s = px->srv; s; s = s->next) {
+			if (s->state & SRV_AGENT_CHECKED)
+				nbagent++;
+
+			if (s->state & (SRV_CHECKED | SRV_AGENT_CHECKED))
+				nbshared++;
+
 			if (!(s->state & SRV_CHECKED))
 				continue;
 
@@ -1557,11 +2600,52 @@ int start_checks() {
 		}
 	}
 
-	if (!nbchk)
+	if (!nbchk && !nbagent)
 		return 0;
 
 	srand((unsigned)time(NULL));
 
+	pool2_check_buf = create_pool("check_buf", sizeof(struct buffer) + global.tune.chksize, MEM_F_SHARED);
+	if ((t = task_new()) == NULL || !pool2_check_buf) {
+		Alert("Starting checks: out of memory.\n");
+		return -1;
+	}
+	check_sched.task = t;
+	t->process = process_check_sched;
+	t->context = NULL;
+	t->expire = TICK_ETERNITY;
+
+	/* With "shared-checks", a single process runs the checks and publishes
+	 * the results into a shared area which must be mapped before the fork.
+	 * Servers which only have an agent check get a slot too, so that their
+	 * agent is also run by the checking process only.
+	 */
+	if (global.shared_checks && global.nbproc > 1 && nbshared) {
+		if (global.shared_checks > global.nbproc) {
+			Warning("shared-checks references process %d which is higher than nbproc (%d), using process 1.\n",
+				global.shared_checks, global.nbproc);
+			global.shared_checks = 1;
+		}
+
+		shared_checks_area = mmap(NULL, nbshared * sizeof(*shared_checks_area),
+					  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (shared_checks_area == MAP_FAILED) {
+			Alert("Starting checks: cannot allocate shared memory for %d servers.\n", nbshared);
+			shared_checks_area = NULL;
+			return -1;
+		}
+		memset(shared_checks_area, 0, nbshared * sizeof(*shared_checks_area));
+
+		if ((t = task_new()) == NULL) {
+			Alert("Starting checks: out of memory.\n");
+			return -1;
+		}
+		t->process = process_shared_checks;
+		t->context = NULL;
+		t->expire = tick_add(now_ms, MS_TO_TICKS(SHARED_CHECK_SYNC_INTER));
+		task_queue(t);
+	}
+
 	/*
 	 * 2- start them as far as possible from each others. For this, we will
 	 * start them after their interval set to the min interval divided by
@@ -1583,6 +2667,24 @@ int start_checks() {
 				t->expire = TICK_ETERNITY;
 			}
 
+			if (shared_checks_area && (s->state & (SRV_CHECKED | SRV_AGENT_CHECKED)))
+				s->check.shared = &shared_checks_area[sharedpos++];
+
+			if (s->state & SRV_AGENT_CHECKED) {
+				if ((t = task_new()) == NULL) {
+					Alert("Starting [%s:%s] agent check: out of memory.\n", px->id, s->id);
+					return -1;
+				}
+				s->agent.task = t;
+				t->process = process_agent;
+				t->context = s;
+				t->expire = TICK_ETERNITY;
+				s->agent.sched.task = t;
+				check_sched_queue(&s->agent.sched,
+				                  tick_add(now_ms, MS_TO_TICKS(s->agent.inter * agentpos / nbagent)));
+				agentpos++;
+			}
+
 			if (!(s->state & SRV_CHECKED))
 				continue;
 
@@ -1596,12 +2698,14 @@ int start_checks() {
 			t->process = process_chk;
 			t->context = s;
 
-			/* check this every ms */
-			t->expire = tick_add(now_ms,
-					     MS_TO_TICKS(((mininter && mininter >= srv_getinter(s)) ?
-							  mininter : srv_getinter(s)) * srvpos / nbchk));
+			/* the task is only woken up by the scheduler */
+			t->expire = TICK_ETERNITY;
+			s->check.sched.task = t;
+			check_sched_queue(&s->check.sched,
+			                  tick_add(now_ms,
+			                           MS_TO_TICKS(((mininter && mininter >= srv_getinter(s)) ?
+			                                        mininter : srv_getinter(s)) * srvpos / nbchk)));
 			s->check.start = now;
-			task_queue(t);
 
 			srvpos++;
 		}
@@ -1609,6 +2713,76 @@ int start_checks() {
 	return 0;
 }
 
+/*
+ * Parses the headers of the HTTP response in s->check.bi to find whether the
+ * connection may be reused for the next check once the response is complete.
+ * The buffer MUST start with a valid HTTP status line. Returns 1 if the whole
+ * response was received and the connection may be kept alive, 0 if more data
+ * are needed, or -1 if the connection cannot be reused (close requested, no
+ * content-length, chunked encoding, or more data than expected).
+ */
+static int httpchk_ka_parse(struct server *s)
+{
+	char *ptr = s->check.bi->data;
+	char *end = ptr + s->check.bi->i;
+	char *eol;
+	long long clen = -1;
+	int keep = (ptr[7] == '1'); /* HTTP/1.1 keeps alive by default */
+	int code = str2uic(ptr + 9);
+
+	/* skip the status line */
+	while (ptr < end && *ptr != '\n')
+		ptr++;
+	if (ptr++ >= end)
+		return 0;
+
+	while (1) {
+		for (eol = ptr; eol < end && *eol != '\n'; eol++);
+		if (eol >= end)
+			return 0; /* headers are not complete yet */
+
+		if (eol == ptr || (eol == ptr + 1 && *ptr == '\r'))
+			break; /* empty line: end of headers */
+
+		if (eol - ptr > 15 && strncasecmp(ptr, "Content-Length:", 15) == 0)
+			clen = strtoll(ptr + 15, NULL, 10);
+		else if (eol - ptr > 18 && strncasecmp(ptr, "Transfer-Encoding:", 18) == 0)
+			return -1;
+		else if (eol - ptr > 11 && strncasecmp(ptr, "Connection:", 11) == 0) {
+			char *p;
+
+			for (p = ptr + 11; p < eol; p++) {
+				if (strncasecmp(p, "close", 5) == 0)
+					return -1;
+				if (strncasecmp(p, "keep-alive", 10) == 0)
+					keep = 1;
+			}
+		}
+		ptr = eol + 1;
+	}
+	ptr = eol + 1;
+
+	if (!keep)
+		return -1;
+
+	/* interim responses are followed by another one */
+	if (code >= 100 && code < 200)
+		return -1;
+
+	/* these responses never have a body */
+	if (code == 204 || code == 304 ||
+	    (s->proxy->check_len >= 5 && memcmp(s->proxy->check_req, "HEAD ", 5) == 0))
+		clen = 0;
+
+	if (clen < 0)
+		return -1;
+
+	if (end - ptr < clen)
+		return 0;
+
+	return (end - ptr == clen) ? 1 : -1;
+}
+
 /*
  * Perform content verification check on data in s->check.buffer buffer.
  * The buffer MUST be terminated by a null byte before calling this function.
@@ -20,10 +20,12 @@
 #include <pwd.h>
 #include <grp.h>
 
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <common/base64.h>
 #include <common/cfgparse.h>
 #include <common/compat.h>
 #include <common/config.h>
@@ -42,6 +44,7 @@
 #include <proto/channel.h>
 #include <proto/checks.h>
 #include <proto/compression.h>
+#include <proto/counters.h>
 #include <proto/dumpstats.h>
 #include <proto/fd.h>
 #include <proto/freq_ctr.h>
@@ -65,6 +68,11 @@ static int stats_dump_info_to_buffer(struct stream_interface *si);
 static int stats_dump_full_sess_to_buffer(struct stream_interface *si, struct session *sess);
 static int stats_dump_sess_to_buffer(struct stream_interface *si);
 static int stats_dump_errors_to_buffer(struct stream_interface *si);
+#ifdef USE_OPENSSL
+static int stats_dump_ssl_to_buffer(struct stream_interface *si);
+#endif
+static int stats_dump_histo_to_buffer(struct stream_interface *si);
+static int stats_dump_metrics_to_buffer(struct stream_interface *si, struct uri_auth *uri);
 static int stats_table_request(struct stream_interface *si, int show);
 static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy *px, struct uri_auth *uri);
 static int stats_dump_stat_to_buffer(struct stream_interface *si, struct uri_auth *uri);
@@ -74,6 +82,8 @@ static int stats_dump_stat_to_buffer(struct stream_interface *si, struct uri_aut
  *     -> stats_dump_sess_to_buffer()     // "show sess"
  *     -> stats_dump_errors_to_buffer()   // "show errors"
  *     -> stats_dump_info_to_buffer()     // "show info"
+ *     -> stats_dump_ssl_to_buffer()      // "show ssl"
+ *     -> stats_dump_histo_to_buffer()    // "show histo"
  *     -> stats_dump_stat_to_buffer()     // "show stat"
  *        -> stats_dump_csv_header()
  *        -> stats_dump_proxy_to_buffer()
@@ -108,15 +118,23 @@ static const char stats_sock_usage_msg[] =
 	"  quit           : disconnect\n"
 	"  show info      : report information about the running process\n"
 	"  show stat      : report counters for each proxy and server\n"
+	"  show histo     : report latency histograms for each proxy and server\n"
+	"  show metrics   : report counters in Prometheus text format\n"
 	"  show errors    : report last request and response errors for each proxy\n"
 	"  show sess [id] : report the list of current sessions or dump this session\n"
 	"  show table [id]: report table usage stats or dump this table's contents\n"
+#ifdef USE_OPENSSL
+	"  show ssl       : report SSL handshake statistics for each bind line\n"
+#endif
 	"  get weight     : report a server's current weight\n"
 	"  set weight     : change a server's weight\n"
 	"  set table [id] : update or create a table entry's data\n"
 	"  set timeout    : change a timeout setting\n"
 	"  set maxconn    : change a maxconn setting\n"
 	"  set rate-limit : change a rate limiting value\n"
+#if (defined USE_OPENSSL && defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+	"  set ssl ocsp-response : update a certificate's stapled OCSP response\n"
+#endif
 	"  disable        : put a server or frontend in maintenance mode\n"
 	"  enable         : re-enable a server or frontend which is in maintenance mode\n"
 	"  shutdown       : kill a session or a frontend (eg:to release listening ports)\n"
@@ -389,36 +407,721 @@ static int stats_parse_global(char **args, int section_type, struct proxy *curpx
 		}
 		global.stats_fe->bind_proc = set;
 	}
+	else if (!strcmp(args[1], "aggregate")) {
+		if (*args[2]) {
+			memprintf(err, "'%s %s' does not take any argument", args[0], args[1]);
+			return -1;
+		}
+		global.stats_aggregate = 1;
+	}
 	else {
-		memprintf(err, "'%s' only supports 'socket', 'maxconn', 'bind-process' and 'timeout' (got '%s')", args[0], args[1]);
+		memprintf(err, "'%s' only supports 'socket', 'maxconn', 'bind-process', 'timeout' and 'aggregate' (got '%s')", args[0], args[1]);
 		return -1;
 	}
 	return 0;
 }
 
+/* Shared counters for "stats aggregate". Each process owns an array of
+ * <stats_shared_slots> records in the area, in which it periodically publishes
+ * the counters of all its frontends, backends and servers. The dump functions
+ * then temporarily replace the local counters with the sum of all processes.
+ */
+static struct shared_counters_hdr *stats_shared_hdr = NULL;
+static struct shared_counters *stats_shared_area = NULL;
+static unsigned int stats_shared_slots;
+static unsigned int stats_clear_epoch, stats_clear_all_epoch;
+
+/* Objects owning each slot, so that they may be published a few at a time
+ * starting at slot <stats_shared_next_slot>. Slots of missing frontends or
+ * backends have no proxy.
+ */
+static struct stats_shared_obj {
+	struct proxy *px;
+	struct server *sv;
+	int type;
+} *stats_shared_objs = NULL;
+static unsigned int stats_shared_next_slot;
+
+/* returns the record of slot <slot> for process <proc> (starting at 1) */
+static inline struct shared_counters *stats_shared_rec(unsigned int slot, int proc)
+{
+	return &stats_shared_area[(proc - 1) * stats_shared_slots + slot];
+}
+
+/* Resets the counters of all proxies, servers and listeners. Only the maximum
+ * values are reset unless <all> is set.
+ */
+static void stats_clear_counters(int all)
+{
+	struct proxy *px;
+	struct server *sv;
+	struct listener *li;
+
+	for (px = proxy; px; px = px->next) {
+		if (all) {
+			memset(&px->be_counters, 0, sizeof(px->be_counters));
+			memset(&px->fe_counters, 0, sizeof(px->fe_counters));
+		}
+		else {
+			px->be_counters.conn_max = 0;
+			px->be_counters.p.http.rps_max = 0;
+			px->be_counters.sps_max = 0;
+			px->be_counters.cps_max = 0;
+			px->be_counters.nbpend_max = 0;
+
+			px->fe_counters.conn_max = 0;
+			px->fe_counters.p.http.rps_max = 0;
+			px->fe_counters.sps_max = 0;
+			px->fe_counters.cps_max = 0;
+			px->fe_counters.nbpend_max = 0;
+		}
+
+		for (sv = px->srv; sv; sv = sv->next)
+			if (all)
+				memset(&sv->counters, 0, sizeof(sv->counters));
+			else {
+				sv->counters.cur_sess_max = 0;
+				sv->counters.nbpend_max = 0;
+				sv->counters.sps_max = 0;
+			}
+
+		list_for_each_entry(li, &px->conf.listeners, by_fe)
+			if (li->counters) {
+				if (all)
+					memset(li->counters, 0, sizeof(*li->counters));
+				else
+					li->counters->conn_max = 0;
+			}
+#ifdef USE_OPENSSL
+		if (all) {
+			struct bind_conf *bind_conf;
+
+			list_for_each_entry(bind_conf, &px->conf.bind, by_fe)
+				memset(&bind_conf->ssl_hs, 0, sizeof(bind_conf->ssl_hs));
+		}
+#endif
+	}
+
+	global.cps_max = 0;
+	check_sched.lag_max = 0;
+}
+
+/* Copies into <rec> the current counters of the frontend (STATS_TYPE_FE) or
+ * backend (STATS_TYPE_BE) of proxy <px>, or of server <sv> (STATS_TYPE_SV).
+ * The sequence number is left untouched.
+ */
+static void stats_shared_get(struct shared_counters *rec, struct proxy *px, struct server *sv, int type)
+{
+	if (type == STATS_TYPE_FE) {
+		rec->cur  = px->feconn;
+		rec->pend = 0;
+		rec->sess_per_sec = px->fe_sess_per_sec;
+		rec->conn_per_sec = px->fe_conn_per_sec;
+		rec->req_per_sec  = px->fe_req_per_sec;
+		rec->c.px = px->fe_counters;
+	}
+	else if (type == STATS_TYPE_BE) {
+		rec->cur  = px->beconn;
+		rec->pend = px->nbpend;
+		rec->sess_per_sec = px->be_sess_per_sec;
+		rec->c.px = px->be_counters;
+	}
+	else {
+		rec->cur  = sv->cur_sess;
+		rec->pend = sv->nbpend;
+		rec->sess_per_sec = sv->sess_per_sec;
+		rec->c.sv = sv->counters;
+	}
+}
+
+/* The opposite of stats_shared_get(), sets the counters from <rec> */
+static void stats_shared_set(const struct shared_counters *rec, struct proxy *px, struct server *sv, int type)
+{
+	if (type == STATS_TYPE_FE) {
+		px->feconn = rec->cur;
+		px->fe_sess_per_sec = rec->sess_per_sec;
+		px->fe_conn_per_sec = rec->conn_per_sec;
+		px->fe_req_per_sec  = rec->req_per_sec;
+		px->fe_counters = rec->c.px;
+	}
+	else if (type == STATS_TYPE_BE) {
+		px->beconn = rec->cur;
+		px->nbpend = rec->pend;
+		px->be_sess_per_sec = rec->sess_per_sec;
+		px->be_counters = rec->c.px;
+	}
+	else {
+		sv->cur_sess = rec->cur;
+		sv->nbpend   = rec->pend;
+		sv->sess_per_sec = rec->sess_per_sec;
+		sv->counters = rec->c.sv;
+	}
+}
+
+/* returns the slot of the object designated by <px>, <sv> and <type> */
+static inline unsigned int stats_shared_slot(struct proxy *px, struct server *sv, int type)
+{
+	if (type == STATS_TYPE_SV)
+		return sv->stats_slot;
+	return px->stats_slot + (type == STATS_TYPE_BE);
+}
+
+/* Publishes the counters of the designated object into this process' record.
+ * The readers never block us, at worst they retry.
+ */
+static void stats_shared_publish(struct proxy *px, struct server *sv, int type)
+{
+	struct shared_counters *rec = stats_shared_rec(stats_shared_slot(px, sv, type), relative_pid);
+
+	rec->seq++;
+	__sync_synchronize();
+	stats_shared_get(rec, px, sv, type);
+	__sync_synchronize();
+	rec->seq++;
+}
+
+/* Copies shared record <src> into <dst>. The copy is retried a few times if
+ * the owner was updating it, then used as is since the counters only increase.
+ */
+static void stats_shared_read(struct shared_counters *dst, const struct shared_counters *src)
+{
+	unsigned int seq;
+	int tries = 0;
+
+	do {
+		seq = src->seq;
+		__sync_synchronize();
+		memcpy(dst, (const void *)src, sizeof(*dst));
+		__sync_synchronize();
+	} while ((seq & 1 || src->seq != seq) && ++tries < 3);
+}
+
+/* adds latency histograms <src> to <dst> */
+static void stats_merge_lat(struct lat_histo *dst, const struct lat_histo *src)
+{
+	int t, b;
+
+	for (t = 0; t < LAT_TIMERS; t++) {
+		dst[t].count += src[t].count;
+		dst[t].max = MAX(dst[t].max, src[t].max);
+		for (b = 0; b < LAT_HISTO_BUCKETS; b++)
+			dst[t].bucket[b] += src[t].bucket[b];
+	}
+}
+
+/* Adds the counters of <src> to <dst>. The maximum values are the highest
+ * ones observed by any process.
+ */
+static void stats_merge_px(struct pxcounters *dst, const struct pxcounters *src)
+{
+	int i;
+
+	dst->conn_max        = MAX(dst->conn_max, src->conn_max);
+	dst->cum_conn       += src->cum_conn;
+	dst->cum_sess       += src->cum_sess;
+	dst->cum_lbconn     += src->cum_lbconn;
+	dst->cps_max         = MAX(dst->cps_max, src->cps_max);
+	dst->sps_max         = MAX(dst->sps_max, src->sps_max);
+	dst->nbpend_max      = MAX(dst->nbpend_max, src->nbpend_max);
+	dst->bytes_in       += src->bytes_in;
+	dst->bytes_out      += src->bytes_out;
+	dst->comp_in        += src->comp_in;
+	dst->comp_out       += src->comp_out;
+	dst->comp_byp       += src->comp_byp;
+	dst->denied_req     += src->denied_req;
+	dst->denied_resp    += src->denied_resp;
+	dst->failed_req     += src->failed_req;
+	dst->denied_conn    += src->denied_conn;
+	dst->failed_conns   += src->failed_conns;
+	dst->failed_resp    += src->failed_resp;
+	dst->cli_aborts     += src->cli_aborts;
+	dst->srv_aborts     += src->srv_aborts;
+	dst->retries        += src->retries;
+	dst->redispatches   += src->redispatches;
+	dst->intercepted_req += src->intercepted_req;
+	dst->log_suppressed += src->log_suppressed;
+	stats_merge_lat(dst->lat, src->lat);
+
+	dst->p.http.cum_req  += src->p.http.cum_req;
+	dst->p.http.comp_rsp += src->p.http.comp_rsp;
+	dst->p.http.rps_max   = MAX(dst->p.http.rps_max, src->p.http.rps_max);
+	for (i = 0; i < 6; i++)
+		dst->p.http.rsp[i] += src->p.http.rsp[i];
+}
+
+/* same as above for servers */
+static void stats_merge_sv(struct srvcounters *dst, const struct srvcounters *src)
+{
+	int i;
+
+	dst->cur_sess_max   = MAX(dst->cur_sess_max, src->cur_sess_max);
+	dst->nbpend_max     = MAX(dst->nbpend_max, src->nbpend_max);
+	dst->sps_max        = MAX(dst->sps_max, src->sps_max);
+	dst->cum_sess      += src->cum_sess;
+	dst->cum_lbconn    += src->cum_lbconn;
+	dst->bytes_in      += src->bytes_in;
+	dst->bytes_out     += src->bytes_out;
+	dst->failed_conns  += src->failed_conns;
+	dst->failed_resp   += src->failed_resp;
+	dst->cli_aborts    += src->cli_aborts;
+	dst->srv_aborts    += src->srv_aborts;
+	dst->retries       += src->retries;
+	dst->redispatches  += src->redispatches;
+	dst->failed_secu   += src->failed_secu;
+	for (i = 0; i < 6; i++)
+		dst->p.http.rsp[i] += src->p.http.rsp[i];
+	dst->failed_checks += src->failed_checks;
+	dst->failed_hana   += src->failed_hana;
+	dst->down_trans    += src->down_trans;
+	dst->ssl_reuse     += src->ssl_reuse;
+	dst->ssl_full      += src->ssl_full;
+	stats_merge_lat(dst->lat, src->lat);
+}
+
+/* Fills <view> with the counters of the designated object summed over all
+ * processes, or those of process <proc> only if it is not zero. The values of
+ * the current process are taken live, the other ones from the shared area. The
+ * rates are stored so that read_freq_ctr() returns their sum.
+ */
+static void stats_shared_view(struct shared_counters *view, struct proxy *px, struct server *sv, int type, int proc)
+{
+	static struct shared_counters rec;
+	unsigned int slot = stats_shared_slot(px, sv, type);
+	unsigned int sess = 0, conn = 0, req = 0;
+	int p;
+
+	memset(view, 0, sizeof(*view));
+	for (p = 1; p <= global.nbproc; p++) {
+		if (proc && p != proc)
+			continue;
+
+		if (p == relative_pid)
+			stats_shared_get(&rec, px, sv, type);
+		else
+			stats_shared_read(&rec, stats_shared_rec(slot, p));
+
+		view->cur  += rec.cur;
+		view->pend += rec.pend;
+		sess += read_freq_ctr(&rec.sess_per_sec);
+		if (type == STATS_TYPE_FE) {
+			conn += read_freq_ctr(&rec.conn_per_sec);
+			req  += read_freq_ctr(&rec.req_per_sec);
+		}
+
+		if (type == STATS_TYPE_SV)
+			stats_merge_sv(&view->c.sv, &rec.c.sv);
+		else
+			stats_merge_px(&view->c.px, &rec.c.px);
+	}
+
+	view->sess_per_sec.curr_sec = view->conn_per_sec.curr_sec = view->req_per_sec.curr_sec = now.tv_sec;
+	view->sess_per_sec.curr_ctr = sess;
+	view->conn_per_sec.curr_ctr = conn;
+	view->req_per_sec.curr_ctr  = req;
+}
+
+static struct shared_counters stats_shared_saved, stats_shared_tmp;
+
+/* When the counters are aggregated, replaces the counters of the designated
+ * object with the view of the process being dumped (0 = all), until
+ * stats_shared_leave() is called. Nothing may happen between these calls.
+ */
+static void stats_shared_enter(struct stream_interface *si, struct proxy *px, struct server *sv, int type)
+{
+	if (!stats_shared_area)
+		return;
+
+	stats_shared_get(&stats_shared_saved, px, sv, type);
+	stats_shared_view(&stats_shared_tmp, px, sv, type, si->applet.ctx.stats.proc);
+	stats_shared_set(&stats_shared_tmp, px, sv, type);
+}
+
+/* restores the counters replaced by stats_shared_enter() */
+static void stats_shared_leave(struct proxy *px, struct server *sv, int type)
+{
+	if (!stats_shared_area)
+		return;
+
+	stats_shared_set(&stats_shared_saved, px, sv, type);
+}
+
+/* Advances the stats context to the next process to break down when the
+ * counters are aggregated and "show stat proc" was used, and returns non-zero.
+ * Otherwise the context is reset and zero is returned.
+ */
+static int stats_shared_next(struct stream_interface *si)
+{
+	if (stats_shared_area && (si->applet.ctx.stats.flags & STAT_SHOW_PROC) &&
+	    si->applet.ctx.stats.proc < global.nbproc) {
+		si->applet.ctx.stats.proc++;
+		return 1;
+	}
+	si->applet.ctx.stats.proc = 0;
+	return 0;
+}
+
+/* returns the process number to report in the "pid" column of the dumped row.
+ * Aggregated rows report zero.
+ */
+static inline int stats_row_pid(struct stream_interface *si)
+{
+	return stats_shared_area ? si->applet.ctx.stats.proc : relative_pid;
+}
+
+/* Periodically publishes the counters of this process, and applies the
+ * "clear counters" executed on other processes. Records are large, so at most
+ * STATS_SHARED_SYNC_BATCH objects are published per call, and the task comes
+ * back as soon as possible until all of them are, so that publishing never
+ * delays the traffic for long.
+ */
+static struct task *process_stats_shared(struct task *t)
+{
+	struct stats_shared_obj *obj;
+	int batch = STATS_SHARED_SYNC_BATCH;
+
+	if (stats_shared_hdr->clear_all_epoch != stats_clear_all_epoch) {
+		stats_clear_all_epoch = stats_shared_hdr->clear_all_epoch;
+		stats_clear_counters(1);
+	}
+	else if (stats_shared_hdr->clear_epoch != stats_clear_epoch) {
+		stats_clear_epoch = stats_shared_hdr->clear_epoch;
+		stats_clear_counters(0);
+	}
+
+	while (stats_shared_next_slot < stats_shared_slots && batch > 0) {
+		obj = &stats_shared_objs[stats_shared_next_slot++];
+		if (!obj->px)
+			continue;
+		stats_shared_publish(obj->px, obj->sv, obj->type);
+		batch--;
+	}
+
+	if (stats_shared_next_slot < stats_shared_slots) {
+		/* let the polling loop run before publishing the next ones */
+		t->expire = tick_add(now_ms, 1);
+		return t;
+	}
+
+	stats_shared_next_slot = 0;
+	t->expire = tick_add(now_ms, MS_TO_TICKS(STATS_SHARED_SYNC_INTER));
+	return t;
+}
+
+/* Maps the shared counters area when "stats aggregate" is set and several
+ * processes will be started. Must be called before the fork. Returns 0 on
+ * success, otherwise -1 with an error message in <err>.
+ */
+int stats_shared_init(char **err)
+{
+	struct proxy *px;
+	struct server *sv;
+	struct task *t;
+	size_t size;
+	void *area;
+
+	if (!global.stats_aggregate || global.nbproc <= 1)
+		return 0;
+
+	stats_shared_slots = 0;
+	for (px = proxy; px; px = px->next) {
+		px->stats_slot = stats_shared_slots;
+		stats_shared_slots += 2;
+		for (sv = px->srv; sv; sv = sv->next)
+			sv->stats_slot = stats_shared_slots++;
+	}
+
+	stats_shared_objs = calloc(stats_shared_slots, sizeof(*stats_shared_objs));
+	if (!stats_shared_objs) {
+		memprintf(err, "stats aggregate : out of memory");
+		return -1;
+	}
+
+	for (px = proxy; px; px = px->next) {
+		if (px->cap & PR_CAP_FE) {
+			stats_shared_objs[px->stats_slot].px = px;
+			stats_shared_objs[px->stats_slot].type = STATS_TYPE_FE;
+		}
+		if (px->cap & PR_CAP_BE) {
+			stats_shared_objs[px->stats_slot + 1].px = px;
+			stats_shared_objs[px->stats_slot + 1].type = STATS_TYPE_BE;
+		}
+		for (sv = px->srv; sv; sv = sv->next) {
+			stats_shared_objs[sv->stats_slot].px = px;
+			stats_shared_objs[sv->stats_slot].sv = sv;
+			stats_shared_objs[sv->stats_slot].type = STATS_TYPE_SV;
+		}
+	}
+
+	size = sizeof(*stats_shared_hdr) + (size_t)global.nbproc * stats_shared_slots * sizeof(*stats_shared_area);
+	area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED) {
+		memprintf(err, "stats aggregate : cannot allocate %lu bytes of shared memory", (unsigned long)size);
+		return -1;
+	}
+	memset(area, 0, size);
+	stats_shared_hdr = area;
+	stats_shared_area = (struct shared_counters *)(stats_shared_hdr + 1);
+
+	if ((t = task_new()) == NULL) {
+		memprintf(err, "stats aggregate : out of memory");
+		return -1;
+	}
+	t->process = process_stats_shared;
+	t->context = NULL;
+	t->expire = tick_add(now_ms, MS_TO_TICKS(STATS_SHARED_SYNC_INTER));
+	task_queue(t);
+	return 0;
+}
+
+/* names of the CSV fields, in the order they are dumped */
+static const char stats_csv_header[] =
+	"# pxname,svname,"
+	"qcur,qmax,"
+	"scur,smax,slim,stot,"
+	"bin,bout,"
+	"dreq,dresp,"
+	"ereq,econ,eresp,"
+	"wretr,wredis,"
+	"status,weight,act,bck,"
+	"chkfail,chkdown,lastchg,downtime,qlimit,"
+	"pid,iid,sid,throttle,lbtot,tracked,type,"
+	"rate,rate_lim,rate_max,"
+	"check_status,check_code,check_duration,"
+	"hrsp_1xx,hrsp_2xx,hrsp_3xx,hrsp_4xx,hrsp_5xx,hrsp_other,hanafail,"
+	"req_rate,req_rate_max,req_tot,"
+	"cli_abrt,srv_abrt,"
+	"comp_in,comp_out,comp_byp,comp_rsp,"
+	"ssl_reuse,ssl_full,ssl_ticket,ssl_fail,"
+	"log_supp,"
+	"qtime_p50,qtime_p90,qtime_p99,qtime_max,"
+	"ctime_p50,ctime_p90,ctime_p99,ctime_max,"
+	"rtime_p50,rtime_p90,rtime_p99,rtime_max,"
+	"ttime_p50,ttime_p90,ttime_p99,ttime_max,"
+	"\n";
+
 /* Dumps the stats CSV header to the trash buffer which. The caller is responsible
  * for clearing it if needed.
  */
 static void stats_dump_csv_header()
 {
-	chunk_appendf(&trash,
-	              "# pxname,svname,"
-	              "qcur,qmax,"
-	              "scur,smax,slim,stot,"
-	              "bin,bout,"
-	              "dreq,dresp,"
-	              "ereq,econ,eresp,"
-	              "wretr,wredis,"
-	              "status,weight,act,bck,"
-	              "chkfail,chkdown,lastchg,downtime,qlimit,"
-	              "pid,iid,sid,throttle,lbtot,tracked,type,"
-	              "rate,rate_lim,rate_max,"
-	              "check_status,check_code,check_duration,"
-	              "hrsp_1xx,hrsp_2xx,hrsp_3xx,hrsp_4xx,hrsp_5xx,hrsp_other,hanafail,"
-	              "req_rate,req_rate_max,req_tot,"
-	              "cli_abrt,srv_abrt,"
-	              "comp_in,comp_out,comp_byp,comp_rsp,"
-	              "\n");
+	chunk_appendf(&trash, "%s", stats_csv_header);
+}
+
+/* Returns the index of CSV field <name> of length <len>, or -1 if unknown */
+static int stats_csv_field(const char *name, int len)
+{
+	const char *p = stats_csv_header + 2; /* skip "# " */
+	const char *next;
+	int idx;
+
+	for (idx = 0; (next = strchr(p, ',')) != NULL; idx++, p = next + 1) {
+		if (next - p == len && memcmp(p, name, len) == 0)
+			return idx;
+	}
+	return -1;
+}
+
+/* Parses the comma-separated list of CSV field names <list> of length <len>
+ * and limits the CSV output of the stats context of <si> to these fields. The
+ * latency percentiles are not even computed when none of them is requested.
+ * Returns 0 on success, or -1 if a name is unknown or if no field was named.
+ */
+int stats_parse_fields(struct stream_interface *si, const char *list, int len)
+{
+	const char *end = list + len;
+	const char *next;
+	int idx, lat;
+
+	si->applet.ctx.stats.fields[0] = si->applet.ctx.stats.fields[1] = 0;
+	while (list < end) {
+		for (next = list; next < end && *next != ','; next++)
+			;
+		if (next > list) {
+			idx = stats_csv_field(list, next - list);
+			if (idx < 0 || idx >= 128)
+				return -1;
+			si->applet.ctx.stats.fields[idx / 64] |= 1ULL << (idx % 64);
+		}
+		list = next + 1;
+	}
+
+	if (!si->applet.ctx.stats.fields[0] && !si->applet.ctx.stats.fields[1])
+		return -1;
+
+	si->applet.ctx.stats.flags |= STAT_FIELDS | STAT_NO_LAT;
+
+	lat = stats_csv_field("qtime_p50", 9);
+	for (idx = lat; idx < lat + 4 * LAT_TIMERS; idx++)
+		if (si->applet.ctx.stats.fields[idx / 64] & (1ULL << (idx % 64)))
+			si->applet.ctx.stats.flags &= ~STAT_NO_LAT;
+	return 0;
+}
+
+/* Removes from the CSV line in <chk> the fields which were not requested in
+ * the stats context of <si>. The line is expected to end with a comma and a
+ * line feed, as all CSV lines do.
+ */
+static void stats_csv_project(struct stream_interface *si, struct chunk *chk)
+{
+	char *src = chk->str, *dst = chk->str, *end = chk->str + chk->len;
+	char *next;
+	int idx = 0;
+
+	if (src < end && *src == '#')
+		src = dst = src + 2; /* keep "# " on the header line */
+
+	while (src < end && (next = memchr(src, ',', end - src)) != NULL) {
+		next++;
+		if (idx < 128 && (si->applet.ctx.stats.fields[idx / 64] & (1ULL << (idx % 64)))) {
+			memmove(dst, src, next - src);
+			dst += next - src;
+		}
+		src = next;
+		idx++;
+	}
+	memmove(dst, src, end - src);
+	dst += end - src;
+	chk->len = dst - chk->str;
+}
+
+/* end of the time budget of the current dump call, see STATS_DUMP_BUDGET */
+static struct timeval stats_budget_end;
+static unsigned int stats_budget_calls;
+
+/* starts the time budget of a dump call */
+static void stats_budget_start()
+{
+	gettimeofday(&stats_budget_end, NULL);
+	stats_budget_end.tv_usec += STATS_DUMP_BUDGET;
+	if (stats_budget_end.tv_usec >= 1000000) {
+		stats_budget_end.tv_sec += stats_budget_end.tv_usec / 1000000;
+		stats_budget_end.tv_usec %= 1000000;
+	}
+	stats_budget_calls = 0;
+}
+
+/* Returns non-zero if the current dump call has exhausted its time budget, in
+ * which case the task of <si> is woken up so that the dump goes on after the
+ * other tasks had a chance to run. The clock is only read every 16 calls.
+ */
+static int stats_budget_expired(struct stream_interface *si)
+{
+	struct timeval tv;
+
+	if (++stats_budget_calls & 15)
+		return 0;
+
+	gettimeofday(&tv, NULL);
+	if (!tv_isge(&tv, &stats_budget_end))
+		return 0;
+
+	task_wakeup(si->owner, TASK_WOKEN_MSG);
+	return 1;
+}
+
+/* Appends string <str> to the trash. Returns 0 if it does not fit. */
+static inline int stats_putstr(const char *str)
+{
+	int len = strlen(str);
+
+	if (trash.len + len > trash.size)
+		return 0;
+	memcpy(trash.str + trash.len, str, len);
+	trash.len += len;
+	return 1;
+}
+
+/* Sends the CSV or HTML contents of the trash to the response channel of
+ * <si>, after having removed the CSV fields which were not requested. Returns
+ * the same as bi_putchk().
+ */
+static int stats_putchk(struct stream_interface *si)
+{
+	if ((si->applet.ctx.stats.flags & (STAT_FMT_HTML | STAT_FIELDS)) == STAT_FIELDS)
+		stats_csv_project(si, &trash);
+	return bi_putchk(si->ib, &trash);
+}
+
+/* names of the latency timers (LAT_*) on the HTML stats page */
+static const char *stats_lat_names[LAT_TIMERS] = {
+	[LAT_TW] = "Queue time",
+	[LAT_TC] = "Connect time",
+	[LAT_TR] = "Response time",
+	[LAT_TT] = "Total time",
+};
+
+/* Appends to the trash the CSV fields "p50,p90,p99,max" of each of the
+ * LAT_TIMERS latency histograms <lat>. Fields are left empty for timers
+ * without any sample, for all timers if <lat> is NULL, or if none of them
+ * was requested in the stats context of <si>.
+ */
+static void stats_dump_csv_lat(struct stream_interface *si, const struct lat_histo *lat)
+{
+	int t;
+
+	if (si->applet.ctx.stats.flags & STAT_NO_LAT)
+		lat = NULL;
+
+	for (t = 0; t < LAT_TIMERS; t++) {
+		if (!lat || !lat[t].count) {
+			chunk_appendf(&trash, ",,,,");
+			continue;
+		}
+		chunk_appendf(&trash, "%u,%u,%u,%u,",
+		              lat_histo_percentile(&lat[t], 50),
+		              lat_histo_percentile(&lat[t], 90),
+		              lat_histo_percentile(&lat[t], 99),
+		              lat[t].max);
+	}
+}
+
+/* Appends to the trash one HTML table row per latency histogram of <lat>
+ * having samples, reporting its percentiles and max.
+ */
+static void stats_dump_html_lat(const struct lat_histo *lat)
+{
+	int t;
+
+	for (t = 0; t < LAT_TIMERS; t++) {
+		if (!lat[t].count)
+			continue;
+		chunk_appendf(&trash,
+		              "<tr><th>%s p50/p90/p99/max:</th><td>%u/%u/%u/%u ms</td></tr>",
+		              stats_lat_names[t],
+		              lat_histo_percentile(&lat[t], 50),
+		              lat_histo_percentile(&lat[t], 90),
+		              lat_histo_percentile(&lat[t], 99),
+		              lat[t].max);
+	}
+}
+
+/* Appends to the trash the CSV fields "ssl_reuse,ssl_full,ssl_ticket,ssl_fail"
+ * for the incoming handshakes of bind line <bind_conf>, or for all bind lines
+ * of frontend <px> if <bind_conf> is NULL. Fields are left empty without SSL.
+ */
+static void stats_dump_csv_ssl_hs(struct proxy *px, struct bind_conf *bind_conf)
+{
+#ifdef USE_OPENSSL
+	unsigned long long full = 0, cache = 0, ticket = 0, fail = 0;
+	struct bind_conf *b;
+	int i, is_ssl = 0;
+
+	list_for_each_entry(b, &px->conf.bind, by_fe) {
+		if (!b->is_ssl || (bind_conf && b != bind_conf))
+			continue;
+		is_ssl = 1;
+		full   += b->ssl_hs.full;
+		cache  += b->ssl_hs.reuse_cache;
+		ticket += b->ssl_hs.reuse_ticket;
+		for (i = 0; i < SSL_HS_FAIL_REASONS; i++)
+			fail += b->ssl_hs.fail[i];
+	}
+	if (is_ssl) {
+		chunk_appendf(&trash, "%llu,%llu,%llu,%llu,", cache + ticket, full, ticket, fail);
+		return;
+	}
+#endif
+	chunk_appendf(&trash, ",,,,");
 }
 
 /* print a string of text buffer to <out>. The format is :
@@ -941,11 +1644,36 @@ static int stats_sock_parse_request(struct stream_interface *si, char *line)
 	si->applet.ctx.stats.flags = 0;
 	if (strcmp(args[0], "show") == 0) {
 		if (strcmp(args[1], "stat") == 0) {
-			if (*args[2] && *args[3] && *args[4]) {
+			int arg = 2;
+
+			if (strcmp(args[arg], "proc") == 0) {
+				si->applet.ctx.stats.flags |= STAT_SHOW_PROC;
+				arg++;
+			}
+
+			if (*args[arg] && strcmp(args[arg], "fields") != 0 && *args[arg + 1] && *args[arg + 2]) {
 				si->applet.ctx.stats.flags |= STAT_BOUND;
-				si->applet.ctx.stats.iid = atoi(args[2]);
-				si->applet.ctx.stats.type = atoi(args[3]);
-				si->applet.ctx.stats.sid = atoi(args[4]);
+				si->applet.ctx.stats.iid = atoi(args[arg]);
+				if (*args[arg] != '-' && !isdigit((unsigned char)*args[arg])) {
+					struct proxy *px = findproxy(args[arg], 0);
+
+					if (!px) {
+						si->applet.ctx.cli.msg = "No such proxy.\n";
+						si->applet.st0 = STAT_CLI_PRINT;
+						return 1;
+					}
+					si->applet.ctx.stats.iid = px->uuid;
+				}
+				si->applet.ctx.stats.type = atoi(args[arg + 1]);
+				si->applet.ctx.stats.sid = atoi(args[arg + 2]);
+				arg += 3;
+			}
+
+			if (strcmp(args[arg], "fields") == 0 &&
+			    stats_parse_fields(si, args[arg + 1], strlen(args[arg + 1])) < 0) {
+				si->applet.ctx.cli.msg = "Unknown field name.\n";
+				si->applet.st0 = STAT_CLI_PRINT;
+				return 1;
 			}
 
 			si->conn->xprt_st = STAT_ST_INIT;
@@ -972,6 +1700,37 @@ static int stats_sock_parse_request(struct stream_interface *si, char *line)
 			si->applet.ctx.sess.pos = 0;
 			si->applet.st0 = STAT_CLI_O_SESS; // stats_dump_sess_to_buffer
 		}
+#ifdef USE_OPENSSL
+		else if (strcmp(args[1], "ssl") == 0) {
+			si->applet.ctx.stats.px = proxy;
+			si->applet.ctx.stats.l = NULL;
+			si->conn->xprt_st = STAT_ST_INIT;
+			si->applet.st0 = STAT_CLI_O_SSL; // stats_dump_ssl_to_buffer
+		}
+#endif
+		else if (strcmp(args[1], "histo") == 0) {
+			si->applet.ctx.stats.flags = 0;
+			if (*args[2]) {
+				struct proxy *px = findproxy(args[2], 0);
+
+				if (!px) {
+					si->applet.ctx.cli.msg = "No such proxy.\n";
+					si->applet.st0 = STAT_CLI_PRINT;
+					return 1;
+				}
+				si->applet.ctx.stats.flags |= STAT_BOUND;
+				si->applet.ctx.stats.iid = px->uuid;
+			}
+			si->applet.ctx.stats.px = proxy;
+			si->applet.ctx.stats.px_st = STAT_PX_ST_FE;
+			si->applet.ctx.stats.sv = NULL;
+			si->conn->xprt_st = STAT_ST_INIT;
+			si->applet.st0 = STAT_CLI_O_HISTO; // stats_dump_histo_to_buffer
+		}
+		else if (strcmp(args[1], "metrics") == 0) {
+			si->conn->xprt_st = STAT_ST_INIT;
+			si->applet.st0 = STAT_CLI_O_METRICS; // stats_dump_metrics_to_buffer
+		}
 		else if (strcmp(args[1], "errors") == 0) {
 			if (s->listener->bind_conf->level < ACCESS_LVL_OPER) {
 				si->applet.ctx.cli.msg = stats_permission_denied_msg;
@@ -995,9 +1754,6 @@ static int stats_sock_parse_request(struct stream_interface *si, char *line)
 	}
 	else if (strcmp(args[0], "clear") == 0) {
 		if (strcmp(args[1], "counters") == 0) {
-			struct proxy *px;
-			struct server *sv;
-			struct listener *li;
 			int clrall = 0;
 
 			if (strcmp(args[2], "all") == 0)
@@ -1011,44 +1767,15 @@ static int stats_sock_parse_request(struct stream_interface *si, char *line)
 				return 1;
 			}
 
-			for (px = proxy; px; px = px->next) {
-				if (clrall) {
-					memset(&px->be_counters, 0, sizeof(px->be_counters));
-					memset(&px->fe_counters, 0, sizeof(px->fe_counters));
-				}
-				else {
-					px->be_counters.conn_max = 0;
-					px->be_counters.p.http.rps_max = 0;
-					px->be_counters.sps_max = 0;
-					px->be_counters.cps_max = 0;
-					px->be_counters.nbpend_max = 0;
-
-					px->fe_counters.conn_max = 0;
-					px->fe_counters.p.http.rps_max = 0;
-					px->fe_counters.sps_max = 0;
-					px->fe_counters.cps_max = 0;
-					px->fe_counters.nbpend_max = 0;
-				}
-
-				for (sv = px->srv; sv; sv = sv->next)
-					if (clrall)
-						memset(&sv->counters, 0, sizeof(sv->counters));
-					else {
-						sv->counters.cur_sess_max = 0;
-						sv->counters.nbpend_max = 0;
-						sv->counters.sps_max = 0;
-					}
+			stats_clear_counters(clrall);
 
-				list_for_each_entry(li, &px->conf.listeners, by_fe)
-					if (li->counters) {
-						if (clrall)
-							memset(li->counters, 0, sizeof(*li->counters));
-						else
-							li->counters->conn_max = 0;
-					}
+			/* let the other processes do the same */
+			if (stats_shared_hdr) {
+				if (clrall)
+					stats_clear_all_epoch = ++stats_shared_hdr->clear_all_epoch;
+				else
+					stats_clear_epoch = ++stats_shared_hdr->clear_epoch;
 			}
-
-			global.cps_max = 0;
 			return 1;
 		}
 		else if (strcmp(args[1], "table") == 0) {
@@ -1266,21 +1993,64 @@ static int stats_sock_parse_request(struct stream_interface *si, char *line)
 					v = atoi(args[4]);
 					global.comp_rate_lim = v * 1024; /* Kilo to bytes. */
 				}
-				else {
-					si->applet.ctx.cli.msg = "'set rate-limit http-compression' only supports 'global'.\n";
+				else {
+					si->applet.ctx.cli.msg = "'set rate-limit http-compression' only supports 'global'.\n";
+					si->applet.st0 = STAT_CLI_PRINT;
+					return 1;
+				}
+			}
+			else {
+				si->applet.ctx.cli.msg = "'set rate-limit' supports 'connections' and 'http-compression'.\n";
+				si->applet.st0 = STAT_CLI_PRINT;
+				return 1;
+			}
+		}
+		else if (strcmp(args[1], "table") == 0) {
+			stats_sock_table_request(si, args, STAT_CLI_O_SET);
+		}
+#if (defined USE_OPENSSL && defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+		else if (strcmp(args[1], "ssl") == 0) {
+			if (strcmp(args[2], "ocsp-response") == 0) {
+				char *err = NULL;
+				int len;
+
+				if (s->listener->bind_conf->level < ACCESS_LVL_ADMIN) {
+					si->applet.ctx.cli.msg = stats_permission_denied_msg;
+					si->applet.st0 = STAT_CLI_PRINT;
+					return 1;
+				}
+
+				if (!*args[3]) {
+					si->applet.ctx.cli.msg = "'set ssl ocsp-response' expects a base64 encoded OCSP response.\n";
+					si->applet.st0 = STAT_CLI_PRINT;
+					return 1;
+				}
+
+				len = base64dec(args[3], strlen(args[3]), trash.str, trash.size);
+				if (len < 0) {
+					si->applet.ctx.cli.msg = "'set ssl ocsp-response' received invalid base64 encoded response.\n";
 					si->applet.st0 = STAT_CLI_PRINT;
 					return 1;
 				}
+				trash.len = len;
+
+				if (ssl_sock_update_ocsp_response(&trash, &err)) {
+					chunk_printf(&trash, "%s.\n", err);
+					free(err);
+					si->applet.ctx.cli.msg = trash.str;
+				}
+				else
+					si->applet.ctx.cli.msg = "OCSP Response updated!\n";
+				si->applet.st0 = STAT_CLI_PRINT;
+				return 1;
 			}
 			else {
-				si->applet.ctx.cli.msg = "'set rate-limit' supports 'connections' and 'http-compression'.\n";
+				si->applet.ctx.cli.msg = "'set ssl' only supports 'ocsp-response'.\n";
 				si->applet.st0 = STAT_CLI_PRINT;
 				return 1;
 			}
 		}
-		else if (strcmp(args[1], "table") == 0) {
-			stats_sock_table_request(si, args, STAT_CLI_O_SET);
-		}
+#endif
 		else { /* unknown "set" parameter */
 			return 0;
 		}
@@ -1610,6 +2380,20 @@ static void cli_io_handler(struct stream_interface *si)
 				if (stats_dump_errors_to_buffer(si))
 					si->applet.st0 = STAT_CLI_PROMPT;
 				break;
+#ifdef USE_OPENSSL
+			case STAT_CLI_O_SSL:
+				if (stats_dump_ssl_to_buffer(si))
+					si->applet.st0 = STAT_CLI_PROMPT;
+				break;
+#endif
+			case STAT_CLI_O_HISTO:
+				if (stats_dump_histo_to_buffer(si))
+					si->applet.st0 = STAT_CLI_PROMPT;
+				break;
+			case STAT_CLI_O_METRICS:
+				if (stats_dump_metrics_to_buffer(si, NULL))
+					si->applet.st0 = STAT_CLI_PROMPT;
+				break;
 			case STAT_CLI_O_TAB:
 			case STAT_CLI_O_CLR:
 				if (stats_table_request(si, si->applet.st0))
@@ -1685,6 +2469,599 @@ static void cli_io_handler(struct stream_interface *si)
 	}
 }
 
+#ifdef USE_OPENSSL
+/* This function dumps the incoming SSL handshake statistics of all SSL bind
+ * lines onto the stream interface's read buffer, one CSV line per bind line.
+ * It returns 0 as long as it does not complete, non-zero upon completion. It
+ * resumes from the proxy and bind line stored in si->applet.ctx.stats.
+ */
+static int stats_dump_ssl_to_buffer(struct stream_interface *si)
+{
+	struct proxy *px;
+	struct bind_conf *bind_conf;
+	int i;
+
+	if (unlikely(si->ib->flags & (CF_WRITE_ERROR|CF_SHUTW)))
+		return 1;
+
+	if (si->conn->xprt_st == STAT_ST_INIT) {
+		chunk_printf(&trash,
+		             "# pxname,file,line,full,cache,ticket,"
+		             "fail_empty,fail_abort,fail_verify,fail_proto,fail_other,cpu_us,");
+		for (i = 0; i < SSL_HS_CPU_BUCKETS - 1; i++)
+			chunk_appendf(&trash, "cpu_lt%dus,", SSL_HS_CPU_MIN_US << i);
+		chunk_appendf(&trash, "cpu_more,\n");
+		if (bi_putchk(si->ib, &trash) == -1)
+			return 0;
+		si->conn->xprt_st = STAT_ST_LIST;
+	}
+
+	for (px = si->applet.ctx.stats.px; px; px = px->next) {
+		if (!(px->cap & PR_CAP_FE))
+			continue;
+
+		bind_conf = si->applet.ctx.stats.l;
+		if (!bind_conf)
+			bind_conf = LIST_ELEM(px->conf.bind.n, struct bind_conf *, by_fe);
+
+		for (; &bind_conf->by_fe != &px->conf.bind;
+		     bind_conf = LIST_ELEM(bind_conf->by_fe.n, struct bind_conf *, by_fe)) {
+			if (!bind_conf->is_ssl)
+				continue;
+
+			chunk_printf(&trash, "%s,%s,%d,%llu,%llu,%llu,",
+			             px->id, bind_conf->file, bind_conf->line,
+			             bind_conf->ssl_hs.full, bind_conf->ssl_hs.reuse_cache,
+			             bind_conf->ssl_hs.reuse_ticket);
+			for (i = 0; i < SSL_HS_FAIL_REASONS; i++)
+				chunk_appendf(&trash, "%llu,", bind_conf->ssl_hs.fail[i]);
+			chunk_appendf(&trash, "%llu,", bind_conf->ssl_hs.cpu_us);
+			for (i = 0; i < SSL_HS_CPU_BUCKETS; i++)
+				chunk_appendf(&trash, "%llu,", bind_conf->ssl_hs.cpu[i]);
+			chunk_appendf(&trash, "\n");
+
+			if (bi_putchk(si->ib, &trash) == -1) {
+				/* Socket buffer full. Let's try again later from the same point */
+				si->applet.ctx.stats.px = px;
+				si->applet.ctx.stats.l = bind_conf;
+				return 0;
+			}
+		}
+		si->applet.ctx.stats.l = NULL;
+	}
+	return 1;
+}
+#endif
+
+/* Appends to the trash one CSV line per non-empty latency histogram of <lat>,
+ * belonging to proxy <px> and object <name>.
+ */
+static void stats_dump_histo_lines(struct proxy *px, const char *name, const struct lat_histo *lat)
+{
+	static const char *timers[LAT_TIMERS] = {
+		[LAT_TW] = "Tw", [LAT_TC] = "Tc", [LAT_TR] = "Tr", [LAT_TT] = "Tt",
+	};
+	int t, b;
+
+	for (t = 0; t < LAT_TIMERS; t++) {
+		if (!lat[t].count)
+			continue;
+		chunk_appendf(&trash, "%s,%s,%s,%llu,%u,",
+		              px->id, name, timers[t], lat[t].count, lat[t].max);
+		for (b = 0; b < LAT_HISTO_BUCKETS; b++)
+			chunk_appendf(&trash, "%llu,", lat[t].bucket[b]);
+		chunk_appendf(&trash, "\n");
+	}
+}
+
+/* This function dumps the raw latency histograms of all frontends, servers and
+ * backends onto the stream interface's read buffer, in CSV format. Only the
+ * proxy designated by its uuid is dumped when STAT_BOUND is set. It returns 0
+ * as long as it does not complete, non-zero upon completion. It resumes from
+ * the proxy, state and server stored in si->applet.ctx.stats.
+ */
+static int stats_dump_histo_to_buffer(struct stream_interface *si)
+{
+	struct proxy *px;
+	struct server *sv;
+	int b;
+
+	if (unlikely(si->ib->flags & (CF_WRITE_ERROR|CF_SHUTW)))
+		return 1;
+
+	if (si->conn->xprt_st == STAT_ST_INIT) {
+		chunk_printf(&trash, "# pxname,svname,timer,count,max,");
+		for (b = 0; b < LAT_HISTO_BUCKETS - 1; b++)
+			chunk_appendf(&trash, "lt%u,", lat_histo_low(b + 1));
+		chunk_appendf(&trash, "more,\n");
+		if (bi_putchk(si->ib, &trash) == -1)
+			return 0;
+		si->conn->xprt_st = STAT_ST_LIST;
+	}
+
+	stats_budget_start();
+	for (px = si->applet.ctx.stats.px; px; px = px->next) {
+		if ((si->applet.ctx.stats.flags & STAT_BOUND) && px->uuid != si->applet.ctx.stats.iid)
+			continue;
+
+		if (si->applet.ctx.stats.px_st == STAT_PX_ST_FE) {
+			chunk_reset(&trash);
+			if (px->cap & PR_CAP_FE) {
+				stats_shared_enter(si, px, NULL, STATS_TYPE_FE);
+				stats_dump_histo_lines(px, "FRONTEND", px->fe_counters.lat);
+				stats_shared_leave(px, NULL, STATS_TYPE_FE);
+			}
+			if (bi_putchk(si->ib, &trash) == -1)
+				goto full;
+			si->applet.ctx.stats.px_st = STAT_PX_ST_SV;
+			si->applet.ctx.stats.sv = px->srv;
+		}
+
+		if (si->applet.ctx.stats.px_st == STAT_PX_ST_SV) {
+			for (sv = si->applet.ctx.stats.sv; sv; sv = sv->next) {
+				if (stats_budget_expired(si)) {
+					si->applet.ctx.stats.sv = sv;
+					goto full;
+				}
+				chunk_reset(&trash);
+				stats_shared_enter(si, px, sv, STATS_TYPE_SV);
+				stats_dump_histo_lines(px, sv->id, sv->counters.lat);
+				stats_shared_leave(px, sv, STATS_TYPE_SV);
+				if (bi_putchk(si->ib, &trash) == -1) {
+					si->applet.ctx.stats.sv = sv;
+					goto full;
+				}
+			}
+			si->applet.ctx.stats.px_st = STAT_PX_ST_BE;
+		}
+
+		chunk_reset(&trash);
+		if (px->cap & PR_CAP_BE) {
+			stats_shared_enter(si, px, NULL, STATS_TYPE_BE);
+			stats_dump_histo_lines(px, "BACKEND", px->be_counters.lat);
+			stats_shared_leave(px, NULL, STATS_TYPE_BE);
+		}
+		if (bi_putchk(si->ib, &trash) == -1)
+			goto full;
+		si->applet.ctx.stats.px_st = STAT_PX_ST_FE;
+	}
+	return 1;
+
+ full:
+	/* Socket buffer full. Let's try again later from the same point */
+	si->applet.ctx.stats.px = px;
+	return 0;
+}
+
+/* Metrics reported by "show metrics" and the ";metrics" stats URI, in the
+ * Prometheus text exposition format. Each entry describes one metric family
+ * for one type of object (STATS_TYPE_FE, STATS_TYPE_BE or STATS_TYPE_SV).
+ */
+enum {
+	MET_CUR_SESS = 0,	/* current sessions */
+	MET_MAX_SESS,		/* max sessions */
+	MET_LIM_SESS,		/* session limit */
+	MET_CUR_QUEUE,		/* current queue */
+	MET_MAX_QUEUE,		/* max queue */
+	MET_CUM_CONN,		/* total connections */
+	MET_CUM_SESS,		/* total sessions */
+	MET_CUM_LBCONN,		/* total load-balanced sessions */
+	MET_CUM_REQ,		/* total HTTP requests */
+	MET_SESS_RATE,		/* current session rate */
+	MET_CONN_RATE,		/* current connection rate */
+	MET_REQ_RATE,		/* current HTTP request rate */
+	MET_BYTES_IN,		/* total bytes in */
+	MET_BYTES_OUT,		/* total bytes out */
+	MET_DENIED_REQ,		/* denied requests */
+	MET_DENIED_RESP,	/* denied responses */
+	MET_DENIED_CONN,	/* denied connections */
+	MET_FAILED_REQ,		/* request errors */
+	MET_FAILED_CONNS,	/* connection errors */
+	MET_FAILED_RESP,	/* response errors */
+	MET_RETRIES,		/* retries */
+	MET_REDISPATCHES,	/* redispatches */
+	MET_CLI_ABORTS,		/* client aborts */
+	MET_SRV_ABORTS,		/* server aborts */
+	MET_HTTP_RSP,		/* HTTP responses per status class */
+	MET_COMP_IN,		/* bytes fed to the compressor */
+	MET_COMP_OUT,		/* bytes emitted by the compressor */
+	MET_COMP_BYP,		/* bytes which bypassed the compressor */
+	MET_COMP_RSP,		/* compressed responses */
+	MET_FAILED_CHECKS,	/* failed health checks */
+	MET_DOWN_TRANS,		/* UP to DOWN transitions */
+	MET_UP,			/* 1 if UP, otherwise 0 */
+	MET_WEIGHT,		/* effective weight */
+	MET_ACT_SRV,		/* active servers */
+	MET_BCK_SRV,		/* backup servers */
+};
+
+/* how the values of the processes are merged when the counters are shared */
+enum {
+	MET_AGG_SUM = 0,	/* sum of all processes */
+	MET_AGG_MAX,		/* highest value */
+	MET_AGG_LOCAL,		/* state of the current process only */
+};
+
+struct stats_metric {
+	int obj;		/* STATS_TYPE_* */
+	int id;			/* MET_* */
+	int agg;		/* MET_AGG_* */
+	const char *name;	/* name after "haproxy_<object>_" */
+	const char *type;	/* "counter" or "gauge" */
+	const char *help;	/* description */
+};
+
+static const struct stats_metric stats_metrics[] = {
+	{ STATS_TYPE_FE, MET_CUR_SESS,     MET_AGG_SUM,   "current_sessions",            "gauge",   "Current number of sessions." },
+	{ STATS_TYPE_FE, MET_MAX_SESS,     MET_AGG_MAX,   "max_sessions",                "gauge",   "Maximum observed number of sessions." },
+	{ STATS_TYPE_FE, MET_LIM_SESS,     MET_AGG_LOCAL, "limit_sessions",              "gauge",   "Configured session limit." },
+	{ STATS_TYPE_FE, MET_CUM_CONN,     MET_AGG_SUM,   "connections_total",           "counter", "Total number of connections." },
+	{ STATS_TYPE_FE, MET_CUM_SESS,     MET_AGG_SUM,   "sessions_total",              "counter", "Total number of sessions." },
+	{ STATS_TYPE_FE, MET_CUM_REQ,      MET_AGG_SUM,   "http_requests_total",         "counter", "Total number of HTTP requests." },
+	{ STATS_TYPE_FE, MET_SESS_RATE,    MET_AGG_SUM,   "current_session_rate",        "gauge",   "Number of sessions over the last second." },
+	{ STATS_TYPE_FE, MET_CONN_RATE,    MET_AGG_SUM,   "current_connection_rate",     "gauge",   "Number of connections over the last second." },
+	{ STATS_TYPE_FE, MET_REQ_RATE,     MET_AGG_SUM,   "current_http_request_rate",   "gauge",   "Number of HTTP requests over the last second." },
+	{ STATS_TYPE_FE, MET_BYTES_IN,     MET_AGG_SUM,   "bytes_in_total",              "counter", "Total number of bytes received from the clients." },
+	{ STATS_TYPE_FE, MET_BYTES_OUT,    MET_AGG_SUM,   "bytes_out_total",             "counter", "Total number of bytes sent to the clients." },
+	{ STATS_TYPE_FE, MET_DENIED_REQ,   MET_AGG_SUM,   "requests_denied_total",       "counter", "Total number of denied requests." },
+	{ STATS_TYPE_FE, MET_DENIED_RESP,  MET_AGG_SUM,   "responses_denied_total",      "counter", "Total number of denied responses." },
+	{ STATS_TYPE_FE, MET_DENIED_CONN,  MET_AGG_SUM,   "connections_denied_total",    "counter", "Total number of connections denied by tcp-request rules." },
+	{ STATS_TYPE_FE, MET_FAILED_REQ,   MET_AGG_SUM,   "request_errors_total",        "counter", "Total number of request errors." },
+	{ STATS_TYPE_FE, MET_HTTP_RSP,     MET_AGG_SUM,   "http_responses_total",        "counter", "Total number of HTTP responses per status class." },
+	{ STATS_TYPE_FE, MET_COMP_IN,      MET_AGG_SUM,   "compressor_bytes_in_total",   "counter", "Total number of bytes fed to the compressor." },
+	{ STATS_TYPE_FE, MET_COMP_OUT,     MET_AGG_SUM,   "compressor_bytes_out_total",  "counter", "Total number of bytes emitted by the compressor." },
+	{ STATS_TYPE_FE, MET_COMP_BYP,     MET_AGG_SUM,   "compressor_bypassed_bytes_total", "counter", "Total number of bytes which bypassed the compressor." },
+	{ STATS_TYPE_FE, MET_COMP_RSP,     MET_AGG_SUM,   "http_responses_compressed_total", "counter", "Total number of compressed HTTP responses." },
+
+	{ STATS_TYPE_BE, MET_CUR_QUEUE,    MET_AGG_SUM,   "current_queue",               "gauge",   "Current number of queued requests with no server assigned." },
+	{ STATS_TYPE_BE, MET_MAX_QUEUE,    MET_AGG_MAX,   "max_queue",                   "gauge",   "Maximum observed number of queued requests." },
+	{ STATS_TYPE_BE, MET_CUR_SESS,     MET_AGG_SUM,   "current_sessions",            "gauge",   "Current number of sessions." },
+	{ STATS_TYPE_BE, MET_MAX_SESS,     MET_AGG_MAX,   "max_sessions",                "gauge",   "Maximum observed number of sessions." },
+	{ STATS_TYPE_BE, MET_CUM_SESS,     MET_AGG_SUM,   "sessions_total",              "counter", "Total number of sessions." },
+	{ STATS_TYPE_BE, MET_CUM_LBCONN,   MET_AGG_SUM,   "loadbalanced_total",          "counter", "Total number of times a server was selected by load balancing." },
+	{ STATS_TYPE_BE, MET_CUM_REQ,      MET_AGG_SUM,   "http_requests_total",         "counter", "Total number of HTTP requests." },
+	{ STATS_TYPE_BE, MET_SESS_RATE,    MET_AGG_SUM,   "current_session_rate",        "gauge",   "Number of sessions over the last second." },
+	{ STATS_TYPE_BE, MET_BYTES_IN,     MET_AGG_SUM,   "bytes_in_total",              "counter", "Total number of bytes received from the clients." },
+	{ STATS_TYPE_BE, MET_BYTES_OUT,    MET_AGG_SUM,   "bytes_out_total",             "counter", "Total number of bytes sent to the clients." },
+	{ STATS_TYPE_BE, MET_DENIED_REQ,   MET_AGG_SUM,   "requests_denied_total",       "counter", "Total number of denied requests." },
+	{ STATS_TYPE_BE, MET_DENIED_RESP,  MET_AGG_SUM,   "responses_denied_total",      "counter", "Total number of denied responses." },
+	{ STATS_TYPE_BE, MET_FAILED_CONNS, MET_AGG_SUM,   "connection_errors_total",     "counter", "Total number of connection errors." },
+	{ STATS_TYPE_BE, MET_FAILED_RESP,  MET_AGG_SUM,   "response_errors_total",       "counter", "Total number of response errors." },
+	{ STATS_TYPE_BE, MET_RETRIES,      MET_AGG_SUM,   "retry_warnings_total",        "counter", "Total number of connection retries." },
+	{ STATS_TYPE_BE, MET_REDISPATCHES, MET_AGG_SUM,   "redispatch_warnings_total",   "counter", "Total number of redispatches." },
+	{ STATS_TYPE_BE, MET_CLI_ABORTS,   MET_AGG_SUM,   "client_aborts_total",         "counter", "Total number of data transfers aborted by the client." },
+	{ STATS_TYPE_BE, MET_SRV_ABORTS,   MET_AGG_SUM,   "server_aborts_total",         "counter", "Total number of data transfers aborted by the server." },
+	{ STATS_TYPE_BE, MET_HTTP_RSP,     MET_AGG_SUM,   "http_responses_total",        "counter", "Total number of HTTP responses per status class." },
+	{ STATS_TYPE_BE, MET_COMP_IN,      MET_AGG_SUM,   "compressor_bytes_in_total",   "counter", "Total number of bytes fed to the compressor." },
+	{ STATS_TYPE_BE, MET_COMP_OUT,     MET_AGG_SUM,   "compressor_bytes_out_total",  "counter", "Total number of bytes emitted by the compressor." },
+	{ STATS_TYPE_BE, MET_COMP_BYP,     MET_AGG_SUM,   "compressor_bypassed_bytes_total", "counter", "Total number of bytes which bypassed the compressor." },
+	{ STATS_TYPE_BE, MET_COMP_RSP,     MET_AGG_SUM,   "http_responses_compressed_total", "counter", "Total number of compressed HTTP responses." },
+	{ STATS_TYPE_BE, MET_UP,           MET_AGG_LOCAL, "up",                          "gauge",   "1 if the backend has usable servers or no server at all, otherwise 0." },
+	{ STATS_TYPE_BE, MET_WEIGHT,       MET_AGG_LOCAL, "weight",                      "gauge",   "Total effective weight of the usable servers." },
+	{ STATS_TYPE_BE, MET_ACT_SRV,      MET_AGG_LOCAL, "active_servers",              "gauge",   "Current number of usable active servers." },
+	{ STATS_TYPE_BE, MET_BCK_SRV,      MET_AGG_LOCAL, "backup_servers",              "gauge",   "Current number of usable backup servers." },
+
+	{ STATS_TYPE_SV, MET_CUR_QUEUE,    MET_AGG_SUM,   "current_queue",               "gauge",   "Current number of queued requests." },
+	{ STATS_TYPE_SV, MET_MAX_QUEUE,    MET_AGG_MAX,   "max_queue",                   "gauge",   "Maximum observed number of queued requests." },
+	{ STATS_TYPE_SV, MET_CUR_SESS,     MET_AGG_SUM,   "current_sessions",            "gauge",   "Current number of sessions." },
+	{ STATS_TYPE_SV, MET_MAX_SESS,     MET_AGG_MAX,   "max_sessions",                "gauge",   "Maximum observed number of sessions." },
+	{ STATS_TYPE_SV, MET_LIM_SESS,     MET_AGG_LOCAL, "limit_sessions",              "gauge",   "Configured session limit, 0 if unlimited." },
+	{ STATS_TYPE_SV, MET_CUM_SESS,     MET_AGG_SUM,   "sessions_total",              "counter", "Total number of sessions." },
+	{ STATS_TYPE_SV, MET_CUM_LBCONN,   MET_AGG_SUM,   "loadbalanced_total",          "counter", "Total number of times the server was selected by load balancing." },
+	{ STATS_TYPE_SV, MET_SESS_RATE,    MET_AGG_SUM,   "current_session_rate",        "gauge",   "Number of sessions over the last second." },
+	{ STATS_TYPE_SV, MET_BYTES_IN,     MET_AGG_SUM,   "bytes_in_total",              "counter", "Total number of bytes received from the clients." },
+	{ STATS_TYPE_SV, MET_BYTES_OUT,    MET_AGG_SUM,   "bytes_out_total",             "counter", "Total number of bytes sent to the clients." },
+	{ STATS_TYPE_SV, MET_DENIED_RESP,  MET_AGG_SUM,   "responses_denied_total",      "counter", "Total number of denied responses." },
+	{ STATS_TYPE_SV, MET_FAILED_CONNS, MET_AGG_SUM,   "connection_errors_total",     "counter", "Total number of connection errors." },
+	{ STATS_TYPE_SV, MET_FAILED_RESP,  MET_AGG_SUM,   "response_errors_total",       "counter", "Total number of response errors." },
+	{ STATS_TYPE_SV, MET_RETRIES,      MET_AGG_SUM,   "retry_warnings_total",        "counter", "Total number of connection retries." },
+	{ STATS_TYPE_SV, MET_REDISPATCHES, MET_AGG_SUM,   "redispatch_warnings_total",   "counter", "Total number of redispatches." },
+	{ STATS_TYPE_SV, MET_CLI_ABORTS,   MET_AGG_SUM,   "client_aborts_total",         "counter", "Total number of data transfers aborted by the client." },
+	{ STATS_TYPE_SV, MET_SRV_ABORTS,   MET_AGG_SUM,   "server_aborts_total",         "counter", "Total number of data transfers aborted by the server." },
+	{ STATS_TYPE_SV, MET_HTTP_RSP,     MET_AGG_SUM,   "http_responses_total",        "counter", "Total number of HTTP responses per status class." },
+	{ STATS_TYPE_SV, MET_FAILED_CHECKS, MET_AGG_SUM,  "check_failures_total",        "counter", "Total number of failed health checks." },
+	{ STATS_TYPE_SV, MET_DOWN_TRANS,   MET_AGG_SUM,   "check_down_total",            "counter", "Total number of UP to DOWN transitions." },
+	{ STATS_TYPE_SV, MET_UP,           MET_AGG_LOCAL, "up",                          "gauge",   "1 if the server is UP or not checked, otherwise 0." },
+	{ STATS_TYPE_SV, MET_WEIGHT,       MET_AGG_LOCAL, "weight",                      "gauge",   "Effective weight of the server." },
+};
+
+#define STATS_METRICS (sizeof(stats_metrics) / sizeof(stats_metrics[0]))
+
+static const char *stats_metric_objs[] = {
+	[STATS_TYPE_FE] = "frontend",
+	[STATS_TYPE_BE] = "backend",
+	[STATS_TYPE_SV] = "server",
+};
+
+/* status class labels, indexed like the p.http.rsp[] counters */
+static const char *stats_metric_codes[6] = { "other", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+/* Where the values of a metric are read from : either the live objects or the
+ * record published by another process when the counters are shared.
+ */
+struct stats_metric_src {
+	struct proxy *px;
+	struct server *sv;
+	unsigned int cur, pend;
+	struct freq_ctr *sess, *conn, *req;
+	struct pxcounters *pxc;			/* FE and BE */
+	struct srvcounters *svc;		/* servers */
+};
+
+/* Fills <src> for the designated object from the live values if <proc> is
+ * zero, otherwise from the record of process <proc> in the shared area. The
+ * shared records are read without the sequence number since each metric is a
+ * single aligned field.
+ */
+static void stats_metric_src(struct stats_metric_src *src, struct proxy *px, struct server *sv, int type, int proc)
+{
+	struct shared_counters *rec;
+
+	src->px = px;
+	src->sv = sv;
+	if (proc) {
+		rec = stats_shared_rec(stats_shared_slot(px, sv, type), proc);
+		src->cur  = rec->cur;
+		src->pend = rec->pend;
+		src->sess = &rec->sess_per_sec;
+		src->conn = &rec->conn_per_sec;
+		src->req  = &rec->req_per_sec;
+		src->pxc  = &rec->c.px;
+		src->svc  = &rec->c.sv;
+	}
+	else if (type == STATS_TYPE_FE) {
+		src->cur  = px->feconn;
+		src->pend = 0;
+		src->sess = &px->fe_sess_per_sec;
+		src->conn = &px->fe_conn_per_sec;
+		src->req  = &px->fe_req_per_sec;
+		src->pxc  = &px->fe_counters;
+	}
+	else if (type == STATS_TYPE_BE) {
+		src->cur  = px->beconn;
+		src->pend = px->nbpend;
+		src->sess = &px->be_sess_per_sec;
+		src->pxc  = &px->be_counters;
+	}
+	else {
+		src->cur  = sv->cur_sess;
+		src->pend = sv->nbpend;
+		src->sess = &sv->sess_per_sec;
+		src->svc  = &sv->counters;
+	}
+}
+
+/* Returns the value of metric <m> from <src>. <code> designates the status
+ * class for MET_HTTP_RSP.
+ */
+static unsigned long long stats_metric_value(const struct stats_metric *m, struct stats_metric_src *src, int code)
+{
+	struct proxy *px = src->px;
+	struct server *sv = src->sv, *svs;
+	int is_sv = (m->obj == STATS_TYPE_SV);
+
+	switch (m->id) {
+	case MET_CUR_SESS:      return src->cur;
+	case MET_MAX_SESS:      return is_sv ? src->svc->cur_sess_max : src->pxc->conn_max;
+	case MET_LIM_SESS:      return is_sv ? sv->maxconn : px->maxconn;
+	case MET_CUR_QUEUE:     return src->pend;
+	case MET_MAX_QUEUE:     return is_sv ? src->svc->nbpend_max : src->pxc->nbpend_max;
+	case MET_CUM_CONN:      return src->pxc->cum_conn;
+	case MET_CUM_SESS:      return is_sv ? src->svc->cum_sess : (m->obj == STATS_TYPE_BE) ? src->pxc->cum_conn : src->pxc->cum_sess;
+	case MET_CUM_LBCONN:    return is_sv ? src->svc->cum_lbconn : src->pxc->cum_lbconn;
+	case MET_CUM_REQ:       return src->pxc->p.http.cum_req;
+	case MET_SESS_RATE:     return read_freq_ctr(src->sess);
+	case MET_CONN_RATE:     return read_freq_ctr(src->conn);
+	case MET_REQ_RATE:      return read_freq_ctr(src->req);
+	case MET_BYTES_IN:      return is_sv ? src->svc->bytes_in : src->pxc->bytes_in;
+	case MET_BYTES_OUT:     return is_sv ? src->svc->bytes_out : src->pxc->bytes_out;
+	case MET_DENIED_REQ:    return src->pxc->denied_req;
+	case MET_DENIED_RESP:   return is_sv ? src->svc->failed_secu : src->pxc->denied_resp;
+	case MET_DENIED_CONN:   return src->pxc->denied_conn;
+	case MET_FAILED_REQ:    return src->pxc->failed_req;
+	case MET_FAILED_CONNS:  return is_sv ? src->svc->failed_conns : src->pxc->failed_conns;
+	case MET_FAILED_RESP:   return is_sv ? src->svc->failed_resp : src->pxc->failed_resp;
+	case MET_RETRIES:       return is_sv ? src->svc->retries : src->pxc->retries;
+	case MET_REDISPATCHES:  return is_sv ? src->svc->redispatches : src->pxc->redispatches;
+	case MET_CLI_ABORTS:    return is_sv ? src->svc->cli_aborts : src->pxc->cli_aborts;
+	case MET_SRV_ABORTS:    return is_sv ? src->svc->srv_aborts : src->pxc->srv_aborts;
+	case MET_HTTP_RSP:      return is_sv ? src->svc->p.http.rsp[code] : src->pxc->p.http.rsp[code];
+	case MET_COMP_IN:       return src->pxc->comp_in;
+	case MET_COMP_OUT:      return src->pxc->comp_out;
+	case MET_COMP_BYP:      return src->pxc->comp_byp;
+	case MET_COMP_RSP:      return src->pxc->p.http.comp_rsp;
+	case MET_FAILED_CHECKS: return src->svc->failed_checks;
+	case MET_DOWN_TRANS:    return src->svc->down_trans;
+	case MET_UP:
+		if (!is_sv)
+			return px->lbprm.tot_weight > 0 || !px->srv;
+		svs = sv->track ? sv->track : sv;
+		if (sv->state & SRV_MAINTAIN)
+			return 0;
+		return !(svs->state & (SRV_CHECKED | SRV_AGENT_CHECKED)) || (svs->state & SRV_RUNNING);
+	case MET_WEIGHT:
+		if (is_sv)
+			return (sv->eweight * px->lbprm.wmult + px->lbprm.wdiv - 1) / px->lbprm.wdiv;
+		return (px->lbprm.tot_weight * px->lbprm.wmult + px->lbprm.wdiv - 1) / px->lbprm.wdiv;
+	case MET_ACT_SRV:       return px->srv_act;
+	case MET_BCK_SRV:       return px->srv_bck;
+	}
+	return 0;
+}
+
+
+/* Appends the lines of metric <m> for the designated object to the trash.
+ * The values are summed or maxed over all processes when the counters are
+ * shared. Returns 0 if the trash is full. Proxy and server names only contain
+ * characters which do not need to be escaped in label values.
+ */
+static int stats_dump_metric(const struct stats_metric *m, struct proxy *px, struct server *sv)
+{
+	struct stats_metric_src src;
+	unsigned long long val, oth;
+	int code, codes, p;
+	char *end;
+
+	codes = (m->id == MET_HTTP_RSP) ? 6 : 1;
+	for (code = 0; code < codes; code++) {
+		stats_metric_src(&src, px, sv, m->obj, 0);
+		val = stats_metric_value(m, &src, code);
+
+		if (stats_shared_area && m->agg != MET_AGG_LOCAL) {
+			for (p = 1; p <= global.nbproc; p++) {
+				if (p == relative_pid)
+					continue;
+				stats_metric_src(&src, px, sv, m->obj, p);
+				oth = stats_metric_value(m, &src, code);
+				if (m->agg == MET_AGG_SUM)
+					val += oth;
+				else if (oth > val)
+					val = oth;
+			}
+		}
+
+		if (!stats_putstr("haproxy_") ||
+		    !stats_putstr(stats_metric_objs[m->obj]) ||
+		    !stats_putstr("_") ||
+		    !stats_putstr(m->name) ||
+		    !stats_putstr("{proxy=\"") ||
+		    !stats_putstr(px->id))
+			return 0;
+
+		if (sv && (!stats_putstr("\",server=\"") || !stats_putstr(sv->id)))
+			return 0;
+
+		if (codes > 1 && (!stats_putstr("\",code=\"") || !stats_putstr(stats_metric_codes[code])))
+			return 0;
+
+		if (!stats_putstr("\"} "))
+			return 0;
+
+		end = ulltoa(val, trash.str + trash.len, trash.size - trash.len);
+		if (!end || end + 1 >= trash.str + trash.size)
+			return 0;
+		*end++ = '\n';
+		trash.len = end - trash.str;
+	}
+	return 1;
+}
+
+/* Returns non-zero if proxy <px> may be dumped on the stats page of <uri>
+ * according to its "stats scope" list, where "." designates the backend of
+ * the current session, and to the scope requested by the user, if any. <uri>
+ * is NULL on the CLI.
+ */
+static int stats_px_in_scope(struct stream_interface *si, struct uri_auth *uri, struct proxy *px)
+{
+	struct session *s = si->conn->xprt_ctx;
+
+	if (uri && uri->scope) {
+		/* we have a limited scope, we have to check the proxy name */
+		struct stat_scope *scope;
+		int len;
+
+		len = strlen(px->id);
+		scope = uri->scope;
+
+		while (scope) {
+			/* match exact proxy name */
+			if (scope->px_len == len && !memcmp(px->id, scope->px_id, len))
+				break;
+
+			/* match '.' which means 'self' proxy */
+			if (!strcmp(scope->px_id, ".") && px == s->be)
+				break;
+			scope = scope->next;
+		}
+
+		/* proxy name not found : don't dump anything */
+		if (scope == NULL)
+			return 0;
+	}
+
+	/* if the user has requested a limited output and the proxy
+	 * name does not match, skip it.
+	 */
+	if (si->applet.ctx.stats.scope_len &&
+	    strnistr(px->id, strlen(px->id), bo_ptr(si->ob->buf) + si->applet.ctx.stats.scope_str, si->applet.ctx.stats.scope_len) == NULL)
+		return 0;
+
+	return 1;
+}
+
+/* This function dumps the metrics of all frontends, backends and servers onto
+ * the stream interface's read buffer in the Prometheus text format. All the
+ * lines of a metric are grouped after its HELP and TYPE lines, so the proxies
+ * are walked once per metric. Only the proxies in the scope of <uri> are
+ * dumped, as on the stats page. It returns 0 as long as it does not complete,
+ * non-zero upon completion. It resumes from the metric, proxy and server
+ * stored in si->applet.ctx.stats, px_st being STAT_PX_ST_TH until the metric's
+ * header is emitted.
+ */
+static int stats_dump_metrics_to_buffer(struct stream_interface *si, struct uri_auth *uri)
+{
+	const struct stats_metric *m;
+	struct proxy *px;
+	struct server *sv;
+
+	if (unlikely(si->ib->flags & (CF_WRITE_ERROR|CF_SHUTW)))
+		return 1;
+
+	stats_budget_start();
+	if (si->conn->xprt_st == STAT_ST_INIT) {
+		si->applet.ctx.stats.metric = 0;
+		si->applet.ctx.stats.px_st = STAT_PX_ST_TH;
+		si->conn->xprt_st = STAT_ST_LIST;
+	}
+
+	for (; si->applet.ctx.stats.metric < STATS_METRICS; si->applet.ctx.stats.metric++) {
+		m = &stats_metrics[si->applet.ctx.stats.metric];
+
+		if (si->applet.ctx.stats.px_st == STAT_PX_ST_TH) {
+			chunk_printf(&trash,
+			             "# HELP haproxy_%s_%s %s\n"
+			             "# TYPE haproxy_%s_%s %s\n",
+			             stats_metric_objs[m->obj], m->name, m->help,
+			             stats_metric_objs[m->obj], m->name, m->type);
+			if (bi_putchk(si->ib, &trash) == -1)
+				return 0;
+			si->applet.ctx.stats.px = proxy;
+			si->applet.ctx.stats.sv = NULL;
+			si->applet.ctx.stats.px_st = STAT_PX_ST_LI;
+		}
+
+		for (; si->applet.ctx.stats.px; si->applet.ctx.stats.px = px->next, si->applet.ctx.stats.sv = NULL) {
+			px = si->applet.ctx.stats.px;
+			if (stats_budget_expired(si))
+				return 0;
+
+			/* same proxies as in the stats page */
+			if (px->state == PR_STSTOPPED || px->uuid <= 0 ||
+			    !(px->cap & (m->obj == STATS_TYPE_FE ? PR_CAP_FE : PR_CAP_BE)) ||
+			    !stats_px_in_scope(si, uri, px))
+				continue;
+
+			if (m->obj != STATS_TYPE_SV) {
+				chunk_reset(&trash);
+				if (stats_dump_metric(m, px, NULL) && bi_putchk(si->ib, &trash) == -1)
+					return 0;
+				continue;
+			}
+
+			for (sv = si->applet.ctx.stats.sv ? si->applet.ctx.stats.sv : px->srv; sv; sv = sv->next) {
+				chunk_reset(&trash);
+				if (stats_budget_expired(si) ||
+				    (stats_dump_metric(m, px, sv) && bi_putchk(si->ib, &trash) == -1)) {
+					si->applet.ctx.stats.sv = sv;
+					return 0;
+				}
+			}
+		}
+		si->applet.ctx.stats.px_st = STAT_PX_ST_TH;
+	}
+	return 1;
+}
+
 /* This function dumps information onto the stream interface's read buffer.
  * It returns 0 as long as it does not complete, non-zero upon completion.
  * No state is used.
@@ -1714,12 +3091,33 @@ static int stats_dump_info_to_buffer(struct stream_interface *si)
 	             "ConnRate: %d\n"
 	             "ConnRateLimit: %d\n"
 	             "MaxConnRate: %d\n"
+	             "ChkRate: %d\n"
+	             "ChkRateLimit: %d\n"
+	             "ChkRunning: %u\n"
+	             "ChkStarted: %llu\n"
+	             "ChkReused: %llu\n"
+	             "ChkDelayed: %llu\n"
+	             "ChkLagAvg: %llu\n"
+	             "ChkLagMax: %u\n"
+	             "LogSent: %llu\n"
+	             "LogDropped: %llu\n"
+	             "LogBatches: %llu\n"
+	             "LogSuppressed: %llu\n"
 	             "CompressBpsIn: %u\n"
 	             "CompressBpsOut: %u\n"
 	             "CompressBpsRateLim: %u\n"
 #ifdef USE_ZLIB
 	             "ZlibMemUsage: %ld\n"
 	             "MaxZlibMemUsage: %ld\n"
+#endif
+#ifdef USE_OPENSSL
+	             "SslRecordsSmall: %llu\n"
+	             "SslRecordsMedium: %llu\n"
+	             "SslRecordsLarge: %llu\n"
+	             "SslLazyCtx: %u\n"
+	             "SslLazyCtxLoads: %llu\n"
+	             "SslReadAheadReads: %llu\n"
+	             "SslReadAheadRecv: %llu\n"
 #endif
 	             "Tasks: %d\n"
 	             "Run_queue: %d\n"
@@ -1737,10 +3135,21 @@ static int stats_dump_info_to_buffer(struct stream_interface *si)
 	             global.maxsock, global.maxconn, global.hardmaxconn, global.maxpipes,
 	             actconn, pipes_used, pipes_free,
 	             read_freq_ctr(&global.conn_per_sec), global.cps_lim, global.cps_max,
+	             read_freq_ctr(&global.chk_per_sec), global.chks_lim, check_sched.running,
+	             check_sched.started, check_sched.reused, check_sched.delayed,
+	             check_sched.started ? check_sched.lag_total / check_sched.started : 0,
+	             check_sched.lag_max,
+	             log_counters.sent, log_counters.dropped, log_counters.batches,
+	             log_counters.suppressed,
 	             read_freq_ctr(&global.comp_bps_in), read_freq_ctr(&global.comp_bps_out),
 	             global.comp_rate_lim,
 #ifdef USE_ZLIB
 	             zlib_used_memory, global.maxzlibmem,
+#endif
+#ifdef USE_OPENSSL
+	             ssl_records[SSL_REC_SMALL], ssl_records[SSL_REC_MEDIUM], ssl_records[SSL_REC_LARGE],
+	             ssl_lazy_ctx_cur, ssl_lazy_ctx_loads,
+	             ssl_bio_reads, ssl_bio_recv,
 #endif
 	             nb_tasks_cur, run_queue_cur, idle_pct,
 	             global.node, global.desc ? global.desc : ""
@@ -1859,6 +3268,9 @@ static int stats_dump_fe_stats(struct stream_interface *si, struct proxy *px)
 			              U2H(px->fe_counters.intercepted_req));
 		}
 
+		/* latency percentiles (via hover) */
+		stats_dump_html_lat(px->fe_counters.lat);
+
 		chunk_appendf(&trash,
 		              "</table></div></u></td>"
 		              /* sessions: lbtot */
@@ -1926,7 +3338,7 @@ static int stats_dump_fe_stats(struct stream_interface *si, struct proxy *px)
 		              px->fe_counters.failed_req,
 		              px->state == PR_STREADY ? "OPEN" :
 		              px->state == PR_STFULL ? "FULL" : "STOP",
-		              relative_pid, px->uuid, STATS_TYPE_FE,
+		              stats_row_pid(si), px->uuid, STATS_TYPE_FE,
 		              read_freq_ctr(&px->fe_sess_per_sec),
 		              px->fe_sps_lim, px->fe_counters.sps_max);
 
@@ -1958,6 +3370,15 @@ static int stats_dump_fe_stats(struct stream_interface *si, struct proxy *px)
 		chunk_appendf(&trash, "%lld,",
 		              px->fe_counters.p.http.comp_rsp);
 
+		/* ssl: ssl_reuse, ssl_full, ssl_ticket, ssl_fail */
+		stats_dump_csv_ssl_hs(px, NULL);
+
+		/* log_supp */
+		chunk_appendf(&trash, "%lld,", px->fe_counters.log_suppressed);
+
+		/* latency percentiles */
+		stats_dump_csv_lat(si, px->fe_counters.lat);
+
 		/* finish with EOL */
 		chunk_appendf(&trash, "\n");
 	}
@@ -2076,8 +3497,7 @@ static int stats_dump_li_stats(struct stream_interface *si, struct proxy *px, st
 		              /* errors: cli_aborts, srv_aborts */
 		              ",,"
 		              /* compression: in, out, bypassed, comp_rsp */
-		              ",,,,"
-		              "\n",
+		              ",,,,",
 		              px->id, l->name,
 		              l->nbconn, l->counters->conn_max,
 		              l->maxconn, l->counters->cum_conn,
@@ -2086,6 +3506,18 @@ static int stats_dump_li_stats(struct stream_interface *si, struct proxy *px, st
 		              l->counters->failed_req,
 		              (l->nbconn < l->maxconn) ? "OPEN" : "FULL",
 		              relative_pid, px->uuid, l->luid, STATS_TYPE_SO);
+
+		/* ssl: ssl_reuse, ssl_full, ssl_ticket, ssl_fail */
+		stats_dump_csv_ssl_hs(px, l->bind_conf);
+
+		/* log_supp */
+		chunk_appendf(&trash, ",");
+
+		/* latency percentiles */
+		stats_dump_csv_lat(si, NULL);
+
+		/* finish with EOL */
+		chunk_appendf(&trash, "\n");
 	}
 	return 1;
 }
@@ -2217,6 +3649,9 @@ static int stats_dump_sv_stats(struct stream_interface *si, struct proxy *px, in
 			              U2H(sv->counters.p.http.rsp[0]), tot ? (int)(100*sv->counters.p.http.rsp[0] / tot) : 0);
 		}
 
+		/* latency percentiles (via hover) */
+		stats_dump_html_lat(sv->counters.lat);
+
 		chunk_appendf(&trash,
 		              "</table></div></u></td>"
 		              /* sessions: lbtot */
@@ -2395,7 +3830,7 @@ static int stats_dump_sv_stats(struct stream_interface *si, struct proxy *px, in
 		              "%s,"
 		              "%d,%d,%d,",
 		              LIM2A(sv->maxqueue, ""),
-		              relative_pid, px->uuid, sv->puid);
+		              stats_row_pid(si), px->uuid, sv->puid);
 
 		/* throttle */
 		if ((sv->state & SRV_WARMINGUP) &&
@@ -2464,6 +3899,16 @@ static int stats_dump_sv_stats(struct stream_interface *si, struct proxy *px, in
 		/* compression: in, out, bypassed, comp_rsp */
 		chunk_appendf(&trash, ",,,,");
 
+		/* ssl: ssl_reuse, ssl_full, ssl_ticket, ssl_fail */
+		chunk_appendf(&trash, "%lld,%lld,,,",
+		              sv->counters.ssl_reuse, sv->counters.ssl_full);
+
+		/* log_supp */
+		chunk_appendf(&trash, ",");
+
+		/* latency percentiles */
+		stats_dump_csv_lat(si, sv->counters.lat);
+
 		/* finish with EOL */
 		chunk_appendf(&trash, "\n");
 	}
@@ -2562,6 +4007,9 @@ static int stats_dump_be_stats(struct stream_interface *si, struct proxy *px, in
 			              U2H(px->be_counters.intercepted_req));
 		}
 
+		/* latency percentiles (via hover) */
+		stats_dump_html_lat(px->be_counters.lat);
+
 		chunk_appendf(&trash,
 		              "</table></div></u></td>"
 		              /* sessions: lbtot */
@@ -2661,7 +4109,7 @@ static int stats_dump_be_stats(struct stream_interface *si, struct proxy *px, in
 		              px->srv_act, px->srv_bck,
 		              px->down_trans, (int)(now.tv_sec - px->last_change),
 		              px->srv?be_downtime(px):0,
-		              relative_pid, px->uuid,
+		              stats_row_pid(si), px->uuid,
 		              px->be_counters.cum_lbconn, STATS_TYPE_BE,
 		              read_freq_ctr(&px->be_sess_per_sec),
 		              px->be_counters.sps_max);
@@ -2692,6 +4140,15 @@ static int stats_dump_be_stats(struct stream_interface *si, struct proxy *px, in
 		/* compression: comp_rsp */
 		chunk_appendf(&trash, "%lld,", px->be_counters.p.http.comp_rsp);
 
+		/* ssl: ssl_reuse, ssl_full, ssl_ticket, ssl_fail */
+		chunk_appendf(&trash, ",,,,");
+
+		/* log_supp */
+		chunk_appendf(&trash, ",");
+
+		/* latency percentiles */
+		stats_dump_csv_lat(si, px->be_counters.lat);
+
 		/* finish with EOL */
 		chunk_appendf(&trash, "\n");
 	}
@@ -2761,24 +4218,23 @@ static void stats_dump_html_px_hdr(struct stream_interface *si, struct proxy *px
 		chunk_appendf(&trash, "<th rowspan=2 width=1></th>");
 	}
 
-	chunk_appendf(&trash,
-	              "<th rowspan=2></th>"
-	              "<th colspan=3>Queue</th>"
-	              "<th colspan=3>Session rate</th><th colspan=5>Sessions</th>"
-	              "<th colspan=2>Bytes</th><th colspan=2>Denied</th>"
-	              "<th colspan=3>Errors</th><th colspan=2>Warnings</th>"
-	              "<th colspan=9>Server</th>"
-	              "</tr>\n"
-	              "<tr class=\"titre\">"
-	              "<th>Cur</th><th>Max</th><th>Limit</th>"
-	              "<th>Cur</th><th>Max</th><th>Limit</th><th>Cur</th><th>Max</th>"
-	              "<th>Limit</th><th>Total</th><th>LbTot</th><th>In</th><th>Out</th>"
-	              "<th>Req</th><th>Resp</th><th>Req</th><th>Conn</th>"
-	              "<th>Resp</th><th>Retr</th><th>Redis</th>"
-	              "<th>Status</th><th>LastChk</th><th>Wght</th><th>Act</th>"
-	              "<th>Bck</th><th>Chk</th><th>Dwn</th><th>Dwntme</th>"
-	              "<th>Thrtle</th>\n"
-	              "</tr>");
+	stats_putstr("<th rowspan=2></th>"
+	             "<th colspan=3>Queue</th>"
+	             "<th colspan=3>Session rate</th><th colspan=5>Sessions</th>"
+	             "<th colspan=2>Bytes</th><th colspan=2>Denied</th>"
+	             "<th colspan=3>Errors</th><th colspan=2>Warnings</th>"
+	             "<th colspan=9>Server</th>"
+	             "</tr>\n"
+	             "<tr class=\"titre\">"
+	             "<th>Cur</th><th>Max</th><th>Limit</th>"
+	             "<th>Cur</th><th>Max</th><th>Limit</th><th>Cur</th><th>Max</th>"
+	             "<th>Limit</th><th>Total</th><th>LbTot</th><th>In</th><th>Out</th>"
+	             "<th>Req</th><th>Resp</th><th>Req</th><th>Conn</th>"
+	             "<th>Resp</th><th>Retr</th><th>Redis</th>"
+	             "<th>Status</th><th>LastChk</th><th>Wght</th><th>Act</th>"
+	             "<th>Bck</th><th>Chk</th><th>Dwn</th><th>Dwntme</th>"
+	             "<th>Thrtle</th>\n"
+	             "</tr>");
 }
 
 /* Dumps the HTML table trailer for proxy <px> to the trash for and uses the state from
@@ -2818,45 +4274,17 @@ static void stats_dump_html_px_end(struct stream_interface *si, struct proxy *px
  */
 static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy *px, struct uri_auth *uri)
 {
-	struct session *s = si->conn->xprt_ctx;
 	struct channel *rep = si->ib;
 	struct server *sv, *svs;	/* server and server-state, server-state=server or server->track */
 	struct listener *l;
+	int ret;
 
 	chunk_reset(&trash);
 
 	switch (si->applet.ctx.stats.px_st) {
 	case STAT_PX_ST_INIT:
 		/* we are on a new proxy */
-		if (uri && uri->scope) {
-			/* we have a limited scope, we have to check the proxy name */
-			struct stat_scope *scope;
-			int len;
-
-			len = strlen(px->id);
-			scope = uri->scope;
-
-			while (scope) {
-				/* match exact proxy name */
-				if (scope->px_len == len && !memcmp(px->id, scope->px_id, len))
-					break;
-
-				/* match '.' which means 'self' proxy */
-				if (!strcmp(scope->px_id, ".") && px == s->be)
-					break;
-				scope = scope->next;
-			}
-
-			/* proxy name not found : don't dump anything */
-			if (scope == NULL)
-				return 1;
-		}
-
-		/* if the user has requested a limited output and the proxy
-		 * name does not match, skip it.
-		 */
-		if (si->applet.ctx.stats.scope_len &&
-		    strnistr(px->id, strlen(px->id), bo_ptr(si->ob->buf) + si->applet.ctx.stats.scope_str, si->applet.ctx.stats.scope_len) == NULL)
+		if (!stats_px_in_scope(si, uri, px))
 			return 1;
 
 		if ((si->applet.ctx.stats.flags & STAT_BOUND) &&
@@ -2870,7 +4298,7 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
 	case STAT_PX_ST_TH:
 		if (si->applet.ctx.stats.flags & STAT_FMT_HTML) {
 			stats_dump_html_px_hdr(si, px, uri);
-			if (bi_putchk(rep, &trash) == -1)
+			if (stats_putchk(si) == -1)
 				return 0;
 		}
 
@@ -2879,9 +4307,13 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
 
 	case STAT_PX_ST_FE:
 		/* print the frontend */
-		if (stats_dump_fe_stats(si, px))
-			if (bi_putchk(rep, &trash) == -1)
+		do {
+			stats_shared_enter(si, px, NULL, STATS_TYPE_FE);
+			ret = stats_dump_fe_stats(si, px);
+			stats_shared_leave(px, NULL, STATS_TYPE_FE);
+			if (ret && stats_putchk(si) == -1)
 				return 0;
+		} while (stats_shared_next(si));
 
 		si->applet.ctx.stats.l = px->conf.listeners.n;
 		si->applet.ctx.stats.px_st = STAT_PX_ST_LI;
@@ -2907,7 +4339,7 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
 
 			/* print the frontend */
 			if (stats_dump_li_stats(si, px, l, uri ? uri->flags : 0))
-				if (bi_putchk(rep, &trash) == -1)
+				if (stats_putchk(si) == -1)
 					return 0;
 		}
 
@@ -2920,7 +4352,7 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
 		for (; si->applet.ctx.stats.sv != NULL; si->applet.ctx.stats.sv = sv->next) {
 			int sv_state; /* 0=DOWN, 1=going up, 2=going down, 3=UP, 4,5=NOLB, 6=unchecked */
 
-			if (buffer_almost_full(rep->buf))
+			if (buffer_almost_full(rep->buf) || stats_budget_expired(si))
 				return 0;
 
 			sv = si->applet.ctx.stats.sv;
@@ -2939,8 +4371,10 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
 				svs = sv;
 
 			/* FIXME: produce some small strings for "UP/DOWN x/y &#xxxx;" */
-			if (!(svs->state & SRV_CHECKED))
+			if (!(svs->state & (SRV_CHECKED | SRV_AGENT_CHECKED)))
 				sv_state = 6;
+			else if (!(svs->state & SRV_CHECKED)) /* only an agent check */
+				sv_state = (svs->state & SRV_RUNNING) ? 3 : 0;
 			else if (svs->state & SRV_RUNNING) {
 				if (svs->health == svs->rise + svs->fall - 1)
 					sv_state = 3; /* UP */
@@ -2962,9 +4396,13 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
 				continue;
 			}
 
-			if (stats_dump_sv_stats(si, px, uri ? uri->flags : 0, sv, sv_state))
-				if (bi_putchk(rep, &trash) == -1)
+			do {
+				stats_shared_enter(si, px, sv, STATS_TYPE_SV);
+				ret = stats_dump_sv_stats(si, px, uri ? uri->flags : 0, sv, sv_state);
+				stats_shared_leave(px, sv, STATS_TYPE_SV);
+				if (ret && stats_putchk(si) == -1)
 					return 0;
+			} while (stats_shared_next(si));
 		} /* for sv */
 
 		si->applet.ctx.stats.px_st = STAT_PX_ST_BE;
@@ -2972,9 +4410,13 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
 
 	case STAT_PX_ST_BE:
 		/* print the backend */
-		if (stats_dump_be_stats(si, px, uri ? uri->flags : 0))
-			if (bi_putchk(rep, &trash) == -1)
+		do {
+			stats_shared_enter(si, px, NULL, STATS_TYPE_BE);
+			ret = stats_dump_be_stats(si, px, uri ? uri->flags : 0);
+			stats_shared_leave(px, NULL, STATS_TYPE_BE);
+			if (ret && stats_putchk(si) == -1)
 				return 0;
+		} while (stats_shared_next(si));
 
 		si->applet.ctx.stats.px_st = STAT_PX_ST_END;
 		/* fall through */
@@ -2982,7 +4424,7 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
 	case STAT_PX_ST_END:
 		if (si->applet.ctx.stats.flags & STAT_FMT_HTML) {
 			stats_dump_html_px_end(si, px);
-			if (bi_putchk(rep, &trash) == -1)
+			if (stats_putchk(si) == -1)
 				return 0;
 		}
 
@@ -3003,6 +4445,14 @@ static int stats_dump_proxy_to_buffer(struct stream_interface *si, struct proxy
  */
 static void stats_dump_html_head(struct uri_auth *uri)
 {
+	int start = trash.len;
+
+	/* it only depends on the configuration so we build it only once */
+	if (uri->html_head.str) {
+		stats_putstr(uri->html_head.str);
+		return;
+	}
+
 	/* WARNING! This must fit in the first buffer !!! */
 	chunk_appendf(&trash,
 	              "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01 Transitional//EN\"\n"
@@ -3114,6 +4564,10 @@ static void stats_dump_html_head(struct uri_auth *uri)
 	              (uri->flags & ST_SHNODE) ? " on " : "",
 	              (uri->flags & ST_SHNODE) ? (uri->node ? uri->node : global.node) : ""
 	              );
+
+	uri->html_head.str = my_strndup(trash.str + start, trash.len - start);
+	if (uri->html_head.str)
+		uri->html_head.len = uri->html_head.size = trash.len - start;
 }
 
 /* Dumps the HTML stats information block to the trash for and uses the state from
@@ -3364,6 +4818,7 @@ static int stats_dump_stat_to_buffer(struct stream_interface *si, struct uri_aut
 	struct proxy *px;
 
 	chunk_reset(&trash);
+	stats_budget_start();
 
 	switch (si->conn->xprt_st) {
 	case STAT_ST_INIT:
@@ -3376,7 +4831,7 @@ static int stats_dump_stat_to_buffer(struct stream_interface *si, struct uri_aut
 		else
 			stats_dump_csv_header();
 
-		if (bi_putchk(rep, &trash) == -1)
+		if (stats_putchk(si) == -1)
 			return 0;
 
 		si->conn->xprt_st = STAT_ST_INFO;
@@ -3385,7 +4840,7 @@ static int stats_dump_stat_to_buffer(struct stream_interface *si, struct uri_aut
 	case STAT_ST_INFO:
 		if (si->applet.ctx.stats.flags & STAT_FMT_HTML) {
 			stats_dump_html_info(si, uri);
-			if (bi_putchk(rep, &trash) == -1)
+			if (stats_putchk(si) == -1)
 				return 0;
 		}
 
@@ -3397,7 +4852,7 @@ static int stats_dump_stat_to_buffer(struct stream_interface *si, struct uri_aut
 	case STAT_ST_LIST:
 		/* dump proxies */
 		while (si->applet.ctx.stats.px) {
-			if (buffer_almost_full(rep->buf))
+			if (buffer_almost_full(rep->buf) || stats_budget_expired(si))
 				return 0;
 
 			px = si->applet.ctx.stats.px;
@@ -3417,7 +4872,7 @@ static int stats_dump_stat_to_buffer(struct stream_interface *si, struct uri_aut
 	case STAT_ST_END:
 		if (si->applet.ctx.stats.flags & STAT_FMT_HTML) {
 			stats_dump_html_end();
-			if (bi_putchk(rep, &trash) == -1)
+			if (stats_putchk(si) == -1)
 				return 0;
 		}
 
@@ -3453,7 +4908,13 @@ static void http_stats_io_handler(struct stream_interface *si)
 		si->applet.st0 = 1;
 
 	if (!si->applet.st0) {
-		if (stats_dump_stat_to_buffer(si, s->be->uri_auth)) {
+		if (si->applet.ctx.stats.flags & STAT_FMT_METRICS) {
+			if (stats_dump_metrics_to_buffer(si, s->be->uri_auth)) {
+				si->applet.st0 = 1;
+				si_shutw(si);
+			}
+		}
+		else if (stats_dump_stat_to_buffer(si, s->be->uri_auth)) {
 			si->applet.st0 = 1;
 			si_shutw(si);
 		}
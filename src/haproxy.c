@@ -85,6 +85,7 @@
 #include <proto/channel.h>
 #include <proto/checks.h>
 #include <proto/connection.h>
+#include <proto/dumpstats.h>
 #include <proto/fd.h>
 #include <proto/hdr_idx.h>
 #include <proto/listener.h>
@@ -122,6 +123,7 @@ struct global global = {
 	.nbproc = 1,
 	.req_count = 0,
 	.logsrvs = LIST_HEAD_INIT(global.logsrvs),
+	.log_shm_size = LOG_SHM_SIZE,
 #ifdef DEFAULT_MAXZLIBMEM
 	.maxzlibmem = DEFAULT_MAXZLIBMEM * 1024U * 1024U,
 #else
@@ -139,8 +141,11 @@ struct global global = {
 		.bufsize = BUFSIZE,
 		.maxrewrite = MAXREWRITE,
 		.chksize = BUFSIZE,
+		.log_ring = LOG_RING_SIZE,
 #ifdef USE_OPENSSL
 		.sslcachesize = SSLCACHESIZE,
+		.ssl_rec_grow = SSL_RECORD_GROW,
+		.ssl_rec_idle = SSL_RECORD_IDLE,
 #endif
 #ifdef USE_ZLIB
 		.zlibmemlevel = 8,
@@ -488,6 +493,7 @@ void init(int argc, char **argv)
 	struct wordlist *wl;
 	char *progname;
 	char *change_dir = NULL;
+	char *errmsg = NULL;
 	struct tm curtime;
 
 	chunk_init(&trash, malloc(global.tune.bufsize), global.tune.bufsize);
@@ -728,6 +734,16 @@ void init(int argc, char **argv)
 	if (start_checks() < 0)
 		exit(1);
 
+	if (log_shm_rings_init(&errmsg) < 0) {
+		Alert("%s\n", errmsg);
+		exit(1);
+	}
+
+	if (stats_shared_init(&errmsg) < 0) {
+		Alert("%s\n", errmsg);
+		exit(1);
+	}
+
 	if (cfg_maxconn > 0)
 		global.maxconn = cfg_maxconn;
 
@@ -953,9 +969,11 @@ void deinit(void)
 	struct uri_auth *uap, *ua = NULL;
 	struct logsrv *log, *logb;
 	struct logformat_node *lf, *lfb;
+	struct tcpcheck_rule *tcpcheck, *tcpcheckb;
 	struct bind_conf *bind_conf, *bind_back;
 	int i;
 
+	log_flush();
 	deinit_signals();
 	while (p) {
 		free(p->conf.file);
@@ -979,6 +997,16 @@ void deinit(void)
 		for (i = 0; i < HTTP_ERR_SIZE; i++)
 			chunk_destroy(&p->errmsg[i]);
 
+		list_for_each_entry_safe(tcpcheck, tcpcheckb, &p->tcpcheck_rules, list) {
+			LIST_DEL(&tcpcheck->list);
+			free(tcpcheck->string);
+			if (tcpcheck->expect_regex) {
+				regfree(tcpcheck->expect_regex);
+				free(tcpcheck->expect_regex);
+			}
+			free(tcpcheck);
+		}
+
 		list_for_each_entry_safe(cwl, cwlb, &p->req_add, list) {
 			LIST_DEL(&cwl->list);
 			free(cwl->s);
@@ -1127,8 +1155,12 @@ void deinit(void)
 
 			free(s->id);
 			free(s->cookie);
-			free(s->check.bi);
-			free(s->check.bo);
+			if (s->check.bi)
+				pool_free2(pool2_check_buf, s->check.bi);
+			if (s->check.bo)
+				pool_free2(pool2_check_buf, s->check.bo);
+			if (s->check.conn)
+				pool_free2(pool2_connection, s->check.conn);
 			free(s);
 			s = s_next;
 		}/* end while(s) */
@@ -1181,6 +1213,7 @@ void deinit(void)
 		free(uap->auth_realm);
 		free(uap->node);
 		free(uap->desc);
+		free(uap->html_head.str);
 
 		userlist_free(uap->userlist);
 		free_http_req_rules(&uap->http_req_rules);
@@ -1214,6 +1247,7 @@ void deinit(void)
 	pool_destroy2(pool2_session);
 	pool_destroy2(pool2_connection);
 	pool_destroy2(pool2_buffer);
+	pool_destroy2(pool2_check_buf);
 	pool_destroy2(pool2_channel);
 	pool_destroy2(pool2_requri);
 	pool_destroy2(pool2_task);
@@ -1260,10 +1294,17 @@ void run_poll_loop()
 		/* Process a few tasks */
 		process_runnable_tasks(&next);
 
+		/* send the log lines produced during this loop */
+		log_flush();
+
 		/* stop when there's nothing left to do */
 		if (jobs == 0)
 			break;
 
+#ifdef USE_OPENSSL
+		/* refill the budget of SSL handshakes allowed for this loop */
+		ssl_hs_budget = global.tune.ssl_max_hs;
+#endif
 		/* The poller will ensure it returns around <next> */
 		cur_poller.poll(&cur_poller, next);
 		fd_process_spec_events();
@@ -1515,6 +1556,9 @@ int main(int argc, char **argv)
 		int *children = calloc(global.nbproc, sizeof(int));
 		int proc;
 
+		/* the children must not inherit pending log lines */
+		log_flush();
+
 		/* the father launches the required number of processes */
 		for (proc = 0; proc < global.nbproc; proc++) {
 			ret = fork();
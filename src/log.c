@@ -21,16 +21,20 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include <common/config.h>
 #include <common/compat.h>
+#include <common/sendmmsg.h>
 #include <common/standard.h>
 #include <common/time.h>
 
 #include <types/global.h>
 #include <types/log.h>
 
+#include <proto/freq_ctr.h>
 #include <proto/frontend.h>
 #include <proto/log.h>
 #include <proto/sample.h>
@@ -69,6 +73,7 @@ struct logformat_type {
 };
 
 int prepare_addrsource(struct logformat_node *node, struct proxy *curproxy);
+static void compile_logformat(struct list *list_format, int options);
 
 /* log_format variable names */
 static const struct logformat_type logformat_keywords[] = {
@@ -397,9 +402,11 @@ void parse_logformat_string(const char *fmt, struct proxy *curproxy, struct list
 	int cformat; /* current token format */
 	int pformat; /* previous token format */
 	struct logformat_node *tmplf, *back;
+	int binary;
 
 	sp = str = backfmt = strdup(fmt);
 	curproxy->to_log |= LW_INIT;
+	binary = options & LOG_OPT_BINARY;
 
 	/* flush the list first. */
 	list_for_each_entry_safe(tmplf, back, list_format, list) {
@@ -514,6 +521,7 @@ void parse_logformat_string(const char *fmt, struct proxy *curproxy, struct list
 		        var ? var : arg ? arg : "%");
 
 	free(backfmt);
+	compile_logformat(list_format, binary);
 }
 
 /*
@@ -602,6 +610,56 @@ int get_log_facility(const char *fac)
 	return facility;
 }
 
+/*
+ * Looks for the optional "sample" and "rate-limit" settings of a "log" line
+ * in <args> and parses them into <logsrv>. Returns the number of words found
+ * before the first setting, or -1 on error with a message in <err>.
+ */
+int parse_logsrv_limits(char **args, struct logsrv *logsrv, char **err)
+{
+	unsigned int num, den;
+	char *end;
+	int pos;
+
+	for (pos = 0; *args[pos]; pos++)
+		if (strcmp(args[pos], "sample") == 0 || strcmp(args[pos], "rate-limit") == 0)
+			break;
+
+	for (args += pos; **args; args += 2) {
+		if (strcmp(args[0], "sample") == 0) {
+			num = 1;
+			den = strtoul(args[1], &end, 10);
+			if (*end == '/') {
+				num = den;
+				den = strtoul(end + 1, &end, 10);
+			}
+			if (!*args[1] || *end || !num || num > den) {
+				memprintf(err, "'%s' expects a ratio <m>/<n> or <n> with 0 < m <= n, got '%s'",
+				          args[0], args[1]);
+				return -1;
+			}
+			logsrv->sample_num = num;
+			logsrv->sample_den = den;
+		}
+		else if (strcmp(args[0], "rate-limit") == 0) {
+			num = strtoul(args[1], &end, 10);
+			if (strcmp(end, "/s") == 0)
+				end += 2;
+			if (!*args[1] || *end || !num) {
+				memprintf(err, "'%s' expects a positive number of logs per second, got '%s'",
+				          args[0], args[1]);
+				return -1;
+			}
+			logsrv->rate_limit = num;
+		}
+		else {
+			memprintf(err, "unexpected '%s', only 'sample' and 'rate-limit' may follow", args[0]);
+			return -1;
+		}
+	}
+	return pos;
+}
+
 /*
  * Write a string in the log string
  * Take cares of quote options
@@ -755,15 +813,323 @@ void send_log(struct proxy *p, int level, const char *format, ...)
 	__send_log(p, level, logline, data_len);
 }
 
+static int logfdunix = -1;	/* syslog to AF_UNIX socket */
+static int logfdinet = -1;	/* syslog to AF_INET socket */
+
+/* A log line waiting in the log ring for the next log_flush() */
+struct log_ring_entry {
+	const struct sockaddr_storage *addr;	/* logger's address */
+	int fd;					/* socket to send the line on */
+	int len;				/* length of <line> */
+	char line[MAX_SYSLOG_LEN];		/* full syslog line with header */
+};
+
+/* Lines are accumulated in this ring of "tune.log.ring" entries during each
+ * polling loop, and flushed all at once by log_flush().
+ */
+static struct log_ring_entry *log_ring = NULL;
+static int log_ring_used = 0;
+
+struct log_counters log_counters;
+
+/* Sends the <count> lines of the log ring which are destined to socket <fd>
+ * with as few system calls as possible, and updates the counters. Lines which
+ * could not be sent (eg: socket buffer full) are accounted as dropped.
+ */
+static void log_flush_fd(int fd, int count)
+{
+	struct log_ring_entry *e;
+	int i, sent = 0;
+#ifdef USE_SENDMMSG
+	static int no_sendmmsg = 0;
+	static struct my_mmsghdr *msgs = NULL;
+	static struct iovec *iovs = NULL;
+	int n, ret;
+
+	if (!no_sendmmsg && !msgs) {
+		msgs = calloc(global.tune.log_ring, sizeof(*msgs));
+		iovs = calloc(global.tune.log_ring, sizeof(*iovs));
+		if (!msgs || !iovs) {
+			free(msgs);
+			free(iovs);
+			msgs = NULL;
+			iovs = NULL;
+			no_sendmmsg = 1;
+		}
+	}
+
+	if (!no_sendmmsg) {
+		for (i = n = 0, e = log_ring; i < log_ring_used; i++, e++) {
+			if (e->fd != fd)
+				continue;
+			iovs[n].iov_base = e->line;
+			iovs[n].iov_len  = e->len;
+			memset(&msgs[n].msg_hdr, 0, sizeof(msgs[n].msg_hdr));
+			msgs[n].msg_hdr.msg_name    = (void *)e->addr;
+			msgs[n].msg_hdr.msg_namelen = get_addr_len(e->addr);
+			msgs[n].msg_hdr.msg_iov     = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen  = 1;
+			n++;
+		}
+
+		while (sent < n) {
+			ret = my_sendmmsg(fd, msgs + sent, n - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (ret > 0) {
+				sent += ret;
+				continue;
+			}
+			if (ret < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		log_counters.batches++;
+
+		if (sent || errno != ENOSYS)
+			goto done;
+
+		/* the kernel does not support it, don't try again */
+		no_sendmmsg = 1;
+		free(msgs);
+		free(iovs);
+		msgs = NULL;
+		iovs = NULL;
+	}
+#endif
+	for (i = 0, e = log_ring; i < log_ring_used; i++, e++) {
+		if (e->fd != fd)
+			continue;
+		if (sendto(fd, e->line, e->len, MSG_DONTWAIT | MSG_NOSIGNAL,
+			   (const struct sockaddr *)e->addr, get_addr_len(e->addr)) < 0)
+			break;
+		sent++;
+	}
+#ifdef USE_SENDMMSG
+ done:
+#endif
+	log_counters.sent += sent;
+	if (sent < count) {
+		log_counters.dropped += count - sent;
+		Alert("sending to loggers failed, %d log lines dropped: %s (errno=%d)\n",
+		      count - sent, strerror(errno), errno);
+	}
+}
+
+/* Sends all the log lines accumulated in the log ring since last call. It is
+ * called at the end of each polling loop, before forking and before exiting,
+ * and whenever the ring is full.
+ */
+void log_flush()
+{
+	struct log_ring_entry *e;
+	int i, nbunix = 0, nbinet = 0;
+
+	if (!log_ring_used)
+		return;
+
+	for (i = 0, e = log_ring; i < log_ring_used; i++, e++) {
+		if (e->fd == logfdunix)
+			nbunix++;
+		else
+			nbinet++;
+	}
+
+	if (nbinet)
+		log_flush_fd(logfdinet, nbinet);
+	if (nbunix)
+		log_flush_fd(logfdunix, nbunix);
+	log_ring_used = 0;
+}
+
+/* Queues log line <line> of <len> bytes to be sent on socket <fd> to logger
+ * address <addr> at the next log_flush(), or sends it immediately if the ring
+ * is disabled.
+ */
+static void log_queue(int fd, const struct sockaddr_storage *addr, const char *line, int len)
+{
+	struct log_ring_entry *e;
+
+	if (global.tune.log_ring > 1 && !log_ring)
+		log_ring = calloc(global.tune.log_ring, sizeof(*log_ring));
+
+	if (global.tune.log_ring <= 1 || !log_ring) {
+		if (sendto(fd, line, len, MSG_DONTWAIT | MSG_NOSIGNAL,
+			   (const struct sockaddr *)addr, get_addr_len(addr)) < 0) {
+			log_counters.dropped++;
+			Alert("sendto logger failed: %s (errno=%d)\n", strerror(errno), errno);
+		}
+		else
+			log_counters.sent++;
+		return;
+	}
+
+	e = &log_ring[log_ring_used++];
+	e->fd = fd;
+	e->addr = addr;
+	e->len = len;
+	memcpy(e->line, line, len);
+
+	if (log_ring_used >= global.tune.log_ring)
+		log_flush();
+}
+
+/* list of all the shared memory log rings */
+static struct list log_shm_rings = LIST_HEAD_INIT(log_shm_rings);
+
+/* Returns the shared memory log ring called <name>, and creates it if it does
+ * not exist yet. The file itself is only created by log_shm_rings_init() once
+ * the whole configuration is known. Returns NULL on memory allocation failure.
+ */
+struct log_shm_ring *log_shm_ring_get(const char *name)
+{
+	struct log_shm_ring *ring;
+
+	list_for_each_entry(ring, &log_shm_rings, list) {
+		if (strcmp(ring->name, name) == 0)
+			return ring;
+	}
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->name = strdup(name);
+	if (!ring->name) {
+		free(ring);
+		return NULL;
+	}
+	LIST_ADDQ(&log_shm_rings, &ring->list);
+	return ring;
+}
+
+/* Creates and maps the files of all the shared memory log rings. This must be
+ * done before chrooting and forking so that all processes share the same
+ * rings. Each file is first built under a temporary name then renamed, so that
+ * an old process still running after a reload keeps writing to the previous
+ * file, which the reader finishes before switching to the new one. Returns 0
+ * on success, or -1 with <err> filled on failure.
+ */
+int log_shm_rings_init(char **err)
+{
+	struct log_shm_ring *ring;
+	struct log_shm_hdr *hdr;
+	char *tmpname = NULL;
+	int fd;
+
+	list_for_each_entry(ring, &log_shm_rings, list) {
+		memprintf(&tmpname, "%s.%d.tmp", ring->name, (int)getpid());
+		if (!tmpname)
+			goto oom;
+
+		unlink(tmpname);
+		fd = open(tmpname, O_RDWR | O_CREAT | O_EXCL, 0640);
+		if (fd < 0) {
+			memprintf(err, "Cannot create log ring '%s' : %s", tmpname, strerror(errno));
+			goto fail;
+		}
+
+		if (ftruncate(fd, sizeof(*hdr) + global.log_shm_size) < 0) {
+			memprintf(err, "Cannot resize log ring '%s' : %s", tmpname, strerror(errno));
+			goto fail_close;
+		}
+
+		hdr = mmap(NULL, sizeof(*hdr) + global.log_shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (hdr == MAP_FAILED) {
+			memprintf(err, "Cannot map log ring '%s' : %s", tmpname, strerror(errno));
+			goto fail_close;
+		}
+		close(fd);
+
+		memcpy(hdr->magic, LOG_SHM_MAGIC, sizeof(hdr->magic));
+		hdr->version = LOG_SHM_VERSION;
+		hdr->size    = global.log_shm_size;
+		hdr->flags   = global.log_shm_flags;
+		hdr->pid     = getpid();
+
+		if (rename(tmpname, ring->name) < 0) {
+			memprintf(err, "Cannot rename log ring '%s' to '%s' : %s", tmpname, ring->name, strerror(errno));
+			munmap(hdr, sizeof(*hdr) + global.log_shm_size);
+			unlink(tmpname);
+			goto fail;
+		}
+
+		ring->hdr  = hdr;
+		ring->data = (char *)(hdr + 1);
+		ring->mask = global.log_shm_size - 1;
+		for (ring->shift = 0; (1U << ring->shift) < global.log_shm_size; ring->shift++)
+			;
+	}
+	free(tmpname);
+	return 0;
+
+ fail_close:
+	close(fd);
+	unlink(tmpname);
+ fail:
+	free(tmpname);
+	return -1;
+ oom:
+	memprintf(err, "Out of memory while creating log rings");
+	return -1;
+}
+
+/* Copies log line <line> of <len> bytes into shared memory ring <ring>. No
+ * system call nor lock is involved : space is reserved by atomically moving
+ * the ring's head, and the record is made visible to the reader by setting
+ * its lap number once it is complete. Depending on the ring's overflow policy,
+ * either the new line is dropped when the reader is late, or older lines are
+ * overwritten and the reader detects the loss.
+ */
+static void log_shm_write(struct log_shm_ring *ring, const char *line, int len)
+{
+	struct log_shm_hdr *hdr = ring->hdr;
+	struct log_shm_rec *rec;
+	unsigned long long pos;
+	unsigned int ofs, rlen, room;
+
+	if (!hdr)
+		return;
+
+	rlen = (sizeof(*rec) + len + 7) & ~7U;
+
+	if (hdr->flags & LOG_SHM_F_DROP_NEW) {
+		do {
+			pos = hdr->head;
+			if (pos + rlen - hdr->tail > ring->mask + 1ULL) {
+				__sync_fetch_and_add(&hdr->drops, 1);
+				log_counters.dropped++;
+				return;
+			}
+		} while (!__sync_bool_compare_and_swap(&hdr->head, pos, pos + rlen));
+	}
+	else
+		pos = __sync_fetch_and_add(&hdr->head, rlen);
+
+	/* records start on 8-byte boundaries and the area's size is a power
+	 * of two, so the record header never wraps, but the line may.
+	 */
+	ofs = pos & ring->mask;
+	rec = (struct log_shm_rec *)(ring->data + ofs);
+	rec->len = len;
+	ofs += sizeof(*rec);
+	room = ring->mask + 1 - ofs;
+	if (len <= room)
+		memcpy(ring->data + ofs, line, len);
+	else {
+		memcpy(ring->data + ofs, line, room);
+		memcpy(ring->data, line + room, len - room);
+	}
+	__sync_synchronize();
+	rec->lap = (pos >> ring->shift) + 1;
+	log_counters.sent++;
+}
+
 /*
- * This function sends a syslog message.
+ * This function queues a syslog message for each logger, see log_queue().
  * It doesn't care about errors nor does it report them.
  * It overrides the last byte (message[size-1]) with an LF character.
  */
 void __send_log(struct proxy *p, int level, char *message, size_t size)
 {
-	static int logfdunix = -1;	/* syslog to AF_UNIX socket */
-	static int logfdinet = -1;	/* syslog to AF_INET socket */
 	static char *dataptr = NULL;
 	int fac_level;
 	struct list *logsrvs = NULL;
@@ -795,6 +1161,9 @@ void __send_log(struct proxy *p, int level, char *message, size_t size)
 		const struct logsrv *logsrv = tmp;
 		int proto, *plogfd;
 
+		if (logsrv->ring)
+			continue;
+
 		if (logsrv->addr.ss_family == AF_UNIX) {
 			proto = 0;
 			plogfd = &logfdunix;
@@ -825,10 +1194,9 @@ void __send_log(struct proxy *p, int level, char *message, size_t size)
 		const struct logsrv *logsrv = tmp;
 		int *plogfd = logsrv->addr.ss_family == AF_UNIX ?
 			&logfdunix : &logfdinet;
-		int sent;
 
 		/* we can filter the level of the messages that are sent to each logger */
-		if (level > logsrv->level)
+		if (level > logsrv->level || logsrv->skip)
 			continue;
 
 		/* For each target, we may have a different facility.
@@ -847,13 +1215,10 @@ void __send_log(struct proxy *p, int level, char *message, size_t size)
 		} while (fac_level && log_ptr > dataptr);
 		*log_ptr = '<';
 
-		sent = sendto(*plogfd, log_ptr, size + log_ptr - dataptr,
-			      MSG_DONTWAIT | MSG_NOSIGNAL,
-			      (struct sockaddr *)&logsrv->addr, get_addr_len(&logsrv->addr));
-		if (sent < 0) {
-			Alert("sendto logger #%d failed: %s (errno=%d)\n",
-				nblogger, strerror(errno), errno);
-		}
+		if (logsrv->ring)
+			log_shm_write(logsrv->ring, log_ptr, size - (log_ptr - dataptr));
+		else
+			log_queue(*plogfd, &logsrv->addr, log_ptr, size - (log_ptr - dataptr));
 		nblogger++;
 	}
 }
@@ -867,653 +1232,1207 @@ const char sess_set_cookie[8] = "NPDIRU67";	/* No set-cookie, Set-cookie found a
 						   Set-cookie Deleted, Set-Cookie Inserted, Set-cookie Rewritten,
 						   Set-cookie Updated, unknown, unknown */
 
+/* State shared by the emitters while building a log line */
+struct lf_state {
+	int t_request;		/* request time, or -1 */
+	int last_isspace;	/* the last emitted character was a separator */
+};
+
 /*
- * try to write a character if there is enough space, or goto out
+ * try to write a character if there is enough space, or return NULL
  */
-#define LOGCHAR(x) do { \
-			if (tmplog < dst + maxsize - 1) { \
-				*(tmplog++) = (x);                     \
-			} else {                                       \
-				goto out;                              \
-			}                                              \
-		} while(0)
-
-
-/* Builds a log line in <dst> based on <list_format>, and stops before reaching
- * <maxsize> characters. Returns the size of the output string in characters,
- * not counting the trailing zero which is always added if the resulting size
- * is not zero.
+#define LF_CHAR(x) do {                         \
+			if (size < 2)           \
+				return NULL;    \
+			*(dst++) = (x);         \
+			size--;                 \
+		} while (0)
+
+/* Writes string <src> like lf_text() does, but only checks the options which
+ * may apply. Only quoted strings are passed to lf_text().
  */
-int build_logline(struct session *s, char *dst, size_t maxsize, struct list *list_format)
+static inline char *lf_str(char *dst, const char *src, size_t size, const struct logformat_node *node)
 {
-	struct proxy *fe = s->fe;
-	struct proxy *be = s->be;
-	struct http_txn *txn = &s->txn;
-	char *uri;
-	struct tm tm;
-	int t_request;
-	int hdr;
-	int last_isspace = 1;
-	char *tmplog;
-	char *ret;
-	int iret;
-	struct logformat_node *tmp;
-
-	/* FIXME: let's limit ourselves to frontend logging for now. */
+	size_t len;
 
-	t_request = -1;
-	if (tv_isge(&s->logs.tv_request, &s->logs.tv_accept))
-		t_request = tv_ms_elapsed(&s->logs.tv_accept, &s->logs.tv_request);
+	if (node->options & LOG_OPT_QUOTE)
+		return lf_text(dst, src, size, (struct logformat_node *)node);
 
-	tmplog = dst;
+	if (size < 2)
+		return NULL;
 
-	/* fill logbuffer */
-	if (LIST_ISEMPTY(list_format))
-		return 0;
+	if (!src) {
+		if (node->options & LOG_OPT_MANDATORY) {
+			*dst++ = '-';
+			*dst = '\0';
+		}
+		return dst;
+	}
 
-	list_for_each_entry(tmp, list_format, list) {
-		const char *src = NULL;
-		struct sample *key;
-
-		switch (tmp->type) {
-			case LOG_FMT_SEPARATOR:
-				if (!last_isspace) {
-					LOGCHAR(' ');
-					last_isspace = 1;
-				}
-				break;
+	len = strlcpy2(dst, src, size);
+	return dst + len;
+}
 
-			case LOG_FMT_TEXT: // text
-				src = tmp->arg;
-				iret = strlcpy2(tmplog, src, dst + maxsize - tmplog);
-				if (iret == 0)
-					goto out;
-				tmplog += iret;
-				last_isspace = 0;
-				break;
+/* Writes <val> in hexadecimal on at least <digits> digits */
+static char *lf_hex(char *dst, size_t size, unsigned int val, int digits)
+{
+	int iret;
 
-			case LOG_FMT_EXPR: // sample expression, may be request or response
-				key = NULL;
-				if (tmp->options & LOG_OPT_REQ_CAP)
-					key = sample_fetch_string(be, s, txn, SMP_OPT_DIR_REQ|SMP_OPT_FINAL, tmp->expr);
-				if (!key && (tmp->options & LOG_OPT_RES_CAP))
-					key = sample_fetch_string(be, s, txn, SMP_OPT_DIR_RES|SMP_OPT_FINAL, tmp->expr);
-				ret = lf_text_len(tmplog, key ? key->data.str.str : NULL, key ? key->data.str.len : 0, dst + maxsize - tmplog, tmp);
-				if (ret == 0)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	iret = snprintf(dst, size, "%0*X", digits, val);
+	if (iret < 0 || iret >= size)
+		return NULL;
+	return dst + iret;
+}
 
-			case LOG_FMT_CLIENTIP:  // %ci
-				ret = lf_ip(tmplog, (struct sockaddr *)&s->req->prod->conn->addr.from,
-					    dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_none(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return dst;
+}
 
-			case LOG_FMT_CLIENTPORT:  // %cp
-				if (s->req->prod->conn->addr.from.ss_family == AF_UNIX) {
-					ret = ltoa_o(s->listener->luid, tmplog, dst + maxsize - tmplog);
-				} else {
-					ret = lf_port(tmplog, (struct sockaddr *)&s->req->prod->conn->addr.from,
-						      dst + maxsize - tmplog, tmp);
-				}
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+/* constant text, possibly ending with a separator */
+static char *lf_emit_text(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	size_t len = node->len;
 
-			case LOG_FMT_FRONTENDIP: // %fi
-				conn_get_to_addr(s->req->prod->conn);
-				ret = lf_ip(tmplog, (struct sockaddr *)&s->req->prod->conn->addr.to,
-					    dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	if (len >= size) {
+		/* truncate the text, the next field will stop the line */
+		if (size < 2)
+			return NULL;
+		len = size - 1;
+	}
+	memcpy(dst, node->arg, len);
+	dst[len] = '\0';
+	st->last_isspace = !!(node->options & LOG_OPT_END_SPACE);
+	return dst + len;
+}
 
-			case  LOG_FMT_FRONTENDPORT: // %fp
-				conn_get_to_addr(s->req->prod->conn);
-				if (s->req->prod->conn->addr.to.ss_family == AF_UNIX) {
-					ret = ltoa_o(s->listener->luid,
-						     tmplog, dst + maxsize - tmplog);
-				} else {
-					ret = lf_port(tmplog, (struct sockaddr *)&s->req->prod->conn->addr.to,
-						      dst + maxsize - tmplog, tmp);
-				}
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+/* separator following a field which may be empty */
+static char *lf_emit_sep(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (!st->last_isspace) {
+		LF_CHAR(' ');
+		*dst = '\0';
+		st->last_isspace = 1;
+	}
+	return dst;
+}
 
-			case LOG_FMT_BACKENDIP:  // %bi
-				ret = lf_ip(tmplog, (struct sockaddr *)&s->req->cons->conn->addr.from,
-					    dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_expr(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	struct sample *key = NULL;
 
-			case LOG_FMT_BACKENDPORT:  // %bp
-				ret = lf_port(tmplog, (struct sockaddr *)&s->req->cons->conn->addr.from,
-					      dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	if (node->options & LOG_OPT_REQ_CAP)
+		key = sample_fetch_string(s->be, s, &s->txn, SMP_OPT_DIR_REQ|SMP_OPT_FINAL, node->expr);
+	if (!key && (node->options & LOG_OPT_RES_CAP))
+		key = sample_fetch_string(s->be, s, &s->txn, SMP_OPT_DIR_RES|SMP_OPT_FINAL, node->expr);
+	return lf_text_len(dst, key ? key->data.str.str : NULL, key ? key->data.str.len : 0, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_SERVERIP: // %si
-				ret = lf_ip(tmplog, (struct sockaddr *)&s->req->cons->conn->addr.to,
-					    dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_clientip(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_ip(dst, (struct sockaddr *)&s->req->prod->conn->addr.from, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_SERVERPORT: // %sp
-				ret = lf_port(tmplog, (struct sockaddr *)&s->req->cons->conn->addr.to,
-					      dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_clientport(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (s->req->prod->conn->addr.from.ss_family == AF_UNIX)
+		return ltoa_o(s->listener->luid, dst, size);
+	return lf_port(dst, (struct sockaddr *)&s->req->prod->conn->addr.from, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_DATE: // %t
-				get_localtime(s->logs.accept_date.tv_sec, &tm);
-				ret = date2str_log(tmplog, &tm, &(s->logs.accept_date),
-						   dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_frontendip(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	conn_get_to_addr(s->req->prod->conn);
+	return lf_ip(dst, (struct sockaddr *)&s->req->prod->conn->addr.to, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_DATEGMT: // %T
-				get_gmtime(s->logs.accept_date.tv_sec, &tm);
-				ret = gmt2str_log(tmplog, &tm, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_frontendport(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	conn_get_to_addr(s->req->prod->conn);
+	if (s->req->prod->conn->addr.to.ss_family == AF_UNIX)
+		return ltoa_o(s->listener->luid, dst, size);
+	return lf_port(dst, (struct sockaddr *)&s->req->prod->conn->addr.to, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_DATELOCAL: // %Tl
-				get_localtime(s->logs.accept_date.tv_sec, &tm);
-				ret = localdate2str_log(tmplog, &tm, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_backendip(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_ip(dst, (struct sockaddr *)&s->req->cons->conn->addr.from, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_TS: // %Ts
-				get_gmtime(s->logs.accept_date.tv_sec, &tm);
-				if (tmp->options & LOG_OPT_HEXA) {
-					iret = snprintf(tmplog, dst + maxsize - tmplog, "%04X", (unsigned int)s->logs.accept_date.tv_sec);
-					if (iret < 0 || iret > dst + maxsize - tmplog)
-						goto out;
-					last_isspace = 0;
-					tmplog += iret;
-				} else {
-					ret = ltoa_o(s->logs.accept_date.tv_sec, tmplog, dst + maxsize - tmplog);
-					if (ret == NULL)
-						goto out;
-					tmplog = ret;
-					last_isspace = 0;
-				}
-			break;
+static char *lf_emit_backendport(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_port(dst, (struct sockaddr *)&s->req->cons->conn->addr.from, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_MS: // %ms
-			if (tmp->options & LOG_OPT_HEXA) {
-					iret = snprintf(tmplog, dst + maxsize - tmplog, "%02X",(unsigned int)s->logs.accept_date.tv_usec/1000);
-					if (iret < 0 || iret > dst + maxsize - tmplog)
-						goto out;
-					last_isspace = 0;
-					tmplog += iret;
-			} else {
-				if ((dst + maxsize - tmplog) < 4)
-					goto out;
-				ret = utoa_pad((unsigned int)s->logs.accept_date.tv_usec/1000,
-				               tmplog, 4);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-			}
-			break;
+static char *lf_emit_serverip(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_ip(dst, (struct sockaddr *)&s->req->cons->conn->addr.to, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_FRONTEND: // %f
-				src = fe->id;
-				ret = lf_text(tmplog, src, dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_serverport(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_port(dst, (struct sockaddr *)&s->req->cons->conn->addr.to, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_FRONTEND_XPRT: // %ft
-				src = fe->id;
-				if (tmp->options & LOG_OPT_QUOTE)
-					LOGCHAR('"');
-				iret = strlcpy2(tmplog, src, dst + maxsize - tmplog);
-				if (iret == 0)
-					goto out;
-				tmplog += iret;
-#ifdef USE_OPENSSL
-				if (s->listener->xprt == &ssl_sock)
-					LOGCHAR('~');
-#endif
-				if (tmp->options & LOG_OPT_QUOTE)
-					LOGCHAR('"');
-				last_isspace = 0;
-				break;
-#ifdef USE_OPENSSL
-			case LOG_FMT_SSL_CIPHER: // %sslc
-				src = NULL;
-				if (s->listener->xprt == &ssl_sock)
-					src = ssl_sock_get_cipher_name(s->si[0].conn);
-				ret = lf_text(tmplog, src, dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+/* The date formats only change once a second. Their text is kept in these
+ * caches so that neither the time conversion nor the formatting have to be
+ * redone for every log line.
+ */
+struct lf_date_cache {
+	time_t sec;		/* second the text corresponds to */
+	int len;		/* length of <str>, 0 if not set yet */
+	char str[32];
+};
 
-			case LOG_FMT_SSL_VERSION: // %sslv
-				src = NULL;
-				if (s->listener->xprt == &ssl_sock)
-					src = ssl_sock_get_proto_version(s->si[0].conn);
-				ret = lf_text(tmplog, src, dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
-#endif
-			case LOG_FMT_BACKEND: // %b
-				src = be->id;
-				ret = lf_text(tmplog, src, dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static struct lf_date_cache lf_date_local;	/* %t, without the milliseconds */
+static struct lf_date_cache lf_date_gmt;	/* %T */
+static struct lf_date_cache lf_date_localtz;	/* %Tl */
 
-			case LOG_FMT_SERVER: // %s
-				switch (obj_type(s->target)) {
-				case OBJ_TYPE_SERVER:
-					src = objt_server(s->target)->id;
-					break;
-				case OBJ_TYPE_APPLET:
-					src = objt_applet(s->target)->name;
-					break;
-				default:
-					src = "<NOSRV>";
-					break;
-				}
-				ret = lf_text(tmplog, src, dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_date(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	struct lf_date_cache *c = &lf_date_local;
 
-			case LOG_FMT_TQ: // %Tq
-				ret = ltoa_o(t_request, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	if (unlikely(s->logs.accept_date.tv_sec != c->sec || !c->len)) {
+		struct tm tm;
 
-			case LOG_FMT_TW: // %Tw
-				ret = ltoa_o((s->logs.t_queue >= 0) ? s->logs.t_queue - t_request : -1,
-						tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+		get_localtime(s->logs.accept_date.tv_sec, &tm);
+		date2str_log(c->str, &tm, &s->logs.accept_date, sizeof(c->str));
+		c->sec = s->logs.accept_date.tv_sec;
+		c->len = 20; /* "dd/Mon/yyyy:HH:MM:SS" */
+	}
 
-			case LOG_FMT_TC: // %Tc
-				ret = ltoa_o((s->logs.t_connect >= 0) ? s->logs.t_connect - s->logs.t_queue : -1,
-						tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	if (size < 25) /* the size is fixed: 24 chars + \0 */
+		return NULL;
 
-			case LOG_FMT_TR: // %Tr
-				ret = ltoa_o((s->logs.t_data >= 0) ? s->logs.t_data - s->logs.t_connect : -1,
-						tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	memcpy(dst, c->str, c->len);
+	dst += c->len;
+	*dst++ = '.';
+	utoa_pad((unsigned int)(s->logs.accept_date.tv_usec / 1000), dst, 4);
+	dst += 3;
+	*dst = '\0';
+	return dst;
+}
 
-			case LOG_FMT_TT:  // %Tt
-				if (!(fe->to_log & LW_BYTES))
-					LOGCHAR('+');
-				ret = ltoa_o(s->logs.t_close, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_date_cached(char *dst, size_t size, time_t sec, struct lf_date_cache *c, int gmt)
+{
+	if (unlikely(sec != c->sec || !c->len)) {
+		struct tm tm;
+		char *end;
 
-			case LOG_FMT_STATUS: // %ST
-				ret = ltoa_o(txn->status, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+		if (gmt) {
+			get_gmtime(sec, &tm);
+			end = gmt2str_log(c->str, &tm, sizeof(c->str));
+		}
+		else {
+			get_localtime(sec, &tm);
+			end = localdate2str_log(c->str, &tm, sizeof(c->str));
+		}
+		c->sec = sec;
+		c->len = end ? end - c->str : 0;
+	}
 
-			case LOG_FMT_BYTES: // %B
-				if (!(fe->to_log & LW_BYTES))
-					LOGCHAR('+');
-				ret = lltoa(s->logs.bytes_out, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	if (!c->len || size <= c->len)
+		return NULL;
 
-			case LOG_FMT_BYTES_UP: // %U
-				ret = lltoa(s->logs.bytes_in, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	memcpy(dst, c->str, c->len + 1);
+	return dst + c->len;
+}
 
-			case LOG_FMT_CCLIENT: // %CC
-				src = txn->cli_cookie;
-				ret = lf_text(tmplog, src, dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_dategmt(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_emit_date_cached(dst, size, s->logs.accept_date.tv_sec, &lf_date_gmt, 1);
+}
 
-			case LOG_FMT_CSERVER: // %CS
-				src = txn->srv_cookie;
-				ret = lf_text(tmplog, src, dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_datelocal(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_emit_date_cached(dst, size, s->logs.accept_date.tv_sec, &lf_date_localtz, 0);
+}
 
-			case LOG_FMT_TERMSTATE: // %ts
-				LOGCHAR(sess_term_cond[(s->flags & SN_ERR_MASK) >> SN_ERR_SHIFT]);
-				LOGCHAR(sess_fin_state[(s->flags & SN_FINST_MASK) >> SN_FINST_SHIFT]);
-				*tmplog = '\0';
-				last_isspace = 0;
-				break;
+static char *lf_emit_ts(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(s->logs.accept_date.tv_sec, dst, size);
+}
 
-			case LOG_FMT_TERMSTATE_CK: // %tsc, same as TS with cookie state (for mode HTTP)
-				LOGCHAR(sess_term_cond[(s->flags & SN_ERR_MASK) >> SN_ERR_SHIFT]);
-				LOGCHAR(sess_fin_state[(s->flags & SN_FINST_MASK) >> SN_FINST_SHIFT]);
-				LOGCHAR((be->ck_opts & PR_CK_ANY) ? sess_cookie[(txn->flags & TX_CK_MASK) >> TX_CK_SHIFT] : '-');
-				LOGCHAR((be->ck_opts & PR_CK_ANY) ? sess_set_cookie[(txn->flags & TX_SCK_MASK) >> TX_SCK_SHIFT] : '-');
-				last_isspace = 0;
-				break;
+static char *lf_emit_ts_hex(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_hex(dst, size, (unsigned int)s->logs.accept_date.tv_sec, 4);
+}
 
-			case LOG_FMT_ACTCONN: // %ac
-				ret = ltoa_o(actconn, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_ms(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (size < 4)
+		return NULL;
+	return utoa_pad((unsigned int)s->logs.accept_date.tv_usec / 1000, dst, 4);
+}
 
-			case LOG_FMT_FECONN:  // %fc
-				ret = ltoa_o(fe->feconn, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_ms_hex(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_hex(dst, size, (unsigned int)s->logs.accept_date.tv_usec / 1000, 2);
+}
 
-			case LOG_FMT_BECONN:  // %bc
-				ret = ltoa_o(be->beconn, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_frontend(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_str(dst, s->fe->id, size, node);
+}
 
-			case LOG_FMT_SRVCONN:  // %sc
-				ret = ultoa_o(objt_server(s->target) ?
-				                 objt_server(s->target)->cur_sess :
-				                 0, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_frontend_xprt(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	size_t len;
 
-			case LOG_FMT_RETRIES:  // %rq
-				if (s->flags & SN_REDISP)
-					LOGCHAR('+');
-				ret = ltoa_o((s->req->cons->conn_retries>0) ?
-				                (be->conn_retries - s->req->cons->conn_retries) :
-				                be->conn_retries, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	if (node->options & LOG_OPT_QUOTE)
+		LF_CHAR('"');
+	len = strlcpy2(dst, s->fe->id, size);
+	if (len == 0)
+		return NULL;
+	dst += len;
+	size -= len;
+#ifdef USE_OPENSSL
+	if (s->listener->xprt == &ssl_sock)
+		LF_CHAR('~');
+#endif
+	if (node->options & LOG_OPT_QUOTE)
+		LF_CHAR('"');
+	*dst = '\0';
+	return dst;
+}
 
-			case LOG_FMT_SRVQUEUE: // %sq
-				ret = ltoa_o(s->logs.srv_queue_size, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+#ifdef USE_OPENSSL
+static char *lf_emit_ssl_cipher(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	const char *src = NULL;
 
-			case LOG_FMT_BCKQUEUE:  // %bq
-				ret = ltoa_o(s->logs.prx_queue_size, tmplog, dst + maxsize - tmplog);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+	if (s->listener->xprt == &ssl_sock)
+		src = ssl_sock_get_cipher_name(s->si[0].conn);
+	return lf_text(dst, src, size, (struct logformat_node *)node);
+}
 
-			case LOG_FMT_HDRREQUEST: // %hr
-				/* request header */
-				if (fe->nb_req_cap && txn->req.cap) {
-					if (tmp->options & LOG_OPT_QUOTE)
-						LOGCHAR('"');
-					LOGCHAR('{');
-					for (hdr = 0; hdr < fe->nb_req_cap; hdr++) {
-						if (hdr)
-							LOGCHAR('|');
-						if (txn->req.cap[hdr] != NULL) {
-							ret = encode_string(tmplog, dst + maxsize,
-									       '#', hdr_encode_map, txn->req.cap[hdr]);
-							if (ret == NULL || *ret != '\0')
-								goto out;
-							tmplog = ret;
-						}
-					}
-					LOGCHAR('}');
-					if (tmp->options & LOG_OPT_QUOTE)
-						LOGCHAR('"');
-					last_isspace = 0;
-					if (tmp->options & LOG_OPT_QUOTE)
-						LOGCHAR('"');
-				}
-				break;
+static char *lf_emit_ssl_version(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	const char *src = NULL;
 
-			case LOG_FMT_HDRREQUESTLIST: // %hrl
-				/* request header list */
-				if (fe->nb_req_cap && txn->req.cap) {
-					for (hdr = 0; hdr < fe->nb_req_cap; hdr++) {
-						if (hdr > 0)
-							LOGCHAR(' ');
-						if (tmp->options & LOG_OPT_QUOTE)
-							LOGCHAR('"');
-						if (txn->req.cap[hdr] != NULL) {
-							ret = encode_string(tmplog, dst + maxsize,
-									       '#', hdr_encode_map, txn->req.cap[hdr]);
-							if (ret == NULL || *ret != '\0')
-								goto out;
-							tmplog = ret;
-						} else if (!(tmp->options & LOG_OPT_QUOTE))
-							LOGCHAR('-');
-						if (tmp->options & LOG_OPT_QUOTE)
-							LOGCHAR('"');
-						last_isspace = 0;
-					}
-				}
-				break;
+	if (s->listener->xprt == &ssl_sock)
+		src = ssl_sock_get_proto_version(s->si[0].conn);
+	return lf_text(dst, src, size, (struct logformat_node *)node);
+}
+#endif
 
+static char *lf_emit_backend(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_str(dst, s->be->id, size, node);
+}
 
-			case LOG_FMT_HDRRESPONS: // %hs
-				/* response header */
-				if (fe->nb_rsp_cap && txn->rsp.cap) {
-					if (tmp->options & LOG_OPT_QUOTE)
-						LOGCHAR('"');
-					LOGCHAR('{');
-					for (hdr = 0; hdr < fe->nb_rsp_cap; hdr++) {
-						if (hdr)
-							LOGCHAR('|');
-						if (txn->rsp.cap[hdr] != NULL) {
-							ret = encode_string(tmplog, dst + maxsize,
-							                    '#', hdr_encode_map, txn->rsp.cap[hdr]);
-							if (ret == NULL || *ret != '\0')
-								goto out;
-							tmplog = ret;
-						}
-					}
-					LOGCHAR('}');
-					last_isspace = 0;
-					if (tmp->options & LOG_OPT_QUOTE)
-						LOGCHAR('"');
-				}
-				break;
+static char *lf_emit_server(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	const char *src;
+
+	switch (obj_type(s->target)) {
+	case OBJ_TYPE_SERVER:
+		src = objt_server(s->target)->id;
+		break;
+	case OBJ_TYPE_APPLET:
+		src = objt_applet(s->target)->name;
+		break;
+	default:
+		src = "<NOSRV>";
+		break;
+	}
+	return lf_str(dst, src, size, node);
+}
 
-			case LOG_FMT_HDRRESPONSLIST: // %hsl
-				/* response header list */
-				if (fe->nb_rsp_cap && txn->rsp.cap) {
-					for (hdr = 0; hdr < fe->nb_rsp_cap; hdr++) {
-						if (hdr > 0)
-							LOGCHAR(' ');
-						if (tmp->options & LOG_OPT_QUOTE)
-							LOGCHAR('"');
-						if (txn->rsp.cap[hdr] != NULL) {
-							ret = encode_string(tmplog, dst + maxsize,
-							                    '#', hdr_encode_map, txn->rsp.cap[hdr]);
-							if (ret == NULL || *ret != '\0')
-								goto out;
-							tmplog = ret;
-						} else if (!(tmp->options & LOG_OPT_QUOTE))
-							LOGCHAR('-');
-						if (tmp->options & LOG_OPT_QUOTE)
-							LOGCHAR('"');
-						last_isspace = 0;
-					}
-				}
-				break;
+static char *lf_emit_tq(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(st->t_request, dst, size);
+}
 
-			case LOG_FMT_REQ: // %r
-				/* Request */
-				if (tmp->options & LOG_OPT_QUOTE)
-					LOGCHAR('"');
-				uri = txn->uri ? txn->uri : "<BADREQ>";
-				ret = encode_string(tmplog, dst + maxsize,
-						       '#', url_encode_map, uri);
-				if (ret == NULL || *ret != '\0')
-					goto out;
-				tmplog = ret;
-				if (tmp->options & LOG_OPT_QUOTE)
-					LOGCHAR('"');
-				last_isspace = 0;
-				break;
+static char *lf_emit_tw(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o((s->logs.t_queue >= 0) ? s->logs.t_queue - st->t_request : -1, dst, size);
+}
 
-			case LOG_FMT_COUNTER: // %rt
-				if (tmp->options & LOG_OPT_HEXA) {
-					iret = snprintf(tmplog, dst + maxsize - tmplog, "%04X", global.req_count);
-					if (iret < 0 || iret > dst + maxsize - tmplog)
-						goto out;
-					last_isspace = 0;
-					tmplog += iret;
-				} else {
-					ret = ltoa_o(global.req_count, tmplog, dst + maxsize - tmplog);
-					if (ret == NULL)
-						goto out;
-					tmplog = ret;
-					last_isspace = 0;
-				}
-				break;
+static char *lf_emit_tc(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o((s->logs.t_connect >= 0) ? s->logs.t_connect - s->logs.t_queue : -1, dst, size);
+}
 
-			case LOG_FMT_HOSTNAME: // %H
-				src = hostname;
-				ret = lf_text(tmplog, src, dst + maxsize - tmplog, tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+static char *lf_emit_tr(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o((s->logs.t_data >= 0) ? s->logs.t_data - s->logs.t_connect : -1, dst, size);
+}
 
-			case LOG_FMT_PID: // %pid
-				if (tmp->options & LOG_OPT_HEXA) {
-					iret = snprintf(tmplog, dst + maxsize - tmplog, "%04X", pid);
-					if (iret < 0 || iret > dst + maxsize - tmplog)
-						goto out;
-					last_isspace = 0;
-					tmplog += iret;
-				} else {
-					ret = ltoa_o(pid, tmplog, dst + maxsize - tmplog);
-					if (ret == NULL)
-						goto out;
-					tmplog = ret;
-					last_isspace = 0;
+static char *lf_emit_tt(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (!(s->fe->to_log & LW_BYTES))
+		LF_CHAR('+');
+	return ltoa_o(s->logs.t_close, dst, size);
+}
+
+static char *lf_emit_status(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(s->txn.status, dst, size);
+}
+
+static char *lf_emit_bytes(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (!(s->fe->to_log & LW_BYTES))
+		LF_CHAR('+');
+	return lltoa(s->logs.bytes_out, dst, size);
+}
+
+static char *lf_emit_bytes_up(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lltoa(s->logs.bytes_in, dst, size);
+}
+
+static char *lf_emit_cclient(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_str(dst, s->txn.cli_cookie, size, node);
+}
+
+static char *lf_emit_cserver(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_str(dst, s->txn.srv_cookie, size, node);
+}
+
+static char *lf_emit_termstate(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (size < 3)
+		return NULL;
+	*dst++ = sess_term_cond[(s->flags & SN_ERR_MASK) >> SN_ERR_SHIFT];
+	*dst++ = sess_fin_state[(s->flags & SN_FINST_MASK) >> SN_FINST_SHIFT];
+	*dst = '\0';
+	return dst;
+}
+
+static char *lf_emit_termstate_ck(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (size < 5)
+		return NULL;
+	*dst++ = sess_term_cond[(s->flags & SN_ERR_MASK) >> SN_ERR_SHIFT];
+	*dst++ = sess_fin_state[(s->flags & SN_FINST_MASK) >> SN_FINST_SHIFT];
+	*dst++ = (s->be->ck_opts & PR_CK_ANY) ? sess_cookie[(s->txn.flags & TX_CK_MASK) >> TX_CK_SHIFT] : '-';
+	*dst++ = (s->be->ck_opts & PR_CK_ANY) ? sess_set_cookie[(s->txn.flags & TX_SCK_MASK) >> TX_SCK_SHIFT] : '-';
+	*dst = '\0';
+	return dst;
+}
+
+static char *lf_emit_actconn(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(actconn, dst, size);
+}
+
+static char *lf_emit_feconn(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(s->fe->feconn, dst, size);
+}
+
+static char *lf_emit_beconn(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(s->be->beconn, dst, size);
+}
+
+static char *lf_emit_srvconn(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ultoa_o(objt_server(s->target) ? objt_server(s->target)->cur_sess : 0, dst, size);
+}
+
+static char *lf_emit_retries(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (s->flags & SN_REDISP)
+		LF_CHAR('+');
+	return ltoa_o((s->req->cons->conn_retries > 0) ?
+	              (s->be->conn_retries - s->req->cons->conn_retries) :
+	              s->be->conn_retries, dst, size);
+}
+
+static char *lf_emit_srvqueue(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(s->logs.srv_queue_size, dst, size);
+}
+
+static char *lf_emit_bckqueue(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(s->logs.prx_queue_size, dst, size);
+}
+
+/* Emits the <nb> captured headers <cap> between braces and separated by
+ * pipes for %hr and %hs, or as a list of words for %hrl and %hsl.
+ */
+static char *lf_emit_caps(char *dst, size_t size, char **cap, int nb, int list, const struct logformat_node *node, struct lf_state *st)
+{
+	char *end = dst + size;
+	char *ret;
+	int hdr;
+
+	if (!nb || !cap)
+		return dst;
+
+	if (!list) {
+		if (node->options & LOG_OPT_QUOTE)
+			LF_CHAR('"');
+		LF_CHAR('{');
+	}
+
+	for (hdr = 0; hdr < nb; hdr++) {
+		if (hdr)
+			LF_CHAR(list ? ' ' : '|');
+		if (list && (node->options & LOG_OPT_QUOTE))
+			LF_CHAR('"');
+		if (cap[hdr] != NULL) {
+			ret = encode_string(dst, end, '#', hdr_encode_map, cap[hdr]);
+			if (ret == NULL || *ret != '\0')
+				return NULL;
+			size -= ret - dst;
+			dst = ret;
+		}
+		else if (list && !(node->options & LOG_OPT_QUOTE))
+			LF_CHAR('-');
+		if (list && (node->options & LOG_OPT_QUOTE))
+			LF_CHAR('"');
+	}
+
+	if (!list) {
+		LF_CHAR('}');
+		if (node->options & LOG_OPT_QUOTE)
+			LF_CHAR('"');
+	}
+	*dst = '\0';
+	st->last_isspace = 0;
+	return dst;
+}
+
+static char *lf_emit_hdrrequest(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_emit_caps(dst, size, s->txn.req.cap, s->fe->nb_req_cap, 0, node, st);
+}
+
+static char *lf_emit_hdrrequestlist(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_emit_caps(dst, size, s->txn.req.cap, s->fe->nb_req_cap, 1, node, st);
+}
+
+static char *lf_emit_hdrresponse(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_emit_caps(dst, size, s->txn.rsp.cap, s->fe->nb_rsp_cap, 0, node, st);
+}
+
+static char *lf_emit_hdrresponselist(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_emit_caps(dst, size, s->txn.rsp.cap, s->fe->nb_rsp_cap, 1, node, st);
+}
+
+static char *lf_emit_req(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	char *end = dst + size;
+	char *ret;
+
+	if (node->options & LOG_OPT_QUOTE)
+		LF_CHAR('"');
+	ret = encode_string(dst, end, '#', url_encode_map, s->txn.uri ? s->txn.uri : "<BADREQ>");
+	if (ret == NULL || *ret != '\0')
+		return NULL;
+	size -= ret - dst;
+	dst = ret;
+	if (node->options & LOG_OPT_QUOTE) {
+		LF_CHAR('"');
+		*dst = '\0';
+	}
+	return dst;
+}
+
+static char *lf_emit_counter(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(global.req_count, dst, size);
+}
+
+static char *lf_emit_counter_hex(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_hex(dst, size, global.req_count, 4);
+}
+
+static char *lf_emit_hostname(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_str(dst, hostname, size, node);
+}
+
+static char *lf_emit_pid(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return ltoa_o(pid, dst, size);
+}
+
+static char *lf_emit_pid_hex(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_hex(dst, size, pid, 4);
+}
+
+static char *lf_emit_uniqueid(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_str(dst, s->unique_id, size, node);
+}
+
+/* Binary emitters for "log-format-binary". Each of them writes the node's
+ * type followed by the value, see the description of the format in
+ * types/log.h. Like the text emitters, they always leave room for the
+ * trailing zero.
+ */
+static inline char *lf_bin_put16(char *dst, unsigned int v)
+{
+	dst[0] = v >> 8;
+	dst[1] = v;
+	return dst + 2;
+}
+
+static inline char *lf_bin_put32(char *dst, unsigned int v)
+{
+	dst[0] = v >> 24;
+	dst[1] = v >> 16;
+	dst[2] = v >> 8;
+	dst[3] = v;
+	return dst + 4;
+}
+
+static char *lf_bin_int(char *dst, size_t size, int tag, int v)
+{
+	if (size < 6)
+		return NULL;
+	*dst++ = tag;
+	return lf_bin_put32(dst, v);
+}
+
+static char *lf_bin_llong(char *dst, size_t size, int tag, long long v)
+{
+	if (size < 10)
+		return NULL;
+	*dst++ = tag;
+	dst = lf_bin_put32(dst, (unsigned long long)v >> 32);
+	return lf_bin_put32(dst, v);
+}
+
+static char *lf_bin_strlen(char *dst, const char *src, int len, size_t size)
+{
+	if (size < 3)
+		return NULL;
+	if (!src)
+		return lf_bin_put16(dst, LOG_BIN_NOSTR);
+	if (len > size - 3)
+		len = size - 3;
+	if (len >= LOG_BIN_NOSTR)
+		len = LOG_BIN_NOSTR - 1;
+	dst = lf_bin_put16(dst, len);
+	memcpy(dst, src, len);
+	return dst + len;
+}
+
+static char *lf_bin_str(char *dst, size_t size, int tag, const char *src)
+{
+	if (size < 4)
+		return NULL;
+	*dst++ = tag;
+	return lf_bin_strlen(dst, src, src ? strlen(src) : 0, size - 1);
+}
+
+static char *lf_bin_date(char *dst, size_t size, int tag, const struct timeval *tv)
+{
+	if (size < 8)
+		return NULL;
+	*dst++ = tag;
+	dst = lf_bin_put32(dst, tv->tv_sec);
+	return lf_bin_put16(dst, tv->tv_usec / 1000);
+}
+
+static char *lf_bin_addr(char *dst, size_t size, int tag, const struct sockaddr_storage *addr)
+{
+	if (size < 19)
+		return NULL;
+	*dst++ = tag;
+	if (addr->ss_family == AF_INET) {
+		*dst++ = 4;
+		memcpy(dst, &((struct sockaddr_in *)addr)->sin_addr, 4);
+		return dst + 4;
+	}
+	if (addr->ss_family == AF_INET6) {
+		*dst++ = 6;
+		memcpy(dst, &((struct sockaddr_in6 *)addr)->sin6_addr, 16);
+		return dst + 16;
+	}
+	*dst++ = 0;
+	return dst;
+}
+
+static char *lf_bin_port(char *dst, size_t size, int tag, unsigned int port)
+{
+	if (size < 4)
+		return NULL;
+	*dst++ = tag;
+	return lf_bin_put16(dst, port);
+}
+
+static char *lf_bin_emit_expr(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	struct sample *key = NULL;
+
+	if (size < 4)
+		return NULL;
+	if (node->options & LOG_OPT_REQ_CAP)
+		key = sample_fetch_string(s->be, s, &s->txn, SMP_OPT_DIR_REQ|SMP_OPT_FINAL, node->expr);
+	if (!key && (node->options & LOG_OPT_RES_CAP))
+		key = sample_fetch_string(s->be, s, &s->txn, SMP_OPT_DIR_RES|SMP_OPT_FINAL, node->expr);
+	*dst++ = node->type;
+	return lf_bin_strlen(dst, key ? key->data.str.str : NULL, key ? key->data.str.len : 0, size - 1);
+}
+
+static char *lf_bin_emit_clientip(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_addr(dst, size, node->type, &s->req->prod->conn->addr.from);
+}
+
+static char *lf_bin_emit_clientport(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (s->req->prod->conn->addr.from.ss_family == AF_UNIX)
+		return lf_bin_port(dst, size, node->type, s->listener->luid);
+	return lf_bin_port(dst, size, node->type, get_host_port(&s->req->prod->conn->addr.from));
+}
+
+static char *lf_bin_emit_frontendip(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	conn_get_to_addr(s->req->prod->conn);
+	return lf_bin_addr(dst, size, node->type, &s->req->prod->conn->addr.to);
+}
+
+static char *lf_bin_emit_frontendport(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	conn_get_to_addr(s->req->prod->conn);
+	if (s->req->prod->conn->addr.to.ss_family == AF_UNIX)
+		return lf_bin_port(dst, size, node->type, s->listener->luid);
+	return lf_bin_port(dst, size, node->type, get_host_port(&s->req->prod->conn->addr.to));
+}
+
+static char *lf_bin_emit_backendip(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_addr(dst, size, node->type, &s->req->cons->conn->addr.from);
+}
+
+static char *lf_bin_emit_backendport(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_port(dst, size, node->type, get_host_port(&s->req->cons->conn->addr.from));
+}
+
+static char *lf_bin_emit_serverip(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_addr(dst, size, node->type, &s->req->cons->conn->addr.to);
+}
+
+static char *lf_bin_emit_serverport(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_port(dst, size, node->type, get_host_port(&s->req->cons->conn->addr.to));
+}
+
+/* %t, %T, %Tl, %Ts and %ms only differ by their type */
+static char *lf_bin_emit_date(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_date(dst, size, node->type, &s->logs.accept_date);
+}
+
+static char *lf_bin_emit_frontend(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_str(dst, size, node->type, s->fe->id);
+}
+
+static char *lf_bin_emit_frontend_xprt(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	int tag = node->type;
+
+#ifdef USE_OPENSSL
+	if (s->listener->xprt == &ssl_sock)
+		tag |= LOG_BIN_PLUS;
+#endif
+	return lf_bin_str(dst, size, tag, s->fe->id);
+}
+
+#ifdef USE_OPENSSL
+static char *lf_bin_emit_ssl_cipher(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	const char *src = NULL;
+
+	if (s->listener->xprt == &ssl_sock)
+		src = ssl_sock_get_cipher_name(s->si[0].conn);
+	return lf_bin_str(dst, size, node->type, src);
+}
+
+static char *lf_bin_emit_ssl_version(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	const char *src = NULL;
+
+	if (s->listener->xprt == &ssl_sock)
+		src = ssl_sock_get_proto_version(s->si[0].conn);
+	return lf_bin_str(dst, size, node->type, src);
+}
+#endif
+
+static char *lf_bin_emit_backend(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_str(dst, size, node->type, s->be->id);
+}
+
+static char *lf_bin_emit_server(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	const char *src;
+
+	switch (obj_type(s->target)) {
+	case OBJ_TYPE_SERVER:
+		src = objt_server(s->target)->id;
+		break;
+	case OBJ_TYPE_APPLET:
+		src = objt_applet(s->target)->name;
+		break;
+	default:
+		src = "<NOSRV>";
+		break;
+	}
+	return lf_bin_str(dst, size, node->type, src);
+}
+
+static char *lf_bin_emit_tq(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, st->t_request);
+}
+
+static char *lf_bin_emit_tw(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, (s->logs.t_queue >= 0) ? s->logs.t_queue - st->t_request : -1);
+}
+
+static char *lf_bin_emit_tc(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, (s->logs.t_connect >= 0) ? s->logs.t_connect - s->logs.t_queue : -1);
+}
+
+static char *lf_bin_emit_tr(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, (s->logs.t_data >= 0) ? s->logs.t_data - s->logs.t_connect : -1);
+}
+
+static char *lf_bin_emit_tt(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type | ((s->fe->to_log & LW_BYTES) ? 0 : LOG_BIN_PLUS), s->logs.t_close);
+}
+
+static char *lf_bin_emit_status(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, s->txn.status);
+}
+
+static char *lf_bin_emit_bytes(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_llong(dst, size, node->type | ((s->fe->to_log & LW_BYTES) ? 0 : LOG_BIN_PLUS), s->logs.bytes_out);
+}
+
+static char *lf_bin_emit_bytes_up(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_llong(dst, size, node->type, s->logs.bytes_in);
+}
+
+static char *lf_bin_emit_cclient(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_str(dst, size, node->type, s->txn.cli_cookie);
+}
+
+static char *lf_bin_emit_cserver(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_str(dst, size, node->type, s->txn.srv_cookie);
+}
+
+static char *lf_bin_emit_termstate(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (size < 4)
+		return NULL;
+	*dst++ = node->type;
+	return lf_emit_termstate(dst, size - 1, s, node, st);
+}
+
+static char *lf_bin_emit_termstate_ck(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	if (size < 6)
+		return NULL;
+	*dst++ = node->type;
+	return lf_emit_termstate_ck(dst, size - 1, s, node, st);
+}
+
+static char *lf_bin_emit_actconn(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, actconn);
+}
+
+static char *lf_bin_emit_feconn(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, s->fe->feconn);
+}
+
+static char *lf_bin_emit_beconn(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, s->be->beconn);
+}
+
+static char *lf_bin_emit_srvconn(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, objt_server(s->target) ? objt_server(s->target)->cur_sess : 0);
+}
+
+static char *lf_bin_emit_retries(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type | ((s->flags & SN_REDISP) ? LOG_BIN_PLUS : 0),
+	                  (s->req->cons->conn_retries > 0) ?
+	                  (s->be->conn_retries - s->req->cons->conn_retries) :
+	                  s->be->conn_retries);
+}
+
+static char *lf_bin_emit_srvqueue(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, s->logs.srv_queue_size);
+}
+
+static char *lf_bin_emit_bckqueue(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, s->logs.prx_queue_size);
+}
+
+static char *lf_bin_caps(char *dst, size_t size, int tag, char **cap, int nb)
+{
+	char *end = dst + size;
+	int hdr;
+
+	if (!cap)
+		nb = 0;
+	if (size < 3)
+		return NULL;
+	*dst++ = tag;
+	*dst++ = nb;
+	for (hdr = 0; hdr < nb; hdr++) {
+		dst = lf_bin_strlen(dst, cap[hdr], cap[hdr] ? strlen(cap[hdr]) : 0, end - dst);
+		if (!dst)
+			return NULL;
+	}
+	return dst;
+}
+
+static char *lf_bin_emit_hdrrequest(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_caps(dst, size, node->type, s->txn.req.cap, s->fe->nb_req_cap);
+}
+
+static char *lf_bin_emit_hdrresponse(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_caps(dst, size, node->type, s->txn.rsp.cap, s->fe->nb_rsp_cap);
+}
+
+static char *lf_bin_emit_req(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_str(dst, size, node->type, s->txn.uri ? s->txn.uri : "<BADREQ>");
+}
+
+static char *lf_bin_emit_counter(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, global.req_count);
+}
+
+static char *lf_bin_emit_hostname(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_str(dst, size, node->type, hostname);
+}
+
+static char *lf_bin_emit_pid(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_int(dst, size, node->type, pid);
+}
+
+static char *lf_bin_emit_uniqueid(char *dst, size_t size, struct session *s, const struct logformat_node *node, struct lf_state *st)
+{
+	return lf_bin_str(dst, size, node->type, s->unique_id);
+}
+
+typedef char *(*lf_emit_fct)(char *dst, size_t size, struct session *s,
+                             const struct logformat_node *node, struct lf_state *st);
+
+/* emitters for each LOG_FMT_* type */
+static const struct lf_emitter {
+	lf_emit_fct emit;	/* default emitter */
+	lf_emit_fct emit_hex;	/* emitter to use with the +X option, if different */
+	lf_emit_fct emit_bin;	/* emitter for binary records, NULL for constant text */
+	int flags;		/* LOG_OPT_OWN_SPACE if the field may be empty */
+} lf_emitters[] = {
+	[LOG_FMT_TEXT]           = { lf_emit_text,            NULL,                NULL,                          LOG_OPT_OWN_SPACE },
+	[LOG_FMT_EXPR]           = { lf_emit_expr,            NULL,                lf_bin_emit_expr,              0 },
+	[LOG_FMT_SEPARATOR]      = { lf_emit_sep,             NULL,                NULL,                          LOG_OPT_OWN_SPACE },
+	[LOG_FMT_CLIENTIP]       = { lf_emit_clientip,        NULL,                lf_bin_emit_clientip,          0 },
+	[LOG_FMT_CLIENTPORT]     = { lf_emit_clientport,      NULL,                lf_bin_emit_clientport,        0 },
+	[LOG_FMT_BACKENDIP]      = { lf_emit_backendip,       NULL,                lf_bin_emit_backendip,         0 },
+	[LOG_FMT_BACKENDPORT]    = { lf_emit_backendport,     NULL,                lf_bin_emit_backendport,       0 },
+	[LOG_FMT_FRONTENDIP]     = { lf_emit_frontendip,      NULL,                lf_bin_emit_frontendip,        0 },
+	[LOG_FMT_FRONTENDPORT]   = { lf_emit_frontendport,    NULL,                lf_bin_emit_frontendport,      0 },
+	[LOG_FMT_SERVERPORT]     = { lf_emit_serverport,      NULL,                lf_bin_emit_serverport,        0 },
+	[LOG_FMT_SERVERIP]       = { lf_emit_serverip,        NULL,                lf_bin_emit_serverip,          0 },
+	[LOG_FMT_COUNTER]        = { lf_emit_counter,         lf_emit_counter_hex, lf_bin_emit_counter,           0 },
+	[LOG_FMT_PID]            = { lf_emit_pid,             lf_emit_pid_hex,     lf_bin_emit_pid,               0 },
+	[LOG_FMT_DATE]           = { lf_emit_date,            NULL,                lf_bin_emit_date,              0 },
+	[LOG_FMT_DATEGMT]        = { lf_emit_dategmt,         NULL,                lf_bin_emit_date,              0 },
+	[LOG_FMT_DATELOCAL]      = { lf_emit_datelocal,       NULL,                lf_bin_emit_date,              0 },
+	[LOG_FMT_TS]             = { lf_emit_ts,              lf_emit_ts_hex,      lf_bin_emit_date,              0 },
+	[LOG_FMT_MS]             = { lf_emit_ms,              lf_emit_ms_hex,      lf_bin_emit_date,              0 },
+	[LOG_FMT_FRONTEND]       = { lf_emit_frontend,        NULL,                lf_bin_emit_frontend,          0 },
+	[LOG_FMT_FRONTEND_XPRT]  = { lf_emit_frontend_xprt,   NULL,                lf_bin_emit_frontend_xprt,     0 },
+	[LOG_FMT_BACKEND]        = { lf_emit_backend,         NULL,                lf_bin_emit_backend,           0 },
+	[LOG_FMT_SERVER]         = { lf_emit_server,          NULL,                lf_bin_emit_server,            0 },
+	[LOG_FMT_BYTES]          = { lf_emit_bytes,           NULL,                lf_bin_emit_bytes,             0 },
+	[LOG_FMT_BYTES_UP]       = { lf_emit_bytes_up,        NULL,                lf_bin_emit_bytes_up,          0 },
+	[LOG_FMT_TQ]             = { lf_emit_tq,              NULL,                lf_bin_emit_tq,                0 },
+	[LOG_FMT_TW]             = { lf_emit_tw,              NULL,                lf_bin_emit_tw,                0 },
+	[LOG_FMT_TC]             = { lf_emit_tc,              NULL,                lf_bin_emit_tc,                0 },
+	[LOG_FMT_TR]             = { lf_emit_tr,              NULL,                lf_bin_emit_tr,                0 },
+	[LOG_FMT_TT]             = { lf_emit_tt,              NULL,                lf_bin_emit_tt,                0 },
+	[LOG_FMT_STATUS]         = { lf_emit_status,          NULL,                lf_bin_emit_status,            0 },
+	[LOG_FMT_CCLIENT]        = { lf_emit_cclient,         NULL,                lf_bin_emit_cclient,           0 },
+	[LOG_FMT_CSERVER]        = { lf_emit_cserver,         NULL,                lf_bin_emit_cserver,           0 },
+	[LOG_FMT_TERMSTATE]      = { lf_emit_termstate,       NULL,                lf_bin_emit_termstate,         0 },
+	[LOG_FMT_TERMSTATE_CK]   = { lf_emit_termstate_ck,    NULL,                lf_bin_emit_termstate_ck,      0 },
+	[LOG_FMT_ACTCONN]        = { lf_emit_actconn,         NULL,                lf_bin_emit_actconn,           0 },
+	[LOG_FMT_FECONN]         = { lf_emit_feconn,          NULL,                lf_bin_emit_feconn,            0 },
+	[LOG_FMT_BECONN]         = { lf_emit_beconn,          NULL,                lf_bin_emit_beconn,            0 },
+	[LOG_FMT_SRVCONN]        = { lf_emit_srvconn,         NULL,                lf_bin_emit_srvconn,           0 },
+	[LOG_FMT_RETRIES]        = { lf_emit_retries,         NULL,                lf_bin_emit_retries,           0 },
+	[LOG_FMT_SRVQUEUE]       = { lf_emit_srvqueue,        NULL,                lf_bin_emit_srvqueue,          0 },
+	[LOG_FMT_BCKQUEUE]       = { lf_emit_bckqueue,        NULL,                lf_bin_emit_bckqueue,          0 },
+	[LOG_FMT_HDRREQUEST]     = { lf_emit_hdrrequest,      NULL,                lf_bin_emit_hdrrequest,        LOG_OPT_OWN_SPACE },
+	[LOG_FMT_HDRRESPONS]     = { lf_emit_hdrresponse,     NULL,                lf_bin_emit_hdrresponse,       LOG_OPT_OWN_SPACE },
+	[LOG_FMT_HDRREQUESTLIST] = { lf_emit_hdrrequestlist,  NULL,                lf_bin_emit_hdrrequest,        LOG_OPT_OWN_SPACE },
+	[LOG_FMT_HDRRESPONSLIST] = { lf_emit_hdrresponselist, NULL,                lf_bin_emit_hdrresponse,       LOG_OPT_OWN_SPACE },
+	[LOG_FMT_REQ]            = { lf_emit_req,             NULL,                lf_bin_emit_req,               0 },
+	[LOG_FMT_HOSTNAME]       = { lf_emit_hostname,        NULL,                lf_bin_emit_hostname,          0 },
+	[LOG_FMT_UNIQUEID]       = { lf_emit_uniqueid,        NULL,                lf_bin_emit_uniqueid,          0 },
+#ifdef USE_OPENSSL
+	[LOG_FMT_SSL_CIPHER]     = { lf_emit_ssl_cipher,      NULL,                lf_bin_emit_ssl_cipher,        0 },
+	[LOG_FMT_SSL_VERSION]    = { lf_emit_ssl_version,     NULL,                lf_bin_emit_ssl_version,       0 },
+#endif
+};
+
+/* returns the emitter for node type <type>, or NULL if there is none */
+static inline const struct lf_emitter *lf_get_emitter(int type)
+{
+	if (type < 0 || type >= sizeof(lf_emitters) / sizeof(lf_emitters[0]) ||
+	    !lf_emitters[type].emit)
+		return NULL;
+	return &lf_emitters[type];
+}
+
+/* Returns non-zero if the field of node <node> may emit nothing at all, in
+ * which case a separator following it can only be resolved at run time.
+ */
+static inline int lf_may_be_empty(const struct logformat_node *node)
+{
+	const struct lf_emitter *e = lf_get_emitter(node->type);
+
+	return node->type != LOG_FMT_TEXT && (!e || (e->flags & LOG_OPT_OWN_SPACE));
+}
+
+/* Compiles the parsed format <list_format> so that build_logline() only has
+ * to call one specialized emitter per node :
+ *   - separators which can be resolved now are turned into text, or removed
+ *     when they would never emit anything ;
+ *   - consecutive texts are merged ;
+ *   - each node is assigned the emitter matching its type and options.
+ * When <options> contains LOG_OPT_BINARY, the binary emitters are used instead
+ * and constant texts are removed.
+ */
+static void compile_logformat(struct list *list_format, int options)
+{
+	struct logformat_node *node, *back, *prev = NULL;
+	const struct lf_emitter *e;
+	char *str;
+
+	if (options & LOG_OPT_BINARY) {
+		list_for_each_entry_safe(node, back, list_format, list) {
+			e = lf_get_emitter(node->type);
+			if (!e || !e->emit_bin) {
+				LIST_DEL(&node->list);
+				free(node->arg);
+				free(node);
+				continue;
+			}
+			node->emit = e->emit_bin;
+		}
+		return;
+	}
+
+	list_for_each_entry_safe(node, back, list_format, list) {
+		if (node->type == LOG_FMT_SEPARATOR) {
+			if (!prev || prev->type == LOG_FMT_SEPARATOR ||
+			    (prev->type == LOG_FMT_TEXT && (prev->options & LOG_OPT_END_SPACE))) {
+				/* a space was already emitted */
+				LIST_DEL(&node->list);
+				free(node->arg);
+				free(node);
+				continue;
+			}
+			if (!lf_may_be_empty(prev)) {
+				str = strdup(" ");
+				if (str) {
+					free(node->arg);
+					node->arg = str;
+					node->type = LOG_FMT_TEXT;
+					node->options |= LOG_OPT_END_SPACE;
 				}
-				break;
+			}
+		}
 
-			case LOG_FMT_UNIQUEID: // %ID
-				src = s->unique_id;
-				ret = lf_text(tmplog, src, maxsize - (tmplog - dst), tmp);
-				if (ret == NULL)
-					goto out;
-				tmplog = ret;
-				last_isspace = 0;
-				break;
+		if (node->type == LOG_FMT_TEXT && prev && prev->type == LOG_FMT_TEXT) {
+			str = malloc(strlen(prev->arg) + strlen(node->arg) + 1);
+			if (str) {
+				strcpy(str, prev->arg);
+				strcat(str, node->arg);
+				free(prev->arg);
+				prev->arg = str;
+				prev->options &= ~LOG_OPT_END_SPACE;
+				prev->options |= node->options & LOG_OPT_END_SPACE;
+				LIST_DEL(&node->list);
+				free(node->arg);
+				free(node);
+				continue;
+			}
+		}
+		prev = node;
+	}
+
+	list_for_each_entry(node, list_format, list) {
+		if (node->type == LOG_FMT_TEXT)
+			node->len = strlen(node->arg);
 
+		e = lf_get_emitter(node->type);
+		if (!e) {
+			node->emit = lf_emit_none;
+			node->options |= LOG_OPT_OWN_SPACE;
+			continue;
 		}
+
+		node->emit = e->emit;
+		if (e->emit_hex && (node->options & LOG_OPT_HEXA))
+			node->emit = e->emit_hex;
+		node->options |= e->flags;
+	}
+}
+
+/* Builds a log line in <dst> based on <list_format>, and stops before reaching
+ * <maxsize> characters. Returns the size of the output string in characters,
+ * not counting the trailing zero which is always added if the resulting size
+ * is not zero. The format must have been compiled by compile_logformat().
+ */
+int build_logline(struct session *s, char *dst, size_t maxsize, struct list *list_format)
+{
+	struct logformat_node *tmp;
+	struct lf_state st;
+	char *tmplog;
+	char *ret;
+
+	/* FIXME: let's limit ourselves to frontend logging for now. */
+
+	/* fill logbuffer */
+	if (LIST_ISEMPTY(list_format))
+		return 0;
+
+	st.t_request = -1;
+	if (tv_isge(&s->logs.tv_request, &s->logs.tv_accept))
+		st.t_request = tv_ms_elapsed(&s->logs.tv_accept, &s->logs.tv_request);
+	st.last_isspace = 1;
+
+	tmplog = dst;
+	list_for_each_entry(tmp, list_format, list) {
+		ret = tmp->emit(tmplog, dst + maxsize - tmplog, s, tmp, &st);
+		if (ret == NULL)
+			break;
+		tmplog = ret;
+		if (!(tmp->options & LOG_OPT_OWN_SPACE))
+			st.last_isspace = 0;
 	}
 
-out:
 	/* *tmplog is a unused character */
 	*tmplog = '\0';
 	return tmplog - dst;
+}
+
+/* Builds a binary log record in <dst> based on <list_format>, which must have
+ * been compiled with LOG_OPT_BINARY, and stops before reaching <maxsize> bytes.
+ * Returns the size of the record, or zero if not even its header fits. When
+ * all fields do not fit, the record is truncated after the last one which
+ * fits, and its header holds the truncated length. A trailing zero is added
+ * after the record.
+ */
+int build_logbin(struct session *s, char *dst, size_t maxsize, struct list *list_format)
+{
+	int len;
+
+	if (maxsize < LOG_BIN_HDR_LEN + 1)
+		return 0;
 
+	/* binary emitters may fill all the room they get, keep one byte for
+	 * the trailing zero.
+	 */
+	len = build_logline(s, dst + LOG_BIN_HDR_LEN, maxsize - LOG_BIN_HDR_LEN - 1, list_format);
+	dst[0] = LOG_BIN_MAGIC;
+	dst[1] = LOG_BIN_VERSION;
+	lf_bin_put16(dst + 2, len);
+	return len + LOG_BIN_HDR_LEN;
 }
 
 /*
  * send a log for the session when we have enough info about it.
  * Will not log if the frontend has no log defined.
  */
+/*
+ * Decides for each log server of proxy <p> whether the log of the current
+ * session, at level <level>, must be sent according to the server's sampling
+ * ratio and rate limit. The servers which must not get it are marked with
+ * <skip> and the suppressed logs are accounted. Returns the number of servers
+ * which will get the log, and sets <skipped> to the number of marked ones.
+ */
+static int sess_log_select(struct proxy *p, int level, int *skipped)
+{
+	struct logsrv *logsrv;
+	int selected = 0;
+
+	*skipped = 0;
+
+	list_for_each_entry(logsrv, &p->logsrvs, list) {
+		logsrv->skip = 0;
+		if (level > logsrv->level)
+			continue;
+
+		if (logsrv->sample_den) {
+			if (++logsrv->sample_cnt >= logsrv->sample_den)
+				logsrv->sample_cnt = 0;
+			if (logsrv->sample_cnt >= logsrv->sample_num)
+				logsrv->skip = 1;
+		}
+
+		if (!logsrv->skip && logsrv->rate_limit) {
+			if (freq_ctr_remain(&logsrv->rate, logsrv->rate_limit, 0))
+				update_freq_ctr(&logsrv->rate, 1);
+			else
+				logsrv->skip = 1;
+		}
+
+		if (logsrv->skip) {
+			p->fe_counters.log_suppressed++;
+			log_counters.suppressed++;
+			(*skipped)++;
+		}
+		else
+			selected++;
+	}
+	return selected;
+}
+
 void sess_log(struct session *s)
 {
+	struct logsrv *logsrv;
 	char *tmplog;
-	int size, err, level;
+	int size, len, err, level, skipped;
 
 	/* if we don't want to log normal traffic, return now */
 	err = (s->flags & (SN_ERR_MASK | SN_REDISP)) ||
@@ -1530,13 +2449,34 @@ void sess_log(struct session *s)
 	if (err && (s->fe->options2 & PR_O2_LOGERRORS))
 		level = LOG_ERR;
 
+	/* errors are always logged, other logs may be sampled or rate-limited */
+	skipped = 0;
+	if (!err && !sess_log_select(s->fe, level, &skipped) && skipped) {
+		s->logs.logwait = 0;
+		goto clear_skip;
+	}
+
 	tmplog = update_log_hdr();
 	size = tmplog - logline;
-	size += build_logline(s, tmplog, sizeof(logline) - size, &s->fe->logformat);
+	if (s->fe->options2 & PR_O2_LOGBIN) {
+		/* a truncated record is sent since its header gives its length,
+		 * but a syslog header without any record is not.
+		 */
+		len = build_logbin(s, tmplog, sizeof(logline) - size, &s->fe->logformat);
+		size = len ? size + len : 0;
+	}
+	else
+		size += build_logline(s, tmplog, sizeof(logline) - size, &s->fe->logformat);
 	if (size > 0) {
 		__send_log(s->fe, level, logline, size + 1);
 		s->logs.logwait = 0;
 	}
+
+ clear_skip:
+	if (skipped) {
+		list_for_each_entry(logsrv, &s->fe->logsrvs, list)
+			logsrv->skip = 0;
+	}
 }
 
 /*
@@ -3048,7 +3048,8 @@ int http_handle_stats(struct session *s, struct channel *req)
 	             "Cache-Control: no-cache\r\n"
 	             "Connection: close\r\n"
 	             "Content-Type: %s\r\n",
-	             (si->applet.ctx.stats.flags & STAT_FMT_HTML) ? "text/html" : "text/plain");
+	             (si->applet.ctx.stats.flags & STAT_FMT_HTML) ? "text/html" :
+	             (si->applet.ctx.stats.flags & STAT_FMT_METRICS) ? "text/plain; version=0.0.4" : "text/plain");
 
 	if (uri->refresh > 0 && !(si->applet.ctx.stats.flags & STAT_NO_REFRESH))
 		chunk_appendf(&trash, "Refresh: %d\r\n",
@@ -4239,6 +4240,8 @@ void http_end_txn_clean_session(struct session *s)
 
 	s->logs.t_close = tv_ms_elapsed(&s->logs.tv_accept, &now);
 	session_process_counters(s);
+	session_account_timers(s);
+	health_observe_latency(s);
 	session_stop_backend_counters(s);
 
 	if (s->txn.status) {
@@ -7825,6 +7828,31 @@ int stats_check_uri(struct stream_interface *si, struct http_txn *txn, struct pr
 		h++;
 	}
 
+	h = uri + uri_auth->uri_len;
+	while (h <= uri + msg->sl.rq.u_l - 8) {
+		if (memcmp(h, ";fields=", 8) == 0) {
+			const char *end;
+
+			h += 8;
+			for (end = h; end < uri + msg->sl.rq.u_l && *end != ';'; end++)
+				;
+			/* the list is ignored if it contains unknown names */
+			stats_parse_fields(si, h, end - h);
+			break;
+		}
+		h++;
+	}
+
+	h = uri + uri_auth->uri_len;
+	while (h <= uri + msg->sl.rq.u_l - 8) {
+		if (memcmp(h, ";metrics", 8) == 0) {
+			si->applet.ctx.stats.flags &= ~STAT_FMT_HTML;
+			si->applet.ctx.stats.flags |= STAT_FMT_METRICS;
+			break;
+		}
+		h++;
+	}
+
 	h = uri + uri_auth->uri_len;
 	while (h <= uri + msg->sl.rq.u_l - 8) {
 		if (memcmp(h, ";st=", 4) == 0) {
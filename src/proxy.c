@@ -450,6 +450,7 @@ void init_new_proxy(struct proxy *p)
 	LIST_INIT(&p->logsrvs);
 	LIST_INIT(&p->logformat);
 	LIST_INIT(&p->format_unique_id);
+	LIST_INIT(&p->tcpcheck_rules);
 	LIST_INIT(&p->conf.bind);
 	LIST_INIT(&p->conf.listeners);
 	LIST_INIT(&p->conf.args.list);
@@ -156,6 +156,45 @@ static void __listener_init(void)
 	srv_register_keywords(&srv_kws);
 }
 
+/* Recomputes the server's effective weight from its user weight <uweight>,
+ * taking a possible slowstart into account, and updates the LB algorithm
+ * accordingly.
+ */
+void server_recalc_eweight(struct server *sv)
+{
+	struct proxy *px = sv->proxy;
+
+	if (px->lbprm.algo & BE_LB_PROP_DYN) {
+	/* we must take care of not pushing the server to full throttle during slow starts */
+		if ((sv->state & SRV_WARMINGUP))
+			sv->eweight = (BE_WEIGHT_SCALE * (now.tv_sec - sv->last_change) + sv->slowstart - 1) / sv->slowstart;
+		else
+			sv->eweight = BE_WEIGHT_SCALE;
+		sv->eweight *= sv->uweight;
+	} else {
+		sv->eweight = sv->uweight;
+	}
+
+	/* servers found too slow by "observe-latency" get a reduced weight */
+	if ((sv->state & SRV_LAT_SLOW) && sv->lat.factor) {
+		sv->eweight /= sv->lat.factor;
+		if (!sv->eweight && sv->uweight)
+			sv->eweight = 1;
+	}
+
+	/* static LB algorithms are a bit harder to update */
+	if (px->lbprm.update_server_eweight)
+		px->lbprm.update_server_eweight(sv);
+	else if (sv->eweight) {
+		if (px->lbprm.set_server_status_up)
+			px->lbprm.set_server_status_up(sv);
+	}
+	else {
+		if (px->lbprm.set_server_status_down)
+			px->lbprm.set_server_status_down(sv);
+	}
+}
+
 /*
  * Parses weight_str and configures sv accordingly.
  * Returns NULL on success, error message string otherwise.
@@ -197,30 +236,7 @@ const char *server_parse_weight_change_request(struct server *sv,
 		return "Backend is using a static LB algorithm and only accepts weights '0%' and '100%'.\n";
 
 	sv->uweight = w;
-
-	if (px->lbprm.algo & BE_LB_PROP_DYN) {
-	/* we must take care of not pushing the server to full throttle during slow starts */
-		if ((sv->state & SRV_WARMINGUP))
-			sv->eweight = (BE_WEIGHT_SCALE * (now.tv_sec - sv->last_change) + sv->slowstart - 1) / sv->slowstart;
-		else
-			sv->eweight = BE_WEIGHT_SCALE;
-		sv->eweight *= sv->uweight;
-	} else {
-		sv->eweight = sv->uweight;
-	}
-
-	/* static LB algorithms are a bit harder to update */
-	if (px->lbprm.update_server_eweight)
-		px->lbprm.update_server_eweight(sv);
-	else if (sv->eweight) {
-		if (px->lbprm.set_server_status_up)
-			px->lbprm.set_server_status_up(sv);
-	}
-	else {
-		if (px->lbprm.set_server_status_down)
-			px->lbprm.set_server_status_down(sv);
-	}
-
+	server_recalc_eweight(sv);
 	return NULL;
 }
 
@@ -28,6 +28,7 @@
 #include <proto/channel.h>
 #include <proto/checks.h>
 #include <proto/connection.h>
+#include <proto/counters.h>
 #include <proto/dumpstats.h>
 #include <proto/fd.h>
 #include <proto/freq_ctr.h>
@@ -764,6 +765,48 @@ void session_process_counters(struct session *s)
 	}
 }
 
+/* Accounts for the timers of session <s> in the latency histograms of its
+ * frontend, backend and server. It is called at the end of each transaction,
+ * once t_close is known. Timers which were not reached are ignored, as well as
+ * keep-alive connections closed while waiting for another request, which are
+ * not logged either.
+ */
+void session_account_timers(struct session *s)
+{
+	struct server *srv = objt_server(s->target);
+	int t_request = 0;
+	int tw, tc, tr;
+
+	if ((s->txn.flags & TX_NOT_FIRST) && tv_iszero(&s->logs.tv_request))
+		return;
+
+	if (tv_isge(&s->logs.tv_request, &s->logs.tv_accept))
+		t_request = tv_ms_elapsed(&s->logs.tv_accept, &s->logs.tv_request);
+
+	tw = (s->logs.t_queue >= 0) ? s->logs.t_queue - t_request : -1;
+	tc = (s->logs.t_connect >= 0 && s->logs.t_queue >= 0) ? s->logs.t_connect - s->logs.t_queue : -1;
+	tr = (s->logs.t_data >= 0 && s->logs.t_connect >= 0) ? s->logs.t_data - s->logs.t_connect : -1;
+
+	lat_histo_add(&s->fe->fe_counters.lat[LAT_TW], tw);
+	lat_histo_add(&s->fe->fe_counters.lat[LAT_TC], tc);
+	lat_histo_add(&s->fe->fe_counters.lat[LAT_TR], tr);
+	lat_histo_add(&s->fe->fe_counters.lat[LAT_TT], s->logs.t_close);
+
+	if (s->flags & SN_BE_ASSIGNED) {
+		lat_histo_add(&s->be->be_counters.lat[LAT_TW], tw);
+		lat_histo_add(&s->be->be_counters.lat[LAT_TC], tc);
+		lat_histo_add(&s->be->be_counters.lat[LAT_TR], tr);
+		lat_histo_add(&s->be->be_counters.lat[LAT_TT], s->logs.t_close);
+	}
+
+	if (srv) {
+		lat_histo_add(&srv->counters.lat[LAT_TW], tw);
+		lat_histo_add(&srv->counters.lat[LAT_TC], tc);
+		lat_histo_add(&srv->counters.lat[LAT_TR], tr);
+		lat_histo_add(&srv->counters.lat[LAT_TT], s->logs.t_close);
+	}
+}
+
 /* This function is called with (si->state == SI_ST_CON) meaning that a
  * connection was attempted and that the file descriptor is already allocated.
  * We must check for establishment, error and abort. Possible output states
@@ -2451,6 +2494,8 @@ struct task *process_session(struct task *t)
 
 	s->logs.t_close = tv_ms_elapsed(&s->logs.tv_accept, &now);
 	session_process_counters(s);
+	session_account_timers(s);
+	health_observe_latency(s);
 
 	if (s->txn.status) {
 		int n;
@@ -44,6 +44,9 @@
 #include <openssl/x509.h>
 #include <openssl/err.h>
 #include <openssl/rand.h>
+#if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+#include <openssl/ocsp.h>
+#endif
 
 #include <common/buffer.h>
 #include <common/compat.h>
@@ -74,8 +77,14 @@
 #include <proto/task.h>
 
 #define SSL_SOCK_ST_FL_VERIFY_DONE  0x00000001
+#define SSL_SOCK_ST_FL_WRITE_RETRY  0x00000002  /* last SSL_write() must be retried */
+#define SSL_SOCK_ST_FL_CACHE_HIT    0x00000004  /* session was found in the session cache */
 /* bits 0xFFFF0000 are reserved to store verify errors */
 
+#define OCSP_MAX_CERTID_ASN1_LENGTH 128    /* max size of a DER encoded OCSP certificate ID */
+#define OCSP_MAX_RESPONSE_TIME_SKEW 300    /* accepted clock skew on OCSP responses, in seconds */
+#define OCSP_MAX_RESPONSE_SIZE      65536  /* max size of an OCSP response file */
+
 /* Verify errors macros */
 #define SSL_SOCK_CA_ERROR_TO_ST(e) (((e > 63) ? 63 : e) << (16))
 #define SSL_SOCK_CAEDEPTH_TO_ST(d) (((d > 15) ? 15 : d) << (6+16))
@@ -87,6 +96,31 @@
 
 static int sslconns = 0;
 
+/* number of frontend handshake steps still allowed during the current polling
+ * loop when "tune.ssl.maxhandshakes" is set. It is refilled by the polling loop.
+ */
+unsigned int ssl_hs_budget = 0;
+
+/* number of records sent over SSL connections, per size class */
+unsigned long long ssl_records[SSL_REC_CLASSES];
+
+/* dynamic record sizing states are attached to SSL sessions using this index */
+static int ssl_recsz_idx = -1;
+static int ssl_hs_time_idx = -1; /* time spent in SSL_do_handshake() (us) */
+
+/* read-ahead BIO staging buffers and statistics */
+static struct pool_head *pool2_ssl_rabuf;
+unsigned long long ssl_bio_reads = 0; /* reads performed by OpenSSL on read-ahead BIOs */
+unsigned long long ssl_bio_recv = 0;  /* recv() calls they resulted in */
+static struct pool_head *pool2_ssl_recsz;
+
+/* lazily loaded SSL contexts, least recently used first */
+static struct list ssl_lazy_lru = LIST_HEAD_INIT(ssl_lazy_lru);
+unsigned int ssl_lazy_ctx_cur = 0;        /* number of instantiated lazy contexts */
+unsigned long long ssl_lazy_ctx_loads = 0; /* number of lazy context instantiations */
+
+static SSL_CTX *ssl_sock_get_lazy_ctx(struct ssl_lazy_crt *lc);
+
 void ssl_sock_infocbk(const SSL *ssl, int where, int ret)
 {
 	struct connection *conn = (struct connection *)SSL_get_app_data(ssl);
@@ -180,6 +214,21 @@ static int ssl_sock_advertise_alpn_protos(SSL *s, const unsigned char **data,
 }
 #endif
 
+/* Session cache lookup callback. It relies on the shared session cache and
+ * only marks the connection when the session was found there, so that the
+ * handshake statistics can tell cache resumptions from ticket resumptions.
+ */
+static SSL_SESSION *ssl_sock_sess_get_cbk(SSL *ssl, unsigned char *key, int key_len, int *do_copy)
+{
+	struct connection *conn = (struct connection *)SSL_get_app_data(ssl);
+	SSL_SESSION *sess;
+
+	sess = shctx_get_cb(ssl, key, key_len, do_copy);
+	if (sess && conn)
+		conn->xprt_st |= SSL_SOCK_ST_FL_CACHE_HIT;
+	return sess;
+}
+
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
 /* Sets the SSL ctx of <ssl> to match the advertised server name. Returns a
  * warning when no match is found, which implies the default (first) cert
@@ -190,6 +239,8 @@ static int ssl_sock_switchctx_cbk(SSL *ssl, int *al, struct bind_conf *s)
 	const char *servername;
 	const char *wildp = NULL;
 	struct ebmb_node *node, *n;
+	struct sni_ctx *sc;
+	SSL_CTX *ctx;
 	int i;
 	(void)al; /* shut gcc stupid warning */
 
@@ -230,19 +281,75 @@ static int ssl_sock_switchctx_cbk(SSL *ssl, int *al, struct bind_conf *s)
 			SSL_TLSEXT_ERR_ALERT_WARNING);
 	}
 
+	/* certificates indexed at boot are only loaded upon first use */
+	sc = container_of(node, struct sni_ctx, name);
+	ctx = sc->ctx;
+	if (!ctx && sc->lazy)
+		ctx = ssl_sock_get_lazy_ctx(sc->lazy);
+
+	if (!ctx) {
+		return (s->strict_sni ?
+			SSL_TLSEXT_ERR_ALERT_FATAL :
+			SSL_TLSEXT_ERR_ALERT_WARNING);
+	}
+
 	/* switch ctx */
-	SSL_set_SSL_CTX(ssl, container_of(node, struct sni_ctx, name)->ctx);
+	SSL_set_SSL_CTX(ssl, ctx);
 	return SSL_TLSEXT_ERR_OK;
 }
 #endif /* SSL_CTRL_SET_TLSEXT_HOSTNAME */
 
+/* Reads the whole contents of file <path> into <buf>, whose storage is
+ * allocated and must be released by the caller. Empty files and files larger
+ * than <max> bytes are rejected. Returns 0 on success, otherwise 1 with an
+ * error message in <err>.
+ */
+static int ssl_sock_read_file(const char *path, struct chunk *buf, int max, char **err)
+{
+	struct stat st;
+	int fd, ret = 1;
+
+	chunk_init(buf, NULL, 0);
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		memprintf(err, "Unable to open file '%s' : %s", path, strerror(errno));
+		goto out;
+	}
+
+	if (!st.st_size || st.st_size > max) {
+		memprintf(err, "Invalid size for file '%s'", path);
+		goto out;
+	}
+
+	buf->str = malloc(st.st_size);
+	if (!buf->str) {
+		memprintf(err, "Not enough memory to load file '%s'", path);
+		goto out;
+	}
+
+	buf->size = st.st_size;
+	buf->len = read(fd, buf->str, st.st_size);
+	if (buf->len != st.st_size) {
+		memprintf(err, "Unable to read file '%s'", path);
+		free(buf->str);
+		chunk_init(buf, NULL, 0);
+		goto out;
+	}
+	ret = 0;
+ out:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
 #ifndef OPENSSL_NO_DH
-/* Loads Diffie-Hellman parameter from a file. Returns 1 if loaded, else -1
-   if an error occured, and 0 if parameter not found. */
-int ssl_sock_load_dh_params(SSL_CTX *ctx, const char *file)
+/* Loads Diffie-Hellman parameter from BIO <in>, or uses default ones if none
+ * is found there. Returns 1 if loaded, else -1 if an error occured, and 0 if
+ * parameter not found.
+ */
+static int ssl_sock_load_dh_params_bio(SSL_CTX *ctx, BIO *in)
 {
 	int ret = -1;
-	BIO *in;
 	DH *dh = NULL;
 	/* If not present, use parameters generated using 'openssl dhparam 1024 -C':
 	 * -----BEGIN DH PARAMETERS-----
@@ -268,13 +375,6 @@ int ssl_sock_load_dh_params(SSL_CTX *ctx, const char *file)
 		0x02,
 	};
 
-	in = BIO_new(BIO_s_file());
-	if (in == NULL)
-		goto end;
-
-	if (BIO_read_filename(in, file) <= 0)
-		goto end;
-
 	dh = PEM_read_bio_DHparams(in, NULL, ctx->default_passwd_callback, ctx->default_passwd_callback_userdata);
 	if (!dh) {
 		/* Clear openssl global errors stack */
@@ -303,6 +403,25 @@ end:
 	if (dh)
 		DH_free(dh);
 
+	return ret;
+}
+
+/* Loads Diffie-Hellman parameter from a file. Returns 1 if loaded, else -1
+   if an error occured, and 0 if parameter not found. */
+int ssl_sock_load_dh_params(SSL_CTX *ctx, const char *file)
+{
+	int ret = -1;
+	BIO *in;
+
+	in = BIO_new(BIO_s_file());
+	if (in == NULL)
+		goto end;
+
+	if (BIO_read_filename(in, file) <= 0)
+		goto end;
+
+	ret = ssl_sock_load_dh_params_bio(ctx, in);
+end:
 	if (in)
 		BIO_free(in);
 
@@ -310,7 +429,345 @@ end:
 }
 #endif
 
-static int ssl_sock_add_cert_sni(SSL_CTX *ctx, struct bind_conf *s, char *name, int order)
+#if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+/* An OCSP response stapled for a certificate. All SSL contexts built from the
+ * same certificate share the same entry, which is indexed by the DER encoding
+ * of the certificate's OCSP ID so that "set ssl ocsp-response" can find it.
+ */
+struct certificate_ocsp {
+	struct ebmb_node key;
+	unsigned char key_data[OCSP_MAX_CERTID_ASN1_LENGTH];
+	struct chunk response;  /* DER encoded response, empty if none */
+	long expire;            /* date after which the response is not stapled anymore */
+};
+
+static struct eb_root cert_ocsp_tree = EB_ROOT_UNIQUE;
+
+/* Converts ASN1 GeneralizedTime <d> to a number of seconds since the epoch.
+ * Only the DER form "YYYYMMDDHHMMSS[.fff]Z" is supported. Returns -1 on error.
+ */
+static long ssl_sock_asn1_time_to_epoch(ASN1_GENERALIZEDTIME *d)
+{
+	const unsigned char *p;
+	int f[6], i, y, m;
+	long days;
+
+	if (!d || d->type != V_ASN1_GENERALIZEDTIME || d->length < 15)
+		return -1;
+
+	p = d->data;
+	for (i = 0; i < 14; i++)
+		if (!isdigit(p[i]))
+			return -1;
+
+	/* year, month, day, hour, minute, second */
+	f[0] = (p[0] - '0') * 1000 + (p[1] - '0') * 100 + (p[2] - '0') * 10 + p[3] - '0';
+	for (i = 1; i < 6; i++)
+		f[i] = (p[2 * i + 2] - '0') * 10 + p[2 * i + 3] - '0';
+
+	i = 14;
+	if (p[i] == '.')
+		while (++i < d->length && isdigit(p[i]))
+			;
+	if (i != d->length - 1 || p[i] != 'Z')
+		return -1;
+
+	if (f[1] < 1 || f[1] > 12 || f[2] < 1 || f[2] > 31)
+		return -1;
+
+	/* days since 1970-01-01, with years starting in March */
+	y = f[0] - (f[1] <= 2);
+	m = f[1] + (f[1] <= 2 ? 9 : -3);
+	days = 365L * y + y / 4 - y / 100 + y / 400 + (153 * m + 2) / 5 + f[2] - 1 - 719468;
+	return ((days * 24 + f[3]) * 60 + f[4]) * 60 + f[5];
+}
+
+/* Checks that DER encoded OCSP response <der> is a successful basic response
+ * carrying a single "good" status, which must be for certificate ID <cid> if
+ * not NULL. It is then installed into <ocsp> if not NULL. Returns 0 on success,
+ * otherwise 1 with an error message in <err>.
+ */
+static int ssl_sock_load_ocsp_response(struct chunk *der, struct certificate_ocsp *ocsp, OCSP_CERTID *cid, char **err)
+{
+	OCSP_RESPONSE *resp;
+	OCSP_BASICRESP *bs = NULL;
+	OCSP_SINGLERESP *sr;
+	ASN1_GENERALIZEDTIME *thisupd, *nextupd;
+	const unsigned char *p = (const unsigned char *)der->str;
+	int reason;
+	long expire;
+	int ret = 1;
+
+	resp = d2i_OCSP_RESPONSE(NULL, &p, der->len);
+	if (!resp) {
+		memprintf(err, "Unable to parse OCSP response");
+		goto out;
+	}
+
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+		memprintf(err, "OCSP response status is not successful");
+		goto out;
+	}
+
+	bs = OCSP_response_get1_basic(resp);
+	if (!bs) {
+		memprintf(err, "Failed to get basic response from OCSP response");
+		goto out;
+	}
+
+	if (OCSP_resp_count(bs) != 1) {
+		memprintf(err, "OCSP response must contain exactly one certificate status");
+		goto out;
+	}
+
+	sr = OCSP_resp_get0(bs, 0);
+	if (!sr) {
+		memprintf(err, "Failed to get OCSP single response");
+		goto out;
+	}
+
+	if (cid && OCSP_id_cmp(sr->certId, cid)) {
+		memprintf(err, "OCSP certificate ID does not match the certificate and its issuer");
+		goto out;
+	}
+
+	if (OCSP_single_get0_status(sr, &reason, NULL, &thisupd, &nextupd) != V_OCSP_CERTSTATUS_GOOD) {
+		memprintf(err, "OCSP certificate status is not good");
+		goto out;
+	}
+
+	if (!nextupd) {
+		memprintf(err, "OCSP response has no next update date");
+		goto out;
+	}
+
+	if (!OCSP_check_validity(thisupd, nextupd, OCSP_MAX_RESPONSE_TIME_SKEW, -1)) {
+		memprintf(err, "OCSP response is not valid anymore");
+		goto out;
+	}
+
+	expire = ssl_sock_asn1_time_to_epoch(nextupd);
+	if (expire < 0) {
+		memprintf(err, "OCSP response has an invalid next update date");
+		goto out;
+	}
+
+	if (ocsp) {
+		if (!chunk_dup(&ocsp->response, der)) {
+			memprintf(err, "Not enough memory to store OCSP response");
+			goto out;
+		}
+		ocsp->expire = expire - OCSP_MAX_RESPONSE_TIME_SKEW;
+	}
+	ret = 0;
+ out:
+	ERR_clear_error();
+	if (bs)
+		OCSP_BASICRESP_free(bs);
+	if (resp)
+		OCSP_RESPONSE_free(resp);
+	return ret;
+}
+
+/* Loads the DER encoded OCSP response from file <path> into <ocsp> after
+ * checking it against certificate ID <cid>. Returns 0 on success, otherwise 1
+ * with an error message in <err>.
+ */
+static int ssl_sock_load_ocsp_response_from_file(const char *path, struct certificate_ocsp *ocsp, OCSP_CERTID *cid, char **err)
+{
+	struct chunk der;
+	int ret;
+
+	if (ssl_sock_read_file(path, &der, OCSP_MAX_RESPONSE_SIZE, err))
+		return 1;
+
+	ret = ssl_sock_load_ocsp_response(&der, ocsp, cid, err);
+	free(der.str);
+	return ret;
+}
+
+/* Status request callback, staples the preloaded OCSP response passed in <arg>
+ * if it has not expired yet.
+ */
+static int ssl_sock_ocsp_stapling_cbk(SSL *ssl, void *arg)
+{
+	struct certificate_ocsp *ocsp = arg;
+	char *ssl_buf;
+
+	if (!ocsp || !ocsp->response.str || !ocsp->response.len ||
+	    ocsp->expire < now.tv_sec)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	/* OpenSSL frees the response once it is sent */
+	ssl_buf = OPENSSL_malloc(ocsp->response.len);
+	if (!ssl_buf)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	memcpy(ssl_buf, ocsp->response.str, ocsp->response.len);
+	SSL_set_tlsext_status_ocsp_resp(ssl, ssl_buf, ocsp->response.len);
+	return SSL_TLSEXT_ERR_OK;
+}
+
+/* Enables OCSP stapling on context <ctx> if file "<cert_path>.ocsp" exists.
+ * If <der> is not NULL, it holds the contents of this file read in advance, or
+ * no data if it does not exist, and the file system is not accessed. The
+ * response is read only the first time the certificate is loaded, later loads
+ * share the same entry, which may have been updated meanwhile. Returns 1 if no
+ * OCSP file exists, 0 on success, and -1 with an error message in <err> on
+ * failure. An invalid or outdated response is only reported as a warning,
+ * since stapling will resume once it is updated.
+ */
+static int ssl_sock_load_ocsp(SSL_CTX *ctx, const char *cert_path, struct chunk *der, char **err)
+{
+	char ocsp_path[MAXPATHLEN+1];
+	struct certificate_ocsp *ocsp = NULL, *iocsp;
+	struct ebmb_node *node;
+	struct stat st;
+	X509 *x = NULL, *issuer = NULL, *xi;
+	X509_STORE_CTX *store_ctx;
+	OCSP_CERTID *cid = NULL;
+	SSL *ssl;
+	unsigned char *p;
+	char *warn = NULL;
+	int i, ret = -1;
+
+	snprintf(ocsp_path, sizeof(ocsp_path), "%s.ocsp", cert_path);
+	if (der ? !der->str : stat(ocsp_path, &st))
+		return 1;
+
+	/* the leaf certificate is only reachable through an SSL session */
+	ssl = SSL_new(ctx);
+	if (!ssl)
+		goto out;
+	x = SSL_get_certificate(ssl);
+	SSL_free(ssl);
+	if (!x)
+		goto out;
+
+	/* look for the issuer in the chain first, then in the store */
+	for (i = 0; i < sk_X509_num(ctx->extra_certs); i++) {
+		xi = sk_X509_value(ctx->extra_certs, i);
+		if (X509_check_issued(xi, x) == X509_V_OK) {
+			issuer = xi;
+			break;
+		}
+	}
+
+	if (!issuer) {
+		store_ctx = X509_STORE_CTX_new();
+		if (!store_ctx)
+			goto out;
+		i = 0;
+		if (X509_STORE_CTX_init(store_ctx, SSL_CTX_get_cert_store(ctx), NULL, NULL))
+			i = X509_STORE_CTX_get1_issuer(&xi, store_ctx, x);
+		X509_STORE_CTX_free(store_ctx);
+		if (i <= 0)
+			goto out;
+		issuer = xi;
+		cid = OCSP_cert_to_id(NULL, x, issuer);
+		X509_free(issuer);
+	}
+	else
+		cid = OCSP_cert_to_id(NULL, x, issuer);
+
+	if (!cid)
+		goto out;
+
+	i = i2d_OCSP_CERTID(cid, NULL);
+	if (i <= 0 || i > OCSP_MAX_CERTID_ASN1_LENGTH)
+		goto out;
+
+	ocsp = calloc(1, sizeof(*ocsp));
+	if (!ocsp)
+		goto out;
+
+	p = ocsp->key_data;
+	i2d_OCSP_CERTID(cid, &p);
+
+	node = ebmb_insert(&cert_ocsp_tree, &ocsp->key, OCSP_MAX_CERTID_ASN1_LENGTH);
+	iocsp = container_of(node, struct certificate_ocsp, key);
+	if (iocsp == ocsp) {
+		ocsp = NULL;
+		if (der ? ssl_sock_load_ocsp_response(der, iocsp, cid, &warn) :
+		    ssl_sock_load_ocsp_response_from_file(ocsp_path, iocsp, cid, &warn))
+			Warning("Loading '%s': %s, OCSP stapling will be disabled until the response is updated.\n",
+			        ocsp_path, warn);
+		free(warn);
+	}
+
+	SSL_CTX_set_tlsext_status_cb(ctx, ssl_sock_ocsp_stapling_cbk);
+	SSL_CTX_set_tlsext_status_arg(ctx, iocsp);
+	ret = 0;
+ out:
+	ERR_clear_error();
+	if (cid)
+		OCSP_CERTID_free(cid);
+	free(ocsp);
+	if (ret < 0)
+		memprintf(err, "%s'%s' is present but the OCSP certificate ID of '%s' cannot be computed (maybe its issuer could not be found).\n",
+		          err && *err ? *err : "", ocsp_path, cert_path);
+	return ret;
+}
+
+/* Replaces the stapled OCSP response of the certificate it was issued for with
+ * DER encoded response <der>. Returns 0 on success, otherwise 1 with an error
+ * message in <err>.
+ */
+int ssl_sock_update_ocsp_response(struct chunk *der, char **err)
+{
+	OCSP_RESPONSE *resp;
+	OCSP_BASICRESP *bs = NULL;
+	OCSP_SINGLERESP *sr;
+	struct ebmb_node *node;
+	unsigned char key[OCSP_MAX_CERTID_ASN1_LENGTH];
+	const unsigned char *p = (const unsigned char *)der->str;
+	unsigned char *q;
+	int i, ret = 1;
+
+	resp = d2i_OCSP_RESPONSE(NULL, &p, der->len);
+	if (!resp) {
+		memprintf(err, "Unable to parse OCSP response");
+		goto out;
+	}
+
+	bs = OCSP_response_get1_basic(resp);
+	if (!bs || OCSP_resp_count(bs) != 1 || !(sr = OCSP_resp_get0(bs, 0))) {
+		memprintf(err, "OCSP response must contain exactly one certificate status");
+		goto out;
+	}
+
+	i = i2d_OCSP_CERTID(sr->certId, NULL);
+	if (i <= 0 || i > OCSP_MAX_CERTID_ASN1_LENGTH) {
+		memprintf(err, "Invalid OCSP certificate ID");
+		goto out;
+	}
+
+	memset(key, 0, sizeof(key));
+	q = key;
+	i2d_OCSP_CERTID(sr->certId, &q);
+
+	node = ebmb_lookup(&cert_ocsp_tree, key, OCSP_MAX_CERTID_ASN1_LENGTH);
+	if (!node) {
+		memprintf(err, "OCSP response does not match any certificate");
+		goto out;
+	}
+
+	ret = ssl_sock_load_ocsp_response(der, container_of(node, struct certificate_ocsp, key), NULL, err);
+ out:
+	ERR_clear_error();
+	if (bs)
+		OCSP_BASICRESP_free(bs);
+	if (resp)
+		OCSP_RESPONSE_free(resp);
+	return ret;
+}
+#endif /* SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !OPENSSL_NO_OCSP */
+
+/* Indexes certificate name <name> in bind_conf <s>'s SNI trees, pointing either
+ * to context <ctx> or to lazily loaded certificate <lazy>. Returns the order to
+ * use for the next name of the same certificate.
+ */
+static int ssl_sock_add_cert_sni(SSL_CTX *ctx, struct ssl_lazy_crt *lazy, struct bind_conf *s, char *name, int order)
 {
 	struct sni_ctx *sc;
 	int wild = 0, neg = 0;
@@ -334,6 +791,7 @@ static int ssl_sock_add_cert_sni(SSL_CTX *ctx, struct bind_conf *s, char *name,
 			sc->name.key[j] = tolower(name[j]);
 		sc->name.key[len] = 0;
 		sc->ctx = ctx;
+		sc->lazy = lazy;
 		sc->order = order++;
 		sc->neg = neg;
 		if (wild)
@@ -344,15 +802,14 @@ static int ssl_sock_add_cert_sni(SSL_CTX *ctx, struct bind_conf *s, char *name,
 	return order;
 }
 
-/* Loads a certificate key and CA chain from a file. Returns 0 on error, -1 if
- * an early error happens and the caller must call SSL_CTX_free() by itelf.
+/* Indexes certificate <x> into bind_conf <s>'s SNI trees, either under the
+ * <fcount> names passed in <sni_filter>, or under its subjectAltNames and
+ * commonNames. Entries point either to context <ctx> or to lazily loaded
+ * certificate <lazy>. Returns the number of names indexed.
  */
-static int ssl_sock_load_cert_chain_file(SSL_CTX *ctx, const char *file, struct bind_conf *s, char **sni_filter, int fcount)
+static int ssl_sock_index_cert_names(X509 *x, SSL_CTX *ctx, struct ssl_lazy_crt *lazy, struct bind_conf *s, char **sni_filter, int fcount)
 {
-	BIO *in;
-	X509 *x = NULL, *ca;
-	int i, err;
-	int ret = -1;
+	int i;
 	int order = 0;
 	X509_NAME *xname;
 	char *str;
@@ -360,47 +817,55 @@ static int ssl_sock_load_cert_chain_file(SSL_CTX *ctx, const char *file, struct
 	STACK_OF(GENERAL_NAME) *names;
 #endif
 
-	in = BIO_new(BIO_s_file());
-	if (in == NULL)
-		goto end;
-
-	if (BIO_read_filename(in, file) <= 0)
-		goto end;
-
-	x = PEM_read_bio_X509_AUX(in, NULL, ctx->default_passwd_callback, ctx->default_passwd_callback_userdata);
-	if (x == NULL)
-		goto end;
-
 	if (fcount) {
 		while (fcount--)
-			order = ssl_sock_add_cert_sni(ctx, s, sni_filter[fcount], order);
+			order = ssl_sock_add_cert_sni(ctx, lazy, s, sni_filter[fcount], order);
+		return order;
 	}
-	else {
+
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
-		names = X509_get_ext_d2i(x, NID_subject_alt_name, NULL, NULL);
-		if (names) {
-			for (i = 0; i < sk_GENERAL_NAME_num(names); i++) {
-				GENERAL_NAME *name = sk_GENERAL_NAME_value(names, i);
-				if (name->type == GEN_DNS) {
-					if (ASN1_STRING_to_UTF8((unsigned char **)&str, name->d.dNSName) >= 0) {
-						order = ssl_sock_add_cert_sni(ctx, s, str, order);
-						OPENSSL_free(str);
-					}
+	names = X509_get_ext_d2i(x, NID_subject_alt_name, NULL, NULL);
+	if (names) {
+		for (i = 0; i < sk_GENERAL_NAME_num(names); i++) {
+			GENERAL_NAME *name = sk_GENERAL_NAME_value(names, i);
+			if (name->type == GEN_DNS) {
+				if (ASN1_STRING_to_UTF8((unsigned char **)&str, name->d.dNSName) >= 0) {
+					order = ssl_sock_add_cert_sni(ctx, lazy, s, str, order);
+					OPENSSL_free(str);
 				}
 			}
-			sk_GENERAL_NAME_pop_free(names, GENERAL_NAME_free);
 		}
+		sk_GENERAL_NAME_pop_free(names, GENERAL_NAME_free);
+	}
 #endif /* SSL_CTRL_SET_TLSEXT_HOSTNAME */
-		xname = X509_get_subject_name(x);
-		i = -1;
-		while ((i = X509_NAME_get_index_by_NID(xname, NID_commonName, i)) != -1) {
-			X509_NAME_ENTRY *entry = X509_NAME_get_entry(xname, i);
-			if (ASN1_STRING_to_UTF8((unsigned char **)&str, entry->value) >= 0) {
-				order = ssl_sock_add_cert_sni(ctx, s, str, order);
-				OPENSSL_free(str);
-			}
+	xname = X509_get_subject_name(x);
+	i = -1;
+	while ((i = X509_NAME_get_index_by_NID(xname, NID_commonName, i)) != -1) {
+		X509_NAME_ENTRY *entry = X509_NAME_get_entry(xname, i);
+		if (ASN1_STRING_to_UTF8((unsigned char **)&str, entry->value) >= 0) {
+			order = ssl_sock_add_cert_sni(ctx, lazy, s, str, order);
+			OPENSSL_free(str);
 		}
 	}
+	return order;
+}
+
+/* Loads a certificate key and CA chain from BIO <in>. Returns 0 on error, -1
+ * if an early error happens and the caller must call SSL_CTX_free() by itelf.
+ * The certificate's names are indexed into <s> unless it is NULL.
+ */
+static int ssl_sock_load_cert_chain_bio(SSL_CTX *ctx, BIO *in, struct bind_conf *s, char **sni_filter, int fcount)
+{
+	X509 *x = NULL, *ca;
+	int err;
+	int ret = -1;
+
+	x = PEM_read_bio_X509_AUX(in, NULL, ctx->default_passwd_callback, ctx->default_passwd_callback_userdata);
+	if (x == NULL)
+		goto end;
+
+	if (s)
+		ssl_sock_index_cert_names(x, ctx, NULL, s, sni_filter, fcount);
 
 	ret = 0; /* the caller must not free the SSL_CTX argument anymore */
 	if (!SSL_CTX_use_certificate(ctx, x))
@@ -429,17 +894,213 @@ end:
 	if (x)
 		X509_free(x);
 
+	return ret;
+}
+
+/* Loads a certificate key and CA chain from a file. Returns 0 on error, -1 if
+ * an early error happens and the caller must call SSL_CTX_free() by itelf.
+ * The certificate's names are indexed into <s> unless it is NULL.
+ */
+static int ssl_sock_load_cert_chain_file(SSL_CTX *ctx, const char *file, struct bind_conf *s, char **sni_filter, int fcount)
+{
+	BIO *in;
+	int ret = -1;
+
+	in = BIO_new(BIO_s_file());
+	if (in == NULL)
+		goto end;
+
+	if (BIO_read_filename(in, file) <= 0)
+		goto end;
+
+	ret = ssl_sock_load_cert_chain_bio(ctx, in, s, sni_filter, fcount);
+end:
 	if (in)
 		BIO_free(in);
 
 	return ret;
 }
 
+/* Releases lazily loaded certificate <lc> and its SSL context if any */
+static void ssl_sock_free_lazy_crt(struct ssl_lazy_crt *lc)
+{
+	if (lc->ctx) {
+		LIST_DEL(&lc->lru);
+		SSL_CTX_free(lc->ctx);
+		ssl_lazy_ctx_cur--;
+	}
+	free(lc->ocsp.str);
+	free(lc->pem.str);
+	free(lc->path);
+	free(lc);
+}
+
+/* Indexes the certificate from PEM file <path> into bind_conf <bind_conf>'s
+ * SNI trees without building its SSL context, which will only be done upon
+ * first use. The file and its OCSP response are kept in memory so that the
+ * context can be built without accessing the file system. When <fcount> SNI
+ * filters are passed in <sni_filter>, the certificate is not even parsed.
+ * Returns 0 on success, 1 on error with a message in <err>.
+ */
+static int ssl_sock_index_cert_file(const char *path, struct bind_conf *bind_conf, struct proxy *curproxy, char **sni_filter, int fcount, char **err)
+{
+#if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+	char ocsp_path[MAXPATHLEN+1];
+	struct stat st;
+#endif
+	struct ssl_lazy_crt *lc;
+	char *msg = NULL;
+	BIO *in = NULL;
+	X509 *x = NULL;
+	int ret = 1;
+
+	lc = calloc(1, sizeof(*lc));
+	if (!lc || !(lc->path = strdup(path))) {
+		memprintf(err, "%sout of memory while indexing cert '%s'.\n",
+		          err && *err ? *err : "", path);
+		goto end;
+	}
+	lc->bind_conf = bind_conf;
+	lc->px = curproxy;
+	LIST_INIT(&lc->lru);
+
+	if (ssl_sock_read_file(path, &lc->pem, INT_MAX, &msg)) {
+		memprintf(err, "%s%s.\n", err && *err ? *err : "", msg);
+		goto end;
+	}
+
+#if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+	snprintf(ocsp_path, sizeof(ocsp_path), "%s.ocsp", path);
+	if (!stat(ocsp_path, &st) &&
+	    ssl_sock_read_file(ocsp_path, &lc->ocsp, OCSP_MAX_RESPONSE_SIZE, &msg)) {
+		Warning("Loading '%s': %s, OCSP stapling will be disabled until the response is updated.\n",
+		        ocsp_path, msg);
+		/* an empty response still enables stapling once updated */
+		lc->ocsp.str = strdup("");
+	}
+#endif
+
+	if (!fcount) {
+		in = BIO_new_mem_buf(lc->pem.str, lc->pem.len);
+		if (!in || !(x = PEM_read_bio_X509_AUX(in, NULL, NULL, NULL))) {
+			memprintf(err, "%sunable to load SSL certificate from PEM file '%s'.\n",
+			          err && *err ? *err : "", path);
+			ERR_clear_error();
+			goto end;
+		}
+	}
+
+	/* the lazy certificate now belongs to the SNI trees if it's referenced */
+	if (ssl_sock_index_cert_names(x, NULL, lc, bind_conf, sni_filter, fcount))
+		lc = NULL;
+	ret = 0;
+ end:
+	if (lc)
+		ssl_sock_free_lazy_crt(lc);
+	free(msg);
+	if (x)
+		X509_free(x);
+	if (in)
+		BIO_free(in);
+	return ret;
+}
+
+/* Returns the SSL context of lazily loaded certificate <lc>, building it if it
+ * was not instantiated yet. When more than "tune.ssl.ctxcache" contexts are
+ * instantiated, the least recently used one is released. This is safe since
+ * SSL sessions still using it hold their own reference. Returns NULL if the
+ * context cannot be built.
+ */
+static SSL_CTX *ssl_sock_get_lazy_ctx(struct ssl_lazy_crt *lc)
+{
+	struct ssl_lazy_crt *old;
+	SSL_CTX *ctx;
+	EVP_PKEY *key = NULL;
+	BIO *in = NULL;
+	int ret;
+
+	if (lc->ctx) {
+		/* move it to the end of the LRU list */
+		LIST_DEL(&lc->lru);
+		LIST_ADDQ(&ssl_lazy_lru, &lc->lru);
+		return lc->ctx;
+	}
+
+	ctx = SSL_CTX_new(SSLv23_server_method());
+	if (!ctx)
+		goto fail;
+
+	/* everything is read from the PEM file's contents, each element
+	 * being looked up from the beginning as the file would be.
+	 */
+	in = BIO_new_mem_buf(lc->pem.str, lc->pem.len);
+	if (!in)
+		goto fail;
+	key = PEM_read_bio_PrivateKey(in, NULL, ctx->default_passwd_callback, ctx->default_passwd_callback_userdata);
+	if (!key || SSL_CTX_use_PrivateKey(ctx, key) <= 0)
+		goto fail;
+
+	BIO_free(in);
+	in = BIO_new_mem_buf(lc->pem.str, lc->pem.len);
+	if (!in || ssl_sock_load_cert_chain_bio(ctx, in, NULL, NULL, 0) <= 0 ||
+	    SSL_CTX_check_private_key(ctx) <= 0)
+		goto fail;
+
+#ifndef OPENSSL_NO_DH
+	BIO_free(in);
+	in = BIO_new_mem_buf(lc->pem.str, lc->pem.len);
+	if (!in)
+		goto fail;
+	ret = ssl_sock_load_dh_params_bio(ctx, in);
+	if (ret < 0)
+		goto fail;
+#endif
+#if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+	if (ssl_sock_load_ocsp(ctx, lc->path, &lc->ocsp, NULL) < 0)
+		goto fail;
+#endif
+	if (ssl_sock_prepare_ctx(lc->bind_conf, ctx, lc->px))
+		goto fail;
+
+	while (ssl_lazy_ctx_cur >= global.tune.ssl_ctx_cache && !LIST_ISEMPTY(&ssl_lazy_lru)) {
+		old = LIST_NEXT(&ssl_lazy_lru, struct ssl_lazy_crt *, lru);
+		LIST_DEL(&old->lru);
+		LIST_INIT(&old->lru);
+		SSL_CTX_free(old->ctx);
+		old->ctx = NULL;
+		ssl_lazy_ctx_cur--;
+	}
+
+	lc->ctx = ctx;
+	LIST_ADDQ(&ssl_lazy_lru, &lc->lru);
+	ssl_lazy_ctx_cur++;
+	ssl_lazy_ctx_loads++;
+	EVP_PKEY_free(key);
+	BIO_free(in);
+	return ctx;
+
+ fail:
+	send_log(lc->px, LOG_ERR, "Proxy %s: unable to load SSL certificate '%s' for bind '%s' at [%s:%d].\n",
+	         lc->px->id, lc->path, lc->bind_conf->arg, lc->bind_conf->file, lc->bind_conf->line);
+	ERR_clear_error();
+	if (key)
+		EVP_PKEY_free(key);
+	if (in)
+		BIO_free(in);
+	if (ctx)
+		SSL_CTX_free(ctx);
+	return NULL;
+}
+
 static int ssl_sock_load_cert_file(const char *path, struct bind_conf *bind_conf, struct proxy *curproxy, char **sni_filter, int fcount, char **err)
 {
 	int ret;
 	SSL_CTX *ctx;
 
+	/* the default certificate is always loaded, others may be indexed only */
+	if (global.tune.ssl_ctx_cache && bind_conf->default_ctx)
+		return ssl_sock_index_cert_file(path, bind_conf, curproxy, sni_filter, fcount, err);
+
 	ctx = SSL_CTX_new(SSLv23_server_method());
 	if (!ctx) {
 		memprintf(err, "%sunable to allocate SSL context for cert '%s'.\n",
@@ -482,6 +1143,11 @@ static int ssl_sock_load_cert_file(const char *path, struct bind_conf *bind_conf
 	}
 #endif
 
+#if (defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB && !defined OPENSSL_NO_OCSP)
+	if (ssl_sock_load_ocsp(ctx, path, NULL, err) < 0)
+		return 1;
+#endif
+
 #ifndef SSL_CTRL_SET_TLSEXT_HOSTNAME
 	if (bind_conf->default_ctx) {
 		memprintf(err, "%sthis version of openssl cannot load multiple SSL certificates.\n",
@@ -521,6 +1187,10 @@ int ssl_sock_load_cert(char *path, struct bind_conf *bind_conf, struct proxy *cu
 		}
 		if (!S_ISREG(buf.st_mode))
 			continue;
+		/* OCSP responses are loaded along with their certificate */
+		end = strrchr(de->d_name, '.');
+		if (end && strcmp(end, ".ocsp") == 0)
+			continue;
 		cfgerr += ssl_sock_load_cert_file(fp, bind_conf, curproxy, NULL, 0, err);
 	}
 	closedir(dir);
@@ -695,7 +1365,18 @@ int ssl_sock_prepare_ctx(struct bind_conf *bind_conf, SSL_CTX *ctx, struct proxy
 	SSL_CTX_set_options(ctx, ssloptions);
 	SSL_CTX_set_mode(ctx, sslmode);
 	SSL_CTX_set_verify(ctx, bind_conf->verify ? bind_conf->verify : SSL_VERIFY_NONE, ssl_sock_verifycbk);
-	if (bind_conf->verify & SSL_VERIFY_PEER) {
+	if ((bind_conf->verify & SSL_VERIFY_PEER) &&
+	    !(global.mode & MODE_STARTING) && bind_conf->default_ctx) {
+		/* contexts built at run time must not access the file system,
+		 * so they share the CA and CRL store of the default context.
+		 */
+		X509_STORE *store = SSL_CTX_get_cert_store(bind_conf->default_ctx);
+
+		CRYPTO_add(&store->references, 1, CRYPTO_LOCK_X509_STORE);
+		SSL_CTX_set_cert_store(ctx, store);
+		SSL_CTX_set_client_CA_list(ctx, SSL_dup_CA_list(SSL_CTX_get_client_CA_list(bind_conf->default_ctx)));
+	}
+	else if (bind_conf->verify & SSL_VERIFY_PEER) {
 		if (bind_conf->ca_file) {
 			/* load CAfile to verify */
 			if (!SSL_CTX_load_verify_locations(ctx, bind_conf->ca_file, NULL)) {
@@ -727,6 +1408,10 @@ int ssl_sock_prepare_ctx(struct bind_conf *bind_conf, SSL_CTX *ctx, struct proxy
 		SSL_CTX_set_timeout(ctx, global.tune.ssllifetime);
 
 	shared_context_set_cache(ctx);
+	/* wrap the session cache lookups to tell cache and ticket resumptions apart */
+	if (SSL_CTX_sess_get_get_cb(ctx) == shctx_get_cb)
+		SSL_CTX_sess_set_get_cb(ctx, ssl_sock_sess_get_cbk);
+
 	if (bind_conf->ciphers &&
 	    !SSL_CTX_set_cipher_list(ctx, bind_conf->ciphers)) {
 		Alert("Proxy '%s': unable to set SSL cipher list to '%s' for bind '%s' at [%s:%d].\n",
@@ -909,7 +1594,7 @@ int ssl_sock_prepare_all_ctx(struct bind_conf *bind_conf, struct proxy *px)
 	node = ebmb_first(&bind_conf->sni_ctx);
 	while (node) {
 		sni = ebmb_entry(node, struct sni_ctx, name);
-		if (!sni->order) /* only initialize the CTX on its first occurrence */
+		if (!sni->order && sni->ctx) /* only initialize the CTX on its first occurrence */
 			err += ssl_sock_prepare_ctx(bind_conf, sni->ctx, px);
 		node = ebmb_next(node);
 	}
@@ -917,7 +1602,7 @@ int ssl_sock_prepare_all_ctx(struct bind_conf *bind_conf, struct proxy *px)
 	node = ebmb_first(&bind_conf->sni_w_ctx);
 	while (node) {
 		sni = ebmb_entry(node, struct sni_ctx, name);
-		if (!sni->order) /* only initialize the CTX on its first occurrence */
+		if (!sni->order && sni->ctx) /* only initialize the CTX on its first occurrence */
 			err += ssl_sock_prepare_ctx(bind_conf, sni->ctx, px);
 		node = ebmb_next(node);
 	}
@@ -940,8 +1625,12 @@ void ssl_sock_free_all_ctx(struct bind_conf *bind_conf)
 		sni = ebmb_entry(node, struct sni_ctx, name);
 		back = ebmb_next(node);
 		ebmb_delete(node);
-		if (!sni->order) /* only free the CTX on its first occurrence */
-			SSL_CTX_free(sni->ctx);
+		if (!sni->order) { /* only free the CTX on its first occurrence */
+			if (sni->lazy)
+				ssl_sock_free_lazy_crt(sni->lazy);
+			else
+				SSL_CTX_free(sni->ctx);
+		}
 		free(sni);
 		node = back;
 	}
@@ -951,8 +1640,12 @@ void ssl_sock_free_all_ctx(struct bind_conf *bind_conf)
 		sni = ebmb_entry(node, struct sni_ctx, name);
 		back = ebmb_next(node);
 		ebmb_delete(node);
-		if (!sni->order) /* only free the CTX on its first occurrence */
-			SSL_CTX_free(sni->ctx);
+		if (!sni->order) { /* only free the CTX on its first occurrence */
+			if (sni->lazy)
+				ssl_sock_free_lazy_crt(sni->lazy);
+			else
+				SSL_CTX_free(sni->ctx);
+		}
 		free(sni);
 		node = back;
 	}
@@ -960,6 +1653,235 @@ void ssl_sock_free_all_ctx(struct bind_conf *bind_conf)
 	bind_conf->default_ctx = NULL;
 }
 
+/* Allocates the dynamic record sizing state of connection <conn> and attaches
+ * it to its SSL session. Returns 0 if the allocation failed, otherwise 1.
+ */
+static int ssl_sock_init_recsz(struct connection *conn)
+{
+	struct ssl_sock_recsz *rs;
+
+	rs = pool_alloc2(pool2_ssl_recsz);
+	if (!rs)
+		return 0;
+
+	rs->sent = 0;
+	rs->last = now_ms;
+	SSL_set_ex_data(conn->xprt_ctx, ssl_recsz_idx, rs);
+	return 1;
+}
+
+/* Returns the maximum number of bytes to pass to SSL_write() at once on
+ * connection <conn>. In dynamic mode, records start small so that the client
+ * can decipher the first bytes as soon as the first TCP segment is received,
+ * then grow to full-sized records once "tune.ssl.recordgrow" bytes were sent
+ * without any idle period longer than "tune.ssl.recordidle". A write which
+ * must be retried is never shrunk since OpenSSL requires at least the same
+ * amount of data upon retries. Zero means no limit.
+ */
+static inline unsigned int ssl_sock_record_limit(struct connection *conn)
+{
+	struct ssl_sock_recsz *rs;
+
+	if (!global.tune.ssl_min_record)
+		return global.tune.ssl_max_record;
+
+	rs = SSL_get_ex_data(conn->xprt_ctx, ssl_recsz_idx);
+	if (!rs)
+		return global.tune.ssl_max_record;
+
+	if (!(conn->xprt_st & SSL_SOCK_ST_FL_WRITE_RETRY) &&
+	    tick_is_expired(tick_add(rs->last, global.tune.ssl_rec_idle), now_ms))
+		rs->sent = 0;
+
+	if (rs->sent < global.tune.ssl_rec_grow)
+		return global.tune.ssl_min_record;
+
+	return global.tune.ssl_max_record;
+}
+
+/* Accounts for <bytes> bytes just written at once with SSL_write() on
+ * connection <conn>. Each full-sized record is accounted for separately.
+ */
+static inline void ssl_sock_account_write(struct connection *conn, unsigned int bytes)
+{
+	struct ssl_sock_recsz *rs;
+	unsigned int rest = bytes % SSL_REC_FULL;
+
+	ssl_records[SSL_REC_LARGE] += bytes / SSL_REC_FULL;
+	if (rest)
+		ssl_records[rest < SSL_REC_SMALL_MAX ? SSL_REC_SMALL : SSL_REC_MEDIUM]++;
+
+	if (!global.tune.ssl_min_record)
+		return;
+
+	rs = SSL_get_ex_data(conn->xprt_ctx, ssl_recsz_idx);
+	if (rs) {
+		/* stop counting once records grew so that it never wraps */
+		if (rs->sent < global.tune.ssl_rec_grow)
+			rs->sent = (bytes < global.tune.ssl_rec_grow - rs->sent) ?
+				rs->sent + bytes : global.tune.ssl_rec_grow;
+		rs->last = now_ms;
+	}
+}
+
+/* Read-ahead socket BIO. OpenSSL reads each record's header then its body,
+ * which costs two recv() calls per record with the default socket BIO. This
+ * BIO reads as much as "tune.ssl.readahead" bytes at once into a staging
+ * buffer and serves OpenSSL's reads from it. The buffer is taken from a pool
+ * when a read is needed and released as soon as it is empty so that idle
+ * connections do not hold any. It is stored in the BIO's <ptr> field.
+ */
+static int ssl_sock_bio_read(BIO *b, char *out, int outl)
+{
+	struct ssl_sock_rabuf *rb = b->ptr;
+	int ret;
+
+	ssl_bio_reads++;
+	BIO_clear_retry_flags(b);
+	if (!out || outl <= 0)
+		return 0;
+
+	if (!rb) {
+		/* there is no point in staging large reads */
+		if (outl >= global.tune.ssl_readahead ||
+		    !(rb = pool_alloc2(pool2_ssl_rabuf))) {
+			ssl_bio_recv++;
+			ret = recv(b->num, out, outl, 0);
+			if (ret <= 0 && BIO_sock_should_retry(ret))
+				BIO_set_retry_read(b);
+			return ret;
+		}
+
+		ssl_bio_recv++;
+		ret = recv(b->num, rb->data, global.tune.ssl_readahead, 0);
+		if (ret <= 0) {
+			pool_free2(pool2_ssl_rabuf, rb);
+			if (BIO_sock_should_retry(ret))
+				BIO_set_retry_read(b);
+			return ret;
+		}
+		rb->len = ret;
+		rb->ofs = 0;
+		b->ptr = rb;
+	}
+
+	ret = rb->len - rb->ofs;
+	if (ret > outl)
+		ret = outl;
+	memcpy(out, rb->data + rb->ofs, ret);
+	rb->ofs += ret;
+
+	if (rb->ofs == rb->len) {
+		b->ptr = NULL;
+		pool_free2(pool2_ssl_rabuf, rb);
+	}
+	return ret;
+}
+
+static int ssl_sock_bio_write(BIO *b, const char *in, int inl)
+{
+	int ret;
+
+	BIO_clear_retry_flags(b);
+	ret = send(b->num, in, inl, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret <= 0 && BIO_sock_should_retry(ret))
+		BIO_set_retry_write(b);
+	return ret;
+}
+
+static int ssl_sock_bio_puts(BIO *b, const char *str)
+{
+	return ssl_sock_bio_write(b, str, strlen(str));
+}
+
+static long ssl_sock_bio_ctrl(BIO *b, int cmd, long num, void *ptr)
+{
+	struct ssl_sock_rabuf *rb = b->ptr;
+
+	switch (cmd) {
+	case BIO_C_SET_FD:
+		b->num = *(int *)ptr;
+		b->shutdown = (int)num;
+		b->init = 1;
+		return 1;
+	case BIO_C_GET_FD:
+		if (!b->init)
+			return -1;
+		if (ptr)
+			*(int *)ptr = b->num;
+		return b->num;
+	case BIO_CTRL_GET_CLOSE:
+		return b->shutdown;
+	case BIO_CTRL_SET_CLOSE:
+		b->shutdown = (int)num;
+		return 1;
+	case BIO_CTRL_PENDING:
+		return rb ? rb->len - rb->ofs : 0;
+	case BIO_CTRL_DUP:
+	case BIO_CTRL_FLUSH:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int ssl_sock_bio_create(BIO *b)
+{
+	b->init = 0;
+	b->num = -1;
+	b->ptr = NULL;
+	b->flags = 0;
+	return 1;
+}
+
+/* the socket belongs to the connection, only the staging buffer is freed */
+static int ssl_sock_bio_destroy(BIO *b)
+{
+	struct ssl_sock_rabuf *rb;
+
+	if (!b)
+		return 0;
+	rb = b->ptr;
+	if (rb)
+		pool_free2(pool2_ssl_rabuf, rb);
+	b->ptr = NULL;
+	b->init = 0;
+	return 1;
+}
+
+static BIO_METHOD ssl_sock_bio_method = {
+	.type    = BIO_TYPE_SOCKET,
+	.name    = "haproxy read-ahead socket",
+	.bwrite  = ssl_sock_bio_write,
+	.bread   = ssl_sock_bio_read,
+	.bputs   = ssl_sock_bio_puts,
+	.ctrl    = ssl_sock_bio_ctrl,
+	.create  = ssl_sock_bio_create,
+	.destroy = ssl_sock_bio_destroy,
+};
+
+/* Attaches connection <conn>'s socket to its SSL session, using the read-ahead
+ * BIO when enabled, or the default socket BIO if it cannot be allocated.
+ */
+static void ssl_sock_set_fd(struct connection *conn)
+{
+	BIO *bio;
+
+	if (global.tune.ssl_readahead) {
+		if (unlikely(!pool2_ssl_rabuf))
+			pool2_ssl_rabuf = create_pool("ssl_rabuf",
+			                              sizeof(struct ssl_sock_rabuf) + global.tune.ssl_readahead,
+			                              MEM_F_SHARED);
+		bio = BIO_new(&ssl_sock_bio_method);
+		if (bio) {
+			BIO_set_fd(bio, conn->t.sock.fd, BIO_NOCLOSE);
+			SSL_set_bio(conn->xprt_ctx, bio, bio);
+			return;
+		}
+	}
+	SSL_set_fd(conn->xprt_ctx, conn->t.sock.fd);
+}
+
 /*
  * This function is called if SSL * context is not yet allocated. The function
  * is designed to be called before any other data-layer operation and sets the
@@ -992,7 +1914,14 @@ static int ssl_sock_init(struct connection *conn)
 			SSL_set_session(conn->xprt_ctx, objt_server(conn->target)->ssl_ctx.reused_sess);
 
 		/* set fd on SSL session context */
-		SSL_set_fd(conn->xprt_ctx, conn->t.sock.fd);
+		ssl_sock_set_fd(conn);
+
+		if (global.tune.ssl_min_record && !ssl_sock_init_recsz(conn)) {
+			SSL_free(conn->xprt_ctx);
+			conn->xprt_ctx = NULL;
+			conn->err_code = CO_ER_SSL_NO_MEM;
+			return -1;
+		}
 
 		/* leave init state and start handshake */
 		conn->flags |= CO_FL_SSL_WAIT_HS | CO_FL_WAIT_L6_CONN;
@@ -1011,11 +1940,18 @@ static int ssl_sock_init(struct connection *conn)
 		SSL_set_accept_state(conn->xprt_ctx);
 
 		/* set fd on SSL session context */
-		SSL_set_fd(conn->xprt_ctx, conn->t.sock.fd);
+		ssl_sock_set_fd(conn);
 
 		/* set connection pointer */
 		SSL_set_app_data(conn->xprt_ctx, conn);
 
+		if (global.tune.ssl_min_record && !ssl_sock_init_recsz(conn)) {
+			SSL_free(conn->xprt_ctx);
+			conn->xprt_ctx = NULL;
+			conn->err_code = CO_ER_SSL_NO_MEM;
+			return -1;
+		}
+
 		/* leave init state and start handshake */
 		conn->flags |= CO_FL_SSL_WAIT_HS | CO_FL_WAIT_L6_CONN;
 
@@ -1028,6 +1964,47 @@ static int ssl_sock_init(struct connection *conn)
 }
 
 
+/* Accounts the time elapsed since <start> into the handshake time of incoming
+ * connection <conn>. The wall clock time is used since SSL_do_handshake() never
+ * blocks, which is much cheaper to retrieve than the thread's CPU time.
+ */
+static inline void ssl_sock_add_hs_time(struct connection *conn, const struct timeval *start)
+{
+	struct timeval stop;
+	long us;
+
+	gettimeofday(&stop, NULL);
+	us = (stop.tv_sec - start->tv_sec) * 1000000 + stop.tv_usec - start->tv_usec;
+	if (us > 0)
+		SSL_set_ex_data(conn->xprt_ctx, ssl_hs_time_idx,
+		                (void *)((long)SSL_get_ex_data(conn->xprt_ctx, ssl_hs_time_idx) + us));
+}
+
+/* Updates the SSL handshake statistics of the bind line incoming connection
+ * <conn> was accepted on, once its handshake is over. The handshake succeeded
+ * if <fail> is negative, otherwise it failed for reason <fail> (SSL_HS_FAIL_*).
+ */
+static void ssl_sock_update_hs_stats(struct connection *conn, int fail)
+{
+	struct ssl_hs_counters *c = &objt_listener(conn->target)->bind_conf->ssl_hs;
+	unsigned long us = (unsigned long)SSL_get_ex_data(conn->xprt_ctx, ssl_hs_time_idx);
+	int b;
+
+	if (fail >= 0)
+		c->fail[fail]++;
+	else if (!SSL_session_reused(conn->xprt_ctx))
+		c->full++;
+	else if (conn->xprt_st & SSL_SOCK_ST_FL_CACHE_HIT)
+		c->reuse_cache++;
+	else
+		c->reuse_ticket++;
+
+	for (b = 0; b < SSL_HS_CPU_BUCKETS - 1 && us >= (SSL_HS_CPU_MIN_US << b); b++)
+		;
+	c->cpu[b]++;
+	c->cpu_us += us;
+}
+
 /* This is the callback which is used when an SSL handshake is pending. It
  * updates the FD status if it wants some polling before being called again.
  * It returns 0 if it fails in a fatal way or needs to poll to go further,
@@ -1036,6 +2013,7 @@ static int ssl_sock_init(struct connection *conn)
  */
 int ssl_sock_handshake(struct connection *conn, unsigned int flag)
 {
+	struct timeval hs_start;
 	int ret;
 
 	if (!conn->xprt_ctx)
@@ -1107,7 +2085,29 @@ int ssl_sock_handshake(struct connection *conn, unsigned int flag)
 		goto reneg_ok;
 	}
 
+	/* Private key operations performed during the handshake are expensive
+	 * and a burst of incoming connections may stall all other connections
+	 * for a long time. Once the per-loop budget is exhausted, incoming
+	 * handshakes are deferred to the next polling loop using speculative
+	 * I/O so that established connections get processed in between.
+	 */
+	if (global.tune.ssl_max_hs && objt_listener(conn->target)) {
+		if (!ssl_hs_budget) {
+			__conn_sock_stop_send(conn);
+			__conn_sock_want_recv(conn);
+			return 0;
+		}
+		ssl_hs_budget--;
+	}
+
+	if (objt_listener(conn->target))
+		gettimeofday(&hs_start, NULL);
+
 	ret = SSL_do_handshake(conn->xprt_ctx);
+
+	if (objt_listener(conn->target))
+		ssl_sock_add_hs_time(conn, &hs_start);
+
 	if (ret != 1) {
 		/* handshake did not complete, let's find why */
 		ret = SSL_get_error(conn->xprt_ctx, ret);
@@ -1158,14 +2158,22 @@ reneg_ok:
 
 	/* Handshake succeeded */
 	if (objt_server(conn->target)) {
+		struct server *srv = objt_server(conn->target);
+
 		if (!SSL_session_reused(conn->xprt_ctx)) {
 			/* check if session was reused, if not store current session on server for reuse */
-			if (objt_server(conn->target)->ssl_ctx.reused_sess)
-				SSL_SESSION_free(objt_server(conn->target)->ssl_ctx.reused_sess);
+			if (srv->ssl_ctx.reused_sess)
+				SSL_SESSION_free(srv->ssl_ctx.reused_sess);
 
-			objt_server(conn->target)->ssl_ctx.reused_sess = SSL_get1_session(conn->xprt_ctx);
+			srv->ssl_ctx.reused_sess = SSL_get1_session(conn->xprt_ctx);
+			if (!(conn->flags & CO_FL_CONNECTED))
+				srv->counters.ssl_full++;
 		}
+		else if (!(conn->flags & CO_FL_CONNECTED))
+			srv->counters.ssl_reuse++;
 	}
+	else if (objt_listener(conn->target) && !(conn->flags & CO_FL_CONNECTED))
+		ssl_sock_update_hs_stats(conn, -1);
 
 	/* The connection is now established at both layers, it's time to leave */
 	conn->flags &= ~(flag | CO_FL_WAIT_L4_CONN | CO_FL_WAIT_L6_CONN);
@@ -1175,8 +2183,12 @@ reneg_ok:
 	/* Clear openssl global errors stack */
 	ERR_clear_error();
 
-	/* free resumed session if exists */
-	if (objt_server(conn->target) && objt_server(conn->target)->ssl_ctx.reused_sess) {
+	/* Invalidate the server's session if it is the one this handshake was
+	 * trying to resume. Another connection may have already replaced it
+	 * with a fresh one in which case we must keep it.
+	 */
+	if (objt_server(conn->target) && objt_server(conn->target)->ssl_ctx.reused_sess &&
+	    (!conn->xprt_ctx || SSL_get_session(conn->xprt_ctx) == objt_server(conn->target)->ssl_ctx.reused_sess)) {
 		SSL_SESSION_free(objt_server(conn->target)->ssl_ctx.reused_sess);
 		objt_server(conn->target)->ssl_ctx.reused_sess = NULL;
 	}
@@ -1185,6 +2197,18 @@ reneg_ok:
 	conn->flags |= CO_FL_ERROR;
 	if (!conn->err_code)
 		conn->err_code = CO_ER_SSL_HANDSHAKE;
+
+	if (conn->xprt_ctx && objt_listener(conn->target) && !(conn->flags & CO_FL_CONNECTED)) {
+		switch (conn->err_code) {
+		case CO_ER_SSL_EMPTY:     ret = SSL_HS_FAIL_EMPTY;  break;
+		case CO_ER_SSL_ABORT:     ret = SSL_HS_FAIL_ABORT;  break;
+		case CO_ER_SSL_CA_FAIL:
+		case CO_ER_SSL_CRT_FAIL:  ret = SSL_HS_FAIL_VERIFY; break;
+		case CO_ER_SSL_HANDSHAKE: ret = SSL_HS_FAIL_PROTO;  break;
+		default:                  ret = SSL_HS_FAIL_OTHER;  break;
+		}
+		ssl_sock_update_hs_stats(conn, ret);
+	}
 	return 0;
 }
 
@@ -1235,10 +2259,17 @@ static int ssl_sock_to_buf(struct connection *conn, struct buffer *buf, int coun
 		if (ret > 0) {
 			buf->i += ret;
 			done += ret;
-			if (ret < try)
-				break;
 			count -= ret;
-			try = count;
+			if (ret < try) {
+				/* records staged by the read-ahead BIO will not
+				 * be reported by the poller, they must be read now.
+				 */
+				if (!BIO_pending(SSL_get_rbio(conn->xprt_ctx)))
+					break;
+				try -= ret;
+			}
+			else
+				try = count;
 		}
 		else if (ret == 0) {
 			ret =  SSL_get_error(conn->xprt_ctx, ret);
@@ -1303,6 +2334,7 @@ static int ssl_sock_to_buf(struct connection *conn, struct buffer *buf, int coun
 static int ssl_sock_from_buf(struct connection *conn, struct buffer *buf, int flags)
 {
 	int ret, try, done;
+	unsigned int limit;
 
 	done = 0;
 
@@ -1320,8 +2352,9 @@ static int ssl_sock_from_buf(struct connection *conn, struct buffer *buf, int fl
 	while (buf->o) {
 		try = buf->o;
 
-		if (global.tune.ssl_max_record && try > global.tune.ssl_max_record)
-			try = global.tune.ssl_max_record;
+		limit = ssl_sock_record_limit(conn);
+		if (limit && try > limit)
+			try = limit;
 
 		/* outgoing data may wrap at the end */
 		if (buf->data + try > buf->p)
@@ -1333,6 +2366,8 @@ static int ssl_sock_from_buf(struct connection *conn, struct buffer *buf, int fl
 			goto out_error;
 		}
 		if (ret > 0) {
+			conn->xprt_st &= ~SSL_SOCK_ST_FL_WRITE_RETRY;
+			ssl_sock_account_write(conn, ret);
 			buf->o -= ret;
 			done += ret;
 
@@ -1354,6 +2389,7 @@ static int ssl_sock_from_buf(struct connection *conn, struct buffer *buf, int fl
 					break;
 				}
 				/* we need to poll to retry a write later */
+				conn->xprt_st |= SSL_SOCK_ST_FL_WRITE_RETRY;
 				__conn_data_poll_send(conn);
 				break;
 			}
@@ -1379,6 +2415,10 @@ static int ssl_sock_from_buf(struct connection *conn, struct buffer *buf, int fl
 static void ssl_sock_close(struct connection *conn) {
 
 	if (conn->xprt_ctx) {
+		if (global.tune.ssl_min_record) {
+			struct ssl_sock_recsz *rs = SSL_get_ex_data(conn->xprt_ctx, ssl_recsz_idx);
+			pool_free2(pool2_ssl_recsz, rs);
+		}
 		SSL_free(conn->xprt_ctx);
 		conn->xprt_ctx = NULL;
 		sslconns--;
@@ -3211,6 +4251,9 @@ static void __ssl_sock_init(void)
 	SSL_library_init();
 	cm = SSL_COMP_get_compression_methods();
 	sk_SSL_COMP_zero(cm);
+	ssl_recsz_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+	ssl_hs_time_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+	pool2_ssl_recsz = create_pool("ssl_recsz", sizeof(struct ssl_sock_recsz), MEM_F_SHARED);
 	sample_register_fetches(&sample_fetch_keywords);
 	acl_register_keywords(&acl_kws);
 	bind_register_keywords(&bind_kws);